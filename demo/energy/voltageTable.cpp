@@ -13,9 +13,11 @@ int main(int argc, char** argv){
     Mammut m;
     CpuFreq* frequency = m.getInstanceCpuFreq();
 
-    Domain* domain = frequency->getDomains().at(0);
-    cout << "Starting computing the voltage table..." << endl;
-    VoltageTable vt = domain->getVoltageTable();
-    dumpVoltageTable(vt, "voltageTable.txt");
-    cout << "Voltage table computed and dumped on file" << endl;
+    cout << "Starting computing the voltage tables..." << endl;
+    // Tables are dumped after each point. If the program is interrupted,
+    // running it again resumes the characterization.
+    VoltageTableParameters parameters;
+    parameters.fileName = "voltageTable.txt";
+    frequency->getVoltageTables(parameters);
+    cout << "Voltage tables computed and dumped on files voltageTable.txt.<DomainId>" << endl;
 }
@@ -1,9 +1,6 @@
 #include <mammut/mammut.hpp>
 
 #include <cassert>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
 #include <iostream>
 #include <unistd.h>
 
@@ -18,6 +15,7 @@ using namespace std;
 int main(int argc, char** argv){
     if(argc < 2){
         cerr << "Usage: " << argv[0] << " CpuId" << endl;
+        return -1;
     }
 
     unsigned int cpuId = atoi(argv[1]);
@@ -35,11 +33,8 @@ int main(int argc, char** argv){
         cout << "No idle levels supported by CPU " << cpu->getCpuId() << "." << endl;
     }else{
         for(int32_t i = idleLevels.size() - 1; i >= 0 ; i--){
-            int fd = open("/dev/cpu_dma_latency", O_RDWR);
-            int32_t lat = idleLevels.at(i)->getExitLatency();
-            if(write(fd, &lat, sizeof(lat)) != sizeof(lat)){
-                throw std::runtime_error("Error while writing\n");
-            }
+            /** Deeper levels are not used while qos is alive. **/
+            LatencyQoS qos(idleLevels.at(i)->getExitLatency());
 
             /** We compute the base power consumption at each frequency step. **/
             vector<Frequency> frequencies;
@@ -62,8 +57,6 @@ int main(int argc, char** argv){
                 cout << fDomain->getCurrentVoltage() << " ";
                 cout << endl;
             }
-
-            close(fd);
         }
     }
 }
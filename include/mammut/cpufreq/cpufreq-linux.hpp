@@ -5,6 +5,7 @@
 
 #include "vector"
 #include "map"
+#include <mutex>
 
 namespace mammut{
 namespace cpufreq{
@@ -28,26 +29,333 @@ public:
     Voltage getCurrentVoltage() const;
     VoltageTable getVoltageTable(bool onlyPhysicalCores = true) const;
     VoltageTable getVoltageTable(uint numVirtualCores, bool onlyPhysicalCores) const;
-private:
+    VoltageTable getVoltageTable(const VoltageTableParameters& parameters) const;
+    bool hasContinuousFrequencies() const;
+
+    /**
+     * Returns the available energy performance preferences
+     * (e.g. "performance", "balance_power", ...).
+     * @return The available energy performance preferences. Empty
+     *         if not supported.
+     */
+    std::vector<std::string> getAvailableEnergyPerformancePreferences() const;
+
+    /**
+     * Returns the current energy performance preference.
+     * @return The current energy performance preference. Empty
+     *         if not supported.
+     */
+    std::string getEnergyPerformancePreference() const;
+
+    /**
+     * Sets the energy performance preference.
+     * @param preference One of the available preferences.
+     * @return true if the operation succeeded, false otherwise.
+     */
+    virtual bool setEnergyPerformancePreference(const std::string& preference) const;
+
+    /**
+     * Computes the average frequency of the first virtual core of the
+     * domain (while not idle) from APERF/MPERF, over a time window
+     * (see topology::VirtualCore::getEffectiveFrequency()).
+     * Differently from getCurrentFrequency(), this is the frequency
+     * actually delivered by the hardware.
+     * @param window The length of the window (milliseconds). The
+     *        function returns after the window is elapsed.
+     * @return The effective frequency, or 0 if the registers are not available.
+     */
+    Frequency getEffectiveFrequency(uint window) const;
+protected:
     std::vector<Governor> _availableGovernors;
     std::vector<Frequency> _availableFrequencies;
     std::vector<std::string> _paths;
     mutable utils::Msr _msr;
     std::vector<Frequency> _turboFrequencies;
     bool _epyc;
+    bool _continuous;
+    Frequency _baseFrequency;
+
+    DomainLinux(DomainId domainIdentifier, std::vector<topology::VirtualCore*> virtualCores, bool epyc);
 
     void writeToDomainFiles(const std::string& what, const std::string& where) const;
+
+    /**
+     * Used by drivers accepting any frequency between the hardware bounds.
+     * Replaces the available frequencies with the hardware range sampled
+     * every 100MHz.
+     * @param baseFrequency The frequencies greater than baseFrequency
+     *        are considered turbo frequencies (0 if unknown).
+     */
+    void setContinuousFrequencies(Frequency baseFrequency);
+
+private:
+    /**
+     * Samples the voltage until it is stable.
+     * @param parameters The parameters of the characterization.
+     * @return The steady state voltage.
+     */
+    Voltage getSteadyVoltage(const VoltageTableParameters& parameters) const;
+
+    /**
+     * Measures the missing points of the voltage table for a specific
+     * number of loaded virtual cores.
+     * @param numVirtualCores The number of loaded virtual cores.
+     * @param parameters The parameters of the characterization.
+     * @param table The voltage table where the points are inserted.
+     */
+    void measureVoltageTable(uint numVirtualCores, const VoltageTableParameters& parameters,
+                             VoltageTable& table) const;
+};
+
+/**
+ * Fields of the IA32_HWP_REQUEST register. Performance levels
+ * are expressed in the same (abstract) scale used by
+ * the IA32_HWP_CAPABILITIES register.
+ */
+typedef struct{
+    uint8_t minPerf;
+    uint8_t maxPerf;
+    // 0 lets the hardware autonomously select the performance level.
+    uint8_t desiredPerf;
+    // 0 (performance) to 255 (energy saving).
+    uint8_t energyPerformancePreference;
+}HwpRequest;
+
+/**
+ * Fields of the IA32_HWP_CAPABILITIES register.
+ */
+typedef struct{
+    uint8_t highestPerf;
+    uint8_t guaranteedPerf;
+    uint8_t mostEfficientPerf;
+    uint8_t lowestPerf;
+}HwpCapabilities;
+
+/**
+ * A domain managed by the intel_pstate driver (both in active
+ * and passive (intel_cpufreq) mode).
+ * The driver does not expose a discrete set of frequencies, so
+ * any frequency between the hardware bounds can be set.
+ * getAvailableFrequencies() returns the range sampled with
+ * the 100MHz granularity of Intel P-states ratios.
+ * If the userspace governor is not available (active mode),
+ * setFrequencyUserspace() pins the frequency by setting both
+ * the governor bounds to the requested frequency.
+ */
+class DomainIntelPstate: public DomainLinux{
+public:
+    DomainIntelPstate(DomainId domainIdentifier, std::vector<topology::VirtualCore*> virtualCores);
+    ~DomainIntelPstate();
+
+    /**
+     * Gets the bounds (percentage of the maximum available
+     * performance) set through intel_pstate min_perf_pct and
+     * max_perf_pct files. These bounds are shared by all the domains.
+     * @param lowerBound The lower bound [0, 100].
+     * @param upperBound The upper bound [0, 100].
+     * @return true if the operation succeeded, false otherwise
+     *         (e.g. the driver is in passive mode).
+     */
+    bool getPerfPctBounds(uint& lowerBound, uint& upperBound) const;
+
+    /**
+     * Sets the bounds (percentage of the maximum available
+     * performance) through intel_pstate min_perf_pct and
+     * max_perf_pct files. These bounds are shared by all the domains.
+     * @param lowerBound The lower bound [0, 100].
+     * @param upperBound The upper bound [0, 100].
+     * @return true if the operation succeeded, false otherwise
+     *         (e.g. the bounds are not valid).
+     */
+    bool setPerfPctBounds(uint lowerBound, uint upperBound) const;
+
+    /**
+     * Checks if Hardware P-states (HWP) are enabled.
+     * @return True if HWP is enabled, false otherwise
+     *         (or if the MSRs are not accessible).
+     */
+    bool isHwpEnabled() const;
+
+    /**
+     * Reads the HWP capabilities of the domain.
+     * @param capabilities The HWP capabilities.
+     * @return true if the operation succeeded, false otherwise.
+     */
+    bool getHwpCapabilities(HwpCapabilities& capabilities) const;
+
+    /**
+     * Reads the HWP request of the domain.
+     * @param request The HWP request.
+     * @return true if the operation succeeded, false otherwise.
+     */
+    bool getHwpRequest(HwpRequest& request) const;
+
+    /**
+     * Writes the HWP request on all the virtual cores of the domain.
+     * ATTENTION: The driver may overwrite these values when
+     * the bounds or the energy performance preference are changed
+     * through sysfs.
+     * @param request The HWP request.
+     * @return true if the operation succeeded, false otherwise
+     *         (e.g. minPerf is greater than maxPerf).
+     */
+    bool setHwpRequest(const HwpRequest& request) const;
+
+    /**
+     * Sets the energy performance preference.
+     * @param preference One of the available preferences or,
+     *        if HWP is enabled, a raw EPP value in [0, 255].
+     * @return true if the operation succeeded, false otherwise.
+     */
+    bool setEnergyPerformancePreference(const std::string& preference) const;
+private:
+    std::string _pstatePath;
+    // Opened on first use.
+    mutable std::once_flag _hwpMsrsOnce;
+    mutable std::vector<utils::Msr*> _hwpMsrs;
+
+    const std::vector<utils::Msr*>& getHwpMsrs() const;
+};
+
+/**
+ * ACPI CPPC capabilities of a virtual core. Performance
+ * levels are expressed in an abstract scale.
+ */
+typedef struct{
+    uint32_t highestPerf;
+    uint32_t nominalPerf;
+    uint32_t lowestNonlinearPerf;
+    uint32_t lowestPerf;
+    // Frequency corresponding to nominalPerf (0 if unknown).
+    Frequency nominalFrequency;
+}CppcCapabilities;
+
+/**
+ * Fields of the MSR_AMD_CPPC_REQ register.
+ */
+typedef struct{
+    uint8_t maxPerf;
+    uint8_t minPerf;
+    // 0 lets the hardware autonomously select the performance level.
+    uint8_t desiredPerf;
+    // 0 (performance) to 255 (energy saving).
+    uint8_t energyPerformancePreference;
+}CppcRequest;
+
+/**
+ * A domain managed by the amd-pstate driver (AMD CPPC), in
+ * any of its modes (passive, guided, active/epp).
+ * As for intel_pstate, any frequency between the hardware
+ * bounds can be set.
+ */
+class DomainAmdPstate: public DomainLinux{
+public:
+    DomainAmdPstate(DomainId domainIdentifier, std::vector<topology::VirtualCore*> virtualCores);
+    ~DomainAmdPstate();
+
+    /**
+     * Returns the CPPC capabilities of the domain.
+     * @param capabilities The CPPC capabilities.
+     * @return true if the operation succeeded, false otherwise.
+     */
+    bool getCppcCapabilities(CppcCapabilities& capabilities) const;
+
+    /**
+     * Converts a CPPC performance level to a frequency.
+     * @param perf The performance level.
+     * @return The frequency (in KHz) corresponding to the performance
+     *         level, or 0 if the nominal frequency is unknown.
+     */
+    Frequency perfToFrequency(uint32_t perf) const;
+
+    /**
+     * Checks if CPPC is enabled.
+     * @return True if CPPC is enabled, false otherwise
+     *         (or if the MSRs are not accessible).
+     */
+    bool isCppcEnabled() const;
+
+    /**
+     * Reads the CPPC request of the domain.
+     * @param request The CPPC request.
+     * @return true if the operation succeeded, false otherwise.
+     */
+    bool getCppcRequest(CppcRequest& request) const;
+
+    /**
+     * Writes the CPPC request on all the virtual cores of the domain.
+     * ATTENTION: The driver may overwrite these values when
+     * the bounds or the energy performance preference are changed
+     * through sysfs.
+     * @param request The CPPC request.
+     * @return true if the operation succeeded, false otherwise
+     *         (e.g. minPerf is greater than maxPerf).
+     */
+    bool setCppcRequest(const CppcRequest& request) const;
+private:
+    // Opened on first use.
+    mutable std::once_flag _cppcMsrsOnce;
+    mutable std::vector<utils::Msr*> _cppcMsrs;
+    CppcCapabilities _capabilities;
+    bool _hasCapabilities;
+
+    const std::vector<utils::Msr*>& getCppcMsrs() const;
+};
+
+/**
+ * Uncore domain managed through the intel_uncore_frequency driver
+ * or, if not available, directly through MSR_UNCORE_RATIO_LIMIT.
+ * If the CPU is composed by more than one die, all of them are
+ * set to the same bounds.
+ */
+class UncoreDomainLinux: public UncoreDomain{
+private:
+    std::vector<std::string> _paths;
+    topology::VirtualCoreId _virtualCoreId;
+    // Opened on first use, only needed if sysfs is not available.
+    mutable std::once_flag _msrOnce;
+    mutable utils::Msr* _msr;
+    bool _useMsr;
+    Frequency _hardwareLowerBound;
+    Frequency _hardwareUpperBound;
+
+    utils::Msr& getMsr() const;
+public:
+    /**
+     * @param cpuId The identifier of the CPU.
+     * @param paths The intel_uncore_frequency directories of the dies
+     *        of the CPU. If empty, the MSRs are used.
+     * @param virtualCoreId A virtual core of the CPU (used to access the MSRs).
+     */
+    UncoreDomainLinux(topology::CpuId cpuId, const std::vector<std::string>& paths,
+                      topology::VirtualCoreId virtualCoreId);
+    ~UncoreDomainLinux();
+    void getHardwareFrequencyBounds(Frequency& lowerBound, Frequency& upperBound) const;
+    bool getFrequencyBounds(Frequency& lowerBound, Frequency& upperBound) const;
+    bool setFrequencyBounds(Frequency lowerBound, Frequency upperBound) const;
+    Frequency getCurrentFrequency() const;
+
+    /**
+     * Checks if uncore frequency can be managed through the MSRs.
+     * @param virtualCoreId A virtual core of the CPU.
+     * @return True if the MSRs are accessible, false otherwise.
+     */
+    static bool isMsrSupported(topology::VirtualCoreId virtualCoreId);
 };
 
 class CpuFreqLinux: public CpuFreq{
 private:
     std::vector<Domain*> _domains;
+    std::vector<UncoreDomain*> _uncoreDomains;
     std::string _boostingFile;
+    // True if _boostingFile disables boosting when set (intel_pstate no_turbo).
+    bool _boostingInverted;
     topology::Topology* _topology;
 public:
     CpuFreqLinux();
     ~CpuFreqLinux();
     std::vector<Domain*> getDomains() const;
+    std::vector<UncoreDomain*> getUncoreDomains() const;
     bool isBoostingSupported() const;
     bool isBoostingEnabled() const;
     void enableBoosting() const;
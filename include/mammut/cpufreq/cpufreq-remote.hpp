@@ -26,13 +26,10 @@ public:
     bool setGovernorBounds(Frequency lowerBound, Frequency upperBound) const;
     int getTransitionLatency() const;
     Voltage getCurrentVoltage() const;
-    VoltageTable getVoltageTable(bool onlyPhysicalCores) const{
-        throw std::runtime_error("notsupported");
-    }
+    VoltageTable getVoltageTable(bool onlyPhysicalCores) const;
     VoltageTable getVoltageTable(uint numVirtualCores,
-                                 bool onlyPhysicalCores) const{
-        throw std::runtime_error("notsupported");
-    }
+                                 bool onlyPhysicalCores) const;
+    VoltageTable getVoltageTable(const VoltageTableParameters& parameters) const;
 private:
     Frequency getCurrentFrequency(bool userspace) const;
     Communicator* const _communicator;
@@ -48,6 +45,8 @@ public:
     explicit CpuFreqRemote(Communicator* const communicator);
     ~CpuFreqRemote();
     std::vector<Domain*> getDomains() const;
+    std::map<DomainId, VoltageTable> getVoltageTables(const VoltageTableParameters& parameters) const;
+    std::vector<UncoreDomain*> getUncoreDomains() const;
     bool isBoostingSupported() const;
     bool isBoostingEnabled() const;
     void enableBoosting() const;
@@ -33,6 +33,33 @@ using VoltageTableKey = std::pair<topology::VirtualCoreId, Frequency>;
 using VoltageTable = std::map<VoltageTableKey, Voltage>;
 using VoltageTableIterator = std::map<VoltageTableKey, Voltage>::const_iterator;
 
+/**
+ * Parameters of the voltage table characterization.
+ * For each point of the table, the voltage is sampled every
+ * samplingInterval microseconds and averaged over windows of
+ * windowSamples samples. The point is considered stable (and the
+ * average of the last window is taken) as soon as two consecutive
+ * windows differ less than tolerance (relative), or after maxWindows
+ * windows.
+ */
+struct VoltageTableParameters{
+    bool onlyPhysicalCores; ///< If true, only one virtual core per physical core is loaded.
+    uint samplingInterval; ///< Interval between two voltage samples (microseconds).
+    uint windowSamples; ///< Number of samples averaged in a window.
+    double tolerance; ///< Maximum relative difference between two consecutive windows.
+    uint maxWindows; ///< Maximum number of windows for each point.
+    /**
+     * If not empty, the table is dumped (with dumpVoltageTable) on this
+     * file after each measured point. If the file already exists, the
+     * points it contains are not measured again, so an interrupted
+     * characterization can be resumed.
+     */
+    std::string fileName;
+
+    VoltageTableParameters():onlyPhysicalCores(true), samplingInterval(1000),
+                             windowSamples(50), tolerance(0.002), maxWindows(20){;}
+};
+
 /**
  * Represents a rollback point. It can be used to bring
  * the domains back to a previous state.
@@ -42,6 +69,10 @@ struct RollbackPoint{
     std::vector<Frequency> lowerBounds;
     std::vector<Frequency> upperBounds;
     std::vector<Governor> governors;
+    // 0 if the bounds of the uncore domain could not be read
+    // (in that case they are not restored).
+    std::vector<Frequency> uncoreLowerBounds;
+    std::vector<Frequency> uncoreUpperBounds;
 };
 
 /**
@@ -103,6 +134,16 @@ public:
      **/
     virtual std::vector<Frequency> getAvailableFrequencies() const = 0;
 
+    /**
+     * Checks if the domain accepts any frequency between its hardware bounds
+     * (e.g. intel_pstate). In this case, getAvailableFrequencies() only
+     * returns a sampling of the admissible range.
+     * @return True if any frequency between the hardware bounds can be set,
+     *         false if only the frequencies returned by getAvailableFrequencies()
+     *         can be set.
+     */
+    virtual bool hasContinuousFrequencies() const;
+
     /**
      * Gets the governors available.
      * @return The governors available.
@@ -229,6 +270,65 @@ public:
      */
     virtual VoltageTable getVoltageTable(uint numVirtualCores,
                                          bool onlyPhysicalCores) const = 0;
+
+    /**
+     * Returns the voltage table of this domain, for any number
+     * of loaded virtual cores.
+     * NOTE: This call may block the caller for some seconds/minutes.
+     * @param parameters The parameters of the characterization.
+     * @return The voltage table of this domain. If voltages cannot be read,
+     *         the table will be empty.
+     */
+    virtual VoltageTable getVoltageTable(const VoltageTableParameters& parameters) const = 0;
+};
+
+/**
+ * Represents the uncore (i.e. ring/mesh, LLC and memory controller)
+ * frequency of a CPU. Uncore frequencies are multiples of 100MHz.
+ */
+class UncoreDomain{
+    const topology::CpuId _cpuId;
+protected:
+    explicit UncoreDomain(topology::CpuId cpuId);
+public:
+    virtual inline ~UncoreDomain(){;}
+
+    /**
+     * Returns the identifier of the CPU of this domain.
+     * @return The identifier of the CPU of this domain.
+     */
+    topology::CpuId getCpuId() const;
+
+    /**
+     * Gets the hardware uncore frequency bounds.
+     * @param lowerBound The hardware frequency lower bound (specified in kHZ).
+     * @param upperBound The hardware frequency upper bound (specified in kHZ).
+     **/
+    virtual void getHardwareFrequencyBounds(Frequency& lowerBound, Frequency& upperBound) const = 0;
+
+    /**
+     * Gets the current uncore frequency bounds.
+     * @param lowerBound The current frequency lower bound (specified in kHZ).
+     * @param upperBound The current frequency upper bound (specified in kHZ).
+     * @return true if the operation succeeded, false otherwise.
+     **/
+    virtual bool getFrequencyBounds(Frequency& lowerBound, Frequency& upperBound) const = 0;
+
+    /**
+     * Changes the uncore frequency bounds. The hardware selects
+     * the uncore frequency within these bounds.
+     * @param lowerBound The new frequency lower bound (specified in kHZ).
+     * @param upperBound The new frequency upper bound (specified in kHZ).
+     * @return true if the operation succeeded, false otherwise (e.g. because
+     *         the bounds are not valid).
+     **/
+    virtual bool setFrequencyBounds(Frequency lowerBound, Frequency upperBound) const = 0;
+
+    /**
+     * Gets the current uncore frequency.
+     * @return The current uncore frequency (specified in kHZ), 0 if it cannot be read.
+     */
+    virtual Frequency getCurrentFrequency() const = 0;
 };
 
 class CpuFreq: public Module{
@@ -253,6 +353,19 @@ public:
      */
     virtual std::vector<Domain*> getDomains() const = 0;
 
+    /**
+     * Computes the voltage tables of all the domains. Domains of
+     * different Cpus are characterized in parallel, while domains of
+     * the same Cpu (which usually share the voltage rail) are
+     * characterized one after the other.
+     * If parameters.fileName is not empty, the table of domain D is
+     * dumped on parameters.fileName + "." + D.
+     * NOTE: This call may block the caller for some seconds/minutes.
+     * @param parameters The parameters of the characterization.
+     * @return A map containing the voltage table of each domain.
+     */
+    virtual std::map<DomainId, VoltageTable> getVoltageTables(const VoltageTableParameters& parameters = VoltageTableParameters()) const;
+
     /**
      * Removes the turbo frequencies from the available
      * frequencies from all the domains.
@@ -307,6 +420,20 @@ public:
      */
     std::vector<Domain*> getDomainsComplete(const std::vector<topology::VirtualCore*>& virtualCores) const;
 
+    /**
+     * Returns the uncore domains (one per CPU).
+     * @return The uncore domains. Empty if uncore frequency
+     *         scaling is not supported.
+     */
+    virtual std::vector<UncoreDomain*> getUncoreDomains() const = 0;
+
+    /**
+     * Returns the uncore domain of a specified CPU.
+     * @param cpu The CPU.
+     * @return The uncore domain of the CPU, or NULL if not present.
+     */
+    UncoreDomain* getUncoreDomain(const topology::Cpu* cpu) const;
+
     /**
      * Returns a rollback point. It can be used to bring the domain
      * back to the point when this function is called.
@@ -380,6 +507,151 @@ void loadVoltageTable(VoltageTable& voltageTable, std::string fileName);
  */
 void dumpVoltageTable(const VoltageTable& voltageTable, std::string fileName);
 
+/**
+ * A voltage and power model of a domain. Voltages are stored in a
+ * dense array indexed by (number of loaded virtual cores, frequency index),
+ * together with calibrated power coefficients for each frequency.
+ * The model can be saved on a versioned binary file, which is then
+ * loaded with mmap (pages are shared among the processes using the
+ * same file, until they are modified).
+ * File layout (native byte order, arrays aligned to 8 bytes):
+ *   uint32 magic ("MMVM"), uint32 version, uint32 number of rows
+ *   (maximum number of virtual cores + 1), uint32 number of frequencies;
+ *   Frequency frequencies[numFrequencies] (increasing);
+ *   double voltages[numRows][numFrequencies];
+ *   double staticPower[numFrequencies];
+ *   double dynamicPower[numFrequencies].
+ */
+class VoltageModel: public utils::NonCopyable{
+private:
+    char* _data;
+    size_t _size;
+    bool _mapped;
+    uint32_t _numRows;
+    uint32_t _numFrequencies;
+    Frequency* _frequencies;
+    double* _voltages;
+    double* _staticPower;
+    double* _dynamicPower;
+
+    void setPointers();
+public:
+    /**
+     * Creates a model from a voltage table. Points missing from
+     * the table have voltage 0. Power coefficients are set to 0.
+     * @param voltageTable The voltage table.
+     */
+    explicit VoltageModel(const VoltageTable& voltageTable);
+
+    /**
+     * Loads a model from a file created with save(). The file is mapped
+     * privately: changes made to the model (e.g. with setPowerCoefficients())
+     * are not written back to the file unless save() is called.
+     * Throws a std::runtime_error if the file cannot be loaded.
+     * @param fileName The name of the file.
+     */
+    explicit VoltageModel(const std::string& fileName);
+
+    ~VoltageModel();
+
+    /**
+     * Saves the model on a file.
+     * Throws a std::runtime_error if the file cannot be written.
+     * @param fileName The name of the file.
+     */
+    void save(const std::string& fileName) const;
+
+    /**
+     * Returns the voltage table corresponding to this model.
+     * @return The voltage table corresponding to this model.
+     */
+    VoltageTable getVoltageTable() const;
+
+    /**
+     * Returns the maximum number of virtual cores in the model.
+     * @return The maximum number of virtual cores in the model.
+     */
+    inline uint getMaxVirtualCores() const{
+        return _numRows - 1;
+    }
+
+    /**
+     * Returns the number of frequencies in the model.
+     * @return The number of frequencies in the model.
+     */
+    inline size_t getNumFrequencies() const{
+        return _numFrequencies;
+    }
+
+    /**
+     * Returns a frequency of the model.
+     * @param frequencyIndex The index of the frequency (frequencies are
+     *        sorted in increasing order).
+     * @return The frequency.
+     */
+    inline Frequency getFrequency(size_t frequencyIndex) const{
+        return _frequencies[frequencyIndex];
+    }
+
+    /**
+     * Returns the index of a frequency.
+     * @param frequency The frequency.
+     * @return The index of the frequency, or -1 if the frequency
+     *         is not present in the model.
+     */
+    int getFrequencyIndex(Frequency frequency) const;
+
+    /**
+     * Returns the voltage of a configuration. No bounds checking is performed.
+     * @param numVirtualCores The number of loaded virtual cores.
+     * @param frequencyIndex The index of the frequency.
+     * @return The voltage.
+     */
+    inline Voltage getVoltage(uint numVirtualCores, size_t frequencyIndex) const{
+        return _voltages[numVirtualCores * _numFrequencies + frequencyIndex];
+    }
+
+    /**
+     * Returns the static power at a given frequency (Watts).
+     * @param frequencyIndex The index of the frequency.
+     * @return The static power at the given frequency.
+     */
+    inline double getStaticPower(size_t frequencyIndex) const{
+        return _staticPower[frequencyIndex];
+    }
+
+    /**
+     * Returns the dynamic power of one loaded virtual core at a given
+     * frequency (Watts).
+     * @param frequencyIndex The index of the frequency.
+     * @return The dynamic power of one loaded virtual core.
+     */
+    inline double getDynamicPower(size_t frequencyIndex) const{
+        return _dynamicPower[frequencyIndex];
+    }
+
+    /**
+     * Returns the predicted power of a configuration (Watts), i.e.
+     * the static power plus numVirtualCores times the dynamic power.
+     * No bounds checking is performed.
+     * @param numVirtualCores The number of loaded virtual cores.
+     * @param frequencyIndex The index of the frequency.
+     * @return The predicted power.
+     */
+    inline double getPower(uint numVirtualCores, size_t frequencyIndex) const{
+        return _staticPower[frequencyIndex] + numVirtualCores * _dynamicPower[frequencyIndex];
+    }
+
+    /**
+     * Sets the power coefficients of a frequency. The change only affects
+     * this object: to persist it, the model must be stored again with save().
+     * @param frequencyIndex The index of the frequency.
+     * @param staticPower The static power (Watts).
+     * @param dynamicPower The dynamic power of one loaded virtual core (Watts).
+     */
+    void setPowerCoefficients(size_t frequencyIndex, double staticPower, double dynamicPower);
+};
+
 }
 }
 
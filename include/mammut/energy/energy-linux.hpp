@@ -3,6 +3,8 @@
 
 #include <mammut/energy/energy.hpp>
 #include <mammut/topology/topology.hpp>
+
+#include <atomic>
 #ifdef HAVE_RAPLCAP
 #include <raplcap/raplcap.h>
 #endif
@@ -30,19 +32,18 @@ public:
     void reset();
 };
 
-class CounterPlugSmartPower2Linux: public CounterPlug{
-    friend class Energy;
+class PowerMeterSmartPower2Linux: public PowerMeter{
 private:
-    FILE* _usbFile;
-    ulong _lastTimestamp;
-    Joules _cumulativeJoules;
-    double getWatts();
-    bool init();
+    int _fd;
+    // Data received but not yet parsed.
+    std::string _buffer;
+    bool readLine(std::string& line);
 public:
-    CounterPlugSmartPower2Linux(); 
-    ~CounterPlugSmartPower2Linux(); 
-    Joules getJoules();
-    void reset();
+    PowerMeterSmartPower2Linux();
+    ~PowerMeterSmartPower2Linux();
+    bool init();
+    bool getWatts(double& watts);
+    uint getSamplingInterval(){return 0;}
 };
 
 class CounterPlugSmartGaugeLinux: public CounterPlug{
@@ -70,17 +71,11 @@ public:
         CounterAmesterLinux("JLS250US", "PWR250US"){;}
 };
 
-class CounterPlugFileLinux: public CounterPlug{
-    friend class Energy;
-private:
-    ulong _lastTimestamp;
-    Joules _cumulativeJoules;
-    double getWatts();
-    bool init();
+class PowerMeterFileLinux: public PowerMeter{
 public:
-    CounterPlugFileLinux();
-    Joules getJoules();
-    void reset();
+    bool init();
+    bool getWatts(double& watts);
+    uint getSamplingInterval();
 };
 
 typedef struct {
@@ -101,153 +96,381 @@ public:
     SensorIna(const char* name);
     ~SensorIna();
     bool init();
-    double getWatts();
+    bool getWatts(double& watts);
 };
 
-class CounterPlugINALinux: public CounterPlug{
-    friend class Energy;
+class PowerMeterINALinux: public PowerMeter{
 private:
     SensorIna _sensorA7, _sensorA15;
-    double _lastRead;
-    Joules _cumulativeJoules;
-    bool init();
 public:
-    CounterPlugINALinux();
-    ~CounterPlugINALinux();
-    Joules getJoules();
-    void reset();
+    PowerMeterINALinux();
+    bool init();
+    bool getWatts(double& watts);
+    uint getSamplingInterval();
 };
 
-class CounterCpusLinuxMsr;
+typedef enum{
+  CPU_FAMILY_INTEL = 0,
+  CPU_FAMILY_AMD
+}CpuFamily;
 
-class CounterMemoryRaplLinux: public CounterMemory{
-    friend class Energy;
+typedef enum{
+  RAPL_SOURCE_ANY = 0, ///< Sysfs if available, msr otherwise.
+  RAPL_SOURCE_SYSFS,   ///< Powercap sysfs interface.
+  RAPL_SOURCE_MSR,     ///< Model specific registers.
+  RAPL_SOURCE_NUM
+}RaplSource;
+
+typedef enum{
+  RAPL_DOMAIN_PACKAGE = 0,
+  RAPL_DOMAIN_CORES,
+  RAPL_DOMAIN_GRAPHIC,
+  RAPL_DOMAIN_DRAM,
+  RAPL_DOMAIN_NUM
+}RaplDomain;
+
+class RaplBackend;
+
+class RaplBackendAccumulator: public utils::Thread{
 private:
-    CounterCpusLinuxMsr* _ccl;
-    bool init();
+    RaplBackend* _backend;
 public:
-    explicit CounterMemoryRaplLinux();
-    Joules getJoules();
-    void reset();
+    explicit RaplBackendAccumulator(RaplBackend* backend);
+    void run();
 };
 
-class CounterMemoryAmesterLinux: public CounterMemory, CounterAmesterLinux{
-    friend class Energy;
+/**
+ * Reads the RAPL energy counters of all the Cpus, accumulating them
+ * so that wraparound is handled. There is at most one backend for
+ * each source in the process, shared (and reference counted) by
+ * all the counters using it. A single timer periodically updates
+ * all the domains at once, often enough to never miss a wrap.
+ */
+class RaplBackend: public utils::NonCopyable{
+    friend class RaplBackendAccumulator;
+    friend class RaplTracer;
 private:
-    bool init(){return CounterAmesterLinux::init();}
+    static std::mutex _instancesLock;
+    static RaplBackend* _instances[RAPL_SOURCE_NUM];
+    RaplSource _source;
+    uint _references;
+    topology::Topology* _topology;
+    std::vector<topology::Cpu*> _cpus;
+    CpuFamily _family;
+    bool _hasDomain[RAPL_DOMAIN_NUM];
+    // Indexed by Cpu identifier.
+    std::vector<utils::Msr*> _msrs;
+    std::vector<std::string> _paths[RAPL_DOMAIN_NUM];
+    // Joules for each unit of the raw counters and value at which they wrap.
+    double _energyPerUnit;
+    uint64_t _range;
+    double _wrappingInterval;
+    utils::LockPthreadMutex _lock;
+    // Indexed by Cpu identifier and domain.
+    std::vector<uint64_t> _lastRaw;
+    std::vector<Joules> _joules;
+    // Per physical core counters (AMD), read together with a single batch.
+    // They are only exposed as MSRs, also when the other domains are
+    // read from sysfs, so they have their own unit.
+    bool _hasCore;
+    double _coresEnergyPerUnit;
+    utils::MsrBatch* _coresBatch;
+    // Indexed by physical core identifier.
+    std::vector<size_t> _coresBatchIndexes;
+    std::vector<uint64_t> _coresLastRaw;
+    std::vector<Joules> _coresJoules;
+    // Time of the last read of the batch (milliseconds).
+    double _coresLastUpdate;
+    // Physical cores of each Cpu (indexed by Cpu identifier).
+    std::vector<std::vector<topology::PhysicalCoreId> > _cpusCores;
+    // Platform (PSys) counter, which is not associated to a specific Cpu.
+    bool _hasPlatform;
+    std::string _platformPath;
+    uint64_t _platformRange;
+    uint64_t _platformLastRaw;
+    Joules _platformJoules;
+    int _timerFd;
+    int _stopFd;
+    RaplBackendAccumulator* _accumulator;
+
+    explicit RaplBackend(RaplSource source);
+    ~RaplBackend();
+    bool init();
+    bool initMsr();
+    bool initSysFs();
+    bool initCores();
+    static bool isCpuIntelSupported(topology::Cpu* cpu);
+    static bool isCpuAMDSupported(topology::Cpu* cpu);
+    static uint32_t getDomainMsr(CpuFamily family, RaplDomain domain);
+    uint64_t readRaw(topology::CpuId cpuId, RaplDomain domain);
+    void update(topology::CpuId cpuId, RaplDomain domain);
+    void updateCores();
+    void sumCores(topology::CpuId cpuId);
+    uint64_t readPlatformRaw();
+    void updatePlatform();
+    void updateAll();
 public:
-    Joules getJoules(){return CounterAmesterLinux::getJoules();}
-    void reset(){CounterAmesterLinux::reset();}
-    CounterMemoryAmesterLinux():
-        CounterAmesterLinux("JLS250USMEM0", "PWR250USMEM0"){;}
+    /**
+     * Returns the backend for a source, creating it if it does not exist.
+     * @param source The source. If RAPL_SOURCE_ANY, an existing backend
+     *        is returned if present.
+     * @return The backend, or NULL if the source is not available. It must
+     *         be released with release().
+     */
+    static RaplBackend* acquire(RaplSource source = RAPL_SOURCE_ANY);
+
+    /**
+     * Releases a backend obtained with acquire(). The backend is
+     * destroyed when released by all its users.
+     * @param backend The backend.
+     */
+    static void release(RaplBackend* backend);
+
+    /**
+     * Returns the source of this backend.
+     * @return The source of this backend.
+     */
+    RaplSource getSource() const{return _source;}
+
+    /**
+     * Returns the family of the Cpus.
+     * @return The family of the Cpus.
+     */
+    CpuFamily getFamily() const{return _family;}
+
+    /**
+     * Returns the Cpus.
+     * @return The Cpus.
+     */
+    const std::vector<topology::Cpu*>& getCpus() const{return _cpus;}
+
+    /**
+     * Checks if a domain is available on all the Cpus.
+     * @param domain The domain.
+     * @return True if the domain is available, false otherwise.
+     */
+    bool hasDomain(RaplDomain domain) const{return _hasDomain[domain];}
+
+    /**
+     * Returns the Joules consumed by a domain of a Cpu since the
+     * creation of the backend.
+     * @param cpuId The identifier of the Cpu.
+     * @param domain The domain.
+     * @return The Joules consumed by the domain, 0 if not available.
+     */
+    Joules getJoules(topology::CpuId cpuId, RaplDomain domain);
+
+    /**
+     * Checks if the energy of each physical core is available.
+     * @return True if the energy of each physical core is available,
+     *         false otherwise.
+     */
+    bool hasJoulesCore() const{return _hasCore;}
+
+    /**
+     * Returns the Joules consumed by a physical core since the creation
+     * of the backend. The counters of all the physical cores are read
+     * together with a single batch, which is reused by the calls made
+     * within one millisecond from the read. Use getJoulesCores() to read
+     * many cores at once.
+     * @param physicalCoreId The identifier of the physical core.
+     * @return The Joules consumed by the physical core, 0 if not available.
+     */
+    Joules getJoulesCore(topology::PhysicalCoreId physicalCoreId);
+
+    /**
+     * Returns the Joules consumed by each physical core since the creation
+     * of the backend, reading all of them with a single batch.
+     * @return The Joules consumed by each physical core (indexed by
+     *         physical core identifier). Empty if not available.
+     */
+    std::vector<Joules> getJoulesCores();
+
+    /**
+     * Checks if the platform (PSys) domain is available. It covers the
+     * whole SoC and, depending on the platform, other components
+     * powered by the same supply (e.g. the whole board).
+     * @return True if the platform domain is available, false otherwise.
+     */
+    bool hasJoulesPlatform() const{return _hasPlatform;}
+
+    /**
+     * Returns the Joules consumed by the platform (PSys) domain since
+     * the creation of the backend.
+     * @return The Joules consumed by the platform, 0 if not available.
+     */
+    Joules getJoulesPlatform();
+
+    /**
+     * Returns the Joules consumed by all the domains of a Cpu since the
+     * creation of the backend. The domains are read together.
+     * @param cpuId The identifier of the Cpu.
+     * @return The Joules consumed by all the domains of the Cpu.
+     */
+    JoulesCpu getJoulesComponents(topology::CpuId cpuId);
 };
 
-class CounterCpusLinux: public CounterCpus{
-  friend class CounterCpusLinuxRefresher;
-protected:
-    utils::Monitor _stopRefresher;
-public:
-    CounterCpusLinux();
-
-    virtual JoulesCpu getJoulesComponents(topology::CpuId cpuId);
-    virtual Joules getJoulesCpu(topology::CpuId cpuId) = 0;
-    virtual Joules getJoulesCores(topology::CpuId cpuId) = 0;
-    virtual Joules getJoulesGraphic(topology::CpuId cpuId) = 0;
-    virtual Joules getJoulesDram(topology::CpuId cpuId) = 0;
-    virtual double getWrappingInterval() = 0;
+/**
+ * A sample of a high resolution RAPL trace, taken when an update
+ * of the energy counter has been observed.
+ */
+struct RaplTraceSample{
+    uint64_t ticks; ///< The TSC value at the update.
+    double timestamp; ///< The update time (milliseconds, see utils::getMillisecondsTime()).
+    Joules joules; ///< The Joules consumed since the first sample of the trace.
+    double watts; ///< The power since the previous sample (0 for the first one).
+
+    RaplTraceSample(uint64_t ticks = 0, double timestamp = 0, Joules joules = 0, double watts = 0):
+        ticks(ticks), timestamp(timestamp), joules(joules), watts(watts){;}
 };
 
-class CounterCpusLinuxRefresher: public utils::Thread{
+class RaplTracer;
+
+class RaplTracerThread: public utils::Thread{
 private:
-    CounterCpusLinux* _counter;
+    RaplTracer* _tracer;
 public:
-    explicit CounterCpusLinuxRefresher(CounterCpusLinux* counter);
+    explicit RaplTracerThread(RaplTracer* tracer);
     void run();
 };
 
-typedef enum{
-  CPU_FAMILY_INTEL = 0,
-  CPU_FAMILY_AMD
-}CpuFamily;
-
-class CounterCpusLinuxMsr: public CounterCpusLinux{
-    friend class CounterCpusLinuxRefresher;
-    friend class Energy;
-    friend class CounterMemoryRaplLinux;
+/**
+ * Traces the power of a Cpu with sub-millisecond resolution.
+ * RAPL counters are updated about every millisecond, so windowed
+ * readings of short intervals are heavily quantized. The tracer
+ * spin-polls the energy register from a dedicated virtual core of the
+ * Cpu and records each update with its TSC value, so that the power
+ * between two consecutive updates is known.
+ * Usage:
+ *       RaplTracer tracer(virtualCoreId);
+ *       tracer.start();
+ *       ... // Run the profiled code on the other virtual cores.
+ *       tracer.stop();
+ *       tracer.getSamples();
+ * The TSC must be invariant (see topology::VirtualCore::areTicksConstant()).
+ * Each counter update (about one per millisecond) takes about 50 bytes of
+ * memory, and traces are truncated after about 10 minutes.
+ */
+class RaplTracer: public utils::NonCopyable{
+    friend class RaplTracerThread;
 private:
-    CpuFamily _family;
-    bool _initialized;
-    utils::LockPthreadMutex _lock;
-    CounterCpusLinuxRefresher* _refresher;
-    utils::Msr** _msrs;
-    topology::CpuId _maxId;
-    double _powerPerUnit;
+    topology::Topology* _topology;
+    topology::VirtualCoreId _virtualCoreId;
+    utils::Msr _msr;
+    // Energy register of the domain and Joules for each of its units.
+    uint32_t _register;
     double _energyPerUnit;
-    double _timePerUnit;
-    double _thermalSpecPower;
-
-    JoulesCpu* _joulesCpus;
-
-    uint32_t* _lastReadCountersCpu;
-    uint32_t* _lastReadCountersCores;
-    uint32_t* _lastReadCountersGraphic;
-    uint32_t* _lastReadCountersDram;
-
-    bool _hasJoulesCores;
-    bool _hasJoulesGraphic;
-    bool _hasJoulesDram;
+    utils::Monitor _started;
+    bool _pinned;
+    std::atomic<bool> _stop;
+    uint _duration;
+    std::vector<RaplTraceSample> _samples;
+    // Set by the tracing thread if the register cannot be read.
+    std::string _error;
+    RaplTracerThread* _thread;
+
+    uint64_t readTicks() const;
+    void run();
+public:
+    /**
+     * Creates a tracer.
+     * @param virtualCoreId The virtual core on which the register is
+     *        polled. The traced Cpu is the one containing it. The
+     *        virtual core is fully used while tracing, so the profiled
+     *        code should run on other virtual cores.
+     * @param domain The domain to trace.
+     * @throw std::runtime_error If RAPL registers or the domain
+     *        are not available, or if the TSC is not invariant.
+     */
+    explicit RaplTracer(topology::VirtualCoreId virtualCoreId,
+                        RaplDomain domain = RAPL_DOMAIN_PACKAGE);
+    ~RaplTracer();
 
-    uint32_t readEnergyCounter(topology::CpuId cpuId, int which);
+    /**
+     * Starts tracing, on a thread pinned on the virtual core.
+     * Previous samples are discarded.
+     * @param duration The duration of the trace (milliseconds). If 0,
+     *        the trace continues until stop() is called (or until the
+     *        maximum length of a trace is reached).
+     * @throw std::runtime_error If the thread cannot be pinned on the
+     *        virtual core.
+     */
+    void start(uint duration = 0);
 
     /**
-     * Adds to the 'joules' counter the joules consumed from lastReadCounter to
-     * the time of this call.
-     * @param cpuId The identifier of the CPU.
-     * @param joules The joules counter.
-     * @param lastReadCounter The last value read for counter counterType.
-     * @param counterType The type of the counter.
+     * Stops tracing. If the trace has a duration which is not
+     * elapsed yet, it is terminated earlier.
+     * @return False if the trace has been interrupted because the
+     *         energy register could not be read, true otherwise.
      */
-    void updateCounter(topology::CpuId cpuId, Joules& joules, uint32_t& lastReadCounter, uint32_t counterType);
-
-    bool hasCoresCounter(topology::Cpu* cpu);
-    bool hasGraphicCounter(topology::Cpu* cpu);
-    bool hasDramCounter(topology::Cpu* cpu);
-    bool isCpuSupported(topology::Cpu* cpu);
-    bool isCpuIntelSupported(topology::Cpu* cpu);
-    bool isCpuAMDSupported(topology::Cpu* cpu);
-    double getWrappingInterval();
-public:
-    CounterCpusLinuxMsr();
+    bool stop();
 
-    Joules getJoulesCpu(topology::CpuId cpuId);
-    Joules getJoulesCores(topology::CpuId cpuId);
-    Joules getJoulesGraphic(topology::CpuId cpuId);
-    Joules getJoulesDram(topology::CpuId cpuId);
+    /**
+     * Returns the samples of the last trace. Must be called after stop().
+     * @return The samples, one for each update of the counter.
+     * @throw std::runtime_error If the trace has been interrupted because
+     *        the energy register could not be read.
+     */
+    const std::vector<RaplTraceSample>& getSamples() const;
+};
 
-    bool hasJoulesCores();
-    bool hasJoulesDram();
-    bool hasJoulesGraphic();    
+class CounterMemoryRaplLinux: public CounterMemory{
+    friend class Energy;
+private:
+    RaplBackend* _backend;
+    Joules _offset;
+    Joules read();
+    bool init();
+public:
+    CounterMemoryRaplLinux();
+    ~CounterMemoryRaplLinux();
+    Joules getJoules();
     void reset();
+};
+
+class CounterPlugRaplPsysLinux: public CounterPlug{
+    friend class Energy;
 private:
+    RaplBackend* _backend;
+    Joules _offset;
     bool init();
-    ~CounterCpusLinuxMsr();
+public:
+    CounterPlugRaplPsysLinux();
+    ~CounterPlugRaplPsysLinux();
+    Joules getJoules();
+    void reset();
 };
 
-class CounterCpusLinuxSysFs: public CounterCpusLinux{
-    friend class CounterCpusLinuxRefresher;
+class CounterMemoryAmesterLinux: public CounterMemory, CounterAmesterLinux{
     friend class Energy;
 private:
-    bool _initialized;
-    utils::LockPthreadMutex _lock;
-    CounterCpusLinuxRefresher* _refresher;
+    bool init(){return CounterAmesterLinux::init();}
+public:
+    Joules getJoules(){return CounterAmesterLinux::getJoules();}
+    void reset(){CounterAmesterLinux::reset();}
+    CounterMemoryAmesterLinux():
+        CounterAmesterLinux("JLS250USMEM0", "PWR250USMEM0"){;}
+};
 
-    int _idCores, _idGraphic, _idDram;
-    std::vector<Joules> _lastCpu, _lastCores, _lastGraphic, _lastDram;
-    std::vector<JoulesCpu> _joulesCpus;
-    double _maxValue;
+/**
+ * A Cpus counter which is a view on a RAPL backend.
+ */
+class CounterCpusLinux: public CounterCpus{
+    friend class Energy;
+private:
+    RaplSource _source;
+    RaplBackend* _backend;
+    // Values of the backend at the last reset (indexed by Cpu identifier).
+    std::vector<JoulesCpu> _offsets;
+    // Indexed by physical core identifier.
+    std::vector<Joules> _coresOffsets;
+    bool init();
+protected:
+    ~CounterCpusLinux();
 public:
-    CounterCpusLinuxSysFs();
+    explicit CounterCpusLinux(RaplSource source);
 
+    JoulesCpu getJoulesComponents(topology::CpuId cpuId);
     Joules getJoulesCpu(topology::CpuId cpuId);
     Joules getJoulesCores(topology::CpuId cpuId);
     Joules getJoulesGraphic(topology::CpuId cpuId);
@@ -256,16 +479,40 @@ public:
     bool hasJoulesCores();
     bool hasJoulesDram();
     bool hasJoulesGraphic();
+    bool hasJoulesCore();
+    Joules getJoulesCore(topology::PhysicalCoreId physicalCoreId);
     void reset();
+};
+
+class CounterCpusLinuxMsr: public CounterCpusLinux{
+    friend class Energy;
+public:
+    CounterCpusLinuxMsr():CounterCpusLinux(RAPL_SOURCE_MSR){;}
 private:
-    double getWrappingInterval(){return 10;}
-    bool init();
-    Joules read(topology::CpuId cpuId, Joules &cumulative, int sub, std::vector<Joules> &last);
-    ~CounterCpusLinuxSysFs();
+    ~CounterCpusLinuxMsr(){;}
+};
+
+class CounterCpusLinuxSysFs: public CounterCpusLinux{
+    friend class Energy;
+public:
+    CounterCpusLinuxSysFs():CounterCpusLinux(RAPL_SOURCE_SYSFS){;}
+private:
+    ~CounterCpusLinuxSysFs(){;}
+};
+
+class PowerCapperLinux;
+
+class PowerCapperLinuxBalancer: public utils::Thread{
+private:
+    PowerCapperLinux* _capper;
+public:
+    explicit PowerCapperLinuxBalancer(PowerCapperLinux* capper);
+    void run();
 };
 
 class PowerCapperLinux : PowerCapper{
   friend class Energy;
+  friend class PowerCapperLinuxBalancer;
 private:
   bool _good;
 #ifdef HAVE_RAPLCAP
@@ -273,10 +520,40 @@ private:
   raplcap_zone _zone;
 #endif
   size_t _sockets;
+  // Used to redistribute the budget when a cap is set for the whole machine.
+  CounterCpus* _counter;
+  std::vector<utils::Msr*> _perfStatusMsrs;
+  double _timePerUnit;
+  utils::Monitor _stopBalancer;
+  PowerCapperLinuxBalancer* _balancer;
+  PowerCap _totalCap;
+  std::vector<double> _budgets;
+  std::vector<Joules> _lastJoules;
+  std::vector<uint64_t> _lastThrottleTime;
+  double _lastTime;
+
   bool init();
+  void setLimit(uint windowId, uint socketId, PowerCap cap);
+  void startBalancer();
+  void stopBalancer();
+  void balance();
 public:
-  PowerCapperLinux(CounterType type);
+  PowerCapperLinux(CounterType type, CounterCpus* counter = NULL);
   ~PowerCapperLinux();
+
+  /**
+   * Redistributes a power budget among sockets, keeping the total unchanged.
+   * Sockets which are not limited by their cap keep their power plus some
+   * headroom (but not less than a minimum share), and the remaining budget
+   * is split among the limited sockets. If all the sockets are limited,
+   * the budgets move towards an even split.
+   * @param budgets The current budget of each socket, updated by this call (Watts).
+   * @param power The power consumed by each socket (Watts).
+   * @param limited For each socket, true if its performance is limited by the cap.
+   */
+  static void redistribute(std::vector<double>& budgets, const std::vector<double>& power,
+                           const std::vector<bool>& limited);
+
   std::vector<std::pair<PowerCap, PowerCap> > get() const;
   std::pair<PowerCap, PowerCap> get(uint socketId) const;
   PowerCap get(uint socketId, uint windowId) const;
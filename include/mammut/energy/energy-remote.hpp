@@ -38,6 +38,7 @@ private:
     bool _hasCores;
     bool _hasDram;
     bool _hasGraphic;
+    bool _hasCore;
 public:
     explicit CounterCpusRemote(mammut::Communicator* const communicator);
 
@@ -54,6 +55,8 @@ public:
     bool hasJoulesCores();
     bool hasJoulesDram();
     bool hasJoulesGraphic();
+    bool hasJoulesCore();
+    Joules getJoulesCore(topology::PhysicalCoreId physicalCoreId);
     void reset();
 private:
     bool init();
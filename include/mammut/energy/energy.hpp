@@ -2,14 +2,18 @@
 #define MAMMUT_ENERGY_HPP_
 
 #include "../communicator.hpp"
+#include "../cpufreq/cpufreq.hpp"
 #include "../module.hpp"
 #include "../topology/topology.hpp"
 
+#include <mutex>
+
 namespace mammut{
 namespace energy{
 
 using Joules = double;
 class JoulesCpu;
+struct EnergySnapshot;
 class Energy;
 class PowerCapper;
 
@@ -194,6 +198,33 @@ public:
      */
     virtual Joules getJoulesCoresAll();
 
+    /**
+     * Returns true if the counter for each individual physical core
+     * is present, false otherwise. By default it is not present.
+     * @return True if the counter for each individual physical core is
+     *         present, false otherwise.
+     */
+    virtual bool hasJoulesCore();
+
+    /**
+     * Returns the Joules consumed by a physical core since the counter creation
+     * (or since the last call of reset()).
+     * @param physicalCoreId The identifier of a physical core.
+     * @return The Joules consumed by the physical core since the counter
+     *         creation (or since the last call of reset()). 0 if
+     *         hasJoulesCore() is false.
+     */
+    virtual Joules getJoulesCore(topology::PhysicalCoreId physicalCoreId);
+
+    /**
+     * Returns the Joules consumed by a physical core since the counter creation
+     * (or since the last call of reset()).
+     * @param physicalCore The physical core.
+     * @return The Joules consumed by the physical core since the counter
+     *         creation (or since the last call of reset()).
+     */
+    Joules getJoulesCore(topology::PhysicalCore* physicalCore);
+
     /**
      * Returns true if the counter for integrated graphic card is present, false otherwise.
      * @return True if the counter for integrated graphic card is present, false otherwise.
@@ -310,6 +341,9 @@ public:
 
   /**
    * Sets a power cap. It is equally split among the available sockets.
+   * If per-socket power can be measured, the budget is then periodically
+   * moved from the sockets with slack to the ones limited by their cap,
+   * keeping the total unchanged.
    * @param cap The power cap.
    */
   virtual void set(PowerCap cap) = 0;
@@ -330,6 +364,381 @@ public:
   virtual void set(uint windowId, uint socketId, PowerCap cap) = 0;
 };
 
+class PowerCapperSoftware;
+
+/**
+ * The control loop of PowerCapperSoftware.
+ */
+class PowerCapperSoftwareThread: public utils::Thread{
+private:
+    PowerCapperSoftware* _capper;
+public:
+    explicit PowerCapperSoftwareThread(PowerCapperSoftware* capper);
+    void run();
+};
+
+/**
+ * A power capper implemented in software, usable with any counter
+ * (e.g. on machines without RAPL). Every sampling interval, the power
+ * is read from the counter and a PID controller computes, for each socket,
+ * a throttling level. Levels are applied, from the least to the most
+ * intrusive, by:
+ *  - Reducing the frequency of the domains of the socket (DVFS).
+ *  - Reducing the clock modulation of the virtual cores of the socket.
+ *  - Hot-unplugging the virtual cores of the socket (the first virtual
+ *    core of each socket is never unplugged).
+ *  - Throttling the processes added with addThrottledProcess().
+ * If the counter measures the power of each socket (COUNTER_CPUS), each
+ * socket is controlled separately and, when a cap is set for the whole
+ * machine with set(PowerCap), the budget left unused by a socket is
+ * redistributed to the other sockets. Otherwise, the same level is applied
+ * to all the sockets.
+ * The controller enforces the smallest enabled cap among the two windows
+ * of a socket. The state of the machine is restored when the capper is
+ * deleted.
+ * ATTENTION: The counter must not be reset by other users while the capper
+ * is running.
+ */
+class PowerCapperSoftware: public PowerCapper, public utils::NonCopyable{
+    friend class PowerCapperSoftwareThread;
+private:
+    Counter* _counter;
+    CounterCpus* _counterCpus;
+    cpufreq::CpuFreq* _cpufreq;
+    topology::Topology* _topology;
+    std::vector<topology::Cpu*> _cpus;
+    cpufreq::RollbackPoint _rollbackPoint;
+    uint _samplingInterval;
+    double _kp, _ki, _kd;
+    // Caps for each socket and window.
+    std::vector<std::pair<PowerCap, PowerCap> > _caps;
+    // If true, the budget can be moved among sockets.
+    bool _redistribute;
+    std::vector<task::ProcessHandler*> _processes;
+    mutable std::mutex _mutex;
+    utils::Monitor _stop;
+    PowerCapperSoftwareThread* _thread;
+    bool _started;
+
+    // Actuators of each socket.
+    std::vector<std::vector<cpufreq::Domain*> > _domains;
+    std::vector<std::vector<cpufreq::Frequency> > _frequencies;
+    std::vector<std::vector<double> > _clockModulationValues;
+    std::vector<std::vector<topology::VirtualCore*> > _unpluggableCores;
+    // Current throttling level of each socket.
+    std::vector<double> _levels;
+    std::vector<int> _appliedLevels;
+    int _appliedThrottling;
+    // State of the controller (one entry for each controlled socket).
+    std::vector<Joules> _lastJoules;
+    double _lastTime;
+    std::vector<double> _lastErrors;
+    std::vector<double> _lastErrors2;
+
+    bool init();
+    uint getMaxLevel(size_t socket) const;
+    /**
+     * Applies a throttling level to a socket.
+     * @param socket The socket.
+     * @param level The level (0 means no throttling).
+     * @param force If true, the level is applied even if it is the
+     *        currently applied one.
+     */
+    void applyLevel(size_t socket, int level, bool force = false);
+    void applyThrottling(int step);
+    void getBudgets(const std::vector<double>& power, std::vector<double>& budgets) const;
+    void control();
+    void restore();
+public:
+    /**
+     * Creates a software power capper. Control starts when
+     * the first cap is set.
+     * @param counter The counter used to measure power.
+     * @param cpufreq The cpufreq module used to change frequencies.
+     * @param samplingInterval The interval between two control steps
+     *        (milliseconds). It should be larger than the update
+     *        interval of the counter.
+     */
+    PowerCapperSoftware(Counter* counter, cpufreq::CpuFreq* cpufreq, uint samplingInterval = 10);
+
+    ~PowerCapperSoftware();
+
+    /**
+     * Sets the gains of the PID controller. The error is normalized
+     * on the budget, and the output is expressed as a fraction of
+     * the number of throttling levels. By default kp = 0.3, ki = 5
+     * and kd = 0.
+     * @param kp The proportional gain.
+     * @param ki The integral gain (1/seconds).
+     * @param kd The derivative gain (seconds).
+     */
+    void setGains(double kp, double ki, double kd);
+
+    /**
+     * Adds a process that can be throttled when the other
+     * actuators are not sufficient to meet the cap. The CPU time
+     * granted by the throttling is split among the added processes.
+     * @param process The process. It must be valid as long as this
+     *        capper is used.
+     */
+    void addThrottledProcess(task::ProcessHandler* process);
+
+    /**
+     * Returns the current throttling level of a socket.
+     * @param socketId The identifier of the socket.
+     * @return The current throttling level of the socket. 0 if not throttled.
+     */
+    uint getLevel(uint socketId) const;
+
+    std::vector<std::pair<PowerCap, PowerCap> > get() const;
+    std::pair<PowerCap, PowerCap> get(uint socketId) const;
+    PowerCap get(uint socketId, uint windowId) const;
+    void set(PowerCap cap);
+    void set(uint socketId, PowerCap cap);
+    void set(uint windowId, uint socketId, PowerCap cap);
+};
+
+/**
+ * A power sample acquired from a meter.
+ */
+struct MeterSample{
+    double timestamp; ///< Acquisition time (milliseconds, see utils::getMillisecondsTime()).
+    double watts; ///< The power (Watts).
+
+    MeterSample(double timestamp = 0, double watts = 0):
+        timestamp(timestamp), watts(watts){;}
+};
+
+/**
+ * An external meter which provides instantaneous power. New meters can be
+ * added by implementing this interface and registering them with
+ * Energy::registerPowerMeter().
+ */
+class PowerMeter{
+public:
+    virtual ~PowerMeter(){;}
+
+    /**
+     * Initializes the meter.
+     * @return True if the meter is present, false otherwise.
+     */
+    virtual bool init() = 0;
+
+    /**
+     * Reads the current power.
+     * @param watts The current power (Watts).
+     * @return True if the power has been read, false otherwise (e.g. the
+     *         device has been disconnected or did not send any sample).
+     */
+    virtual bool getWatts(double& watts) = 0;
+
+    /**
+     * Returns the interval between two samples.
+     * @return The interval between two samples (milliseconds). If 0, the
+     *         meter is paced by the device, i.e. getWatts() blocks until
+     *         a new sample is available. It must not block indefinitely,
+     *         otherwise the counter cannot be stopped.
+     */
+    virtual uint getSamplingInterval() = 0;
+};
+
+class CounterPlugMeter;
+
+/**
+ * The acquisition loop of CounterPlugMeter.
+ */
+class CounterPlugMeterSampler: public utils::Thread{
+private:
+    CounterPlugMeter* _counter;
+public:
+    explicit CounterPlugMeterSampler(CounterPlugMeter* counter);
+    void run();
+};
+
+/**
+ * A plug counter which acquires samples from a power meter in background,
+ * at the native rate of the meter. Samples are timestamped and kept in a
+ * ring, and the energy is computed with trapezoidal integration between
+ * consecutive samples. Accordingly, the energy does not depend on how
+ * often the counter is read, and it includes the power up to the last
+ * acquired sample. Failed reads are not recorded, and the meter is read
+ * increasingly less often until it provides samples again.
+ */
+class CounterPlugMeter: public CounterPlug, public utils::NonCopyable{
+    friend class mammut::energy::Energy;
+    friend class CounterPlugMeterSampler;
+private:
+    PowerMeter* _meter;
+    mutable std::mutex _mutex;
+    utils::Monitor _stop;
+    CounterPlugMeterSampler* _sampler;
+    std::vector<MeterSample> _samples;
+    // Joules consumed from the first sample to each sample.
+    std::vector<Joules> _cumulative;
+    size_t _next;
+    size_t _numSamples;
+    Joules _offset;
+
+    bool init();
+    bool sample();
+    const MeterSample& getSample(size_t i) const;
+    Joules getCumulative(size_t i) const;
+public:
+    /**
+     * Creates a plug counter on a meter.
+     * @param meter The meter. It is deleted with the counter.
+     * @param ringSize The maximum number of samples kept.
+     */
+    explicit CounterPlugMeter(PowerMeter* meter, size_t ringSize = 1024);
+    ~CounterPlugMeter();
+
+    Joules getJoules();
+    void reset();
+
+    /**
+     * Returns the Joules consumed up to a given instant. Power is linearly
+     * interpolated between the samples surrounding the instant. After the
+     * last sample (or before the first one), the power of the nearest
+     * sample is assumed.
+     * @param timestamp The instant (milliseconds, see utils::getMillisecondsTime()).
+     * @param skew The distance between the instant and the nearest sample
+     *        (milliseconds).
+     * @return The Joules consumed up to the instant.
+     */
+    Joules getJoules(double timestamp, double& skew) const;
+
+    /**
+     * Returns the samples in the ring, from the oldest to the newest.
+     * @return The samples in the ring, from the oldest to the newest.
+     */
+    std::vector<MeterSample> getSamples() const;
+};
+
+class EnergyAccounting;
+
+/**
+ * The sampling loop of EnergyAccounting.
+ */
+class EnergyAccountingThread: public utils::Thread{
+private:
+    EnergyAccounting* _accounting;
+public:
+    explicit EnergyAccountingThread(EnergyAccounting* accounting);
+    void run();
+};
+
+/**
+ * The CPU time spent by a thread on a virtual core in an interval.
+ */
+struct TaskUsage{
+    task::TaskId pid; ///< The identifier of the process the thread belongs to.
+    std::string cgroup; ///< The cgroup of the process.
+    topology::VirtualCoreId virtualCoreId; ///< The virtual core on which the thread ran.
+    double time; ///< The CPU time spent by the thread (seconds).
+
+    TaskUsage(task::TaskId pid = 0, const std::string& cgroup = "",
+              topology::VirtualCoreId virtualCoreId = 0, double time = 0):
+        pid(pid), cgroup(cgroup), virtualCoreId(virtualCoreId), time(time){;}
+};
+
+/**
+ * Attributes the energy consumed by the Cpus to processes and cgroups.
+ * Every sampling interval, the energy consumed by each Cpu is read from
+ * the counter and each thread which ran on that Cpu in the interval is
+ * charged with the fraction of the Cpu capacity (interval length times
+ * the number of online virtual cores) it used, according to its CPU time
+ * (read from /proc/[pid]/task/[tid]/schedstat). The energy corresponding
+ * to the unused capacity (idle time) is accounted as unattributed.
+ * The CPU of a thread is the last one it ran on, so threads migrating
+ * in the middle of an interval are approximated.
+ * ATTENTION: The counter must not be reset by other users while the
+ * accounting is running.
+ */
+class EnergyAccounting: public utils::NonCopyable{
+    friend class EnergyAccountingThread;
+private:
+    CounterCpus* _counter;
+    topology::Topology* _topology;
+    std::vector<topology::Cpu*> _cpus;
+    // Index in _cpus of each virtual core.
+    std::vector<size_t> _cpuIndexes;
+    // Number of online virtual cores of each Cpu.
+    std::vector<uint> _onlineVirtualCores;
+    double _lastSampleTime;
+    uint _samplingInterval;
+    double _hertz;
+    mutable std::mutex _mutex;
+    utils::Monitor _stop;
+    EnergyAccountingThread* _thread;
+
+    std::vector<Joules> _lastJoules;
+    // Last CPU time of each thread (seconds), with a flag used to find dead threads.
+    std::map<task::TaskId, std::pair<double, bool> > _lastTimes;
+    // Cgroup of each process, with the sample in which it was read.
+    std::map<task::TaskId, std::pair<std::string, uint> > _cgroups;
+    uint _numSamples;
+    std::map<task::TaskId, Joules> _processesJoules;
+    std::map<std::string, Joules> _cgroupsJoules;
+    Joules _unattributed;
+
+    std::string getCgroup(task::TaskId pid);
+    void sample();
+public:
+    /**
+     * Creates an energy accounting and starts sampling.
+     * ATTENTION: Each sample reads two files for each thread of the system
+     * (plus one for each process, periodically), so its cost grows with the
+     * number of threads (in the order of milliseconds of CPU time every
+     * thousand threads). Short sampling intervals should be used only on
+     * systems with few threads.
+     * @param counter The counter used to read the energy of the Cpus.
+     * @param samplingInterval The sampling interval (milliseconds).
+     */
+    explicit EnergyAccounting(CounterCpus* counter, uint samplingInterval = 1000);
+
+    ~EnergyAccounting();
+
+    /**
+     * Splits the energy consumed by the Cpus in an interval among the
+     * threads which ran on them. Called by the sampling loop, can be
+     * used to feed the accounting with externally collected usages.
+     * @param joules The Joules consumed by each Cpu in the interval (in the
+     *        same order of CounterCpus::getCpus()).
+     * @param usages The CPU time spent by each thread in the interval.
+     * @param interval The length of the interval (seconds).
+     */
+    void account(const std::vector<Joules>& joules, const std::vector<TaskUsage>& usages,
+                 double interval);
+
+    /**
+     * Returns the Joules attributed to a process since the accounting
+     * started. Processes are forgotten when they terminate, their energy
+     * remains accounted to their cgroup.
+     * @param pid The identifier of the process.
+     * @param joules The Joules attributed to the process.
+     * @return True if the process is known (i.e. it has been seen by
+     *         at least one sample), false otherwise.
+     */
+    bool getJoules(task::TaskId pid, Joules& joules) const;
+
+    /**
+     * Returns the Joules attributed to each cgroup since the accounting
+     * started. Cgroups are identified by their path in the cgroup v2
+     * hierarchy (or in the first v1 hierarchy if v2 is not mounted).
+     * The cgroup of a process is read again every few samples, so the
+     * energy of a process moved to another cgroup may be accounted to the
+     * old one for a short time.
+     * @return A map from cgroups to the Joules attributed to them.
+     */
+    std::map<std::string, Joules> getCgroupsJoules() const;
+
+    /**
+     * Returns the Joules consumed by Cpus on which no thread ran.
+     * @return The Joules consumed by Cpus on which no thread ran.
+     */
+    Joules getUnattributedJoules() const;
+};
+
 struct RollbackPoint{
   std::vector<std::pair<PowerCap, PowerCap>> powerCaps[COUNTER_NUM];
 };
@@ -337,6 +746,8 @@ struct RollbackPoint{
 class Energy: public Module{
     MAMMUT_MODULE_DECL(Energy)
 private:
+    static std::vector<std::pair<std::string, PowerMeter* (*)()> > _powerMeters;
+    CounterPlug* createCounterPlug(const std::string& name);
     CounterPlug* _counterPlug;
     CounterCpus* _counterCpus;
     CounterMemory* _counterMemory;
@@ -347,6 +758,19 @@ private:
     bool processMessage(const std::string& messageIdIn, const std::string& messageIn,
                         std::string& messageIdOut, std::string& messageOut);
 public:
+    /**
+     * Registers a power meter, which will be considered when looking for
+     * a plug counter. Must be called before getting the Energy module.
+     * The plug counters are looked for in the order specified by the
+     * MAMMUT_PLUG_COUNTERS environment variable (a comma separated list
+     * of names). If not set, the built-in counters are looked for in the
+     * order smartpower2, smartgauge, amester, file, ina, followed by
+     * the registered meters and, last, psys.
+     * @param name The name of the meter.
+     * @param create A function creating the meter.
+     */
+    static void registerPowerMeter(const std::string& name, PowerMeter* (*create)());
+
     /**
      * Returns the most precise energy counter available on this machine, or
      * NULL if no energy counters are available.
@@ -391,8 +815,174 @@ public:
      * @param rollbackPoint A rollback point.
      */
     void rollback(const RollbackPoint& rollbackPoint) const;
+
+    /**
+     * Reads all the available counters at (approximately) the same instant.
+     * The Cpus counter is read first and its reading time is used as the
+     * snapshot timestamp. Counters acquired at a lower rate (e.g. plug
+     * meters sampled at 1-10Hz) are interpolated on that timestamp.
+     * Counters values are the same returned by their getJoules() calls.
+     * @return A snapshot of the counters.
+     */
+    EnergySnapshot snapshot() const;
+};
+
+/**
+ * A configuration of a domain, for which power can be predicted.
+ */
+struct PowerConfiguration{
+    uint numVirtualCores; ///< The number of loaded virtual cores.
+    cpufreq::Frequency frequency; ///< The frequency of the domain.
+    uint workloadClass; ///< The class of the workload running on the loaded virtual cores.
+
+    PowerConfiguration(uint numVirtualCores = 0, cpufreq::Frequency frequency = 0, uint workloadClass = 0):
+        numVirtualCores(numVirtualCores), frequency(frequency), workloadClass(workloadClass){;}
 };
 
+/**
+ * A power measurement of a configuration.
+ */
+struct PowerSample{
+    PowerConfiguration configuration; ///< The measured configuration.
+    double power; ///< The measured power (Watts).
+
+    PowerSample(const PowerConfiguration& configuration = PowerConfiguration(), double power = 0):
+        configuration(configuration), power(power){;}
+};
+
+/**
+ * A power model of a domain. The power of a configuration with N loaded
+ * virtual cores at frequency F and workload class W is modeled as:
+ *   P = Ps + N * Cw * V(N, F)^2 * F
+ * where Ps is the static power, Cw the dynamic coefficient of class W
+ * and V(N, F) is taken from the voltage table of the domain.
+ * Coefficients are fitted from calibration samples (least squares) and
+ * can be refined online with recursive least squares.
+ */
+class PowerModel{
+private:
+    std::vector<cpufreq::Frequency> _frequencies;
+    uint _maxVirtualCores;
+    // V^2 * F (F in GHz), indexed by (numVirtualCores, frequency index).
+    std::vector<double> _v2f;
+    uint _numWorkloadClasses;
+    double _forgettingFactor;
+    // Static power followed by the dynamic coefficients.
+    std::vector<double> _coefficients;
+    // Covariance matrix of the coefficients (row-major).
+    std::vector<double> _covariance;
+
+    void init(const cpufreq::VoltageModel& voltageModel);
+    double getV2f(uint numVirtualCores, cpufreq::Frequency frequency) const;
+    std::vector<double> getFeatures(const PowerConfiguration& configuration) const;
+public:
+    /**
+     * Creates a power model.
+     * @param voltageModel The voltage model of the domain.
+     * @param numWorkloadClasses The number of workload classes.
+     * @param forgettingFactor The forgetting factor used by update(), in (0, 1].
+     *        Smaller values adapt faster to changes.
+     */
+    PowerModel(const cpufreq::VoltageModel& voltageModel, uint numWorkloadClasses = 1,
+               double forgettingFactor = 0.99);
+
+    /**
+     * Creates a power model.
+     * @param voltageTable The voltage table of the domain.
+     * @param numWorkloadClasses The number of workload classes.
+     * @param forgettingFactor The forgetting factor used by update(), in (0, 1].
+     *        Smaller values adapt faster to changes.
+     */
+    PowerModel(const cpufreq::VoltageTable& voltageTable, uint numWorkloadClasses = 1,
+               double forgettingFactor = 0.99);
+
+    /**
+     * Fits the model on a set of samples, replacing the current coefficients.
+     * Classes without samples have a dynamic coefficient of 0.
+     * @param samples The samples.
+     */
+    void fit(const std::vector<PowerSample>& samples);
+
+    /**
+     * Updates the model with a new sample (recursive least squares).
+     * @param sample The sample.
+     */
+    void update(const PowerSample& sample);
+
+    /**
+     * Predicts the power of a configuration. Voltages of frequencies not
+     * present in the voltage table are linearly interpolated.
+     * @param configuration The configuration.
+     * @return The predicted power (Watts).
+     */
+    double predict(const PowerConfiguration& configuration) const;
+
+    /**
+     * Predicts the power of a configuration, without bounds checking.
+     * @param numVirtualCores The number of loaded virtual cores.
+     * @param frequencyIndex The index of the frequency in getFrequencies().
+     * @param workloadClass The workload class.
+     * @return The predicted power (Watts).
+     */
+    inline double predict(uint numVirtualCores, size_t frequencyIndex, uint workloadClass) const{
+        return _coefficients[0] + numVirtualCores * _coefficients[1 + workloadClass] *
+               _v2f[numVirtualCores * _frequencies.size() + frequencyIndex];
+    }
+
+    /**
+     * Returns the frequencies of the model (increasing).
+     * @return The frequencies of the model.
+     */
+    const std::vector<cpufreq::Frequency>& getFrequencies() const;
+
+    /**
+     * Returns the static power (Watts).
+     * @return The static power (Watts).
+     */
+    double getStaticPower() const;
+
+    /**
+     * Returns the dynamic coefficient of a workload class.
+     * @param workloadClass The workload class.
+     * @return The dynamic coefficient of the workload class.
+     */
+    double getDynamicCoefficient(uint workloadClass) const;
+
+    /**
+     * Stores the coefficients of a workload class in a voltage model,
+     * as static power and dynamic power of one loaded virtual core
+     * for each frequency. Since the voltage model has a single dynamic
+     * term per frequency, only the voltages measured with one loaded
+     * virtual core are used: VoltageModel::getPower(n, f) will not
+     * account for the voltage changes due to the number of loaded cores,
+     * while predict() does.
+     * Throws a std::runtime_error if the frequencies differ or if the
+     * voltage with one loaded virtual core is missing for some frequency.
+     * @param voltageModel The voltage model. It must have the same frequencies of this model.
+     * @param workloadClass The workload class.
+     */
+    void storeCoefficients(cpufreq::VoltageModel& voltageModel, uint workloadClass = 0) const;
+
+    /**
+     * Runs a calibration sweep on a domain. For each number of loaded virtual
+     * cores (one per physical core) and for each available frequency, the
+     * cores are loaded with a LoadGenerator and the power is measured with
+     * a counter. The governor of the domain is restored at the end.
+     * The counter measures the whole machine, so the static power will
+     * include the power of the other domains.
+     * NOTE: This call may block the caller for some seconds/minutes.
+     * @param domain The domain.
+     * @param counter The counter used to measure the power.
+     * @param workloadClass The workload class of the samples.
+     * @param kernel The kernel executed on the loaded virtual cores.
+     * @param duration The duration of each measurement (milliseconds).
+     * @return The samples. Empty if the userspace governor is not available.
+     */
+    static std::vector<PowerSample> calibrate(const cpufreq::Domain* domain, Counter* counter,
+                                              uint workloadClass = 0,
+                                              topology::LoadKernel kernel = topology::LOAD_KERNEL_SCALAR,
+                                              uint duration = 1000);
+};
 
 /*!
  * \class JoulesCpu
@@ -523,6 +1113,41 @@ inline std::ostream& operator<<(std::ostream& os, const JoulesCpu& obj){
     return os;
 }
 
+/**
+ * The value of a counter in a snapshot.
+ */
+struct CounterSnapshot{
+    bool available; ///< True if the counter is present on this machine.
+    Joules joules; ///< The Joules consumed up to the snapshot timestamp.
+    /**
+     * Milliseconds between the snapshot timestamp and the instant the value
+     * refers to. For interpolated counters, this is the distance from the
+     * nearest actual sample.
+     */
+    double skew;
+    bool interpolated; ///< True if the value has been interpolated.
+
+    CounterSnapshot():available(false), joules(0), skew(0), interpolated(false){;}
+};
+
+/**
+ * The values of all the counters at a given instant.
+ */
+struct EnergySnapshot{
+    /**
+     * The instant the snapshot refers to (milliseconds, CLOCK_MONOTONIC_RAW).
+     */
+    double timestamp;
+    CounterSnapshot counters[COUNTER_NUM]; ///< The counters, indexed by CounterType.
+    /**
+     * The components of each Cpu (in the order returned by
+     * CounterCpus::getCpus()). Empty if the Cpus counter is not available.
+     */
+    std::vector<JoulesCpu> cpus;
+
+    EnergySnapshot():timestamp(0){;}
+};
+
 }
 }
 
@@ -35,6 +35,7 @@ public:
     bool move(const std::vector<topology::VirtualCore*>& virtualCores) const;
     bool move(const std::vector<const topology::VirtualCore*>& virtualCores) const;
     virtual bool move(const std::vector<topology::VirtualCoreId>& virtualCoresIds) const = 0;
+    bool move(const topology::NumaNode* numaNode, bool bindMemory = false) const;
     bool getVirtualCoreIds(std::vector<topology::VirtualCoreId>& virtualCoresIds) const;
     bool isActive() const;
 };
@@ -97,6 +98,7 @@ class ProcessHandlerLinux: public ProcessHandler, public ExecutionUnitLinux{
 private:
     TaskId _pid;
     ThrottlerThread& _throttlerThread;
+    const energy::EnergyAccounting* _accounting;
     std::string getSetPriorityIdentifiers() const;
 #ifdef WITH_PAPI
     bool _countersAvailable;
@@ -105,8 +107,8 @@ private:
     long long * _oldValues;
 #endif
 public:
-    explicit ProcessHandlerLinux(TaskId pid,
-                                 ThrottlerThread& throttlerThread);
+    ProcessHandlerLinux(TaskId pid, ThrottlerThread& throttlerThread,
+                        const energy::EnergyAccounting* accounting = NULL);
     ~ProcessHandlerLinux();
     std::vector<TaskId> getActiveThreadsIdentifiers() const;
     ThreadHandler* getThreadHandler(TaskId tid) const;
@@ -118,11 +120,13 @@ public:
     bool throttle(double percentage);
     bool removeThrottling();
     bool sendSignal(int signal) const;
+    bool getJoules(double& joules) const;
 };
 
 class ProcessesManagerLinux: public TasksManager{
 private:
     ThrottlerThread _throttler;
+    const energy::EnergyAccounting* _accounting;
 public:
     ProcessesManagerLinux();
     ~ProcessesManagerLinux();
@@ -130,6 +134,7 @@ public:
     ProcessHandler* getProcessHandler(TaskId pid);
     void releaseProcessHandler(ProcessHandler* process) const;
     void setThrottlingInterval(ulong throttlingInterval);
+    void setEnergyAccounting(const energy::EnergyAccounting* accounting);
     ThreadHandler* getThreadHandler(TaskId pid, TaskId tid) const;
     ThreadHandler* getThreadHandler() const;
     void releaseThreadHandler(ThreadHandler* thread) const;
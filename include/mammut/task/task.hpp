@@ -10,6 +10,7 @@
 #define MAMMUT_PROCESS_PRIORITY_MAX (uint) (PRIO_MAX - PRIO_MIN)
 
 namespace mammut{
+namespace energy{class EnergyAccounting;}
 namespace task{
 
 class Task{
@@ -141,6 +142,20 @@ public:
      */
     virtual bool move(const std::vector<topology::VirtualCoreId>& virtualCoresIds) const = 0;
 
+    /**
+     * Move this execution unit on the virtual cores of a NUMA node.
+     * NOTE: If executed on a process, all its threads will be moved too.
+     * @param numaNode The NUMA node on which this execution unit must be moved.
+     * @param bindMemory If true, the pages of the process to which this
+     *        execution unit belongs are migrated to the memory of the node.
+     *        If this execution unit is the calling thread, its future
+     *        allocations are bound to the node too.
+     * @return If false is returned, this execution unit is no more active or
+     *         its pages could not be migrated (insufficient privileges), and
+     *         the call failed. Otherwise, true is returned.
+     */
+    virtual bool move(const topology::NumaNode* numaNode, bool bindMemory = false) const = 0;
+
     /**
      * Returns true if this execution unit is still active, false otherwise.
      * @return True if this execution unit is still active, false otherwise.
@@ -244,6 +259,17 @@ public:
      *         and the call failed. Otherwise, true is returned.
      */
     virtual bool sendSignal(int signal) const = 0;
+
+    /**
+     * Returns the Joules consumed by this process since the energy
+     * accounting set on the tasks manager started.
+     * @param joules The Joules consumed by this process.
+     * @return If false is returned, this process is no more active
+     *         and the call failed. Otherwise, true is returned.
+     * @throw std::runtime_error If no energy accounting was set
+     *        on the tasks manager.
+     */
+    virtual bool getJoules(double& joules) const = 0;
 };
 
 class TasksManager: public Module{
@@ -276,6 +302,15 @@ public:
      **/
     virtual void setThrottlingInterval(ulong throttlingInterval) = 0;
 
+    /**
+     * Sets the energy accounting used by the process handlers to
+     * get the energy of the processes. It only affects the handlers
+     * created after this call.
+     * @param accounting The energy accounting. It must be valid
+     *        as long as the process handlers are used.
+     */
+    virtual void setEnergyAccounting(const energy::EnergyAccounting* accounting) = 0;
+
     /**
      * Returns the handler associated to a specific thread.
      * @param pid The process identifier.
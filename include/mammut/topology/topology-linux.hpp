@@ -3,16 +3,25 @@
 
 #include "topology.hpp"
 
+#include <atomic>
+#include <mutex>
+
 namespace mammut{
 namespace topology{
 
 std::string getTopologyPathFromVirtualCoreId(VirtualCoreId id);
 
 class TopologyLinux: public Topology{
+private:
+    void buildNumaNodes();
+    void buildCaches() const;
 public:
     TopologyLinux();
     void maximizeUtilization() const;
     void resetUtilization() const;
+    bool getEffectiveFrequencies(uint window,
+                                 std::vector<EffectiveFrequency>& effectiveFrequencies) const;
+    UtilizationSnapshot getUtilizationSnapshot() const;
 };
 
 class CpuLinux: public Cpu{
@@ -25,6 +34,7 @@ public:
     std::string getModel() const;
     void maximizeUtilization() const;
     void resetUtilization() const;
+    bool getCStateResidencies(uint window, CStateResidencies& residencies) const;
 };
 
 class PhysicalCoreLinux: public PhysicalCore{
@@ -34,6 +44,17 @@ public:
     void resetUtilization() const;
 };
 
+class NumaNodeLinux: public NumaNode{
+private:
+    std::string _memInfoPath;
+    uint64_t getMemInfoField(const std::string& fieldName) const;
+public:
+    NumaNodeLinux(NumaNodeId numaNodeId, std::vector<VirtualCore*> virtualCores,
+                  std::map<NumaNodeId, uint> distances);
+    uint64_t getMemoryTotal() const;
+    uint64_t getMemoryFree() const;
+};
+
 class VirtualCoreLinux;
 
 class VirtualCoreIdleLevelLinux: public VirtualCoreIdleLevel{
@@ -61,24 +82,46 @@ public:
 };
 
 /**
- * Rise the utilization to 100%.
+ * Generates load on a virtual core (see LoadGenerator).
  * To start:
- *       setStop(false);
  *       start();
+ *       if(!waitPinned()){...}
  * To stop:
  *       setStop(true);
  *       join();
  */
-class SpinnerThread: public utils::Thread{
+class LoadThread: public utils::Thread{
 private:
-    utils::LockPthreadMutex _lock;
-    bool _stop;
-
-    bool isStopped();
+    const VirtualCoreId _virtualCoreId;
+    std::atomic<bool> _stop;
+    std::atomic<int> _kernel;
+    std::atomic<double> _utilization;
+    std::atomic<uint> _period;
+    // Buffers of the memory kernels, allocated (by this thread) on first use.
+    std::vector<double> _streamBuffer;
+    size_t _streamOffset;
+    std::vector<size_t> _chaseBuffer;
+    size_t _chaseIndex;
+    double _sink;
+    utils::Monitor _started;
+    bool _pinned;
+
+    void runKernel(LoadKernel kernel);
 public:
-    SpinnerThread();
+    LoadThread(VirtualCoreId virtualCoreId, LoadKernel kernel,
+               double utilization, uint period);
+
+    /**
+     * Waits until the thread is started. Must be called once after start().
+     * @return True if the thread has been pinned on the virtual core, false
+     *         otherwise (in this case the thread terminates without
+     *         generating any load).
+     */
+    bool waitPinned();
 
     void setStop(bool s);
+    void setKernel(LoadKernel kernel);
+    void setUtilization(double utilization);
     void run();
 };
 
@@ -98,14 +141,33 @@ typedef enum{
 
 class VirtualCoreLinux: public VirtualCore{
 private:
+    /**
+     * Per-core resources (threads, file descriptors, sysfs handlers)
+     * are created on first use, so that building the topology is cheap.
+     */
     std::string _hotplugFile;
-    std::vector<VirtualCoreIdleLevel*> _idleLevels;
-    double _lastProcIdleTime;
-    SpinnerThread* _utilizationThread;
-    utils::Msr _clkModMsr;
-    uint _clkModLowBit;
-    double _clkModStep;
-    std::vector<double> _clkModValues;
+    mutable std::once_flag _idleLevelsOnce;
+    mutable std::vector<VirtualCoreIdleLevel*> _idleLevels;
+    mutable std::once_flag _idleTimeOnce;
+    mutable double _lastProcIdleTime;
+    mutable std::once_flag _loadGeneratorOnce;
+    mutable LoadGenerator* _loadGenerator;
+    mutable std::once_flag _clkModOnce;
+    mutable utils::Msr* _clkModMsr;
+    mutable uint _clkModLowBit;
+    mutable double _clkModStep;
+    mutable std::vector<double> _clkModValues;
+    mutable std::once_flag _coreTypeOnce;
+    mutable CoreType _coreType;
+    mutable std::once_flag _estimatedCapacityOnce;
+    mutable uint _estimatedCapacity;
+
+    void initIdleLevels() const;
+    void initIdleTime() const;
+    void initLoadGenerator() const;
+    void initClockModulation() const;
+    void initCoreType() const;
+    void initEstimatedCapacity() const;
 
     /**
      * Returns a specified time field of the line of this virtual core in /proc/stat file (in microseconds).
@@ -125,6 +187,10 @@ public:
 
     bool hasFlag(const std::string& flagName) const;
     uint64_t getAbsoluteTicks() const;
+    bool getEffectiveFrequency(uint window, EffectiveFrequency& effectiveFrequency) const;
+    bool getCStateResidencies(uint window, CStateResidencies& residencies) const;
+    CoreType getCoreType() const;
+    uint getCapacity() const;
     void maximizeUtilization() const;
     void resetUtilization() const;
     double getIdleTime() const;
@@ -11,6 +11,9 @@ public:
     explicit TopologyRemote(Communicator* const communicator);
     void maximizeUtilization() const;
     void resetUtilization() const;
+    bool getEffectiveFrequencies(uint window,
+                                 std::vector<EffectiveFrequency>& effectiveFrequencies) const;
+    UtilizationSnapshot getUtilizationSnapshot() const;
 };
 
 class CpuRemote: public Cpu{
@@ -24,6 +27,7 @@ public:
     std::string getModel() const;
     void maximizeUtilization() const;
     void resetUtilization() const;
+    bool getCStateResidencies(uint window, CStateResidencies& residencies) const;
 };
 
 class PhysicalCoreRemote: public PhysicalCore{
@@ -71,6 +75,10 @@ public:
 
     bool hasFlag(const std::string& flagName) const;
     uint64_t getAbsoluteTicks() const;
+    bool getEffectiveFrequency(uint window, EffectiveFrequency& effectiveFrequency) const;
+    bool getCStateResidencies(uint window, CStateResidencies& residencies) const;
+    CoreType getCoreType() const;
+    uint getCapacity() const;
     void maximizeUtilization() const;
     void resetUtilization() const;
     double getIdleTime() const;
@@ -12,6 +12,8 @@
 #include "../communicator.hpp"
 #include "../module.hpp"
 
+#include "map"
+#include "mutex"
 #include "stdint.h"
 #include "vector"
 
@@ -21,10 +23,14 @@ namespace topology{
 class VirtualCore;
 class PhysicalCore;
 class Cpu;
+class NumaNode;
+class Cache;
+class LoadThread;
 
 using CpuId = uint32_t;
 using PhysicalCoreId = uint32_t;
 using VirtualCoreId = uint32_t;
+using NumaNodeId = uint32_t;
 
 // @cond HIDDEN_SYMBOLS
 typedef struct{
@@ -53,6 +59,181 @@ public:
     virtual void resetUtilization() const = 0;
 };
 
+/**
+ * Activity of a virtual core over a time window, computed
+ * from the APERF, MPERF and TSC registers.
+ */
+typedef struct{
+    // Percentage of the window spent in C0 [0, 100].
+    double busy;
+    // Average frequency (KHz) while in C0 (i.e. the delivered frequency).
+    double busyFrequency;
+    // Average frequency (KHz) over the whole window (idle time included).
+    double averageFrequency;
+    // False if the registers of the virtual core could not be read
+    // (in that case, all the other fields are 0).
+    bool valid;
+}EffectiveFrequency;
+
+/**
+ * Hardware idle states (C-States) whose residency can be measured.
+ */
+typedef enum{
+    CSTATE_C0 = 0,
+    CSTATE_C1,
+    CSTATE_C2,
+    CSTATE_C3,
+    CSTATE_C6,
+    CSTATE_C7,
+    CSTATE_C8,
+    CSTATE_C9,
+    CSTATE_C10,
+    CSTATE_NUM
+}CState;
+
+/**
+ * For each C-State, the percentage of a time window [0, 100]
+ * spent in that state. Only the states supported by
+ * the hardware are present.
+ */
+using CStateResidencies = std::map<CState, double>;
+
+/**
+ * States in which a virtual core spends its time (as reported by /proc/stat).
+ */
+typedef enum{
+    UTILIZATION_USER = 0,
+    UTILIZATION_NICE,
+    UTILIZATION_SYSTEM,
+    UTILIZATION_IDLE,
+    UTILIZATION_IOWAIT,
+    UTILIZATION_IRQ,
+    UTILIZATION_SOFTIRQ,
+    UTILIZATION_STEAL,
+    UTILIZATION_FIELDS_NUM
+}UtilizationField;
+
+/**
+ * The time spent by all the virtual cores in each state, taken at the
+ * same instant. Times are stored in a packed array (one row of
+ * UTILIZATION_FIELDS_NUM elements for each virtual core), so that
+ * snapshots can be taken and compared at high rate on many cores.
+ */
+class UtilizationSnapshot{
+private:
+    std::vector<VirtualCoreId> _virtualCoresIds;
+    // Position in _virtualCoresIds of each virtual core identifier (-1 if not present).
+    std::vector<int> _positions;
+    // Clock ticks.
+    std::vector<uint64_t> _ticks;
+    double _ticksPerSecond;
+
+    const uint64_t* getRow(VirtualCoreId virtualCoreId) const;
+public:
+    UtilizationSnapshot();
+
+    /**
+     * Creates a snapshot.
+     * @param virtualCoresIds The identifiers of the virtual cores.
+     * @param ticks The clock ticks spent by each virtual core in each state.
+     *        The element [i*UTILIZATION_FIELDS_NUM + f] is the time spent in
+     *        state f by the i-th virtual core of virtualCoresIds.
+     * @param ticksPerSecond The number of clock ticks per second.
+     */
+    UtilizationSnapshot(const std::vector<VirtualCoreId>& virtualCoresIds,
+                        const std::vector<uint64_t>& ticks, double ticksPerSecond);
+
+    /**
+     * Returns the identifiers of the virtual cores in this snapshot.
+     * @return The identifiers of the virtual cores in this snapshot.
+     */
+    std::vector<VirtualCoreId> getVirtualCoresIds() const;
+
+    /**
+     * Checks if a virtual core is present in this snapshot.
+     * @param virtualCoreId The identifier of the virtual core.
+     * @return True if the virtual core is present, false otherwise.
+     */
+    bool hasVirtualCore(VirtualCoreId virtualCoreId) const;
+
+    /**
+     * Returns the time spent by a virtual core in a state
+     * (since boot or, for snapshots obtained with getDelta(),
+     * between the two snapshots).
+     * @param virtualCoreId The identifier of the virtual core.
+     * @param field The state.
+     * @return The time spent by the virtual core in the state
+     *         (microseconds). 0 if the virtual core is not present.
+     */
+    double getTime(VirtualCoreId virtualCoreId, UtilizationField field) const;
+
+    /**
+     * Returns the difference between this snapshot and a previous one.
+     * Only the virtual cores present in both the snapshots are considered.
+     * @param previous The previous snapshot.
+     * @return The difference between this snapshot and previous.
+     */
+    UtilizationSnapshot getDelta(const UtilizationSnapshot& previous) const;
+
+    /**
+     * Returns the utilization of a virtual core between a previous
+     * snapshot and this one, i.e. the percentage of time spent
+     * neither in idle nor in iowait.
+     * @param previous The previous snapshot.
+     * @param virtualCoreId The identifier of the virtual core.
+     * @return The utilization of the virtual core [0, 100]. If the virtual
+     *         core is not present in both the snapshots, or no time elapsed,
+     *         0 is returned.
+     */
+    double getUtilization(const UtilizationSnapshot& previous,
+                          VirtualCoreId virtualCoreId) const;
+
+    /**
+     * Returns the utilization of all the virtual cores of this snapshot
+     * between a previous snapshot and this one.
+     * @param previous The previous snapshot.
+     * @return The utilizations [0, 100]. The i-th element refers to
+     *         the i-th element of getVirtualCoresIds().
+     */
+    std::vector<double> getUtilizations(const UtilizationSnapshot& previous) const;
+};
+
+/**
+ * Types of core on hybrid systems (e.g. Intel P-cores/E-cores
+ * or ARM big.LITTLE).
+ */
+typedef enum{
+    // Big cores (P-cores). On non-hybrid systems all the cores are of this type.
+    CORE_TYPE_PERFORMANCE = 0,
+    // Little cores (E-cores).
+    CORE_TYPE_EFFICIENCY
+}CoreType;
+
+/**
+ * Kernels which can be used to generate load on the virtual cores.
+ */
+typedef enum{
+    // Scalar floating point operations.
+    LOAD_KERNEL_SCALAR = 0,
+    // AVX2 fused multiply-add on 256 bits vectors.
+    LOAD_KERNEL_FMA_AVX2,
+    // AVX-512 fused multiply-add on 512 bits vectors.
+    LOAD_KERNEL_FMA_AVX512,
+    // Sequential reads and writes on a buffer larger than the caches.
+    LOAD_KERNEL_MEMORY_STREAM,
+    // Dependent loads at random positions of a buffer larger than the caches.
+    LOAD_KERNEL_POINTER_CHASE
+}LoadKernel;
+
+/**
+ * Types of cache.
+ */
+typedef enum{
+    CACHE_TYPE_DATA = 0,
+    CACHE_TYPE_INSTRUCTION,
+    CACHE_TYPE_UNIFIED
+}CacheType;
+
 struct RollbackPoint{
     std::vector<bool> plugged;  
     std::vector<double> clockModulation;
@@ -64,12 +245,24 @@ protected:
     std::vector<Cpu*> _cpus;
     std::vector<PhysicalCore*> _physicalCores;
     std::vector<VirtualCore*> _virtualCores;
+    std::vector<NumaNode*> _numaNodes;
+    /**
+     * Caches are built on first access (see buildCaches()).
+     */
+    mutable std::once_flag _cachesOnce;
+    mutable std::vector<Cache*> _caches;
     Communicator* const _communicator;
 
     Topology();
     explicit Topology(Communicator* const communicator);
     virtual ~Topology();
+
+    /**
+     * Fills _caches. Called once, the first time the caches are accessed.
+     */
+    virtual void buildCaches() const{;}
 private:
+    const std::vector<Cache*>& caches() const;
     void buildCpuVector(std::vector<VirtualCoreCoordinates> coord);
     std::vector<PhysicalCore*> buildPhysicalCoresVector(std::vector<VirtualCoreCoordinates> coord, CpuId cpuId);
     std::vector<VirtualCore*> buildVirtualCoresVector(std::vector<VirtualCoreCoordinates> coord, CpuId cpuId, PhysicalCoreId physicalCoreId);
@@ -128,6 +321,64 @@ public:
      */
     VirtualCore* getVirtualCore() const;
 
+    /**
+     * Returns the NUMA nodes of the system. If the system is not
+     * NUMA (or NUMA information is not available), a single node
+     * containing all the virtual cores is returned.
+     * NOTE: NUMA nodes are not available on remote topologies.
+     * @return A vector of NUMA nodes.
+     */
+    std::vector<NumaNode*> getNumaNodes() const;
+
+    /**
+     * Returns the NUMA node with the given identifier, or NULL if it is not present.
+     * @param numaNodeId The identifier of the NUMA node.
+     * @return The NUMA node with the given identifier, or NULL if it is not present.
+     */
+    NumaNode* getNumaNode(NumaNodeId numaNodeId) const;
+
+    /**
+     * Returns the NUMA node to which a virtual core belongs, or NULL
+     * if it is not present.
+     * @param virtualCore The virtual core.
+     * @return The NUMA node to which the virtual core belongs, or NULL
+     *         if it is not present.
+     */
+    NumaNode* getNumaNode(const VirtualCore* virtualCore) const;
+
+    /**
+     * Returns the distance matrix between the NUMA nodes.
+     * @return The distance matrix. Element [i][j] is the distance
+     *         between the i-th and the j-th element of getNumaNodes().
+     *         The distance of a node from itself is normalized to 10.
+     */
+    std::vector<std::vector<uint> > getNumaDistances() const;
+
+    /**
+     * Returns the caches of the system. Each cache shared by
+     * multiple virtual cores is present only once.
+     * NOTE: Caches are not available on remote topologies.
+     * @return A vector of caches.
+     */
+    std::vector<Cache*> getCaches() const;
+
+    /**
+     * Returns the caches used by a virtual core, sorted by level.
+     * @param virtualCore The virtual core.
+     * @return The caches used by the virtual core, sorted by level.
+     */
+    std::vector<Cache*> getCaches(const VirtualCore* virtualCore) const;
+
+    /**
+     * Returns the groups of virtual cores sharing the same last level
+     * cache (e.g. the CCXs of AMD EPYC processors). Threads which
+     * communicate often should be placed on the same group.
+     * If the caches are not known, one group per CPU is returned.
+     * @return The groups of virtual cores sharing the same last
+     *         level cache.
+     */
+    std::vector<std::vector<VirtualCore*> > getLlcGroups() const;
+
     /**
      * Returns a rollback point. It can be used to bring the topology
      * back to the point when this function is called.
@@ -140,6 +391,32 @@ public:
      * @param rollbackPoint A rollback point.
      */
     void rollback(const RollbackPoint& rollbackPoint) const;
+
+    /**
+     * Measures the effective frequency of all the virtual cores
+     * of the system. All the virtual cores are sampled over the same
+     * window (i.e. the call lasts for 'window' milliseconds, regardless
+     * of the number of virtual cores).
+     * NOTE: This call blocks the caller for 'window' milliseconds.
+     * @param window The length of the sampling window (milliseconds).
+     * @param effectiveFrequencies The effective frequencies. The i-th
+     *        element refers to the i-th element of getVirtualCores().
+     *        Virtual cores whose registers could not be read are
+     *        marked as not valid.
+     * @return true if the operation succeeded for at least one virtual
+     *         core, false otherwise (e.g. the registers are not accessible).
+     */
+    virtual bool getEffectiveFrequencies(uint window,
+                                         std::vector<EffectiveFrequency>& effectiveFrequencies) const = 0;
+
+    /**
+     * Returns the time spent by all the virtual cores in each state,
+     * read at once. To get the utilization over a period, take two
+     * snapshots and compare them (e.g. with getUtilizations()).
+     * @return A snapshot of the time spent by all the virtual cores in
+     *         each state.
+     */
+    virtual UtilizationSnapshot getUtilizationSnapshot() const = 0;
 };
 
 class Cpu: public Unit{
@@ -218,6 +495,18 @@ public:
      */
     virtual void resetUtilization() const = 0;
 
+    /**
+     * Measures the residency of this CPU in the package C-States
+     * (not exposed by cpuidle). All the registers are read together.
+     * NOTE: This call blocks the caller for 'window' milliseconds.
+     * @param window The length of the sampling window (milliseconds).
+     * @param residencies The residencies in the package C-States
+     *        (CSTATE_C2 to CSTATE_C10).
+     * @return true if the operation succeeded, false otherwise
+     *         (e.g. the registers are not accessible).
+     */
+    virtual bool getCStateResidencies(uint window, CStateResidencies& residencies) const = 0;
+
     /*****************************************************/
     /*                   HotPlug Support                 */
     /*****************************************************/
@@ -578,6 +867,46 @@ public:
      */
     virtual bool areTicksConstant() const;
 
+    /**
+     * Measures the effective (i.e. delivered) frequency of this virtual core.
+     * Differently from the frequency requested through the cpufreq module,
+     * it accounts for turbo, hardware managed P-states and thermal throttling.
+     * NOTE: This call blocks the caller for 'window' milliseconds.
+     * @param window The length of the sampling window (milliseconds).
+     * @param effectiveFrequency The effective frequency.
+     * @return true if the operation succeeded, false otherwise
+     *         (e.g. the registers are not accessible).
+     */
+    virtual bool getEffectiveFrequency(uint window, EffectiveFrequency& effectiveFrequency) const = 0;
+
+    /**
+     * Measures the residency of this virtual core in the C-States.
+     * Apart from CSTATE_C0, the residencies refer to the physical core
+     * to which this virtual core belongs. All the registers are read together.
+     * NOTE: This call blocks the caller for 'window' milliseconds.
+     * @param window The length of the sampling window (milliseconds).
+     * @param residencies The residencies in the core C-States
+     *        (CSTATE_C0, CSTATE_C1, CSTATE_C3, CSTATE_C6, CSTATE_C7).
+     * @return true if the operation succeeded, false otherwise
+     *         (e.g. the registers are not accessible).
+     */
+    virtual bool getCStateResidencies(uint window, CStateResidencies& residencies) const = 0;
+
+    /**
+     * Returns the type of this virtual core.
+     * @return The type of this virtual core. On non-hybrid systems,
+     *         CORE_TYPE_PERFORMANCE is returned.
+     */
+    virtual CoreType getCoreType() const = 0;
+
+    /**
+     * Returns the capacity of this virtual core, i.e. its maximum
+     * performance normalized to the fastest virtual core of the
+     * system, which has capacity 1024 (as in the Linux scheduler).
+     * @return The capacity of this virtual core [0, 1024].
+     */
+    virtual uint getCapacity() const = 0;
+
     /**
      * Bring the utilization of this virtual core to 100%
      * until resetUtilization() is called.
@@ -592,7 +921,7 @@ public:
     /**
      * Returns the number of microseconds that this virtual core have been
      * idle since the last call of resetIdleTime() (or since the
-     * creation of this virtual core handler).
+     * first call of getIdleTime()).
      * @return The number of microseconds that this virtual core have been
      *         idle.
      */
@@ -679,6 +1008,282 @@ public:
     virtual inline ~VirtualCore(){;}
 };
 
+/**
+ * A NUMA node, i.e. a set of virtual cores and the memory
+ * directly attached to them.
+ */
+class NumaNode{
+protected:
+    const NumaNodeId _numaNodeId;
+    const std::vector<VirtualCore*> _virtualCores;
+    const std::map<NumaNodeId, uint> _distances;
+
+    NumaNode(NumaNodeId numaNodeId, std::vector<VirtualCore*> virtualCores,
+             std::map<NumaNodeId, uint> distances);
+public:
+    virtual inline ~NumaNode(){;}
+
+    /**
+     * Returns the identifier of this NUMA node.
+     * @return The identifier of this NUMA node.
+     */
+    NumaNodeId getNumaNodeId() const;
+
+    /**
+     * Returns the virtual cores of this NUMA node.
+     * @return The virtual cores of this NUMA node. It may be
+     *         empty for memory-only nodes.
+     */
+    std::vector<VirtualCore*> getVirtualCores() const;
+
+    /**
+     * Checks if a virtual core belongs to this NUMA node.
+     * @param virtualCore The virtual core.
+     * @return True if the virtual core belongs to this NUMA node,
+     *         false otherwise.
+     */
+    bool hasVirtualCore(const VirtualCore* virtualCore) const;
+
+    /**
+     * Returns the distance between this NUMA node and another one,
+     * as reported by the firmware (ACPI SLIT). The distance of a node
+     * from itself is 10.
+     * @param numaNodeId The identifier of the other NUMA node.
+     * @return The distance between the two NUMA nodes.
+     *         If the distance is not known, 0 is returned.
+     */
+    uint getDistance(NumaNodeId numaNodeId) const;
+
+    /**
+     * Returns the total memory of this NUMA node.
+     * @return The total memory of this NUMA node (KB).
+     *         If not available, 0 is returned.
+     */
+    virtual uint64_t getMemoryTotal() const = 0;
+
+    /**
+     * Returns the free memory of this NUMA node.
+     * @return The free memory of this NUMA node (KB).
+     *         If not available, 0 is returned.
+     */
+    virtual uint64_t getMemoryFree() const = 0;
+};
+
+/**
+ * A cache, shared by one or more virtual cores.
+ */
+class Cache{
+private:
+    const uint _level;
+    const CacheType _type;
+    const uint _size;
+    const uint _lineSize;
+    const uint _associativity;
+    const std::vector<VirtualCore*> _virtualCores;
+public:
+    Cache(uint level, CacheType type, uint size, uint lineSize,
+          uint associativity, std::vector<VirtualCore*> virtualCores);
+
+    /**
+     * Returns the level of this cache (1 for L1, 2 for L2, ...).
+     * @return The level of this cache.
+     */
+    uint getLevel() const;
+
+    /**
+     * Returns the type of this cache.
+     * @return The type of this cache.
+     */
+    CacheType getType() const;
+
+    /**
+     * Returns the size of this cache.
+     * @return The size of this cache (bytes).
+     */
+    uint getSize() const;
+
+    /**
+     * Returns the size of a line of this cache.
+     * @return The size of a line of this cache (bytes).
+     */
+    uint getLineSize() const;
+
+    /**
+     * Returns the associativity (number of ways) of this cache.
+     * @return The associativity of this cache. 0 is returned if
+     *         it is not known.
+     */
+    uint getAssociativity() const;
+
+    /**
+     * Returns the virtual cores sharing this cache.
+     * @return The virtual cores sharing this cache.
+     */
+    std::vector<VirtualCore*> getVirtualCores() const;
+
+    /**
+     * Checks if a virtual core uses this cache.
+     * @param virtualCore The virtual core.
+     * @return True if the virtual core uses this cache,
+     *         false otherwise.
+     */
+    bool hasVirtualCore(const VirtualCore* virtualCore) const;
+};
+
+/**
+ * A Power Management Quality of Service request on the wakeup latency.
+ * While the request is alive, the idle levels (C-States) with an exit
+ * latency greater than the requested bound are not used, either on
+ * the whole system or on a specific set of virtual cores.
+ * The request is removed when the object is destroyed.
+ */
+class LatencyQoS: public utils::NonCopyable{
+private:
+    uint _latency;
+    int _fd;
+    std::vector<VirtualCore*> _virtualCores;
+    std::vector<std::string> _oldLatencies;
+
+    void writeLatency() const;
+public:
+    /**
+     * Creates a request for the whole system (/dev/cpu_dma_latency).
+     * @param latency The maximum wakeup latency (microseconds).
+     */
+    explicit LatencyQoS(uint latency);
+
+    /**
+     * Creates a request for a set of virtual cores (per-core
+     * resume latency constraint).
+     * @param latency The maximum wakeup latency (microseconds).
+     * @param virtualCores The virtual cores to which the request applies.
+     */
+    LatencyQoS(uint latency, const std::vector<VirtualCore*>& virtualCores);
+
+    ~LatencyQoS();
+
+    /**
+     * Returns the maximum wakeup latency (microseconds).
+     * @return The maximum wakeup latency (microseconds).
+     */
+    uint getLatency() const;
+
+    /**
+     * Changes the maximum wakeup latency.
+     * @param latency The maximum wakeup latency (microseconds).
+     */
+    void setLatency(uint latency);
+
+    /**
+     * Returns the virtual cores to which the request applies.
+     * @return The virtual cores to which the request applies. If
+     *         empty, the request applies to the whole system.
+     */
+    std::vector<VirtualCore*> getVirtualCores() const;
+
+    /**
+     * Checks if an idle level can be used under this request.
+     * @param level The idle level.
+     * @return True if the idle level can be used, false otherwise.
+     */
+    bool isAllowed(const VirtualCoreIdleLevel* level) const;
+
+    /**
+     * Returns the idle levels of a virtual core that can be used
+     * under this request.
+     * @param virtualCore The virtual core.
+     * @return The idle levels of the virtual core that can be used
+     *         under this request.
+     */
+    std::vector<VirtualCoreIdleLevel*> getAllowedIdleLevels(const VirtualCore* virtualCore) const;
+};
+
+/**
+ * A synthetic load on a set of virtual cores. A thread is pinned on each
+ * virtual core and, in each period, runs the selected kernel for a fraction
+ * of the period equal to the target utilization and then sleeps for the
+ * rest of the period (duty cycling).
+ * Utilization and kernel can be changed while the load is running.
+ * The load is removed when the object is destroyed.
+ */
+class LoadGenerator: public utils::NonCopyable{
+private:
+    std::vector<VirtualCore*> _virtualCores;
+    std::vector<LoadThread*> _threads;
+    LoadKernel _kernel;
+    double _utilization;
+    uint _period;
+public:
+    /**
+     * Creates a load generator. The load is not started.
+     * @param virtualCores The virtual cores on which the load must be generated.
+     * @param kernel The kernel to run.
+     * @param utilization The target utilization of each virtual core [0, 100].
+     * @param period The length of the duty cycle (milliseconds).
+     */
+    LoadGenerator(const std::vector<VirtualCore*>& virtualCores,
+                  LoadKernel kernel = LOAD_KERNEL_SCALAR,
+                  double utilization = 100, uint period = 100);
+
+    ~LoadGenerator();
+
+    /**
+     * Starts the load. If the load is already running, nothing is done.
+     * If the threads cannot be pinned on the virtual cores, the load is
+     * stopped and an exception is thrown.
+     */
+    void start();
+
+    /**
+     * Stops the load. If the load is not running, nothing is done.
+     */
+    void stop();
+
+    /**
+     * Checks if the load is running.
+     * @return True if the load is running, false otherwise.
+     */
+    bool isRunning() const;
+
+    /**
+     * Returns the virtual cores on which the load is generated.
+     * @return The virtual cores on which the load is generated.
+     */
+    std::vector<VirtualCore*> getVirtualCores() const;
+
+    /**
+     * Returns the target utilization.
+     * @return The target utilization [0, 100].
+     */
+    double getUtilization() const;
+
+    /**
+     * Changes the target utilization.
+     * @param utilization The target utilization [0, 100].
+     */
+    void setUtilization(double utilization);
+
+    /**
+     * Returns the kernel.
+     * @return The kernel.
+     */
+    LoadKernel getKernel() const;
+
+    /**
+     * Changes the kernel. If the kernel is not supported,
+     * an exception is thrown.
+     * @param kernel The kernel.
+     */
+    void setKernel(LoadKernel kernel);
+
+    /**
+     * Checks if a kernel can be run on this machine.
+     * @param kernel The kernel.
+     * @return True if the kernel can be run, false otherwise.
+     */
+    static bool isKernelSupported(LoadKernel kernel);
+};
+
 /**
  * Given a set of virtual cores, returns the number of different physical cores
  * to which these virtual cores belong to.
@@ -695,6 +1300,15 @@ size_t getNumPhysicalCores(const std::vector<VirtualCore*>& virtualCores);
  */
 std::vector<VirtualCore*> getOneVirtualPerPhysical(const std::vector<VirtualCore*>& virtualCores);
 
+/**
+ * Given a set of virtual cores, returns the ones of a specific type.
+ * @param virtualCores A set of virtual cores.
+ * @param coreType The type of core.
+ * @return The virtual cores of type coreType.
+ */
+std::vector<VirtualCore*> getVirtualCoresOfType(const std::vector<VirtualCore*>& virtualCores,
+                                                CoreType coreType);
+
 /**
  * Checks if two CPUs are equal.
  * ATTENTION: It is meaningful only on virtual cores belonging to the same topology
@@ -57,6 +57,9 @@
 #define MSR_DRAM_PERF_STATUS_INTEL 0x61B
 #define MSR_DRAM_POWER_INFO_INTEL 0x61C
 
+/* Platform (PSys) RAPL Domain */
+#define MSR_PLATFORM_ENERGY_STATUS_INTEL 0x64D
+
 /* AMD RAPL */
 // See https://lkml.org/lkml/2018/7/17/1275
 // See https://www.amd.com/system/files/TechDocs/56255_OSRR.pdf
@@ -67,6 +70,10 @@
 /* Voltage */
 #define MSR_PERF_STATUS 0x198
 
+/* Actual and maximum performance frequency clock counters */
+#define MSR_MPERF 0xE7
+#define MSR_APERF 0xE8
+
 /* C states */
 #define MSR_PKG_C2_RESIDENCY 0x60D
 #define MSR_PKG_C3_RESIDENCY 0x3F8
@@ -83,6 +90,20 @@
 /* Clock modulation */
 #define MSR_CLOCK_MODULATION 0x19A
 
+/* Intel Hardware P-states (HWP) */
+#define MSR_PM_ENABLE 0x770
+#define MSR_HWP_CAPABILITIES 0x771
+#define MSR_HWP_REQUEST 0x774
+
+/* Intel uncore frequency */
+#define MSR_UNCORE_RATIO_LIMIT 0x620
+#define MSR_UNCORE_PERF_STATUS 0x621
+
+/* AMD Collaborative Processor Performance Control (CPPC) */
+#define MSR_AMD_CPPC_CAP1 0xC00102B0
+#define MSR_AMD_CPPC_ENABLE 0xC00102B1
+#define MSR_AMD_CPPC_REQ 0xC00102B3
+
 namespace mammut{
 
 namespace task{class TasksManager; class ProcessHandler; class ThreadHandler;}
@@ -540,6 +561,14 @@ void writeFile(const std::string& fileName, const std::string& line);
  */
 void dashedRangeToIntegers(const std::string& dashedRange, int& rangeStart, int& rangeStop);
 
+/**
+ * Extracts all the integers from a comma separated list of
+ * ranges (e.g. "0-3,8,10-11", as in sysfs cpulist files).
+ * @param dashedRanges The list of ranges.
+ * @return The integers contained in the ranges.
+ */
+std::vector<uint> dashedRangesToIntegers(const std::string& dashedRanges);
+
 /**
  * Call a delete on all the elements of a vector and remove the element itself from the vector.
  * @param v The vector.
@@ -669,6 +698,63 @@ public:
                    unsigned int lowBit, uint64_t value);
 };
 
+/**
+ * Reads a set of registers on a set of virtual cores.
+ * If the msr_safe batch interface (/dev/cpu/msr_batch) is
+ * available, all the registers are read with a single call
+ * (i.e. with the smallest possible skew between the reads).
+ * Otherwise, they are read one after the other through the
+ * per-core MSR files (which are kept open between reads).
+ * Usage:
+ *       MsrBatch batch;
+ *       size_t a = batch.add(0, MSR_APERF);
+ *       size_t m = batch.add(1, MSR_MPERF);
+ *       batch.read();
+ *       batch.get(a, value);
+ */
+class MsrBatch: NonCopyable{
+private:
+    int _batchFd;
+    std::vector<uint32_t> _virtualCores;
+    std::vector<uint32_t> _registers;
+    std::vector<uint64_t> _values;
+    std::vector<bool> _valid;
+    std::vector<Msr*> _msrs;
+
+    Msr* getMsr(uint32_t virtualCoreId);
+public:
+    MsrBatch();
+    ~MsrBatch();
+
+    /**
+     * Adds a register to be read.
+     * @param virtualCoreId The identifier of the virtual core.
+     * @param which The register.
+     * @return The index to be used in get() to retrieve the value.
+     */
+    size_t add(uint32_t virtualCoreId, uint32_t which);
+
+    /**
+     * Returns the number of registers in the batch.
+     * @return The number of registers in the batch.
+     */
+    size_t size() const;
+
+    /**
+     * Reads all the registers in the batch.
+     * @return True if all the registers have been read, false otherwise.
+     */
+    bool read();
+
+    /**
+     * Gets the value read by the last read() call.
+     * @param index The index returned by add().
+     * @param value The value of the register.
+     * @return True if the register was successfully read, false otherwise.
+     */
+    bool get(size_t index, uint64_t& value) const;
+};
+
 typedef struct{
     ulong timestamp;
     double value;
@@ -805,7 +891,7 @@ class CpuIdAsm {
   uint32_t regs[4];
 
 public:
-  explicit CpuIdAsm(unsigned i);
+  explicit CpuIdAsm(unsigned i, unsigned subleaf = 0);
   const uint32_t &EAX() const;
   const uint32_t &EBX() const;
   const uint32_t &ECX() const;
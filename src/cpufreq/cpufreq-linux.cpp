@@ -2,6 +2,7 @@
 #include <mammut/cpufreq/cpufreq-linux.hpp>
 
 #include "algorithm"
+#include "cmath"
 #include "fstream"
 #include "iostream"
 #include "limits"
@@ -20,15 +21,25 @@ using namespace std;
 using namespace utils;
 
 
-DomainLinux::DomainLinux(DomainId domainIdentifier, vector<topology::VirtualCore*> virtualCores):
-        Domain(domainIdentifier, virtualCores),
-        _msr(virtualCores.at(0)->getVirtualCoreId(), O_RDWR){
-
+static bool isEpyc(){
     topology::Topology* top = topology::Topology::getInstance();
     std::vector<topology::Cpu*> cpus = top->getCpus();
-    if(!cpus[0]->getFamily().compare("23") &&
-       !cpus[0]->getVendorId().compare(0, 12, "AuthenticAMD")){
-      _epyc = true;
+    bool r = !cpus[0]->getFamily().compare("23") &&
+             !cpus[0]->getVendorId().compare(0, 12, "AuthenticAMD");
+    topology::Topology::release(top);
+    return r;
+}
+
+DomainLinux::DomainLinux(DomainId domainIdentifier, vector<topology::VirtualCore*> virtualCores):
+        DomainLinux(domainIdentifier, virtualCores, isEpyc()){
+    ;
+}
+
+DomainLinux::DomainLinux(DomainId domainIdentifier, vector<topology::VirtualCore*> virtualCores, bool epyc):
+        Domain(domainIdentifier, virtualCores),
+        _msr(virtualCores.at(0)->getVirtualCoreId(), O_RDWR),
+        _epyc(epyc), _continuous(false), _baseFrequency(0){
+    if(_epyc){
       for(int i = 8; i >= 0; i--){
         uint64_t fId = 0, dfsId = 0;
         bool fIdr, dfsIdr;
@@ -42,7 +53,6 @@ DomainLinux::DomainLinux(DomainId domainIdentifier, vector<topology::VirtualCore
       }
       _availableGovernors.push_back(GOVERNOR_USERSPACE);
     }else{
-      _epyc = false;
       /** Reads available frequecies. **/
       for(size_t i = 0; i < virtualCores.size(); i++){
           _paths.push_back(simulationParameters.sysfsRootPrefix +
@@ -107,7 +117,49 @@ void DomainLinux::writeToDomainFiles(const string& what, const string& where) co
     }
 }
 
+/** Granularity of the sampling of continuous frequency ranges (KHz). **/
+#define CONTINUOUS_FREQUENCIES_STEP 100000
+
+void DomainLinux::setContinuousFrequencies(Frequency baseFrequency){
+    _continuous = true;
+    _baseFrequency = baseFrequency;
+    _availableFrequencies.clear();
+    Frequency lb, ub;
+    getHardwareFrequencyBounds(lb, ub);
+    for(Frequency f = lb; f <= ub; f += CONTINUOUS_FREQUENCIES_STEP){
+        _availableFrequencies.push_back(f);
+    }
+    if(_availableFrequencies.empty() || _availableFrequencies.back() != ub){
+        _availableFrequencies.push_back(ub);
+    }
+}
+
+Frequency DomainLinux::getEffectiveFrequency(uint window) const{
+    topology::EffectiveFrequency effectiveFrequency;
+    if(!_virtualCores.at(0)->getEffectiveFrequency(window, effectiveFrequency)){
+        return 0;
+    }
+    return effectiveFrequency.busyFrequency;
+}
+
+bool DomainLinux::hasContinuousFrequencies() const{
+    return _continuous;
+}
+
 void DomainLinux::removeTurboFrequencies(){
+    if(_continuous && _baseFrequency){
+        if(_turboFrequencies.empty()){
+            for(auto it = _availableFrequencies.begin(); it != _availableFrequencies.end();){
+                if(*it > _baseFrequency){
+                    _turboFrequencies.push_back(*it);
+                    it = _availableFrequencies.erase(it);
+                }else{
+                    ++it;
+                }
+            }
+        }
+        return;
+    }
 #if defined(__x86_64__) // It seems that on Power8 this is not the case
     if(_turboFrequencies.empty()){
         for(auto it = _availableFrequencies.begin(); it != _availableFrequencies.end();){
@@ -139,7 +191,12 @@ vector<Governor> DomainLinux::getAvailableGovernors() const{
 
 Frequency DomainLinux::getCurrentFrequency() const{
     if(_epyc){
-      return 0; // TODO
+      // Frequency of the current P-state (see getEffectiveFrequency()).
+      uint64_t pState;
+      if(!_msr.readBits(0xC0010063, 2, 0, pState) || pState >= _availableFrequencies.size()){
+        return 0;
+      }
+      return _availableFrequencies[_availableFrequencies.size() - 1 - pState];
     }else{
       string fileName = _paths.at(0) + "scaling_cur_freq";
       return stringToInt(readFirstLineFromFile(fileName));
@@ -155,6 +212,15 @@ static uint64_t getCurrentEpycPstate(const Msr& msr){
 Frequency DomainLinux::getCurrentFrequencyUserspace() const{
     if(_epyc){
       return _availableFrequencies[_availableFrequencies.size() - 1 - getCurrentEpycPstate(_msr)];
+    }else if(_continuous && !isGovernorAvailable(GOVERNOR_USERSPACE)){
+      // Frequency pinned through the bounds.
+      Frequency lb, ub;
+      getCurrentGovernorBounds(lb, ub);
+      if(lb == ub){
+        return lb;
+      }else{
+        return 0;
+      }
     }else{
       switch(getCurrentGovernor()){
           case GOVERNOR_USERSPACE:{
@@ -193,10 +259,20 @@ bool DomainLinux::setFrequencyUserspace(Frequency frequency) const{
       }else{
         return false;
       }
+    }else if(_continuous && !isGovernorAvailable(GOVERNOR_USERSPACE)){
+      // No userspace governor (e.g. intel_pstate active mode),
+      // the frequency is pinned through the bounds.
+      return setGovernorBounds(frequency, frequency);
     }else{
       switch(getCurrentGovernor()){
           case GOVERNOR_USERSPACE:{
-              if(!utils::contains(_availableFrequencies, frequency)){
+              if(_continuous){
+                  Frequency lb, ub;
+                  getHardwareFrequencyBounds(lb, ub);
+                  if(frequency < lb || frequency > ub){
+                      return false;
+                  }
+              }else if(!utils::contains(_availableFrequencies, frequency)){
                   return false;
               }
               writeToDomainFiles(intToString(frequency), "scaling_setspeed");
@@ -232,6 +308,22 @@ bool DomainLinux::getCurrentGovernorBounds(Frequency& lowerBound, Frequency& upp
 bool DomainLinux::setGovernorBounds(Frequency lowerBound, Frequency upperBound) const{
     if(_epyc){
       return false;
+    }else if(_continuous){
+      Frequency lb, ub, currentLb, currentUb;
+      getHardwareFrequencyBounds(lb, ub);
+      if(lowerBound > upperBound || lowerBound < lb || upperBound > ub){
+          return false;
+      }
+      getCurrentGovernorBounds(currentLb, currentUb);
+      // The driver rejects a lower bound greater than the current upper bound.
+      if(lowerBound > currentUb){
+          writeToDomainFiles(intToString(upperBound), "scaling_max_freq");
+          writeToDomainFiles(intToString(lowerBound), "scaling_min_freq");
+      }else{
+          writeToDomainFiles(intToString(lowerBound), "scaling_min_freq");
+          writeToDomainFiles(intToString(upperBound), "scaling_max_freq");
+      }
+      return true;
     }else{
       if(!utils::contains(getAvailableFrequencies(), lowerBound) ||
          !utils::contains(getAvailableFrequencies(), upperBound) ||
@@ -296,35 +388,115 @@ Voltage DomainLinux::getCurrentVoltage() const{
     }
 }
 
+vector<string> DomainLinux::getAvailableEnergyPerformancePreferences() const{
+    vector<string> r;
+    if(_paths.empty()){
+        return r;
+    }
+    string fileName = _paths.at(0) + "energy_performance_available_preferences";
+    if(existsFile(fileName)){
+        ifstream file(fileName.c_str());
+        string preference;
+        while(file >> preference){
+            r.push_back(preference);
+        }
+    }
+    return r;
+}
+
+string DomainLinux::getEnergyPerformancePreference() const{
+    if(!_paths.empty() && existsFile(_paths.at(0) + "energy_performance_preference")){
+        return readFirstLineFromFile(_paths.at(0) + "energy_performance_preference");
+    }else{
+        return "";
+    }
+}
+
+bool DomainLinux::setEnergyPerformancePreference(const string& preference) const{
+    if(!utils::contains(getAvailableEnergyPerformancePreferences(), preference)){
+        return false;
+    }
+    writeToDomainFiles(preference, "energy_performance_preference");
+    return true;
+}
+
 VoltageTable DomainLinux::getVoltageTable(bool onlyPhysicalCores) const{
+    VoltageTableParameters parameters;
+    parameters.onlyPhysicalCores = onlyPhysicalCores;
+    return getVoltageTable(parameters);
+}
+
+VoltageTable DomainLinux::getVoltageTable(uint numVirtualCores, bool onlyPhysicalCores) const{
+    VoltageTableParameters parameters;
+    parameters.onlyPhysicalCores = onlyPhysicalCores;
+    VoltageTable r;
+    measureVoltageTable(numVirtualCores, parameters, r);
+    return r;
+}
+
+VoltageTable DomainLinux::getVoltageTable(const VoltageTableParameters& parameters) const{
     VoltageTable r;
+    if(!parameters.fileName.empty() && existsFile(parameters.fileName)){
+        loadVoltageTable(r, parameters.fileName);
+    }
     size_t numCores = 0;
-    if(onlyPhysicalCores){
+    if(parameters.onlyPhysicalCores){
         numCores = topology::getNumPhysicalCores(_virtualCores);
     }else{
         numCores = _virtualCores.size();
     }
     for(size_t i = 0; i <= numCores; i++){
-        VoltageTable tmp = getVoltageTable((uint)i, onlyPhysicalCores);
-        for(VoltageTableIterator iterator = tmp.begin(); iterator != tmp.end(); ++iterator){
-            r.insert(*iterator);
-        }
+        measureVoltageTable((uint) i, parameters, r);
     }
     return r;
 }
 
-VoltageTable DomainLinux::getVoltageTable(uint numVirtualCores, bool onlyPhysicalCores) const{
-    uint numSamples;
-    uint sleepInterval;
+Voltage DomainLinux::getSteadyVoltage(const VoltageTableParameters& parameters) const{
     if(_epyc){
-      numSamples = 1;
-      sleepInterval = 0;
+        // Read from the P-state definition, no need to average.
+        return getCurrentVoltage();
+    }
+    uint windowSamples = std::max(parameters.windowSamples, (uint) 1);
+    Voltage previous = 0, current = 0;
+    for(uint i = 0; i < std::max(parameters.maxWindows, (uint) 1); i++){
+        Voltage voltageSum = 0;
+        for(uint j = 0; j < windowSamples; j++){
+            usleep(parameters.samplingInterval);
+            voltageSum += getCurrentVoltage();
+        }
+        current = voltageSum / (double) windowSamples;
+        if(i && fabs(current - previous) <= parameters.tolerance * previous){
+            break;
+        }
+        previous = current;
+    }
+    return current;
+}
+
+void DomainLinux::measureVoltageTable(uint numVirtualCores, const VoltageTableParameters& parameters,
+                                      VoltageTable& table) const{
+    vector<topology::VirtualCore*> vcToMax;
+    if(parameters.onlyPhysicalCores){
+        vcToMax = getOneVirtualPerPhysical(_virtualCores);
     }else{
-      numSamples = 5;
-      sleepInterval = 3;
+        vcToMax = _virtualCores;
     }
-    VoltageTable r;
-    
+
+    if(numVirtualCores > vcToMax.size()){
+        numVirtualCores = vcToMax.size();
+    }
+
+    vector<Frequency> frequencies;
+    for(size_t i = 0; i < _availableFrequencies.size(); i++){
+        VoltageTableKey key(numVirtualCores, _availableFrequencies.at(i));
+        if(table.find(key) == table.end()){
+            frequencies.push_back(_availableFrequencies.at(i));
+        }
+    }
+    if(frequencies.empty() || !getCurrentVoltage()){
+        return;
+    }
+
     Governor oldGovernor = getCurrentGovernor();
     Frequency oldFrequency = getCurrentFrequencyUserspace();
     Frequency oldFrequencyLb, oldFrequencyUb;
@@ -333,46 +505,389 @@ VoltageTable DomainLinux::getVoltageTable(uint numVirtualCores, bool onlyPhysica
     }
 
     if(!setGovernor(GOVERNOR_USERSPACE)){
-        return r;
+        return;
     }
 
-    vector<topology::VirtualCore*> vcToMax;
-    if(onlyPhysicalCores){
-        vcToMax = getOneVirtualPerPhysical(_virtualCores);
+    auto restore = [&]{
+        setGovernor(oldGovernor);
+        if(oldGovernor == GOVERNOR_USERSPACE){
+            setFrequencyUserspace(oldFrequency);
+        }else{
+            if(!_epyc){
+              setGovernorBounds(oldFrequencyLb, oldFrequencyUb);
+            }
+        }
+    };
+
+    try{
+        // The load is stopped by the LoadGenerator destructor.
+        topology::LoadGenerator load(vector<topology::VirtualCore*>(vcToMax.begin(),
+                                                                    vcToMax.begin() + numVirtualCores));
+        if(numVirtualCores){
+            load.start();
+        }
+
+        for(size_t i = 0; i < frequencies.size(); i++){
+            setFrequencyUserspace(frequencies.at(i));
+            VoltageTableKey key(numVirtualCores, frequencies.at(i));
+            table[key] = getSteadyVoltage(parameters);
+            if(!parameters.fileName.empty()){
+                dumpVoltageTable(table, parameters.fileName);
+            }
+        }
+    }catch(...){
+        // Restore the previous configuration, but report the original error.
+        try{
+            restore();
+        }catch(...){
+            ;
+        }
+        throw;
+    }
+
+    restore();
+}
+
+DomainIntelPstate::DomainIntelPstate(DomainId domainIdentifier, vector<topology::VirtualCore*> virtualCores):
+        DomainLinux(domainIdentifier, virtualCores, false),
+        _pstatePath(simulationParameters.sysfsRootPrefix +
+                    "/sys/devices/system/cpu/intel_pstate/"){
+    Frequency baseFrequency = 0;
+    if(existsFile(_paths.at(0) + "base_frequency")){
+        baseFrequency = stringToUint(readFirstLineFromFile(_paths.at(0) + "base_frequency"));
+    }
+    setContinuousFrequencies(baseFrequency);
+}
+
+DomainIntelPstate::~DomainIntelPstate(){
+    deleteVectorElements<Msr*>(_hwpMsrs);
+}
+
+const vector<Msr*>& DomainIntelPstate::getHwpMsrs() const{
+    std::call_once(_hwpMsrsOnce, [this]{
+        for(size_t i = 0; i < _virtualCores.size(); i++){
+            _hwpMsrs.push_back(new Msr(_virtualCores.at(i)->getVirtualCoreId(), O_RDWR));
+        }
+    });
+    return _hwpMsrs;
+}
+
+bool DomainIntelPstate::getPerfPctBounds(uint& lowerBound, uint& upperBound) const{
+    if(!existsFile(_pstatePath + "min_perf_pct") ||
+       !existsFile(_pstatePath + "max_perf_pct")){
+        return false;
+    }
+    lowerBound = stringToUint(readFirstLineFromFile(_pstatePath + "min_perf_pct"));
+    upperBound = stringToUint(readFirstLineFromFile(_pstatePath + "max_perf_pct"));
+    return true;
+}
+
+bool DomainIntelPstate::setPerfPctBounds(uint lowerBound, uint upperBound) const{
+    uint currentLb, currentUb;
+    if(lowerBound > upperBound || upperBound > 100 ||
+       !getPerfPctBounds(currentLb, currentUb)){
+        return false;
+    }
+    if(lowerBound > currentUb){
+        writeFile(_pstatePath + "max_perf_pct", intToString(upperBound));
+        writeFile(_pstatePath + "min_perf_pct", intToString(lowerBound));
     }else{
-        vcToMax = _virtualCores;
+        writeFile(_pstatePath + "min_perf_pct", intToString(lowerBound));
+        writeFile(_pstatePath + "max_perf_pct", intToString(upperBound));
     }
+    return true;
+}
 
-    if(numVirtualCores > vcToMax.size()){
-        numVirtualCores = vcToMax.size();
+bool DomainIntelPstate::isHwpEnabled() const{
+    uint64_t enabled;
+    return getHwpMsrs().at(0)->available() &&
+           getHwpMsrs().at(0)->readBits(MSR_PM_ENABLE, 0, 0, enabled) &&
+           enabled;
+}
+
+bool DomainIntelPstate::getHwpCapabilities(HwpCapabilities& capabilities) const{
+    uint64_t r;
+    if(!isHwpEnabled() || !getHwpMsrs().at(0)->read(MSR_HWP_CAPABILITIES, r)){
+        return false;
     }
+    capabilities.highestPerf = r & 0xFF;
+    capabilities.guaranteedPerf = (r >> 8) & 0xFF;
+    capabilities.mostEfficientPerf = (r >> 16) & 0xFF;
+    capabilities.lowestPerf = (r >> 24) & 0xFF;
+    return true;
+}
 
-    for(size_t i = 0; i < numVirtualCores; i++){
-        vcToMax.at(i)->maximizeUtilization();
+bool DomainIntelPstate::getHwpRequest(HwpRequest& request) const{
+    uint64_t r;
+    if(!isHwpEnabled() || !getHwpMsrs().at(0)->read(MSR_HWP_REQUEST, r)){
+        return false;
     }
+    request.minPerf = r & 0xFF;
+    request.maxPerf = (r >> 8) & 0xFF;
+    request.desiredPerf = (r >> 16) & 0xFF;
+    request.energyPerformancePreference = (r >> 24) & 0xFF;
+    return true;
+}
 
-    for(size_t i = 0; i < _availableFrequencies.size(); i++){
-        setFrequencyUserspace(_availableFrequencies.at(i));
-        Voltage voltageSum = 0;
-        for(uint j = 0; j < numSamples; j++){
-            sleep(sleepInterval);
-            voltageSum += getCurrentVoltage();
+bool DomainIntelPstate::setHwpRequest(const HwpRequest& request) const{
+    if(!isHwpEnabled() || request.minPerf > request.maxPerf){
+        return false;
+    }
+    uint64_t value = (uint64_t) request.minPerf |
+                     ((uint64_t) request.maxPerf << 8) |
+                     ((uint64_t) request.desiredPerf << 16) |
+                     ((uint64_t) request.energyPerformancePreference << 24);
+    const vector<Msr*>& msrs = getHwpMsrs();
+    for(size_t i = 0; i < msrs.size(); i++){
+        // Activity window and package control bits are preserved.
+        if(!msrs.at(i)->writeBits(MSR_HWP_REQUEST, 31, 0, value)){
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DomainIntelPstate::setEnergyPerformancePreference(const string& preference) const{
+    if(DomainLinux::setEnergyPerformancePreference(preference)){
+        return true;
+    }
+    // Raw values are only accepted when HWP is enabled.
+    if(preference.empty() || preference.size() > 3 ||
+       preference.find_first_not_of("0123456789") != string::npos ||
+       stringToUint(preference) > 255 || !isHwpEnabled() ||
+       !existsFile(_paths.at(0) + "energy_performance_preference")){
+        return false;
+    }
+    writeToDomainFiles(preference, "energy_performance_preference");
+    return true;
+}
+
+DomainAmdPstate::DomainAmdPstate(DomainId domainIdentifier, vector<topology::VirtualCore*> virtualCores):
+        DomainLinux(domainIdentifier, virtualCores, false),
+        _hasCapabilities(false){
+    string cppcPath = simulationParameters.sysfsRootPrefix +
+                      "/sys/devices/system/cpu/cpu" +
+                      intToString(virtualCores.at(0)->getVirtualCoreId()) +
+                      "/acpi_cppc/";
+    uint64_t r;
+    if(existsFile(cppcPath + "highest_perf")){
+        _capabilities.highestPerf = stringToUint(readFirstLineFromFile(cppcPath + "highest_perf"));
+        _capabilities.nominalPerf = stringToUint(readFirstLineFromFile(cppcPath + "nominal_perf"));
+        _capabilities.lowestNonlinearPerf = stringToUint(readFirstLineFromFile(cppcPath + "lowest_nonlinear_perf"));
+        _capabilities.lowestPerf = stringToUint(readFirstLineFromFile(cppcPath + "lowest_perf"));
+        _capabilities.nominalFrequency = 0;
+        if(existsFile(cppcPath + "nominal_freq")){
+            // MHz
+            _capabilities.nominalFrequency = stringToUint(readFirstLineFromFile(cppcPath + "nominal_freq")) * 1000;
         }
+        _hasCapabilities = true;
+    }else if(Msr(virtualCores.at(0)->getVirtualCoreId()).read(MSR_AMD_CPPC_CAP1, r)){
+        _capabilities.lowestPerf = r & 0xFF;
+        _capabilities.lowestNonlinearPerf = (r >> 8) & 0xFF;
+        _capabilities.nominalPerf = (r >> 16) & 0xFF;
+        _capabilities.highestPerf = (r >> 24) & 0xFF;
+        _capabilities.nominalFrequency = 0;
+        _hasCapabilities = true;
+    }
 
-        VoltageTableKey key(numVirtualCores, _availableFrequencies.at(i));
-        r.insert(pair<VoltageTableKey, Voltage>(key, (voltageSum / (double)numSamples)));
+    Frequency baseFrequency = 0;
+    if(_hasCapabilities){
+        baseFrequency = perfToFrequency(_capabilities.nominalPerf);
+    }
+    setContinuousFrequencies(baseFrequency);
+}
+
+DomainAmdPstate::~DomainAmdPstate(){
+    deleteVectorElements<Msr*>(_cppcMsrs);
+}
+
+const vector<Msr*>& DomainAmdPstate::getCppcMsrs() const{
+    std::call_once(_cppcMsrsOnce, [this]{
+        for(size_t i = 0; i < _virtualCores.size(); i++){
+            _cppcMsrs.push_back(new Msr(_virtualCores.at(i)->getVirtualCoreId(), O_RDWR));
+        }
+    });
+    return _cppcMsrs;
+}
+
+bool DomainAmdPstate::getCppcCapabilities(CppcCapabilities& capabilities) const{
+    if(_hasCapabilities){
+        capabilities = _capabilities;
     }
+    return _hasCapabilities;
+}
 
-    for(size_t i = 0; i < numVirtualCores; i++){
-        vcToMax.at(i)->resetUtilization();
+Frequency DomainAmdPstate::perfToFrequency(uint32_t perf) const{
+    if(!_hasCapabilities || !_capabilities.nominalPerf){
+        return 0;
+    }
+    Frequency nominalFrequency = _capabilities.nominalFrequency;
+    if(!nominalFrequency && !_paths.empty() &&
+       existsFile(_paths.at(0) + "cpuinfo_max_freq")){
+        // The driver maps highest_perf to cpuinfo_max_freq.
+        Frequency maxFrequency = stringToUint(readFirstLineFromFile(_paths.at(0) + "cpuinfo_max_freq"));
+        return (uint64_t) maxFrequency * perf / _capabilities.highestPerf;
     }
+    return (uint64_t) nominalFrequency * perf / _capabilities.nominalPerf;
+}
 
-    setGovernor(oldGovernor);
-    if(oldGovernor == GOVERNOR_USERSPACE){
-        setFrequencyUserspace(oldFrequency);
+bool DomainAmdPstate::isCppcEnabled() const{
+    uint64_t enabled;
+    return getCppcMsrs().at(0)->available() &&
+           getCppcMsrs().at(0)->readBits(MSR_AMD_CPPC_ENABLE, 0, 0, enabled) &&
+           enabled;
+}
+
+bool DomainAmdPstate::getCppcRequest(CppcRequest& request) const{
+    uint64_t r;
+    if(!isCppcEnabled() || !getCppcMsrs().at(0)->read(MSR_AMD_CPPC_REQ, r)){
+        return false;
+    }
+    request.maxPerf = r & 0xFF;
+    request.minPerf = (r >> 8) & 0xFF;
+    request.desiredPerf = (r >> 16) & 0xFF;
+    request.energyPerformancePreference = (r >> 24) & 0xFF;
+    return true;
+}
+
+bool DomainAmdPstate::setCppcRequest(const CppcRequest& request) const{
+    if(!isCppcEnabled() || request.minPerf > request.maxPerf){
+        return false;
+    }
+    uint64_t value = (uint64_t) request.maxPerf |
+                     ((uint64_t) request.minPerf << 8) |
+                     ((uint64_t) request.desiredPerf << 16) |
+                     ((uint64_t) request.energyPerformancePreference << 24);
+    const vector<Msr*>& msrs = getCppcMsrs();
+    for(size_t i = 0; i < msrs.size(); i++){
+        if(!msrs.at(i)->writeBits(MSR_AMD_CPPC_REQ, 31, 0, value)){
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Uncore ratios are expressed in multiples of 100MHz. **/
+#define UNCORE_RATIO_STEP 100000
+
+UncoreDomainLinux::UncoreDomainLinux(topology::CpuId cpuId, const vector<string>& paths,
+                                     topology::VirtualCoreId virtualCoreId):
+        UncoreDomain(cpuId), _paths(paths), _virtualCoreId(virtualCoreId), _msr(NULL),
+        _useMsr(paths.empty()), _hardwareLowerBound(0), _hardwareUpperBound(0){
+    if(_useMsr){
+        // There is no register with the hardware bounds, we consider the
+        // (BIOS set) values found when the domain is created.
+        uint64_t minRatio = 0, maxRatio = 0;
+        getMsr().readBits(MSR_UNCORE_RATIO_LIMIT, 14, 8, minRatio);
+        getMsr().readBits(MSR_UNCORE_RATIO_LIMIT, 6, 0, maxRatio);
+        _hardwareLowerBound = minRatio * UNCORE_RATIO_STEP;
+        _hardwareUpperBound = maxRatio * UNCORE_RATIO_STEP;
     }else{
-        if(!_epyc){
-          setGovernorBounds(oldFrequencyLb, oldFrequencyUb);
+        _hardwareLowerBound = stringToUint(readFirstLineFromFile(_paths.at(0) + "initial_min_freq_khz"));
+        _hardwareUpperBound = stringToUint(readFirstLineFromFile(_paths.at(0) + "initial_max_freq_khz"));
+    }
+}
+
+UncoreDomainLinux::~UncoreDomainLinux(){
+    delete _msr;
+}
+
+Msr& UncoreDomainLinux::getMsr() const{
+    std::call_once(_msrOnce, [this]{
+        _msr = new Msr(_virtualCoreId, O_RDWR);
+    });
+    return *_msr;
+}
+
+bool UncoreDomainLinux::isMsrSupported(topology::VirtualCoreId virtualCoreId){
+    Msr msr(virtualCoreId);
+    uint64_t maxRatio;
+    return msr.available() &&
+           msr.readBits(MSR_UNCORE_RATIO_LIMIT, 6, 0, maxRatio) && maxRatio;
+}
+
+void UncoreDomainLinux::getHardwareFrequencyBounds(Frequency& lowerBound, Frequency& upperBound) const{
+    lowerBound = _hardwareLowerBound;
+    upperBound = _hardwareUpperBound;
+}
+
+bool UncoreDomainLinux::getFrequencyBounds(Frequency& lowerBound, Frequency& upperBound) const{
+    if(_useMsr){
+        uint64_t minRatio, maxRatio;
+        if(!getMsr().readBits(MSR_UNCORE_RATIO_LIMIT, 14, 8, minRatio) ||
+           !getMsr().readBits(MSR_UNCORE_RATIO_LIMIT, 6, 0, maxRatio)){
+            return false;
+        }
+        lowerBound = minRatio * UNCORE_RATIO_STEP;
+        upperBound = maxRatio * UNCORE_RATIO_STEP;
+    }else{
+        lowerBound = stringToUint(readFirstLineFromFile(_paths.at(0) + "min_freq_khz"));
+        upperBound = stringToUint(readFirstLineFromFile(_paths.at(0) + "max_freq_khz"));
+    }
+    return true;
+}
+
+bool UncoreDomainLinux::setFrequencyBounds(Frequency lowerBound, Frequency upperBound) const{
+    if(lowerBound > upperBound ||
+       lowerBound < _hardwareLowerBound ||
+       upperBound > _hardwareUpperBound){
+        return false;
+    }
+    if(_useMsr){
+        return getMsr().writeBits(MSR_UNCORE_RATIO_LIMIT, 14, 8, lowerBound / UNCORE_RATIO_STEP) &&
+               getMsr().writeBits(MSR_UNCORE_RATIO_LIMIT, 6, 0, upperBound / UNCORE_RATIO_STEP);
+    }else{
+        Frequency currentLb, currentUb;
+        getFrequencyBounds(currentLb, currentUb);
+        for(size_t i = 0; i < _paths.size(); i++){
+            // The driver rejects a lower bound greater than the current upper bound.
+            if(lowerBound > currentUb){
+                writeFile(_paths.at(i) + "max_freq_khz", intToString(upperBound));
+                writeFile(_paths.at(i) + "min_freq_khz", intToString(lowerBound));
+            }else{
+                writeFile(_paths.at(i) + "min_freq_khz", intToString(lowerBound));
+                writeFile(_paths.at(i) + "max_freq_khz", intToString(upperBound));
+            }
+        }
+        return true;
+    }
+}
+
+Frequency UncoreDomainLinux::getCurrentFrequency() const{
+    if(!_useMsr && existsFile(_paths.at(0) + "current_freq_khz")){
+        return stringToUint(readFirstLineFromFile(_paths.at(0) + "current_freq_khz"));
+    }
+    uint64_t ratio;
+    if(getMsr().available() && getMsr().readBits(MSR_UNCORE_PERF_STATUS, 6, 0, ratio)){
+        return ratio * UNCORE_RATIO_STEP;
+    }
+    return 0;
+}
+
+/**
+ * Returns the intel_uncore_frequency directories associated to a CPU.
+ * Directories are named package_XX_die_YY (or uncoreXX, containing
+ * a package_id file, on recent kernels).
+ */
+static vector<string> getUncorePaths(topology::CpuId cpuId){
+    vector<string> r;
+    string root = simulationParameters.sysfsRootPrefix +
+                  "/sys/devices/system/cpu/intel_uncore_frequency/";
+    if(!existsDirectory(root)){
+        return r;
+    }
+    vector<string> dirs = getFilesNamesInDir(root, false, true);
+    sort(dirs.begin(), dirs.end());
+    for(size_t i = 0; i < dirs.size(); i++){
+        string path = root + dirs.at(i) + "/";
+        int packageId = -1;
+        if(!dirs.at(i).compare(0, 8, "package_")){
+            packageId = stringToInt(split(dirs.at(i), '_').at(1));
+        }else if(existsFile(path + "package_id")){
+            packageId = stringToInt(readFirstLineFromFile(path + "package_id"));
+        }
+        if(packageId == (int) cpuId){
+            r.push_back(path);
         }
     }
     return r;
@@ -380,10 +895,26 @@ VoltageTable DomainLinux::getVoltageTable(uint numVirtualCores, bool onlyPhysica
 
 CpuFreqLinux::CpuFreqLinux():
     _boostingFile(simulationParameters.sysfsRootPrefix +
-                  "/sys/devices/system/cpu/cpufreq/boost"){
+                  "/sys/devices/system/cpu/cpufreq/boost"),
+    _boostingInverted(false){
+    string noTurboFile = simulationParameters.sysfsRootPrefix +
+                         "/sys/devices/system/cpu/intel_pstate/no_turbo";
+    if(!existsFile(_boostingFile) && existsFile(noTurboFile)){
+        _boostingFile = noTurboFile;
+        _boostingInverted = true;
+    }
+    _topology = topology::Topology::local();
     if(existsDirectory(simulationParameters.sysfsRootPrefix +
                        "/sys/devices/system/cpu/cpu0/cpufreq")){
-        _topology = topology::Topology::local();
+        string driverFile = simulationParameters.sysfsRootPrefix +
+                            "/sys/devices/system/cpu/cpu0/cpufreq/scaling_driver";
+        bool intelPstate = false, amdPstate = false;
+        if(existsFile(driverFile)){
+            string driver = readFirstLineFromFile(driverFile);
+            intelPstate = !driver.compare("intel_pstate") ||
+                          !driver.compare("intel_cpufreq");
+            amdPstate = !driver.compare(0, 10, "amd-pstate");
+        }
         vector<string> output;
 
         /** If freqdomain_cpus file are present, we must consider them instead of related_cpus. **/
@@ -411,14 +942,19 @@ CpuFreqLinux::CpuFreqLinux():
                 virtualCoresIdentifiers.push_back(num);
             }
             /** Creates a domain based on the vector of cores identifiers. **/
-            _domains.at(i) = new DomainLinux(i, filterVirtualCores(vc, virtualCoresIdentifiers));
+            if(intelPstate){
+                _domains.at(i) = new DomainIntelPstate(i, filterVirtualCores(vc, virtualCoresIdentifiers));
+            }else if(amdPstate){
+                _domains.at(i) = new DomainAmdPstate(i, filterVirtualCores(vc, virtualCoresIdentifiers));
+            }else{
+                _domains.at(i) = new DomainLinux(i, filterVirtualCores(vc, virtualCoresIdentifiers));
+            }
         }
     }else{
-      topology::Topology* top = topology::Topology::getInstance();
-      std::vector<topology::Cpu*> cpus = top->getCpus();
+      std::vector<topology::Cpu*> cpus = _topology->getCpus();
       if(!cpus[0]->getFamily().compare("23") &&
          !cpus[0]->getVendorId().compare(0, 12, "AuthenticAMD")){
-        std::vector<topology::PhysicalCore*> cores = top->getPhysicalCores();
+        std::vector<topology::PhysicalCore*> cores = _topology->getPhysicalCores();
         size_t i = 0;
         for(auto c : cores){
           _domains.push_back(new DomainLinux(i, c->getVirtualCores()));
@@ -426,10 +962,20 @@ CpuFreqLinux::CpuFreqLinux():
         }
       }
     }
+
+    /** Uncore domains. **/
+    for(topology::Cpu* cpu : _topology->getCpus()){
+        vector<string> paths = getUncorePaths(cpu->getCpuId());
+        topology::VirtualCoreId virtualCoreId = cpu->getVirtualCore()->getVirtualCoreId();
+        if(paths.size() || UncoreDomainLinux::isMsrSupported(virtualCoreId)){
+            _uncoreDomains.push_back(new UncoreDomainLinux(cpu->getCpuId(), paths, virtualCoreId));
+        }
+    }
 }
 
 CpuFreqLinux::~CpuFreqLinux(){
     deleteVectorElements<Domain*>(_domains);
+    deleteVectorElements<UncoreDomain*>(_uncoreDomains);
     topology::Topology::release(_topology);
 }
 
@@ -437,6 +983,10 @@ vector<Domain*> CpuFreqLinux::getDomains() const{
     return _domains;
 }
 
+vector<UncoreDomain*> CpuFreqLinux::getUncoreDomains() const{
+    return _uncoreDomains;
+}
+
 bool CpuFreqLinux::isBoostingSupported() const{
     //TODO: Se esiste il file è abilitabile dinamicamente. Potrebbe esserci boosting anche se il file non esiste?
     return existsFile(_boostingFile);
@@ -444,7 +994,7 @@ bool CpuFreqLinux::isBoostingSupported() const{
 
 bool CpuFreqLinux::isBoostingEnabled() const{
     if(isBoostingSupported()){
-        if(stringToInt(readFirstLineFromFile(_boostingFile))){
+        if(stringToInt(readFirstLineFromFile(_boostingFile)) != _boostingInverted){
             return true;
         }
     }
@@ -452,11 +1002,11 @@ bool CpuFreqLinux::isBoostingEnabled() const{
 }
 
 void CpuFreqLinux::enableBoosting() const{
-    writeFile(_boostingFile, "1");
+    writeFile(_boostingFile, _boostingInverted ? "0" : "1");
 }
 
 void CpuFreqLinux::disableBoosting() const{
-    writeFile(_boostingFile, "0");
+    writeFile(_boostingFile, _boostingInverted ? "1" : "0");
 }
 
 }
@@ -7,6 +7,25 @@
 namespace mammut{
 namespace cpufreq{
 
+static void setVoltageTableSettings(const VoltageTableParameters& parameters, VoltageTableSettings* settings){
+    settings->set_only_physical_cores(parameters.onlyPhysicalCores);
+    settings->set_sampling_interval(parameters.samplingInterval);
+    settings->set_window_samples(parameters.windowSamples);
+    settings->set_tolerance(parameters.tolerance);
+    settings->set_max_windows(parameters.maxWindows);
+    settings->set_file_name(parameters.fileName);
+}
+
+static std::map<DomainId, VoltageTable> toVoltageTables(const VoltageTableRes& r){
+    std::map<DomainId, VoltageTable> tables;
+    for(int i = 0; i < r.entries_size(); i++){
+        const VoltageTableRes::Entry& entry = r.entries(i);
+        VoltageTableKey key(entry.num_virtual_cores(), entry.frequency());
+        tables[entry.domain_id()][key] = entry.voltage();
+    }
+    return tables;
+}
+
 DomainRemote::DomainRemote(Communicator* const communicator,
                            DomainId domainIdentifier,
                            std::vector<topology::VirtualCore*> virtualCores):
@@ -142,6 +161,32 @@ Voltage DomainRemote::getCurrentVoltage() const{
     return r.result();
 }
 
+VoltageTable DomainRemote::getVoltageTable(bool onlyPhysicalCores) const{
+    VoltageTableParameters parameters;
+    parameters.onlyPhysicalCores = onlyPhysicalCores;
+    return getVoltageTable(parameters);
+}
+
+VoltageTable DomainRemote::getVoltageTable(uint numVirtualCores, bool onlyPhysicalCores) const{
+    GetVoltageTable gvt;
+    VoltageTableRes r;
+    VoltageTableParameters parameters;
+    parameters.onlyPhysicalCores = onlyPhysicalCores;
+    gvt.set_id(getId());
+    gvt.set_num_virtual_cores(numVirtualCores);
+    setVoltageTableSettings(parameters, gvt.mutable_settings());
+    _communicator->remoteCall(gvt, r);
+    return toVoltageTables(r)[getId()];
+}
+
+VoltageTable DomainRemote::getVoltageTable(const VoltageTableParameters& parameters) const{
+    GetVoltageTable gvt;
+    VoltageTableRes r;
+    gvt.set_id(getId());
+    setVoltageTableSettings(parameters, gvt.mutable_settings());
+    _communicator->remoteCall(gvt, r);
+    return toVoltageTables(r)[getId()];
+}
 
 CpuFreqRemote::CpuFreqRemote(Communicator* const communicator):_communicator(communicator){
     GetDomains gd;
@@ -168,6 +213,20 @@ std::vector<Domain*> CpuFreqRemote::getDomains() const{
     return _domains;
 }
 
+std::map<DomainId, VoltageTable> CpuFreqRemote::getVoltageTables(const VoltageTableParameters& parameters) const{
+    // Domains are characterized in parallel on the remote machine.
+    GetVoltageTables gvt;
+    VoltageTableRes r;
+    setVoltageTableSettings(parameters, gvt.mutable_settings());
+    _communicator->remoteCall(gvt, r);
+    return toVoltageTables(r);
+}
+
+std::vector<UncoreDomain*> CpuFreqRemote::getUncoreDomains() const{
+    // Not yet supported on remote machines.
+    return std::vector<UncoreDomain*>();
+}
+
 bool CpuFreqRemote::isBoostingSupported() const{
     IsBoostingSupported ibs;
     Result r;
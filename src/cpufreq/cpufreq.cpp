@@ -6,9 +6,16 @@
 #endif
 #include <mammut/utils.hpp>
 
+#include "algorithm"
+#include "fcntl.h"
 #include "fstream"
+#include "limits"
 #include "sstream"
 #include "stdexcept"
+#include "string.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+#include "unistd.h"
 
 #include "iostream"
 
@@ -55,6 +62,10 @@ DomainId Domain::getId() const{
     return _domainIdentifier;
 }
 
+bool Domain::hasContinuousFrequencies() const{
+    return false;
+}
+
 bool Domain::isGovernorAvailable(Governor governor) const{
     return utils::contains(getAvailableGovernors(), governor);
 }
@@ -77,6 +88,14 @@ bool Domain::setLowestFrequencyUserspace() const{
     }
 }
 
+UncoreDomain::UncoreDomain(topology::CpuId cpuId):_cpuId(cpuId){
+    ;
+}
+
+topology::CpuId UncoreDomain::getCpuId() const{
+    return _cpuId;
+}
+
 Governor CpuFreq::getGovernorFromGovernorName(const std::string& governorName){
     Governor g;
     return utils::stringToEnum(governorName, g);
@@ -187,6 +206,15 @@ void CpuFreq::reinsertTurboFrequencies(){
     }
 }
 
+UncoreDomain* CpuFreq::getUncoreDomain(const topology::Cpu* cpu) const{
+    for(UncoreDomain* d : getUncoreDomains()){
+        if(d->getCpuId() == cpu->getCpuId()){
+            return d;
+        }
+    }
+    return NULL;
+}
+
 RollbackPoint CpuFreq::getRollbackPoint() const{
     RollbackPoint rp;
     for(Domain* d : getDomains()){
@@ -198,6 +226,16 @@ RollbackPoint CpuFreq::getRollbackPoint() const{
         rp.lowerBounds.push_back(lb);
         rp.upperBounds.push_back(ub);
     }
+    for(UncoreDomain* d : getUncoreDomains()){
+        Frequency lb = 0, ub = 0;
+        if(!d->getFrequencyBounds(lb, ub)){
+            // Not restored by rollback().
+            lb = 0;
+            ub = 0;
+        }
+        rp.uncoreLowerBounds.push_back(lb);
+        rp.uncoreUpperBounds.push_back(ub);
+    }
     return rp;
 }
 
@@ -225,6 +263,20 @@ void CpuFreq::rollback(const RollbackPoint& rollbackPoint) const{
 
         i++;
     }
+
+    std::vector<UncoreDomain*> uncoreDomains = getUncoreDomains();
+    for(size_t j = 0; j < rollbackPoint.uncoreLowerBounds.size() && j < uncoreDomains.size(); j++){
+        if(!rollbackPoint.uncoreLowerBounds[j] && !rollbackPoint.uncoreUpperBounds[j]){
+            // The bounds could not be read when the rollback point was taken.
+            continue;
+        }
+        if(!uncoreDomains.at(j)->setFrequencyBounds(rollbackPoint.uncoreLowerBounds[j],
+                                                    rollbackPoint.uncoreUpperBounds[j])){
+            throw std::runtime_error("Domain: Impossible to rollback the uncore domain to bounds: " +
+                                     utils::intToString(rollbackPoint.uncoreLowerBounds[j]) + " " +
+                                     utils::intToString(rollbackPoint.uncoreUpperBounds[j]));
+        }
+    }
 }
 
 bool CpuFreq::isGovernorAvailable(Governor governor) const{
@@ -240,6 +292,84 @@ bool CpuFreq::isGovernorAvailable(Governor governor) const{
     return true;
 }
 
+/**
+ * Characterizes, one after the other, the domains of a Cpu.
+ * Domains of the same Cpu (e.g. per-core policies of acpi-cpufreq
+ * and intel_pstate) usually share the voltage rail, so they can't
+ * be characterized at the same time.
+ */
+class VoltageTableThread: public utils::Thread{
+private:
+    std::vector<const Domain*> _domains;
+    VoltageTableParameters _parameters;
+    std::map<DomainId, VoltageTable> _tables;
+    std::string _error;
+public:
+    explicit VoltageTableThread(const VoltageTableParameters& parameters):
+            _parameters(parameters){
+        ;
+    }
+
+    void addDomain(const Domain* domain){
+        _domains.push_back(domain);
+    }
+
+    void run(){
+        try{
+            for(size_t i = 0; i < _domains.size(); i++){
+                const Domain* domain = _domains.at(i);
+                VoltageTableParameters domainParameters = _parameters;
+                if(!_parameters.fileName.empty()){
+                    domainParameters.fileName += "." + utils::intToString(domain->getId());
+                }
+                _tables[domain->getId()] = domain->getVoltageTable(domainParameters);
+            }
+        }catch(const std::exception& e){
+            _error = e.what();
+        }
+    }
+
+    const std::map<DomainId, VoltageTable>& getTables() const{
+        return _tables;
+    }
+
+    const std::string& getError() const{
+        return _error;
+    }
+};
+
+std::map<DomainId, VoltageTable> CpuFreq::getVoltageTables(const VoltageTableParameters& parameters) const{
+    std::vector<Domain*> domains = getDomains();
+    // One thread for each Cpu.
+    std::map<topology::CpuId, VoltageTableThread*> threads;
+    for(size_t i = 0; i < domains.size(); i++){
+        topology::CpuId cpuId = domains.at(i)->getVirtualCores().at(0)->getCpuId();
+        if(threads.find(cpuId) == threads.end()){
+            threads[cpuId] = new VoltageTableThread(parameters);
+        }
+        threads[cpuId]->addDomain(domains.at(i));
+    }
+    for(auto it = threads.begin(); it != threads.end(); it++){
+        it->second->start();
+    }
+
+    std::map<DomainId, VoltageTable> r;
+    std::string error;
+    for(auto it = threads.begin(); it != threads.end(); it++){
+        it->second->join();
+        const std::map<DomainId, VoltageTable>& tables = it->second->getTables();
+        r.insert(tables.begin(), tables.end());
+        if(!it->second->getError().empty()){
+            error = it->second->getError();
+        }
+        delete it->second;
+    }
+    if(!error.empty()){
+        throw std::runtime_error("getVoltageTables: " + error);
+    }
+    return r;
+}
+
 void loadVoltageTable(VoltageTable& voltageTable, std::string fileName){
     std::ifstream file;
     file.open(fileName.c_str());
@@ -252,8 +382,8 @@ void loadVoltageTable(VoltageTable& voltageTable, std::string fileName){
     std::vector<std::string> fields;
     VoltageTableKey key;
     while(std::getline(file, line)){
-        /** Skips lines starting with #. **/
-        if(line.at(0) == '#'){
+        /** Skips empty lines and lines starting with #. **/
+        if(line.empty() || line.at(0) == '#'){
             continue;
         }
         fields = utils::split(line, ';');
@@ -279,7 +409,179 @@ void dumpVoltageTable(const VoltageTable& voltageTable, std::string fileName){
     file.close();
 }
 
+#define MAMMUT_VOLTAGE_MODEL_MAGIC 0x4D564D4D // "MMVM"
+#define MAMMUT_VOLTAGE_MODEL_VERSION 1
+
+static size_t alignSize(size_t size){
+    return (size + 7) & ~((size_t) 7);
+}
+
+/**
+ * Computes the size of a voltage model.
+ * @return false if the size can't be represented.
+ */
+static bool getVoltageModelSize(uint32_t numRows, uint32_t numFrequencies, size_t& size){
+    const size_t max = std::numeric_limits<size_t>::max();
+    size_t rows = (size_t) numRows + 2;
+    if(numFrequencies > (max - 8) / sizeof(Frequency) ||
+       (numFrequencies && rows > max / numFrequencies / sizeof(double))){
+        return false;
+    }
+    size_t frequenciesSize = 4 * sizeof(uint32_t) + alignSize((size_t) numFrequencies * sizeof(Frequency));
+    size_t valuesSize = rows * numFrequencies * sizeof(double);
+    if(frequenciesSize > max - valuesSize){
+        return false;
+    }
+    size = frequenciesSize + valuesSize;
+    return true;
+}
+
+void VoltageModel::setPointers(){
+    uint32_t* header = (uint32_t*) _data;
+    _numRows = header[2];
+    _numFrequencies = header[3];
+    _frequencies = (Frequency*) (_data + 4 * sizeof(uint32_t));
+    _voltages = (double*) (_data + 4 * sizeof(uint32_t) +
+                           alignSize((size_t) _numFrequencies * sizeof(Frequency)));
+    _staticPower = _voltages + (size_t) _numRows * _numFrequencies;
+    _dynamicPower = _staticPower + _numFrequencies;
+}
+
+VoltageModel::VoltageModel(const VoltageTable& voltageTable):
+        _data(NULL), _size(0), _mapped(false){
+    std::vector<Frequency> frequencies;
+    uint32_t numRows = 1;
+    for(VoltageTableIterator iterator = voltageTable.begin(); iterator != voltageTable.end(); ++iterator){
+        numRows = std::max(numRows, iterator->first.first + 1);
+        frequencies.push_back(iterator->first.second);
+    }
+    std::sort(frequencies.begin(), frequencies.end());
+    frequencies.erase(std::unique(frequencies.begin(), frequencies.end()), frequencies.end());
+
+    if(frequencies.size() > std::numeric_limits<uint32_t>::max() ||
+       !getVoltageModelSize(numRows, frequencies.size(), _size)){
+        throw std::runtime_error("Voltage table too large.");
+    }
+    _data = new char[_size];
+    memset(_data, 0, _size);
+    uint32_t* header = (uint32_t*) _data;
+    header[0] = MAMMUT_VOLTAGE_MODEL_MAGIC;
+    header[1] = MAMMUT_VOLTAGE_MODEL_VERSION;
+    header[2] = numRows;
+    header[3] = frequencies.size();
+    setPointers();
+    for(size_t i = 0; i < frequencies.size(); i++){
+        _frequencies[i] = frequencies.at(i);
+    }
+    for(VoltageTableIterator iterator = voltageTable.begin(); iterator != voltageTable.end(); ++iterator){
+        _voltages[iterator->first.first * _numFrequencies +
+                  getFrequencyIndex(iterator->first.second)] = iterator->second;
+    }
+}
+
+VoltageModel::VoltageModel(const std::string& fileName):
+        _data(NULL), _size(0), _mapped(true){
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if(fd == -1){
+        throw std::runtime_error("Impossible to open the specified voltage model file.");
+    }
+    struct stat st;
+    if(fstat(fd, &st) || (size_t) st.st_size < 4 * sizeof(uint32_t)){
+        close(fd);
+        throw std::runtime_error("Invalid voltage model file.");
+    }
+    _size = st.st_size;
+    // Private mapping: pages are shared until they are modified.
+    void* data = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED){
+        throw std::runtime_error("Impossible to map the specified voltage model file.");
+    }
+    _data = (char*) data;
+    uint32_t* header = (uint32_t*) _data;
+    size_t size;
+    if(header[0] != MAMMUT_VOLTAGE_MODEL_MAGIC ||
+       header[1] != MAMMUT_VOLTAGE_MODEL_VERSION ||
+       !header[2] ||
+       !getVoltageModelSize(header[2], header[3], size) || size != _size){
+        munmap(_data, _size);
+        throw std::runtime_error("Invalid voltage model file.");
+    }
+    setPointers();
+    // getFrequencyIndex() relies on sorted frequencies.
+    for(uint32_t i = 1; i < _numFrequencies; i++){
+        if(_frequencies[i] <= _frequencies[i - 1]){
+            munmap(_data, _size);
+            throw std::runtime_error("Invalid voltage model file.");
+        }
+    }
+}
+
+VoltageModel::~VoltageModel(){
+    if(_mapped){
+        munmap(_data, _size);
+    }else{
+        delete[] _data;
+    }
+}
+
+void VoltageModel::save(const std::string& fileName) const{
+    std::ofstream file(fileName.c_str(), std::ios::binary | std::ios::trunc);
+    if(!file){
+        throw std::runtime_error("Impossible to open the specified voltage model file.");
+    }
+    file.write(_data, _size);
+    if(!file){
+        throw std::runtime_error("Impossible to write the specified voltage model file.");
+    }
+}
+
+VoltageTable VoltageModel::getVoltageTable() const{
+    VoltageTable r;
+    for(uint32_t i = 0; i < _numRows; i++){
+        for(uint32_t j = 0; j < _numFrequencies; j++){
+            r[VoltageTableKey(i, _frequencies[j])] = getVoltage(i, j);
+        }
+    }
+    return r;
+}
+
+int VoltageModel::getFrequencyIndex(Frequency frequency) const{
+    Frequency* end = _frequencies + _numFrequencies;
+    Frequency* it = std::lower_bound(_frequencies, end, frequency);
+    if(it == end || *it != frequency){
+        return -1;
+    }
+    return it - _frequencies;
+}
+
+void VoltageModel::setPowerCoefficients(size_t frequencyIndex, double staticPower, double dynamicPower){
+    _staticPower[frequencyIndex] = staticPower;
+    _dynamicPower[frequencyIndex] = dynamicPower;
+}
+
 #ifdef MAMMUT_REMOTE
+static VoltageTableParameters getVoltageTableParameters(const VoltageTableSettings& settings){
+    VoltageTableParameters parameters;
+    parameters.onlyPhysicalCores = settings.only_physical_cores();
+    parameters.samplingInterval = settings.sampling_interval();
+    parameters.windowSamples = settings.window_samples();
+    parameters.tolerance = settings.tolerance();
+    parameters.maxWindows = settings.max_windows();
+    parameters.fileName = settings.file_name();
+    return parameters;
+}
+
+static void addVoltageTableEntries(DomainId domainId, const VoltageTable& table, VoltageTableRes& r){
+    for(VoltageTableIterator iterator = table.begin(); iterator != table.end(); ++iterator){
+        VoltageTableRes::Entry* entry = r.add_entries();
+        entry->set_domain_id(domainId);
+        entry->set_num_virtual_cores(iterator->first.first);
+        entry->set_frequency(iterator->first.second);
+        entry->set_voltage(iterator->second);
+    }
+}
+
 std::string CpuFreq::getModuleName(){
     // Any message defined in the .proto file is ok.
     GetAvailableFrequencies gaf;
@@ -492,6 +794,35 @@ bool CpuFreq::processMessage(const std::string& messageIdIn, const std::string&
         }
     }
 
+    {
+        GetVoltageTable gvt;
+        if(utils::getDataFromMessage<GetVoltageTable>(messageIdIn, messageIn, gvt)){
+            VoltageTableRes r;
+            VoltageTableParameters parameters = getVoltageTableParameters(gvt.settings());
+            Domain* domain = domains.at(gvt.id());
+            if(gvt.has_num_virtual_cores()){
+                addVoltageTableEntries(gvt.id(), domain->getVoltageTable(gvt.num_virtual_cores(),
+                                                                         parameters.onlyPhysicalCores), r);
+            }else{
+                addVoltageTableEntries(gvt.id(), domain->getVoltageTable(parameters), r);
+            }
+            return utils::setMessageFromData(&r, messageIdOut, messageOut);
+        }
+    }
+
+    {
+        GetVoltageTables gvt;
+        if(utils::getDataFromMessage<GetVoltageTables>(messageIdIn, messageIn, gvt)){
+            VoltageTableRes r;
+            std::map<DomainId, VoltageTable> tables = getVoltageTables(getVoltageTableParameters(gvt.settings()));
+            for(std::map<DomainId, VoltageTable>::const_iterator iterator = tables.begin();
+                iterator != tables.end(); ++iterator){
+                addVoltageTableEntries(iterator->first, iterator->second, r);
+            }
+            return utils::setMessageFromData(&r, messageIdOut, messageOut);
+        }
+    }
+
     return false;
 }
 #endif
@@ -2,6 +2,7 @@
 
 #include "../external/odroid-smartpower-linux/smartgauge.hpp"
 
+#include "algorithm"
 #include "cmath"
 #include "errno.h"
 #include "fcntl.h"
@@ -12,6 +13,10 @@
 #include "cstring"
 #include "unistd.h"
 #include "iostream"
+#include "poll.h"
+#include "sched.h"
+#include "sys/eventfd.h"
+#include "sys/timerfd.h"
 /* RAPL UNIT BITMASK */
 #define POWER_UNIT_OFFSET 0
 #define POWER_UNIT_MASK 0x0F
@@ -27,6 +32,8 @@
 using namespace mammut::utils;
 
 namespace mammut{
+extern SimulationParameters simulationParameters;
+
 namespace energy{
 
 CounterAmesterLinux::CounterAmesterLinux(string jlsSensor, string wtsSensor):
@@ -62,46 +69,86 @@ void CounterAmesterLinux::reset(){
     _lastValue = getAdjustedValue();
 }
 
-CounterPlugSmartPower2Linux::CounterPlugSmartPower2Linux():_usbFile(NULL), _cumulativeJoules(0){
+// Maximum time we wait for data from the SmartPower2 (milliseconds).
+#define SMARTPOWER2_TIMEOUT 1000
+
+PowerMeterSmartPower2Linux::PowerMeterSmartPower2Linux():_fd(-1){
     ;
 }
 
-CounterPlugSmartPower2Linux::~CounterPlugSmartPower2Linux(){
-    if(_usbFile){
-        fclose(_usbFile);
-        _usbFile = NULL;
+PowerMeterSmartPower2Linux::~PowerMeterSmartPower2Linux(){
+    if(_fd != -1){
+        close(_fd);
+        _fd = -1;
     }
 }
 
-bool CounterPlugSmartPower2Linux::CounterPlugSmartPower2Linux::init(){
+bool PowerMeterSmartPower2Linux::init(){
     char* usbName = getenv("MAMMUT_SMARTPOWER2_PATH");
     if(!usbName){
         return false;
     }
-    _usbFile = fopen(usbName, "r");    
-    if (_usbFile == NULL) {
+    // Non blocking, so that a silent device does not block the sampler forever.
+    _fd = open(usbName, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    if(_fd == -1){
         return false;
     }
-    _lastTimestamp = getMillisecondsTime();    
     return true;
 }
 
-double CounterPlugSmartPower2Linux::getWatts(){
-  if(!_usbFile){
-    return 0;
+bool PowerMeterSmartPower2Linux::readLine(std::string& line){
+    size_t pos;
+    while((pos = _buffer.find('\n')) == std::string::npos){
+        struct pollfd pfd;
+        pfd.fd = _fd;
+        pfd.events = POLLIN;
+        int r = poll(&pfd, 1, SMARTPOWER2_TIMEOUT);
+        if(r == -1 && errno == EINTR){
+            continue;
+        }else if(r <= 0){
+            return false;
+        }
+        char buff[256];
+        ssize_t n = read(_fd, buff, sizeof(buff));
+        if(n == -1 && (errno == EAGAIN || errno == EINTR)){
+            continue;
+        }else if(n <= 0){
+            // Error or device disconnected.
+            return false;
+        }
+        _buffer.append(buff, n);
+    }
+    line = _buffer.substr(0, pos);
+    _buffer.erase(0, pos + 1);
+    return true;
+}
+
+bool PowerMeterSmartPower2Linux::getWatts(double& watts){
+  if(_fd == -1){
+    return false;
   }
 
   int len=0;
   char * data = NULL, *line = NULL, buff[50];
-  
-  buff[0]='\n';
-  while(buff[0] == '\n') fgets(buff, 50, (FILE*)_usbFile);//there is an empty line between power data
-  
+  std::string l;
+
+  //there is an empty line between power data
+  do{
+    if(!readLine(l)){
+      return false;
+    }
+  }while(l.empty() || l == "\r");
+
+  strncpy(buff, l.c_str(), sizeof(buff) - 1);
+  buff[sizeof(buff) - 1] = '\0';
   line = buff;
   len = strlen(buff);
   
   if (len > 28){ //So the first two values are voltage.
     line = strchr(buff, ','); //removing the first value
+    if(!line){
+      return false;
+    }
     line+=1;//remove the  comma
   }
 
@@ -114,25 +161,14 @@ double CounterPlugSmartPower2Linux::getWatts(){
       count++;
     }
   }else{
-    return 0;
+    return false;
   }
 
-  double p = atof(data);
-
-  return p;
-}
-
-Joules CounterPlugSmartPower2Linux::getJoules(){
-    double watts = getWatts();
-    ulong now = getMillisecondsTime();
-    _cumulativeJoules += watts*((now - _lastTimestamp)/1000.0);
-    _lastTimestamp = now;
-    return _cumulativeJoules;
-}
-
-void CounterPlugSmartPower2Linux::reset(){
-    _cumulativeJoules = 0;
-    _lastTimestamp = getMillisecondsTime();
+  if(!data){
+    return false;
+  }
+  watts = atof(data);
+  return true;
 }
 
 CounterPlugSmartGaugeLinux::CounterPlugSmartGaugeLinux():_lastValue(0){
@@ -164,37 +200,27 @@ void CounterPlugSmartGaugeLinux::reset(){
 }
 
 #define COUNTER_FILE_LINUX_NAME "/tmp/counter_power.csv"
+// Interval between two reads of the file (milliseconds).
+#define COUNTER_FILE_LINUX_INTERVAL 100
 
-CounterPlugFileLinux::CounterPlugFileLinux():
-  _lastTimestamp(getMillisecondsTime()), _cumulativeJoules(0){
-	;
+bool PowerMeterFileLinux::init(){
+	return existsFile(COUNTER_FILE_LINUX_NAME);
 }
 
-bool CounterPlugFileLinux::init(){
-	bool available = existsFile(COUNTER_FILE_LINUX_NAME);
-	if(available){
-		_lastTimestamp = getMillisecondsTime();
+bool PowerMeterFileLinux::getWatts(double& watts){
+	// The file may be rewritten while we read it.
+	std::ifstream file(COUNTER_FILE_LINUX_NAME);
+	std::string s;
+	if(!file || !getline(file, s) || s.empty()){
+		return false;
 	}
-	return available;
-}
-
-double CounterPlugFileLinux::getWatts(){
-	std::string s = readFirstLineFromFile(COUNTER_FILE_LINUX_NAME);
 	std::vector<std::string> values = split(s, ',');
-	return atof(values[0].c_str());
-}
-
-Joules CounterPlugFileLinux::getJoules(){
-	double watts = getWatts();
-	ulong now = getMillisecondsTime();
-	_cumulativeJoules += watts*((now - _lastTimestamp)/1000.0);
-	_lastTimestamp = now;
-	return _cumulativeJoules;
+	watts = atof(values[0].c_str());
+	return true;
 }
 
-void CounterPlugFileLinux::reset(){
-	_cumulativeJoules = 0;
-	_lastTimestamp = getMillisecondsTime();
+uint PowerMeterFileLinux::getSamplingInterval(){
+	return COUNTER_FILE_LINUX_INTERVAL;
 }
 
 #include <sys/ioctl.h>
@@ -232,118 +258,117 @@ SensorIna::~SensorIna(){
   }
 }
 
-double SensorIna::getWatts(){
+bool SensorIna::getWatts(double& watts){
   if(ioctl(_fd, INA231_IOCGREG, &_data) < 0)
-    throw std::runtime_error("CounterPlugINA: ioctl error (2)");
-  return (_data.cur_uW / 1000.0) / 1000.0;
+    return false;
+  watts = (_data.cur_uW / 1000.0) / 1000.0;
+  return true;
 }
 
-bool CounterPlugINALinux::init(){
-  _lastRead = getMillisecondsTime();
-  return _sensorA7.init() && _sensorA15.init();
-}
+// Interval between two reads of the INA231 sensors (milliseconds).
+#define COUNTER_INA_LINUX_INTERVAL 10
 
-CounterPlugINALinux::CounterPlugINALinux():
-  _sensorA7("/dev/sensor_kfc"), _sensorA15("/dev/sensor_arm"), _cumulativeJoules(0){
+PowerMeterINALinux::PowerMeterINALinux():
+  _sensorA7("/dev/sensor_kfc"), _sensorA15("/dev/sensor_arm"){
   ;
 }
 
-CounterPlugINALinux::~CounterPlugINALinux(){
-
+bool PowerMeterINALinux::init(){
+  return _sensorA7.init() && _sensorA15.init();
 }
 
-Joules CounterPlugINALinux::getJoules(){
-  double now = getMillisecondsTime();
-  Joules j = (_sensorA7.getWatts() + _sensorA15.getWatts()) * ((now - _lastRead)/1000.0);
-  _cumulativeJoules += j;
-  _lastRead = now;
-  return j;
+bool PowerMeterINALinux::getWatts(double& watts){
+  double a7, a15;
+  if(!_sensorA7.getWatts(a7) || !_sensorA15.getWatts(a15)){
+    return false;
+  }
+  watts = a7 + a15;
+  return true;
 }
 
-void CounterPlugINALinux::reset(){
-  _cumulativeJoules = 0;
-  _lastRead = getMillisecondsTime();
+uint PowerMeterINALinux::getSamplingInterval(){
+  return COUNTER_INA_LINUX_INTERVAL;
 }
 
-bool CounterMemoryRaplLinux::init(){
-    if(_ccl){
-        return true;
-    }else{
-        return false;
-    }
+RaplBackendAccumulator::RaplBackendAccumulator(RaplBackend* backend):_backend(backend){
+    ;
 }
 
-CounterMemoryRaplLinux::CounterMemoryRaplLinux():_ccl(new CounterCpusLinuxMsr()){
-    if(!_ccl->init()){
-        delete _ccl;
-        _ccl = NULL;
+void RaplBackendAccumulator::run(){
+    struct pollfd fds[2];
+    fds[0].fd = _backend->_timerFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = _backend->_stopFd;
+    fds[1].events = POLLIN;
+    while(true){
+        if(poll(fds, 2, -1) == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            throw std::runtime_error("RaplBackend: poll failed: " + utils::errnoToStr());
+        }
+        if(fds[1].revents & POLLIN){
+            return;
+        }
+        if(fds[0].revents & POLLIN){
+            uint64_t expirations;
+            if(::read(_backend->_timerFd, &expirations, sizeof(expirations)) == sizeof(expirations)){
+                _backend->updateAll();
+            }
+        }
     }
 }
 
-Joules CounterMemoryRaplLinux::getJoules(){
-    if(_ccl){
-        return _ccl->getJoulesDramAll();
-    }else{
-        return 0;
+std::mutex RaplBackend::_instancesLock;
+RaplBackend* RaplBackend::_instances[RAPL_SOURCE_NUM] = {NULL};
+
+#define RAPL_SYSFS_PREFIX (simulationParameters.sysfsRootPrefix + "/sys/class/powercap/intel-rapl/intel-rapl:")
+// Upper bound of the platform power, used to compute its wrapping interval (Watts).
+#define RAPL_PLATFORM_MAX_POWER 500.0
+// Interval used when the wrapping interval is not known (seconds).
+#define RAPL_SYSFS_WRAPPING_INTERVAL 10.0
+// Per physical core counters read less than this time ago are not read
+// again (milliseconds). The hardware updates them about every millisecond.
+#define RAPL_CORES_MIN_UPDATE_INTERVAL 1.0
+// Value at which the MSR counters wrap.
+#define RAPL_MSR_RANGE (((uint64_t) 1) << 32)
+// Minimum update period (seconds). A zero timer value would disarm the timer.
+#define RAPL_MIN_UPDATE_PERIOD 0.001
+
+RaplBackend::RaplBackend(RaplSource source):
+        _source(source), _references(0),
+        _topology(topology::Topology::getInstance()),
+        _cpus(_topology->getCpus()), _family(CPU_FAMILY_INTEL),
+        _energyPerUnit(0), _range(0), _wrappingInterval(0),
+        _hasCore(false), _coresEnergyPerUnit(0), _coresBatch(NULL), _coresLastUpdate(0),
+        _hasPlatform(false), _platformRange(0), _platformLastRaw(0), _platformJoules(0),
+        _timerFd(-1), _stopFd(-1), _accumulator(NULL){
+    for(size_t i = 0; i < RAPL_DOMAIN_NUM; i++){
+        _hasDomain[i] = false;
     }
 }
 
-void CounterMemoryRaplLinux::reset(){
-    if(_ccl){
-        _ccl->reset();
+RaplBackend::~RaplBackend(){
+    if(_accumulator){
+        uint64_t one = 1;
+        // Writing to an eventfd only fails on counter overflow.
+        ssize_t written = write(_stopFd, &one, sizeof(one));
+        (void) written;
+        _accumulator->join();
+        delete _accumulator;
     }
-}
-
-CounterCpusLinuxRefresher::CounterCpusLinuxRefresher(CounterCpusLinux *counter):_counter(counter){
-    ;
-}
-
-void CounterCpusLinuxRefresher::run(){
-    double sleepingIntervalMs = (_counter->getWrappingInterval() / 2) * 1000;
-    while(!_counter->_stopRefresher.timedWait(sleepingIntervalMs)){
-        _counter->getJoulesComponentsAll();
+    if(_timerFd != -1){
+        close(_timerFd);
     }
+    if(_stopFd != -1){
+        close(_stopFd);
+    }
+    delete _coresBatch;
+    utils::deleteVectorElements<utils::Msr*>(_msrs);
+    topology::Topology::release(_topology);
 }
 
-CounterCpusLinux::CounterCpusLinux():
-  CounterCpus(topology::Topology::getInstance()),
-  _stopRefresher(){
-  ;
-}
-
-JoulesCpu CounterCpusLinux::getJoulesComponents(topology::CpuId cpuId){
-  return JoulesCpu(getJoulesCpu(cpuId), getJoulesCores(cpuId), getJoulesGraphic(cpuId), getJoulesDram(cpuId));
-}
-
-bool CounterCpusLinuxMsr::hasCoresCounter(topology::Cpu* cpu){
-  if(_family == CPU_FAMILY_INTEL){
-    uint64_t dummy;
-    return Msr(cpu->getVirtualCore()->getVirtualCoreId()).read(MSR_PP0_ENERGY_STATUS_INTEL, dummy) && dummy > 0;
-  }else if(_family == CPU_FAMILY_AMD){
-    return false; // TODO Return true and implement per-core readings
-  }
-  return false;
-}
-
-bool CounterCpusLinuxMsr::hasGraphicCounter(topology::Cpu* cpu){
-  if(_family == CPU_FAMILY_INTEL){
-    uint64_t dummy;
-    return Msr(cpu->getVirtualCore()->getVirtualCoreId()).read(MSR_PP1_ENERGY_STATUS_INTEL, dummy) && dummy > 0;
-  }else{
-    return false;
-  }
-}
-
-bool CounterCpusLinuxMsr::hasDramCounter(topology::Cpu* cpu){
-  if(_family == CPU_FAMILY_INTEL){
-    uint64_t dummy;
-    return Msr(cpu->getVirtualCore()->getVirtualCoreId()).read(MSR_DRAM_ENERGY_STATUS_INTEL, dummy) && dummy > 0;
-  }else{
-    return false;
-  }
-}
-
-bool CounterCpusLinuxMsr::isCpuIntelSupported(topology::Cpu* cpu){
+bool RaplBackend::isCpuIntelSupported(topology::Cpu* cpu){
     Msr msr(cpu->getVirtualCore()->getVirtualCoreId());
     uint64_t dummy, dummy2, dummy3; // 3 different variables to avoid cppcheck warnings.
     return !cpu->getFamily().compare("6") &&
@@ -354,399 +379,809 @@ bool CounterCpusLinuxMsr::isCpuIntelSupported(topology::Cpu* cpu){
            msr.read(MSR_PKG_ENERGY_STATUS_INTEL, dummy3);
 }
 
-bool CounterCpusLinuxMsr::isCpuAMDSupported(topology::Cpu* cpu){
+bool RaplBackend::isCpuAMDSupported(topology::Cpu* cpu){
     Msr msr(cpu->getVirtualCore()->getVirtualCoreId());
     uint64_t dummy, dummy3; // 3 different variables to avoid cppcheck warnings.
-    return !cpu->getFamily().compare("23") &&
+    // Zen (17h), Zen 3/4 (19h) and Zen 5 (1Ah).
+    std::string family = cpu->getFamily();
+    return (!family.compare("23") || !family.compare("25") || !family.compare("26")) &&
            !cpu->getVendorId().compare(0, 12, "AuthenticAMD") &&
            msr.available() &&
            msr.read(MSR_RAPL_POWER_UNIT_AMD, dummy) && dummy &&
            msr.read(MSR_PKG_ENERGY_STATUS_AMD, dummy3);
 }
 
-bool CounterCpusLinuxMsr::isCpuSupported(topology::Cpu* cpu){
-    return isCpuIntelSupported(cpu) || isCpuAMDSupported(cpu);
-}
-
-CounterCpusLinuxMsr::CounterCpusLinuxMsr():
-        _initialized(false),
-        _lock(),
-        _refresher(NULL),
-        _msrs(NULL),
-        _maxId(0),
-        _powerPerUnit(0),
-        _energyPerUnit(0),
-        _timePerUnit(0),
-        _thermalSpecPower(0),
-        _joulesCpus(NULL),
-        _lastReadCountersCpu(NULL),
-        _lastReadCountersCores(NULL),
-        _lastReadCountersGraphic(NULL),
-        _lastReadCountersDram(NULL),
-        _hasJoulesCores(false),
-        _hasJoulesGraphic(false),
-        _hasJoulesDram(false){
-    ;
-}
-
-bool CounterCpusLinuxMsr::init(){
-    if(!_cpus[0]->getVendorId().compare(0, 12, "GenuineIntel")){
-      _family = CPU_FAMILY_INTEL;
-    }else if(!_cpus[0]->getVendorId().compare(0, 12, "AuthenticAMD")){
-      _family = CPU_FAMILY_AMD;
-    }else{
-      return false;
+uint32_t RaplBackend::getDomainMsr(CpuFamily family, RaplDomain domain){
+    if(family == CPU_FAMILY_AMD){
+        return MSR_PKG_ENERGY_STATUS_AMD;
     }
-
-    for(size_t i = 0; i < _cpus.size(); i++){
-        if(!isCpuSupported(_cpus.at(i))){
-            return false;
-        }	
+    switch(domain){
+        case RAPL_DOMAIN_CORES:{
+            return MSR_PP0_ENERGY_STATUS_INTEL;
+        }
+        case RAPL_DOMAIN_GRAPHIC:{
+            return MSR_PP1_ENERGY_STATUS_INTEL;
+        }
+        case RAPL_DOMAIN_DRAM:{
+            return MSR_DRAM_ENERGY_STATUS_INTEL;
+        }
+        default:{
+            return MSR_PKG_ENERGY_STATUS_INTEL;
+        }
     }
+}
 
-    _initialized = true;
-    _refresher = new CounterCpusLinuxRefresher(this);
-
-    /**
-     * I have one msr for each CPU. Since I have no guarantee that the CPU
-     * identifiers are contiguous, I find their maximum id to decide
-     * how long the array of msrs should be.
-     * For example, if a have a CPU with id 1 and a CPU with id 3, then
-     * I will allocate an array of 4 positions.
-     * In msrs[1] I will have the msr associated to CPU 1 and in msrs[3]
-     * I will have the msr associated to CPU 3.
-     */
-    _maxId = 0;
-    topology::Cpu* cpu;
+bool RaplBackend::initMsr(){
     for(size_t i = 0; i < _cpus.size(); i++){
-        cpu = _cpus.at(i);
-        if(cpu->getCpuId() > _maxId){
-            _maxId = cpu->getCpuId();
+        if(isCpuIntelSupported(_cpus.at(i))){
+            _family = CPU_FAMILY_INTEL;
+        }else if(isCpuAMDSupported(_cpus.at(i))){
+            _family = CPU_FAMILY_AMD;
+        }else{
+            return false;
         }
     }
 
-    _msrs = new Msr*[_maxId + 1];
     for(size_t i = 0; i < _cpus.size(); i++){
-        cpu = _cpus.at(i);
-        _msrs[cpu->getCpuId()] = new Msr(cpu->getVirtualCore()->getVirtualCoreId());
-        if(!_msrs[cpu->getCpuId()]->available()){
+        topology::Cpu* cpu = _cpus.at(i);
+        if(cpu->getCpuId() >= _msrs.size()){
+            _msrs.resize(cpu->getCpuId() + 1, NULL);
+        }
+        _msrs.at(cpu->getCpuId()) = new Msr(cpu->getVirtualCore()->getVirtualCoreId());
+        if(!_msrs.at(cpu->getCpuId())->available()){
             throw std::runtime_error("Impossible to open msr for CPU " +
                                      intToString(cpu->getCpuId()));
         }
     }
 
-    _joulesCpus = new JoulesCpu[_maxId + 1];
-
-    _lastReadCountersCpu = new uint32_t[_maxId + 1];
-    _lastReadCountersCores = new uint32_t[_maxId + 1];
-    _lastReadCountersGraphic = new uint32_t[_maxId + 1];
-    _lastReadCountersDram = new uint32_t[_maxId + 1];
-
     /*
      * Calculate the units used. We suppose to have the same units
      * for all the CPUs. So we can read the units of any of the CPUs.
      */
+    Msr* msr = _msrs.at(_cpus.at(0)->getCpuId());
     uint64_t result;
     if(_family == CPU_FAMILY_INTEL){
-      _msrs[_maxId]->read(MSR_RAPL_POWER_UNIT_INTEL, result);
+      msr->read(MSR_RAPL_POWER_UNIT_INTEL, result);
     }else{
-      _msrs[_maxId]->read(MSR_RAPL_POWER_UNIT_AMD, result);
+      msr->read(MSR_RAPL_POWER_UNIT_AMD, result);
     }
-    _powerPerUnit = pow(0.5,(double)(result&0xF));
+    double powerPerUnit = pow(0.5,(double)(result&0xF));
     _energyPerUnit = pow(0.5,(double)((result>>8)&0x1F));
-    _timePerUnit = pow(0.5,(double)((result>>16)&0xF));
+    _range = RAPL_MSR_RANGE;
+    double thermalSpecPower;
+    if(_family == CPU_FAMILY_INTEL){
+      msr->read(MSR_PKG_POWER_INFO_INTEL, result);
+      thermalSpecPower = powerPerUnit*(double)(result&0x7FFF);
+    }else{
+      thermalSpecPower = 180.0; // See https://lkml.org/lkml/2018/7/17/1275
+    }
+    _wrappingInterval = ((double) 0xFFFFFFFF) * _energyPerUnit / thermalSpecPower;
+
+    _hasDomain[RAPL_DOMAIN_PACKAGE] = true;
+    if(_family == CPU_FAMILY_INTEL){
+        for(size_t d = RAPL_DOMAIN_CORES; d < RAPL_DOMAIN_NUM; d++){
+            _hasDomain[d] = true;
+            for(size_t i = 0; i < _cpus.size(); i++){
+                uint64_t dummy;
+                if(!_msrs.at(_cpus.at(i)->getCpuId())->read(getDomainMsr(_family, static_cast<RaplDomain>(d)), dummy) || !dummy){
+                    _hasDomain[d] = false;
+                }
+            }
+        }
+    }
     if(_family == CPU_FAMILY_INTEL){
-      _msrs[_maxId]->read(MSR_PKG_POWER_INFO_INTEL, result);
-      _thermalSpecPower = _powerPerUnit*(double)(result&0x7FFF);
+        uint64_t dummy;
+        _hasPlatform = msr->read(MSR_PLATFORM_ENERGY_STATUS_INTEL, dummy) && dummy;
+        _platformRange = _range;
     }else if(_family == CPU_FAMILY_AMD){
-      _thermalSpecPower = 180.0; // See https://lkml.org/lkml/2018/7/17/1275
+        _coresEnergyPerUnit = _energyPerUnit;
+        _hasCore = initCores();
+        // The cores of a Cpu are the sum of its physical cores.
+        _hasDomain[RAPL_DOMAIN_CORES] = _hasCore;
     }
+    return true;
+}
 
-    _hasJoulesCores = true;
-    _hasJoulesDram = true;
-    _hasJoulesGraphic = true;
+bool RaplBackend::initCores(){
+    _coresBatch = new MsrBatch();
     for(size_t i = 0; i < _cpus.size(); i++){
-    	if(!hasCoresCounter(_cpus.at(i))){
-            _hasJoulesCores = false;
-    	}
-        if(!hasDramCounter(_cpus.at(i))){
-            _hasJoulesDram = false;
+        topology::CpuId cpuId = _cpus.at(i)->getCpuId();
+        if(cpuId >= _cpusCores.size()){
+            _cpusCores.resize(cpuId + 1);
         }
-        if(!hasGraphicCounter(_cpus.at(i))){
-            _hasJoulesGraphic = false;
+        std::vector<topology::PhysicalCore*> physicalCores = _cpus.at(i)->getPhysicalCores();
+        for(size_t j = 0; j < physicalCores.size(); j++){
+            topology::PhysicalCoreId id = physicalCores.at(j)->getPhysicalCoreId();
+            if(id >= _coresBatchIndexes.size()){
+                _coresBatchIndexes.resize(id + 1, 0);
+            }
+            // Each physical core has its own core energy register.
+            _coresBatchIndexes.at(id) = _coresBatch->add(physicalCores.at(j)->getVirtualCore()->getVirtualCoreId(),
+                                                         MSR_PP0_ENERGY_STATUS_AMD);
+            _cpusCores.at(cpuId).push_back(id);
+        }
+    }
+    _coresLastRaw.resize(_coresBatchIndexes.size(), 0);
+    _coresJoules.resize(_coresBatchIndexes.size(), 0);
+    if(!_coresBatch->read()){
+        delete _coresBatch;
+        _coresBatch = NULL;
+        _coresJoules.clear();
+        return false;
+    }
+    for(size_t i = 0; i < _cpusCores.size(); i++){
+        for(size_t j = 0; j < _cpusCores.at(i).size(); j++){
+            topology::PhysicalCoreId id = _cpusCores.at(i).at(j);
+            _coresBatch->get(_coresBatchIndexes.at(id), _coresLastRaw.at(id));
+            _coresLastRaw.at(id) &= 0xFFFFFFFF;
         }
     }
-
-    reset();
-    _refresher->start();
     return true;
 }
 
-CounterCpusLinuxMsr::~CounterCpusLinuxMsr(){
-    if(_initialized){
-        _stopRefresher.notifyAll();
-        _refresher->join();
-        delete _refresher;
+bool RaplBackend::initSysFs(){
+  for(size_t i = 0; i < _cpus.size(); i++){
+      if(!utils::existsFile(RAPL_SYSFS_PREFIX + utils::intToString(_cpus.at(i)->getCpuId()) + "/energy_uj")){
+          return false;
+      }
+  }
+  int sub = 0;
+  int ids[RAPL_DOMAIN_NUM] = {-1, -1, -1, -1};
+  while(utils::existsFile(RAPL_SYSFS_PREFIX + "0/intel-rapl:0:" + utils::intToString(sub) + "/name")){
+    std::string name = utils::readFirstLineFromFile(RAPL_SYSFS_PREFIX + "0/intel-rapl:0:" + utils::intToString(sub) + "/name");
+    if(name == "core"){
+      ids[RAPL_DOMAIN_CORES] = sub;
+    }else if(name == "dram"){
+      ids[RAPL_DOMAIN_DRAM] = sub;
+    }else if(name == "uncore"){ // TODO Not sure this is the correct name.
+      ids[RAPL_DOMAIN_GRAPHIC] = sub;
+    }
+    sub += 1;
+  }
+  for(size_t d = 0; d < RAPL_DOMAIN_NUM; d++){
+    _hasDomain[d] = (d == RAPL_DOMAIN_PACKAGE || ids[d] != -1);
+    for(size_t i = 0; i < _cpus.size(); i++){
+      topology::CpuId cpuId = _cpus.at(i)->getCpuId();
+      if(cpuId >= _paths[d].size()){
+        _paths[d].resize(cpuId + 1);
+      }
+      std::string cpuStr = utils::intToString(cpuId);
+      if(d == RAPL_DOMAIN_PACKAGE){
+        _paths[d].at(cpuId) = RAPL_SYSFS_PREFIX + cpuStr + "/energy_uj";
+      }else if(_hasDomain[d]){
+        _paths[d].at(cpuId) = RAPL_SYSFS_PREFIX + cpuStr + "/intel-rapl:" + cpuStr + ":" + utils::intToString(ids[d]) + "/energy_uj";
+      }
+    }
+  }
+  // The platform zone is a top-level zone, after the packages.
+  for(uint zone = 0; utils::existsFile(RAPL_SYSFS_PREFIX + utils::intToString(zone) + "/name"); zone++){
+    std::string path = RAPL_SYSFS_PREFIX + utils::intToString(zone) + "/";
+    if(utils::readFirstLineFromFile(path + "name") == "psys"){
+      _hasPlatform = true;
+      _platformPath = path + "energy_uj";
+      _platformRange = utils::stringToUlong(utils::readFirstLineFromFile(path + "max_energy_range_uj"));
+    }
+  }
+  _energyPerUnit = 1.0 / 1000000.0;
+  _range = utils::stringToUlong(utils::readFirstLineFromFile(RAPL_SYSFS_PREFIX + "0/max_energy_range_uj"));
+  _wrappingInterval = RAPL_SYSFS_WRAPPING_INTERVAL;
+  // Powercap does not expose the per physical core counters (AMD), so
+  // we read them from the MSRs when accessible.
+  bool amd = true;
+  for(size_t i = 0; i < _cpus.size(); i++){
+      amd = amd && isCpuAMDSupported(_cpus.at(i));
+  }
+  uint64_t result;
+  if(amd && Msr(_cpus.at(0)->getVirtualCore()->getVirtualCoreId()).read(MSR_RAPL_POWER_UNIT_AMD, result)){
+      _family = CPU_FAMILY_AMD;
+      _coresEnergyPerUnit = pow(0.5,(double)((result>>8)&0x1F));
+      _hasCore = initCores();
+      if(_hasCore){
+          _hasDomain[RAPL_DOMAIN_CORES] = true;
+      }
+  }
+  return true;
+}
+
+bool RaplBackend::init(){
+    bool available;
+    if(_source == RAPL_SOURCE_MSR){
+        available = initMsr();
+    }else{
+        available = initSysFs();
+    }
+    if(!available){
+        return false;
+    }
+
+    topology::CpuId maxId = 0;
+    for(size_t i = 0; i < _cpus.size(); i++){
+        maxId = std::max(maxId, _cpus.at(i)->getCpuId());
+    }
+    _lastRaw.resize((maxId + 1) * RAPL_DOMAIN_NUM, 0);
+    _joules.resize((maxId + 1) * RAPL_DOMAIN_NUM, 0);
+    for(size_t i = 0; i < _cpus.size(); i++){
+        for(size_t d = 0; d < RAPL_DOMAIN_NUM; d++){
+            // Per physical core counters are initialized by initCores().
+            if(_hasDomain[d] && !(d == RAPL_DOMAIN_CORES && _hasCore)){
+                topology::CpuId cpuId = _cpus.at(i)->getCpuId();
+                _lastRaw.at(cpuId * RAPL_DOMAIN_NUM + d) = readRaw(cpuId, static_cast<RaplDomain>(d));
+            }
+        }
+    }
+
+    if(_hasPlatform){
+        _platformLastRaw = readPlatformRaw();
+        // The platform may consume more than the package.
+        _wrappingInterval = std::min(_wrappingInterval, _platformRange * _energyPerUnit / RAPL_PLATFORM_MAX_POWER);
+    }
+
+    // Updates all the domains twice per wrapping interval.
+    _timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    _stopFd = eventfd(0, EFD_CLOEXEC);
+    if(_timerFd == -1 || _stopFd == -1){
+        throw std::runtime_error("RaplBackend: Impossible to create timer: " + utils::errnoToStr());
+    }
+    double period = std::max(_wrappingInterval / 2.0, RAPL_MIN_UPDATE_PERIOD);
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = (time_t) period;
+    spec.it_interval.tv_nsec = (long) ((period - spec.it_interval.tv_sec) * 1000000000.0);
+    spec.it_value = spec.it_interval;
+    if(timerfd_settime(_timerFd, 0, &spec, NULL) == -1){
+        throw std::runtime_error("RaplBackend: Impossible to set timer: " + utils::errnoToStr());
+    }
+    _accumulator = new RaplBackendAccumulator(this);
+    _accumulator->start();
+    return true;
+}
 
-        for(size_t i = 0; i < _maxId + 1; i++){
-            if(_msrs[i]){
-                delete _msrs[i];
+RaplBackend* RaplBackend::acquire(RaplSource source){
+    std::unique_lock<std::mutex> lock(_instancesLock);
+    std::vector<RaplSource> sources;
+    if(source == RAPL_SOURCE_ANY){
+        sources.push_back(RAPL_SOURCE_SYSFS);
+        sources.push_back(RAPL_SOURCE_MSR);
+        // Existing backends first.
+        for(size_t i = 0; i < sources.size(); i++){
+            if(_instances[sources.at(i)]){
+                ++_instances[sources.at(i)]->_references;
+                return _instances[sources.at(i)];
             }
         }
-        delete[] _msrs;
-
-        delete[] _joulesCpus;
-        delete[] _lastReadCountersCpu;
-        delete[] _lastReadCountersCores;
-        delete[] _lastReadCountersGraphic;
-        delete[] _lastReadCountersDram;
-    }
-}
-
-uint32_t CounterCpusLinuxMsr::readEnergyCounter(topology::CpuId cpuId, int which){
-    switch(which){
-        case MSR_PKG_ENERGY_STATUS_INTEL:
-        case MSR_PP0_ENERGY_STATUS_INTEL:
-        case MSR_PP1_ENERGY_STATUS_INTEL:
-        case MSR_DRAM_ENERGY_STATUS_INTEL:
-        case MSR_PKG_ENERGY_STATUS_AMD:
-        case MSR_PP0_ENERGY_STATUS_AMD:{
-            uint64_t result;
-            if(!_msrs[cpuId]->read(which, result) || !result){
-                throw std::runtime_error("Fatal error. Counter has been created but registers are not present.");
+    }else{
+        sources.push_back(source);
+    }
+    for(size_t i = 0; i < sources.size(); i++){
+        RaplSource s = sources.at(i);
+        if(!_instances[s]){
+            RaplBackend* backend = new RaplBackend(s);
+            bool available;
+            try{
+                available = backend->init();
+            }catch(...){
+                delete backend;
+                throw;
             }
-            return result & 0xFFFFFFFF;
-        }break;
-        default:{
-            throw std::runtime_error("Invalid energy counter specification.");
+            if(!available){
+                delete backend;
+                continue;
+            }
+            _instances[s] = backend;
         }
+        ++_instances[s]->_references;
+        return _instances[s];
     }
+    return NULL;
 }
 
-double CounterCpusLinuxMsr::getWrappingInterval(){
-    return ((double) 0xFFFFFFFF) * _energyPerUnit / _thermalSpecPower;
+void RaplBackend::release(RaplBackend* backend){
+    if(!backend){
+        return;
+    }
+    std::unique_lock<std::mutex> lock(_instancesLock);
+    if(--backend->_references == 0){
+        _instances[backend->_source] = NULL;
+        delete backend;
+    }
 }
 
-static uint32_t deltaDiff(uint32_t c1, uint32_t c2){
-    if(c2 > c1){
-        return c2 - c1;
+uint64_t RaplBackend::readRaw(topology::CpuId cpuId, RaplDomain domain){
+    if(_source == RAPL_SOURCE_MSR){
+        uint64_t result;
+        if(!_msrs.at(cpuId)->read(getDomainMsr(_family, domain), result)){
+            throw std::runtime_error("Fatal error. Counter has been created but registers are not present.");
+        }
+        return result & 0xFFFFFFFF;
     }else{
-        return (((uint32_t)0xFFFFFFFF) - c1) + (uint32_t)1 + c2;
+        return utils::stringToUlong(utils::readFirstLineFromFile(_paths[domain].at(cpuId)));
     }
 }
 
-void CounterCpusLinuxMsr::updateCounter(topology::CpuId cpuId, double& joules, uint32_t& lastReadCounter, uint32_t counterType){
-    uint32_t currentCounter = readEnergyCounter(cpuId, counterType);
-    joules += ((double) deltaDiff(lastReadCounter, currentCounter)) * _energyPerUnit;
-    lastReadCounter = currentCounter;
+void RaplBackend::update(topology::CpuId cpuId, RaplDomain domain){
+    size_t index = cpuId * RAPL_DOMAIN_NUM + domain;
+    if(domain == RAPL_DOMAIN_CORES && _hasCore){
+        updateCores();
+        sumCores(cpuId);
+        return;
+    }
+    uint64_t now = readRaw(cpuId, domain);
+    uint64_t last = _lastRaw.at(index);
+    uint64_t delta;
+    if(now >= last){
+        delta = now - last;
+    }else{
+        delta = _range - last + now;
+    }
+    _joules.at(index) += delta * _energyPerUnit;
+    _lastRaw.at(index) = now;
 }
 
-Joules CounterCpusLinuxMsr::getJoulesCpu(topology::CpuId cpuId){
-    ScopedLock sLock(_lock);
-    if(_family == CPU_FAMILY_INTEL){
-      updateCounter(cpuId, _joulesCpus[cpuId].cpu, _lastReadCountersCpu[cpuId], MSR_PKG_ENERGY_STATUS_INTEL);
-    }else if(_family == CPU_FAMILY_AMD){
-      updateCounter(cpuId, _joulesCpus[cpuId].cpu, _lastReadCountersCpu[cpuId], MSR_PKG_ENERGY_STATUS_AMD);
+void RaplBackend::updateCores(){
+    if(!_coresBatch->read()){
+        throw std::runtime_error("Fatal error. Counter has been created but registers are not present.");
     }
-    return _joulesCpus[cpuId].cpu;
+    for(size_t i = 0; i < _cpusCores.size(); i++){
+        for(size_t j = 0; j < _cpusCores.at(i).size(); j++){
+            topology::PhysicalCoreId id = _cpusCores.at(i).at(j);
+            uint64_t now;
+            _coresBatch->get(_coresBatchIndexes.at(id), now);
+            now &= 0xFFFFFFFF;
+            uint64_t last = _coresLastRaw.at(id);
+            _coresJoules.at(id) += (now >= last ? now - last : RAPL_MSR_RANGE - last + now) * _coresEnergyPerUnit;
+            _coresLastRaw.at(id) = now;
+        }
+    }
+    _coresLastUpdate = utils::getMillisecondsTime();
 }
 
-Joules CounterCpusLinuxMsr::getJoulesCores(topology::CpuId cpuId){
-    if(hasJoulesCores()){
-        ScopedLock sLock(_lock);
-        if(_family == CPU_FAMILY_INTEL){
-          updateCounter(cpuId, _joulesCpus[cpuId].cores, _lastReadCountersCores[cpuId], MSR_PP0_ENERGY_STATUS_INTEL);
-        }else{
-          // TODO Read joules from each individual core and sum them.
+void RaplBackend::sumCores(topology::CpuId cpuId){
+    Joules j = 0;
+    for(size_t i = 0; i < _cpusCores.at(cpuId).size(); i++){
+        j += _coresJoules.at(_cpusCores.at(cpuId).at(i));
+    }
+    _joules.at(cpuId * RAPL_DOMAIN_NUM + RAPL_DOMAIN_CORES) = j;
+}
+
+uint64_t RaplBackend::readPlatformRaw(){
+    if(_source == RAPL_SOURCE_MSR){
+        uint64_t result;
+        if(!_msrs.at(_cpus.at(0)->getCpuId())->read(MSR_PLATFORM_ENERGY_STATUS_INTEL, result)){
+            throw std::runtime_error("Fatal error. Counter has been created but registers are not present.");
         }
-        return _joulesCpus[cpuId].cores;
+        return result & 0xFFFFFFFF;
     }else{
-        return 0;
+        return utils::stringToUlong(utils::readFirstLineFromFile(_platformPath));
     }
 }
 
-Joules CounterCpusLinuxMsr::getJoulesGraphic(topology::CpuId cpuId){
-    if(hasJoulesGraphic()){
-        ScopedLock sLock(_lock);
-        if(_family == CPU_FAMILY_INTEL){
-          updateCounter(cpuId, _joulesCpus[cpuId].graphic, _lastReadCountersGraphic[cpuId], MSR_PP1_ENERGY_STATUS_INTEL);
-          return _joulesCpus[cpuId].graphic;
+void RaplBackend::updatePlatform(){
+    uint64_t now = readPlatformRaw();
+    uint64_t last = _platformLastRaw;
+    _platformJoules += (now >= last ? now - last : _platformRange - last + now) * _energyPerUnit;
+    _platformLastRaw = now;
+}
+
+void RaplBackend::updateAll(){
+    ScopedLock sLock(_lock);
+    if(_hasCore){
+        updateCores();
+    }
+    for(size_t i = 0; i < _cpus.size(); i++){
+        topology::CpuId cpuId = _cpus.at(i)->getCpuId();
+        for(size_t d = 0; d < RAPL_DOMAIN_NUM; d++){
+            if(d == RAPL_DOMAIN_CORES && _hasCore){
+                sumCores(cpuId);
+            }else if(_hasDomain[d]){
+                update(cpuId, static_cast<RaplDomain>(d));
+            }
         }
     }
-    return 0;
+    if(_hasPlatform){
+        updatePlatform();
+    }
 }
 
-Joules CounterCpusLinuxMsr::getJoulesDram(topology::CpuId cpuId){
-    if(hasJoulesDram()){
-        ScopedLock sLock(_lock);
-        if(_family == CPU_FAMILY_INTEL){
-          updateCounter(cpuId, _joulesCpus[cpuId].dram, _lastReadCountersDram[cpuId], MSR_DRAM_ENERGY_STATUS_INTEL);
-          return _joulesCpus[cpuId].dram;
-        }
+Joules RaplBackend::getJoulesCore(topology::PhysicalCoreId physicalCoreId){
+    if(!_hasCore){
+        return 0;
     }
-    return 0;
+    ScopedLock sLock(_lock);
+    // When reading the cores one after the other, the batch is read once.
+    if(utils::getMillisecondsTime() - _coresLastUpdate >= RAPL_CORES_MIN_UPDATE_INTERVAL){
+        updateCores();
+    }
+    return _coresJoules.at(physicalCoreId);
 }
 
-void CounterCpusLinuxMsr::reset(){
+Joules RaplBackend::getJoulesPlatform(){
+    if(!_hasPlatform){
+        return 0;
+    }
     ScopedLock sLock(_lock);
-    for(size_t i = 0; i < _cpus.size(); i++){
-        if(_family == CPU_FAMILY_INTEL){
-          _lastReadCountersCpu[i] = readEnergyCounter(i, MSR_PKG_ENERGY_STATUS_INTEL);
-        }else if(_family == CPU_FAMILY_AMD){
-          _lastReadCountersCpu[i] = readEnergyCounter(i, MSR_PKG_ENERGY_STATUS_AMD);
+    updatePlatform();
+    return _platformJoules;
+}
+
+std::vector<Joules> RaplBackend::getJoulesCores(){
+    ScopedLock sLock(_lock);
+    if(_hasCore){
+        updateCores();
+    }
+    return _coresJoules;
+}
+
+Joules RaplBackend::getJoules(topology::CpuId cpuId, RaplDomain domain){
+    if(!_hasDomain[domain]){
+        return 0;
+    }
+    ScopedLock sLock(_lock);
+    update(cpuId, domain);
+    return _joules.at(cpuId * RAPL_DOMAIN_NUM + domain);
+}
+
+JoulesCpu RaplBackend::getJoulesComponents(topology::CpuId cpuId){
+    ScopedLock sLock(_lock);
+    Joules j[RAPL_DOMAIN_NUM];
+    for(size_t d = 0; d < RAPL_DOMAIN_NUM; d++){
+        j[d] = 0;
+        if(_hasDomain[d]){
+            update(cpuId, static_cast<RaplDomain>(d));
+            j[d] = _joules.at(cpuId * RAPL_DOMAIN_NUM + d);
         }
-        if(hasJoulesCores()){
-          _lastReadCountersCores[i] = readEnergyCounter(i, MSR_PP0_ENERGY_STATUS_INTEL);
+    }
+    return JoulesCpu(j[RAPL_DOMAIN_PACKAGE], j[RAPL_DOMAIN_CORES], j[RAPL_DOMAIN_GRAPHIC], j[RAPL_DOMAIN_DRAM]);
+}
+
+// Maximum number of counter updates recorded by a trace. Counters are
+// updated about every millisecond, so this is about 10 minutes of trace.
+#define RAPL_TRACER_MAX_UPDATES 600000
+
+RaplTracerThread::RaplTracerThread(RaplTracer* tracer):_tracer(tracer){
+    ;
+}
+
+void RaplTracerThread::run(){
+    _tracer->run();
+}
+
+RaplTracer::RaplTracer(topology::VirtualCoreId virtualCoreId, RaplDomain domain):
+        _topology(topology::Topology::getInstance()), _virtualCoreId(virtualCoreId),
+        _msr(virtualCoreId), _register(0), _energyPerUnit(0), _pinned(false),
+        _stop(false), _duration(0), _thread(NULL){
+    // Registers are read directly, a backend would poll all the Cpus.
+    topology::VirtualCore* vc = _topology->getVirtualCore(virtualCoreId);
+    std::string error;
+    uint64_t result = 0;
+    if(!vc || !_msr.available()){
+        error = "RaplTracer: Impossible to open msr for virtual core " + intToString(virtualCoreId) + ".";
+    }else if(RaplBackend::isCpuIntelSupported(_topology->getCpu(vc->getCpuId()))){
+        _register = RaplBackend::getDomainMsr(CPU_FAMILY_INTEL, domain);
+        uint64_t dummy;
+        if(!_msr.read(MSR_RAPL_POWER_UNIT_INTEL, result) || !result){
+            error = "RaplTracer: Impossible to read the RAPL units.";
+        }else if(!_msr.read(_register, dummy) || !dummy){
+            error = "RaplTracer: Domain not available.";
         }
-        if(hasJoulesGraphic()){
-            _lastReadCountersGraphic[i] = readEnergyCounter(i, MSR_PP1_ENERGY_STATUS_INTEL);
+    }else if(RaplBackend::isCpuAMDSupported(_topology->getCpu(vc->getCpuId()))){
+        _register = RaplBackend::getDomainMsr(CPU_FAMILY_AMD, domain);
+        if(!_msr.read(MSR_RAPL_POWER_UNIT_AMD, result) || !result){
+            error = "RaplTracer: Impossible to read the RAPL units.";
+        }else if(domain != RAPL_DOMAIN_PACKAGE){
+            // Per physical core counters (AMD) are not a Cpu register.
+            error = "RaplTracer: Domain not available.";
         }
-        if(hasJoulesDram()){
-            _lastReadCountersDram[i] = readEnergyCounter(i, MSR_DRAM_ENERGY_STATUS_INTEL);
+    }else{
+        error = "RaplTracer: RAPL registers not available.";
+    }
+    if(error.empty() && !vc->areTicksConstant()){
+        error = "RaplTracer: TSC is not invariant.";
+    }
+    if(error.size()){
+        topology::Topology::release(_topology);
+        throw std::runtime_error(error);
+    }
+    _energyPerUnit = pow(0.5,(double)((result>>8)&0x1F));
+}
+
+RaplTracer::~RaplTracer(){
+    stop();
+    topology::Topology::release(_topology);
+}
+
+uint64_t RaplTracer::readTicks() const{
+#if defined(__x86_64__)
+    // Same value of MSR_TSC, without the cost of a system call.
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a" (low), "=d" (high));
+    return (((uint64_t) high) << 32) | low;
+#else
+    uint64_t ticks = 0;
+    _msr.read(MSR_TSC, ticks);
+    return ticks;
+#endif
+}
+
+void RaplTracer::run(){
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(_virtualCoreId, &set);
+    _pinned = sched_setaffinity(0, sizeof(cpu_set_t), &set) != -1;
+    _started.notifyAll();
+    if(!_pinned){
+        return;
+    }
+
+    // TSC and raw value of each observed update. Counters are updated
+    // about every millisecond.
+    std::vector<std::pair<uint64_t, uint64_t> > updates;
+    updates.reserve(std::min(_duration ? _duration * 2 + 16 : 16384, (uint) RAPL_TRACER_MAX_UPDATES));
+
+    double startTime = getMillisecondsTime();
+    uint64_t startTicks = readTicks();
+    uint64_t raw, lastRaw;
+    if(!_msr.read(_register, lastRaw)){
+        _error = "RaplTracer: Impossible to read the energy register.";
+        return;
+    }
+    lastRaw &= 0xFFFFFFFF;
+    uint64_t ticks, lastTicks = readTicks();
+    while(!_stop && (!_duration || getMillisecondsTime() - startTime < _duration) &&
+          updates.size() < RAPL_TRACER_MAX_UPDATES){
+        if(!_msr.read(_register, raw)){
+            // The samples collected so far are kept.
+            _error = "RaplTracer: Impossible to read the energy register.";
+            break;
+        }
+        ticks = readTicks();
+        raw &= 0xFFFFFFFF;
+        if(raw != lastRaw){
+            // The update happened between the previous read and this one.
+            updates.push_back(std::pair<uint64_t, uint64_t>(lastTicks + (ticks - lastTicks) / 2, raw));
+            lastRaw = raw;
         }
-        _joulesCpus[i].cpu = 0;
-        _joulesCpus[i].cores = 0;
-        _joulesCpus[i].graphic = 0;
-        _joulesCpus[i].dram = 0;
+        lastTicks = ticks;
+    }
+    double endTime = getMillisecondsTime();
+    uint64_t endTicks = readTicks();
+
+    // TSC frequency, calibrated over the whole trace.
+    double ticksPerMs = (endTicks - startTicks) / (endTime - startTime);
+    Joules joules = 0;
+    for(size_t i = 0; i < updates.size(); i++){
+        uint64_t now = updates.at(i).second;
+        double timestamp = startTime + (updates.at(i).first - startTicks) / ticksPerMs;
+        double watts = 0;
+        if(i){
+            uint64_t last = updates.at(i - 1).second;
+            Joules delta = (now >= last ? now - last : RAPL_MSR_RANGE - last + now) * _energyPerUnit;
+            joules += delta;
+            watts = delta / ((timestamp - _samples.back().timestamp) / MAMMUT_MILLISECS_IN_SEC);
+        }
+        _samples.push_back(RaplTraceSample(updates.at(i).first, timestamp, joules, watts));
+    }
+}
+
+void RaplTracer::start(uint duration){
+    if(_thread){
+        throw std::runtime_error("RaplTracer: Already started.");
+    }
+    _samples.clear();
+    _error.clear();
+    _stop = false;
+    _duration = duration;
+    _thread = new RaplTracerThread(this);
+    _thread->start();
+    _started.wait();
+    if(!_pinned){
+        stop();
+        throw std::runtime_error("RaplTracer: Impossible to pin the thread on virtual core " +
+                                 intToString(_virtualCoreId) + ".");
+    }
+}
+
+bool RaplTracer::stop(){
+    if(_thread){
+        _stop = true;
+        _thread->join();
+        delete _thread;
+        _thread = NULL;
+    }
+    return _error.empty();
+}
+
+const std::vector<RaplTraceSample>& RaplTracer::getSamples() const{
+    if(_error.size()){
+        throw std::runtime_error(_error);
+    }
+    return _samples;
+}
+
+CounterMemoryRaplLinux::CounterMemoryRaplLinux():_backend(NULL), _offset(0){
+    ;
+}
+
+CounterMemoryRaplLinux::~CounterMemoryRaplLinux(){
+    RaplBackend::release(_backend);
+}
+
+bool CounterMemoryRaplLinux::init(){
+    _backend = RaplBackend::acquire();
+    if(!_backend){
+        return false;
+    }
+    if(!_backend->hasDomain(RAPL_DOMAIN_DRAM)){
+        RaplBackend::release(_backend);
+        _backend = NULL;
+        return false;
+    }
+    reset();
+    return true;
+}
+
+Joules CounterMemoryRaplLinux::read(){
+    const std::vector<topology::Cpu*>& cpus = _backend->getCpus();
+    Joules j = 0;
+    for(size_t i = 0; i < cpus.size(); i++){
+        j += _backend->getJoules(cpus.at(i)->getCpuId(), RAPL_DOMAIN_DRAM);
     }
+    return j;
+}
+
+Joules CounterMemoryRaplLinux::getJoules(){
+    if(_backend){
+        return read() - _offset;
+    }else{
+        return 0;
+    }
+}
+
+void CounterMemoryRaplLinux::reset(){
+    if(_backend){
+        _offset = read();
+    }
+}
+
+CounterPlugRaplPsysLinux::CounterPlugRaplPsysLinux():_backend(NULL), _offset(0){
+    ;
+}
+
+CounterPlugRaplPsysLinux::~CounterPlugRaplPsysLinux(){
+    RaplBackend::release(_backend);
 }
 
-bool CounterCpusLinuxMsr::hasJoulesCores(){
-    return _hasJoulesCores;
+bool CounterPlugRaplPsysLinux::init(){
+    _backend = RaplBackend::acquire();
+    if(!_backend){
+        return false;
+    }
+    if(!_backend->hasJoulesPlatform()){
+        RaplBackend::release(_backend);
+        _backend = NULL;
+        return false;
+    }
+    reset();
+    return true;
 }
 
-bool CounterCpusLinuxMsr::hasJoulesDram(){
-    return _hasJoulesDram;
+Joules CounterPlugRaplPsysLinux::getJoules(){
+    if(_backend){
+        return _backend->getJoulesPlatform() - _offset;
+    }else{
+        return 0;
+    }
 }
 
-bool CounterCpusLinuxMsr::hasJoulesGraphic(){
-    return _hasJoulesGraphic;
+void CounterPlugRaplPsysLinux::reset(){
+    if(_backend){
+        _offset = _backend->getJoulesPlatform();
+    }
 }
 
-CounterCpusLinuxSysFs::CounterCpusLinuxSysFs():
-  _initialized(false),
-  _lock(),
-  _refresher(NULL),
-  _idCores(-1),
-  _idGraphic(-1),
-  _idDram(-1){
+CounterCpusLinux::CounterCpusLinux(RaplSource source):
+  CounterCpus(topology::Topology::getInstance()),
+  _source(source), _backend(NULL){
   ;
 }
 
-#define RAPL_SYSFS_PREFIX std::string("/sys/class/powercap/intel-rapl/intel-rapl:")
+CounterCpusLinux::~CounterCpusLinux(){
+  RaplBackend::release(_backend);
+}
 
-bool CounterCpusLinuxSysFs::init(){
-  for(size_t i = 0; i < _cpus.size(); i++){
-      if(!utils::existsFile(RAPL_SYSFS_PREFIX + utils::intToString(i) + "/energy_uj")){
-          return false;
-      }
+bool CounterCpusLinux::init(){
+  _backend = RaplBackend::acquire(_source);
+  if(!_backend){
+    return false;
   }
-  _initialized = true;
-  _refresher = new CounterCpusLinuxRefresher(this);
-  int sub = 0;
-  while(utils::existsFile(RAPL_SYSFS_PREFIX + "0/intel-rapl:0:" + utils::intToString(sub) + "/name")){
-    std::string name = utils::readFirstLineFromFile(RAPL_SYSFS_PREFIX + "0/intel-rapl:0:" + utils::intToString(sub) + "/name");
-    if(name == "core"){
-      _idCores = sub;
-    }else if(name == "dram"){
-      _idDram = sub;
-    }else if(name == "uncore"){ // TODO Not sure this is the correct name.
-      _idGraphic = sub;
-    }
-    sub += 1;
+  topology::CpuId maxId = 0;
+  for(size_t i = 0; i < _cpus.size(); i++){
+    maxId = std::max(maxId, _cpus.at(i)->getCpuId());
   }
-  _lastCpu.resize(_cpus.size());
-  _lastCores.resize(_cpus.size());
-  _lastDram.resize(_cpus.size());
-  _lastGraphic.resize(_cpus.size());
-  _joulesCpus.resize(_cpus.size());
-  _maxValue = atof(utils::readFirstLineFromFile(RAPL_SYSFS_PREFIX + "0/max_energy_range_uj").c_str()) / 1000000.0;
+  _offsets.resize(maxId + 1);
   reset();
-  _refresher->start();
   return true;
 }
 
-Joules CounterCpusLinuxSysFs::read(topology::CpuId cpuId, Joules& cumulative, int sub, std::vector<Joules> &last){
-  ScopedLock sLock(_lock);
-  Joules now;
-  if(sub != -1){
-    now = atof(utils::readFirstLineFromFile(RAPL_SYSFS_PREFIX + utils::intToString(cpuId) + "/intel-rapl:" + utils::intToString(cpuId) + ":" + utils::intToString(sub) + "/energy_uj").c_str()) / 1000000.0;
-  }else{
-    now = atof(utils::readFirstLineFromFile(RAPL_SYSFS_PREFIX + utils::intToString(cpuId) + "/energy_uj").c_str()) / 1000000.0;
-  }
-  Joules r;
-  if(last[cpuId] > now){
-    r = _maxValue - last[cpuId] + now;
-  }else{
-    r = now - last[cpuId];
-  }
-  cumulative += r;
-  last[cpuId] = now;
-  return cumulative;
+JoulesCpu CounterCpusLinux::getJoulesComponents(topology::CpuId cpuId){
+  JoulesCpu j = _backend->getJoulesComponents(cpuId);
+  const JoulesCpu& offset = _offsets.at(cpuId);
+  return JoulesCpu(j.cpu - offset.cpu, j.cores - offset.cores,
+                   j.graphic - offset.graphic, j.dram - offset.dram);
 }
 
-Joules CounterCpusLinuxSysFs::getJoulesCpu(topology::CpuId cpuId){
-  return read(cpuId, _joulesCpus[cpuId].cpu, -1, _lastCpu);
+Joules CounterCpusLinux::getJoulesCpu(topology::CpuId cpuId){
+  return _backend->getJoules(cpuId, RAPL_DOMAIN_PACKAGE) - _offsets.at(cpuId).cpu;
 }
 
-Joules CounterCpusLinuxSysFs::getJoulesCores(topology::CpuId cpuId){
-  if(_idCores != -1){
-    return read(cpuId, _joulesCpus[cpuId].cores, _idCores, _lastCores);
-  }else{
-    return 0;
-  }
+Joules CounterCpusLinux::getJoulesCores(topology::CpuId cpuId){
+  return _backend->getJoules(cpuId, RAPL_DOMAIN_CORES) - _offsets.at(cpuId).cores;
 }
 
-Joules CounterCpusLinuxSysFs::getJoulesGraphic(topology::CpuId cpuId){
-  if(_idGraphic != -1){
-    return read(cpuId, _joulesCpus[cpuId].graphic, _idGraphic, _lastGraphic);
-  }else{
-    return 0;
-  }
+Joules CounterCpusLinux::getJoulesGraphic(topology::CpuId cpuId){
+  return _backend->getJoules(cpuId, RAPL_DOMAIN_GRAPHIC) - _offsets.at(cpuId).graphic;
 }
 
-Joules CounterCpusLinuxSysFs::getJoulesDram(topology::CpuId cpuId){
-  if(_idDram != -1){
-    return read(cpuId, _joulesCpus[cpuId].dram, _idDram, _lastDram);
-  }else{
-    return 0;
-  }
+Joules CounterCpusLinux::getJoulesDram(topology::CpuId cpuId){
+  return _backend->getJoules(cpuId, RAPL_DOMAIN_DRAM) - _offsets.at(cpuId).dram;
 }
 
-bool CounterCpusLinuxSysFs::hasJoulesCores(){
-  return _idCores != -1;
+bool CounterCpusLinux::hasJoulesCores(){
+  return _backend->hasDomain(RAPL_DOMAIN_CORES);
 }
 
-bool CounterCpusLinuxSysFs::hasJoulesDram(){
-  return _idDram != -1;
+bool CounterCpusLinux::hasJoulesDram(){
+  return _backend->hasDomain(RAPL_DOMAIN_DRAM);
 }
 
-bool CounterCpusLinuxSysFs::hasJoulesGraphic(){
-  return _idGraphic != -1;
+bool CounterCpusLinux::hasJoulesGraphic(){
+  return _backend->hasDomain(RAPL_DOMAIN_GRAPHIC);
 }
 
-void CounterCpusLinuxSysFs::reset(){
-  for(size_t i = 0; i < _cpus.size(); i++){
-    getJoulesCpu(i);
-    getJoulesCores(i);
-    getJoulesGraphic(i);
-    getJoulesDram(i);
-    _joulesCpus[i].cpu = 0;
-    _joulesCpus[i].cores = 0;
-    _joulesCpus[i].graphic = 0;
-    _joulesCpus[i].dram = 0;
+bool CounterCpusLinux::hasJoulesCore(){
+  return _backend->hasJoulesCore();
+}
+
+Joules CounterCpusLinux::getJoulesCore(topology::PhysicalCoreId physicalCoreId){
+  if(!_backend->hasJoulesCore()){
+    return 0;
   }
+  return _backend->getJoulesCore(physicalCoreId) - _coresOffsets.at(physicalCoreId);
 }
 
-CounterCpusLinuxSysFs::~CounterCpusLinuxSysFs(){
-  if(_initialized){
-      _stopRefresher.notifyAll();
-      _refresher->join();
-      delete _refresher;
+void CounterCpusLinux::reset(){
+  for(size_t i = 0; i < _cpus.size(); i++){
+    topology::CpuId cpuId = _cpus.at(i)->getCpuId();
+    _offsets.at(cpuId) = _backend->getJoulesComponents(cpuId);
+  }
+  if(_backend->hasJoulesCore()){
+    _coresOffsets = _backend->getJoulesCores();
   }
 }
 
-PowerCapperLinux::PowerCapperLinux(CounterType type):PowerCapper(type), _good(false){
+// Interval between two redistributions of the budget among sockets (milliseconds).
+#define MAMMUT_POWER_CAPPER_BALANCING_INTERVAL 250
+// Headroom left to sockets which are not limited by their cap.
+#define MAMMUT_POWER_CAPPER_BALANCING_HEADROOM 1.1
+// Minimum budget of a socket, as a fraction of the even split.
+#define MAMMUT_POWER_CAPPER_BALANCING_MIN_SHARE 0.25
+// A socket is limited if throttled for more than this fraction of time...
+#define MAMMUT_POWER_CAPPER_BALANCING_THROTTLED 0.01
+// ...or if its power is higher than this fraction of its budget.
+#define MAMMUT_POWER_CAPPER_BALANCING_SATURATION 0.95
+
+PowerCapperLinuxBalancer::PowerCapperLinuxBalancer(PowerCapperLinux* capper):
+        _capper(capper){
+    ;
+}
+
+void PowerCapperLinuxBalancer::run(){
+    while(!_capper->_stopBalancer.timedWait(MAMMUT_POWER_CAPPER_BALANCING_INTERVAL)){
+        _capper->balance();
+    }
+}
+
+PowerCapperLinux::PowerCapperLinux(CounterType type, CounterCpus* counter):
+    PowerCapper(type), _good(false), _sockets(0), _counter(counter), _timePerUnit(0),
+    _balancer(NULL), _lastTime(0){
 #ifdef HAVE_RAPLCAP
   switch(_type){
   case COUNTER_CPUS:{
@@ -768,6 +1203,8 @@ PowerCapperLinux::PowerCapperLinux(CounterType type):PowerCapper(type), _good(fa
 }
 
 PowerCapperLinux::~PowerCapperLinux(){
+  stopBalancer();
+  utils::deleteVectorElements<utils::Msr*>(_perfStatusMsrs);
 #ifdef HAVE_RAPLCAP
   if(_good){
      raplcap_destroy(&_rc);
@@ -792,6 +1229,26 @@ bool PowerCapperLinux::init(){
     }
   }
   _good = true;
+
+  if(_counter && _counter->getCpus().size() != _sockets){
+    _counter = NULL;
+  }
+  if(_counter){
+    // Throttling time of each package (Intel only).
+    bool perfStatus = true;
+    for(size_t i = 0; i < _sockets; i++){
+      utils::Msr* msr = new utils::Msr(_counter->getCpus().at(i)->getVirtualCore()->getVirtualCoreId());
+      uint64_t dummy;
+      _perfStatusMsrs.push_back(msr);
+      perfStatus = perfStatus && msr->available() && msr->read(MSR_PKG_PERF_STATUS_INTEL, dummy);
+    }
+    uint64_t units;
+    if(perfStatus && _perfStatusMsrs.at(0)->read(MSR_RAPL_POWER_UNIT_INTEL, units)){
+      _timePerUnit = pow(0.5, (double)((units >> 16) & 0xF));
+    }else{
+      utils::deleteVectorElements<utils::Msr*>(_perfStatusMsrs);
+    }
+  }
   return true;
 #else
   throw std::runtime_error("If you want to use the power capper, please build Mammut with -DENABLE_RAPLCAP=ON.");
@@ -835,10 +1292,17 @@ PowerCap PowerCapperLinux::get(uint socketId, uint windowId) const{
 }
 
 void PowerCapperLinux::set(PowerCap cap){
-  double wattsPerSocket = cap.value / _sockets;
-  cap.value = wattsPerSocket;
+  stopBalancer();
+  PowerCap socketCap = cap;
+  socketCap.value = cap.value / _sockets;
   for(size_t i = 0; i < _sockets; i++){
-    set(i, cap);
+    setLimit(0, i, socketCap);
+    setLimit(1, i, socketCap);
+  }
+  if(_counter && _sockets > 1 && !cap.preparedOnly){
+    _totalCap = cap;
+    _budgets.assign(_sockets, socketCap.value);
+    startBalancer();
   }
 }
 
@@ -849,6 +1313,107 @@ void PowerCapperLinux::set(uint socketId, PowerCap cap){
 }
 
 void PowerCapperLinux::set(uint windowId, uint socketId, PowerCap cap){
+  // Explicit per-socket caps disable the redistribution.
+  stopBalancer();
+  setLimit(windowId, socketId, cap);
+}
+
+void PowerCapperLinux::startBalancer(){
+  _lastTime = 0;
+  _balancer = new PowerCapperLinuxBalancer(this);
+  _balancer->start();
+}
+
+void PowerCapperLinux::stopBalancer(){
+  if(_balancer){
+    _stopBalancer.notifyAll();
+    _balancer->join();
+    delete _balancer;
+    _balancer = NULL;
+  }
+}
+
+void PowerCapperLinux::redistribute(std::vector<double>& budgets, const std::vector<double>& power,
+                                    const std::vector<bool>& limited){
+  double total = 0;
+  for(size_t i = 0; i < budgets.size(); i++){
+    total += budgets.at(i);
+  }
+  double share = total / budgets.size();
+  double slack = 0;
+  size_t numLimited = 0;
+  for(size_t i = 0; i < budgets.size(); i++){
+    if(limited.at(i)){
+      ++numLimited;
+    }else{
+      double needed = std::max(power.at(i) * MAMMUT_POWER_CAPPER_BALANCING_HEADROOM,
+                               share * MAMMUT_POWER_CAPPER_BALANCING_MIN_SHARE);
+      if(needed < budgets.at(i)){
+        slack += budgets.at(i) - needed;
+        budgets.at(i) = needed;
+      }
+    }
+  }
+  if(numLimited == budgets.size()){
+    for(size_t i = 0; i < budgets.size(); i++){
+      budgets.at(i) = (budgets.at(i) + share) / 2.0;
+    }
+  }else{
+    for(size_t i = 0; i < budgets.size(); i++){
+      if(!numLimited){
+        budgets.at(i) += slack / budgets.size();
+      }else if(limited.at(i)){
+        budgets.at(i) += slack / numLimited;
+      }
+    }
+  }
+}
+
+void PowerCapperLinux::balance(){
+  double now = utils::getMillisecondsTime();
+  std::vector<Joules> joules;
+  std::vector<uint64_t> throttleTime;
+  for(size_t i = 0; i < _sockets; i++){
+    joules.push_back(_counter->getJoulesCpu(_counter->getCpus().at(i)));
+    uint64_t t = 0;
+    if(!_perfStatusMsrs.empty()){
+      _perfStatusMsrs.at(i)->readBits(MSR_PKG_PERF_STATUS_INTEL, 31, 0, t);
+    }
+    throttleTime.push_back(t);
+  }
+  double interval = (now - _lastTime) / MAMMUT_MILLISECS_IN_SEC;
+  bool first = _lastTime == 0;
+  std::vector<double> power(_sockets, 0);
+  std::vector<bool> limited(_sockets, false);
+  for(size_t i = 0; i < _sockets && !first; i++){
+    power.at(i) = (joules.at(i) - _lastJoules.at(i)) / interval;
+    first = power.at(i) < 0;
+    double throttled = 0;
+    if(!_perfStatusMsrs.empty()){
+      // 32 bits counter.
+      uint64_t delta = (throttleTime.at(i) - _lastThrottleTime.at(i)) & 0xFFFFFFFF;
+      throttled = delta * _timePerUnit / interval;
+    }
+    limited.at(i) = throttled > MAMMUT_POWER_CAPPER_BALANCING_THROTTLED ||
+                    power.at(i) > _budgets.at(i) * MAMMUT_POWER_CAPPER_BALANCING_SATURATION;
+  }
+  _lastJoules = joules;
+  _lastThrottleTime = throttleTime;
+  _lastTime = now;
+  if(first){
+    return;
+  }
+
+  redistribute(_budgets, power, limited);
+  for(size_t i = 0; i < _sockets; i++){
+    PowerCap cap = _totalCap;
+    cap.value = _budgets.at(i);
+    setLimit(0, i, cap);
+    setLimit(1, i, cap);
+  }
+}
+
+void PowerCapperLinux::setLimit(uint windowId, uint socketId, PowerCap cap){
 #ifdef HAVE_RAPLCAP
   raplcap_limit lim;
   lim.watts = cap.value;
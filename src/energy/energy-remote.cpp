@@ -90,6 +90,12 @@ CounterCpusRemote::CounterCpusRemote(mammut::Communicator* const communicator):
     cr.set_subtype(COUNTER_VALUE_TYPE_DRAM);
     _communicator->remoteCall(cr, crb);
     _hasDram = crb.res();
+
+    cr.set_type(COUNTER_TYPE_PB_CPUS);
+    cr.set_cmd(COUNTER_COMMAND_HAS);
+    cr.set_subtype(COUNTER_VALUE_TYPE_CORE);
+    _communicator->remoteCall(cr, crb);
+    _hasCore = crb.res();
 }
 
 JoulesCpu CounterCpusRemote::getJoulesComponents(){
@@ -170,6 +176,21 @@ bool CounterCpusRemote::hasJoulesGraphic(){
     return _hasGraphic;
 }
 
+bool CounterCpusRemote::hasJoulesCore(){
+    return _hasCore;
+}
+
+Joules CounterCpusRemote::getJoulesCore(topology::PhysicalCoreId physicalCoreId){
+    CounterReq cr;
+    CounterResGetGeneric crgg;
+    cr.set_type(COUNTER_TYPE_PB_CPUS);
+    cr.set_cmd(COUNTER_COMMAND_GET);
+    cr.set_subtype(COUNTER_VALUE_TYPE_CORE);
+    cr.set_physicalcoreid(physicalCoreId);
+    _communicator->remoteCall(cr, crgg);
+    return crgg.joules();
+}
+
 bool CounterCpusRemote::init(){
     CounterReq cr;
     CounterResBool cri;
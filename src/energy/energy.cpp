@@ -4,9 +4,15 @@
 #include <mammut/energy/energy-remote.hpp>
 #include <mammut/energy/energy-remote.pb.h>
 #endif
+#include <mammut/task/task.hpp>
 #include <mammut/topology/topology.hpp>
 
+#include "algorithm"
+#include "cmath"
+#include "cstring"
 #include "stdexcept"
+#include "time.h"
+#include "unistd.h"
 
 namespace mammut{
 namespace energy{
@@ -41,6 +47,14 @@ Joules CounterCpus::getJoulesCoresAll(){
     return r;
 }
 
+bool CounterCpus::hasJoulesCore(){
+    return false;
+}
+
+Joules CounterCpus::getJoulesCore(topology::PhysicalCoreId physicalCoreId){
+    return 0;
+}
+
 Joules CounterCpus::getJoulesGraphicAll(){
     Joules r = 0;
     for(size_t i = 0; i < _cpus.size(); i++){
@@ -73,6 +87,10 @@ Joules CounterCpus::getJoulesCores(topology::Cpu* cpu){
     return getJoulesCores(cpu->getCpuId());
 }
 
+Joules CounterCpus::getJoulesCore(topology::PhysicalCore* physicalCore){
+    return getJoulesCore(physicalCore->getPhysicalCoreId());
+}
+
 Joules CounterCpus::getJoulesGraphic(topology::Cpu* cpu){
     return getJoulesGraphic(cpu->getCpuId());
 }
@@ -81,60 +99,1026 @@ Joules CounterCpus::getJoulesDram(topology::Cpu* cpu){
     return getJoulesDram(cpu->getCpuId());
 }
 
-Energy::Energy(){
-#if defined (__linux__)
-    _counterPlug = NULL;
-    /******** Create plug counter (if present). ********/
-    // SmartPower2
-    CounterPlugSmartPower2Linux* cps = new CounterPlugSmartPower2Linux();
-    if(cps->init()){
-        _counterPlug = cps;
+// Initial variance of the coefficients, when no samples have been fitted.
+#define MAMMUT_POWER_MODEL_INITIAL_VARIANCE 1e6
+// Regularization used when fitting, to handle classes without samples.
+#define MAMMUT_POWER_MODEL_RIDGE 1e-9
+
+PowerModel::PowerModel(const cpufreq::VoltageModel& voltageModel, uint numWorkloadClasses,
+                       double forgettingFactor):
+        _numWorkloadClasses(numWorkloadClasses), _forgettingFactor(forgettingFactor){
+    init(voltageModel);
+}
+
+PowerModel::PowerModel(const cpufreq::VoltageTable& voltageTable, uint numWorkloadClasses,
+                       double forgettingFactor):
+        _numWorkloadClasses(numWorkloadClasses), _forgettingFactor(forgettingFactor){
+    init(cpufreq::VoltageModel(voltageTable));
+}
+
+void PowerModel::init(const cpufreq::VoltageModel& voltageModel){
+    if(!_numWorkloadClasses){
+        throw std::runtime_error("PowerModel: At least one workload class is needed.");
+    }
+    if(_forgettingFactor <= 0 || _forgettingFactor > 1){
+        throw std::runtime_error("PowerModel: The forgetting factor must be in the range (0, 1].");
+    }
+    _maxVirtualCores = voltageModel.getMaxVirtualCores();
+    for(size_t i = 0; i < voltageModel.getNumFrequencies(); i++){
+        _frequencies.push_back(voltageModel.getFrequency(i));
+    }
+    _v2f.resize((_maxVirtualCores + 1) * _frequencies.size());
+    for(uint n = 0; n <= _maxVirtualCores; n++){
+        for(size_t i = 0; i < _frequencies.size(); i++){
+            double voltage = voltageModel.getVoltage(n, i);
+            _v2f[n * _frequencies.size() + i] = voltage * voltage * (_frequencies.at(i) / 1000000.0);
+        }
+    }
+    size_t numCoefficients = 1 + _numWorkloadClasses;
+    _coefficients.assign(numCoefficients, 0);
+    _covariance.assign(numCoefficients * numCoefficients, 0);
+    for(size_t i = 0; i < numCoefficients; i++){
+        _covariance[i * numCoefficients + i] = MAMMUT_POWER_MODEL_INITIAL_VARIANCE;
+    }
+}
+
+double PowerModel::getV2f(uint numVirtualCores, cpufreq::Frequency frequency) const{
+    if(_frequencies.empty()){
+        throw std::runtime_error("PowerModel: Empty voltage table.");
+    }
+    numVirtualCores = std::min(numVirtualCores, _maxVirtualCores);
+    const double* row = &(_v2f[numVirtualCores * _frequencies.size()]);
+    std::vector<cpufreq::Frequency>::const_iterator it = std::lower_bound(_frequencies.begin(),
+                                                                          _frequencies.end(),
+                                                                          frequency);
+    size_t i = it - _frequencies.begin();
+    if(it == _frequencies.end()){
+        return row[_frequencies.size() - 1];
+    }else if(*it == frequency || i == 0){
+        return row[i];
     }else{
-        delete cps;
-        _counterPlug = NULL;
+        double w = ((double) frequency - _frequencies.at(i - 1)) /
+                   ((double) _frequencies.at(i) - _frequencies.at(i - 1));
+        return row[i - 1] + w * (row[i] - row[i - 1]);
+    }
+}
+
+std::vector<double> PowerModel::getFeatures(const PowerConfiguration& configuration) const{
+    if(configuration.workloadClass >= _numWorkloadClasses){
+        throw std::runtime_error("PowerModel: Invalid workload class.");
+    }
+    std::vector<double> x(_coefficients.size(), 0);
+    x[0] = 1;
+    x[1 + configuration.workloadClass] = configuration.numVirtualCores *
+                                         getV2f(configuration.numVirtualCores,
+                                                configuration.frequency);
+    return x;
+}
+
+void PowerModel::fit(const std::vector<PowerSample>& samples){
+    size_t n = _coefficients.size();
+    // Normal equations: (X'X) c = X'y. X'X is inverted with Gauss-Jordan
+    // elimination, and its inverse is used as covariance for update().
+    std::vector<double> a(n * n, 0), b(n, 0), inverse(n * n, 0);
+    for(size_t s = 0; s < samples.size(); s++){
+        std::vector<double> x = getFeatures(samples.at(s).configuration);
+        for(size_t i = 0; i < n; i++){
+            for(size_t j = 0; j < n; j++){
+                a[i * n + j] += x[i] * x[j];
+            }
+            b[i] += x[i] * samples.at(s).power;
+        }
+    }
+    for(size_t i = 0; i < n; i++){
+        a[i * n + i] += MAMMUT_POWER_MODEL_RIDGE;
+        inverse[i * n + i] = 1;
+    }
+    for(size_t c = 0; c < n; c++){
+        size_t pivot = c;
+        for(size_t r = c + 1; r < n; r++){
+            if(fabs(a[r * n + c]) > fabs(a[pivot * n + c])){
+                pivot = r;
+            }
+        }
+        for(size_t j = 0; j < n; j++){
+            std::swap(a[c * n + j], a[pivot * n + j]);
+            std::swap(inverse[c * n + j], inverse[pivot * n + j]);
+        }
+        double p = a[c * n + c];
+        for(size_t j = 0; j < n; j++){
+            a[c * n + j] /= p;
+            inverse[c * n + j] /= p;
+        }
+        for(size_t r = 0; r < n; r++){
+            if(r != c){
+                double f = a[r * n + c];
+                for(size_t j = 0; j < n; j++){
+                    a[r * n + j] -= f * a[c * n + j];
+                    inverse[r * n + j] -= f * inverse[c * n + j];
+                }
+            }
+        }
+    }
+    for(size_t i = 0; i < n; i++){
+        _coefficients[i] = 0;
+        for(size_t j = 0; j < n; j++){
+            _coefficients[i] += inverse[i * n + j] * b[j];
+        }
+    }
+    _covariance = inverse;
+}
+
+void PowerModel::update(const PowerSample& sample){
+    size_t n = _coefficients.size();
+    std::vector<double> x = getFeatures(sample.configuration);
+    // px = P * x
+    std::vector<double> px(n, 0);
+    double xpx = 0, prediction = 0;
+    for(size_t i = 0; i < n; i++){
+        for(size_t j = 0; j < n; j++){
+            px[i] += _covariance[i * n + j] * x[j];
+        }
+        xpx += x[i] * px[i];
+        prediction += x[i] * _coefficients[i];
+    }
+    double denominator = _forgettingFactor + xpx;
+    double error = sample.power - prediction;
+    for(size_t i = 0; i < n; i++){
+        _coefficients[i] += px[i] / denominator * error;
+    }
+    // P = (P - (P x)(P x)' / (lambda + x' P x)) / lambda
+    for(size_t i = 0; i < n; i++){
+        for(size_t j = 0; j < n; j++){
+            _covariance[i * n + j] = (_covariance[i * n + j] - px[i] * px[j] / denominator) /
+                                     _forgettingFactor;
+        }
+    }
+}
+
+double PowerModel::predict(const PowerConfiguration& configuration) const{
+    if(configuration.workloadClass >= _numWorkloadClasses){
+        throw std::runtime_error("PowerModel: Invalid workload class.");
+    }
+    return _coefficients[0] + configuration.numVirtualCores *
+                              _coefficients[1 + configuration.workloadClass] *
+                              getV2f(configuration.numVirtualCores, configuration.frequency);
+}
+
+const std::vector<cpufreq::Frequency>& PowerModel::getFrequencies() const{
+    return _frequencies;
+}
+
+double PowerModel::getStaticPower() const{
+    return _coefficients[0];
+}
+
+double PowerModel::getDynamicCoefficient(uint workloadClass) const{
+    return _coefficients.at(1 + workloadClass);
+}
+
+void PowerModel::storeCoefficients(cpufreq::VoltageModel& voltageModel, uint workloadClass) const{
+    if(voltageModel.getNumFrequencies() != _frequencies.size()){
+        throw std::runtime_error("PowerModel: Different frequencies in the voltage model.");
+    }
+    // Only the dynamic power of one loaded virtual core can be stored.
+    const double* row = &(_v2f[std::min((uint) 1, _maxVirtualCores) * _frequencies.size()]);
+    for(size_t i = 0; i < _frequencies.size(); i++){
+        if(!row[i]){
+            throw std::runtime_error("PowerModel: Missing voltage for one loaded virtual core.");
+        }
+    }
+    for(size_t i = 0; i < _frequencies.size(); i++){
+        voltageModel.setPowerCoefficients(i, getStaticPower(),
+                                          getDynamicCoefficient(workloadClass) * row[i]);
+    }
+}
+
+std::vector<PowerSample> PowerModel::calibrate(const cpufreq::Domain* domain, Counter* counter,
+                                               uint workloadClass, topology::LoadKernel kernel,
+                                               uint duration){
+    std::vector<PowerSample> r;
+    cpufreq::Governor oldGovernor = domain->getCurrentGovernor();
+    cpufreq::Frequency oldFrequency = domain->getCurrentFrequencyUserspace();
+    cpufreq::Frequency oldFrequencyLb = 0, oldFrequencyUb = 0;
+    bool hasBounds = domain->getCurrentGovernorBounds(oldFrequencyLb, oldFrequencyUb);
+    if(!domain->setGovernor(cpufreq::GOVERNOR_USERSPACE)){
+        return r;
+    }
+
+    std::vector<topology::VirtualCore*> virtualCores = topology::getOneVirtualPerPhysical(domain->getVirtualCores());
+    std::vector<cpufreq::Frequency> frequencies = domain->getAvailableFrequencies();
+    for(size_t n = 0; n <= virtualCores.size(); n++){
+        topology::LoadGenerator load(std::vector<topology::VirtualCore*>(virtualCores.begin(),
+                                                                         virtualCores.begin() + n),
+                                     kernel);
+        if(n){
+            load.start();
+        }
+        for(size_t i = 0; i < frequencies.size(); i++){
+            domain->setFrequencyUserspace(frequencies.at(i));
+            counter->reset();
+            double start = utils::getMillisecondsTime();
+            usleep(duration * MAMMUT_MICROSECS_IN_MILLISEC);
+            Joules joules = counter->getJoules();
+            double seconds = (utils::getMillisecondsTime() - start) / MAMMUT_MILLISECS_IN_SEC;
+            r.push_back(PowerSample(PowerConfiguration(n, frequencies.at(i), workloadClass),
+                                    joules / seconds));
+        }
+        load.stop();
+    }
+
+    domain->setGovernor(oldGovernor);
+    if(oldGovernor == cpufreq::GOVERNOR_USERSPACE){
+        domain->setFrequencyUserspace(oldFrequency);
+    }else if(hasBounds){
+        domain->setGovernorBounds(oldFrequencyLb, oldFrequencyUb);
+    }
+    return r;
+}
+
+// Throttling steps of PowerCapperSoftware (10% of CPU time each).
+#define MAMMUT_POWER_CAPPER_THROTTLING_STEPS 9
+// Headroom left to sockets which are not throttled, when redistributing the budget.
+#define MAMMUT_POWER_CAPPER_HEADROOM 1.1
+
+PowerCapperSoftwareThread::PowerCapperSoftwareThread(PowerCapperSoftware* capper):
+        _capper(capper){
+    ;
+}
+
+void PowerCapperSoftwareThread::run(){
+    while(!_capper->_stop.timedWait(_capper->_samplingInterval)){
+        _capper->control();
+    }
+}
+
+PowerCapperSoftware::PowerCapperSoftware(Counter* counter, cpufreq::CpuFreq* cpufreq, uint samplingInterval):
+        PowerCapper(counter ? counter->getType() : COUNTER_CPUS),
+        _counter(counter), _counterCpus(NULL), _cpufreq(cpufreq),
+        _topology(topology::Topology::getInstance()), _cpus(_topology->getCpus()),
+        _samplingInterval(samplingInterval), _kp(0.3), _ki(5), _kd(0),
+        _redistribute(false), _thread(NULL), _started(false),
+        _appliedThrottling(0), _lastTime(0){
+    if(!init()){
+        topology::Topology::release(_topology);
+        throw std::runtime_error("PowerCapperSoftware: Invalid counter or cpufreq module.");
+    }
+}
+
+PowerCapperSoftware::~PowerCapperSoftware(){
+    if(_started){
+        _stop.notifyAll();
+        _thread->join();
+        delete _thread;
+        restore();
+    }
+    topology::Topology::release(_topology);
+}
+
+bool PowerCapperSoftware::init(){
+    if(!_counter || !_cpufreq || !_samplingInterval){
+        return false;
+    }
+    if(_type == COUNTER_CPUS){
+        _counterCpus = dynamic_cast<CounterCpus*>(_counter);
+    }
+    PowerCap disabled;
+    disabled.value = 0;
+    disabled.window = 0;
+    disabled.preparedOnly = true;
+    _caps.assign(_cpus.size(), std::pair<PowerCap, PowerCap>(disabled, disabled));
+
+    for(size_t i = 0; i < _cpus.size(); i++){
+        topology::Cpu* cpu = _cpus.at(i);
+        std::vector<topology::VirtualCore*> virtualCores = cpu->getVirtualCores();
+        _domains.push_back(_cpufreq->getDomains(cpu));
+
+        std::vector<cpufreq::Frequency> frequencies;
+        if(!_domains.back().empty()){
+            frequencies = _domains.back().at(0)->getAvailableFrequencies();
+        }
+        std::sort(frequencies.rbegin(), frequencies.rend());
+        _frequencies.push_back(frequencies);
+
+        std::vector<double> clockModulationValues;
+        if(!virtualCores.empty() && virtualCores.at(0)->hasClockModulation()){
+            std::vector<double> values = virtualCores.at(0)->getClockModulationValues();
+            for(size_t j = 0; j < values.size(); j++){
+                if(values.at(j) < 100){
+                    clockModulationValues.push_back(values.at(j));
+                }
+            }
+        }
+        std::sort(clockModulationValues.rbegin(), clockModulationValues.rend());
+        _clockModulationValues.push_back(clockModulationValues);
+
+        std::vector<topology::VirtualCore*> unpluggableCores;
+        for(size_t j = 1; j < virtualCores.size(); j++){
+            if(virtualCores.at(j)->getVirtualCoreId() && virtualCores.at(j)->isHotPluggable()){
+                unpluggableCores.push_back(virtualCores.at(j));
+            }
+        }
+        _unpluggableCores.push_back(unpluggableCores);
+    }
+    _levels.assign(_cpus.size(), 0);
+    _appliedLevels.assign(_cpus.size(), 0);
+    size_t numControlled = _counterCpus ? _cpus.size() : 1;
+    _lastJoules.assign(numControlled, 0);
+    _lastErrors.assign(numControlled, 0);
+    _lastErrors2.assign(numControlled, 0);
+    return true;
+}
+
+uint PowerCapperSoftware::getMaxLevel(size_t socket) const{
+    uint r = 0;
+    if(!_frequencies.at(socket).empty()){
+        r += _frequencies.at(socket).size() - 1;
+    }
+    r += _clockModulationValues.at(socket).size();
+    r += _unpluggableCores.at(socket).size();
+    if(!_processes.empty()){
+        r += MAMMUT_POWER_CAPPER_THROTTLING_STEPS;
+    }
+    return r;
+}
+
+void PowerCapperSoftware::applyLevel(size_t socket, int level, bool force){
+    if(level == _appliedLevels.at(socket) && !force){
+        return;
+    }
+    _appliedLevels.at(socket) = level;
+    const std::vector<cpufreq::Frequency>& frequencies = _frequencies.at(socket);
+    if(!frequencies.empty()){
+        int index = std::min(level, (int) frequencies.size() - 1);
+        level -= index;
+        for(size_t i = 0; i < _domains.at(socket).size(); i++){
+            _domains.at(socket).at(i)->setFrequencyUserspace(frequencies.at(index));
+        }
+    }
+
+    const std::vector<double>& clockModulationValues = _clockModulationValues.at(socket);
+    int modulationIndex = std::min(level, (int) clockModulationValues.size());
+    level -= modulationIndex;
+
+    // Cores are unplugged starting from the last one. Cores to be plugged
+    // are plugged before setting the clock modulation, so that they get it too.
+    const std::vector<topology::VirtualCore*>& unpluggableCores = _unpluggableCores.at(socket);
+    size_t numPlugged = unpluggableCores.size() - std::min(level, (int) unpluggableCores.size());
+    for(size_t i = 0; i < numPlugged; i++){
+        if(!unpluggableCores.at(i)->isHotPlugged()){
+            unpluggableCores.at(i)->hotPlug();
+        }
+    }
+
+    if(!clockModulationValues.empty()){
+        double value = modulationIndex ? clockModulationValues.at(modulationIndex - 1) : 100;
+        std::vector<topology::VirtualCore*> virtualCores = _cpus.at(socket)->getVirtualCores();
+        for(size_t i = 0; i < virtualCores.size(); i++){
+            if(virtualCores.at(i)->isHotPlugged() && virtualCores.at(i)->getClockModulation() != value){
+                virtualCores.at(i)->setClockModulation(value);
+            }
+        }
+    }
+
+    for(size_t i = numPlugged; i < unpluggableCores.size(); i++){
+        if(unpluggableCores.at(i)->isHotPlugged()){
+            unpluggableCores.at(i)->hotUnplug();
+        }
+    }
+}
+
+void PowerCapperSoftware::applyThrottling(int step){
+    if(step == _appliedThrottling){
+        return;
+    }
+    _appliedThrottling = step;
+    for(size_t i = 0; i < _processes.size(); i++){
+        if(step){
+            // The sum of the percentages cannot exceed 100.
+            double percentage = (100.0 - step * (100.0 / (MAMMUT_POWER_CAPPER_THROTTLING_STEPS + 1))) /
+                                _processes.size();
+            _processes.at(i)->throttle(percentage);
+        }else{
+            _processes.at(i)->removeThrottling();
+        }
+    }
+}
+
+void PowerCapperSoftware::getBudgets(const std::vector<double>& power, std::vector<double>& budgets) const{
+    budgets.assign(_cpus.size(), -1);
+    bool allCapped = true;
+    for(size_t i = 0; i < _cpus.size(); i++){
+        const std::pair<PowerCap, PowerCap>& caps = _caps.at(i);
+        if(!caps.first.preparedOnly){
+            budgets.at(i) = caps.first.value;
+        }
+        if(!caps.second.preparedOnly && (budgets.at(i) < 0 || caps.second.value < budgets.at(i))){
+            budgets.at(i) = caps.second.value;
+        }
+        allCapped = allCapped && budgets.at(i) >= 0;
+    }
+
+    if(_counterCpus && _redistribute && allCapped){
+        // Sockets which are not throttled and consume less than their share
+        // only keep some headroom. The rest is split among the throttled ones.
+        double available = 0;
+        size_t numThrottled = 0;
+        for(size_t i = 0; i < _cpus.size(); i++){
+            if(_levels.at(i) > 0){
+                ++numThrottled;
+                available += budgets.at(i);
+            }else{
+                double needed = std::min(budgets.at(i), power.at(i) * MAMMUT_POWER_CAPPER_HEADROOM);
+                available += budgets.at(i) - needed;
+                budgets.at(i) = needed;
+            }
+        }
+        if(numThrottled){
+            for(size_t i = 0; i < _cpus.size(); i++){
+                if(_levels.at(i) > 0){
+                    budgets.at(i) = available / numThrottled;
+                }
+            }
+        }else{
+            // Nobody needs more than its share.
+            for(size_t i = 0; i < _cpus.size(); i++){
+                budgets.at(i) += available / _cpus.size();
+            }
+        }
+    }
+}
+
+void PowerCapperSoftware::control(){
+    double now = utils::getMillisecondsTime();
+    std::vector<Joules> joules;
+    if(_counterCpus){
+        for(size_t i = 0; i < _cpus.size(); i++){
+            joules.push_back(_counterCpus->getJoulesCpu(_cpus.at(i)->getCpuId()));
+        }
+    }else{
+        joules.push_back(_counter->getJoules());
+    }
+    double interval = (now - _lastTime) / MAMMUT_MILLISECS_IN_SEC;
+    bool first = _lastTime == 0;
+    std::vector<double> power(joules.size(), 0);
+    for(size_t i = 0; i < joules.size(); i++){
+        power.at(i) = (joules.at(i) - _lastJoules.at(i)) / interval;
+        first = first || power.at(i) < 0;
+    }
+    _lastJoules = joules;
+    _lastTime = now;
+    if(first){
+        return;
     }
 
-    // SmartPower 
-    if(!_counterPlug){
-        CounterPlugSmartGaugeLinux* cpl = new CounterPlugSmartGaugeLinux();
-        if(cpl->init()){
-            _counterPlug = cpl;
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<double> budgets;
+    if(_counterCpus){
+        getBudgets(power, budgets);
+    }else{
+        getBudgets(std::vector<double>(_cpus.size(), 0), budgets);
+        // A single budget for the whole machine.
+        double total = 0;
+        for(size_t i = 0; i < budgets.size(); i++){
+            if(budgets.at(i) < 0){
+                total = -1;
+                break;
+            }
+            total += budgets.at(i);
+        }
+        budgets.assign(1, total);
+    }
+
+    for(size_t i = 0; i < power.size(); i++){
+        // Controlled sockets.
+        size_t firstSocket = _counterCpus ? i : 0;
+        size_t lastSocket = _counterCpus ? i + 1 : _cpus.size();
+        uint maxLevel = 0;
+        for(size_t s = firstSocket; s < lastSocket; s++){
+            maxLevel = std::max(maxLevel, getMaxLevel(s));
+        }
+        double level = _levels.at(firstSocket);
+        if(budgets.at(i) <= 0){
+            level = 0;
+            _lastErrors.at(i) = 0;
+            _lastErrors2.at(i) = 0;
         }else{
-            delete cpl;
-            _counterPlug = NULL;
+            // Velocity form of the PID controller.
+            double error = (budgets.at(i) - power.at(i)) / budgets.at(i);
+            double output = _kp * (error - _lastErrors.at(i)) +
+                            _ki * error * interval +
+                            _kd * (error - 2 * _lastErrors.at(i) + _lastErrors2.at(i)) / interval;
+            level -= output * maxLevel;
+            level = std::max(0.0, std::min((double) maxLevel, level));
+            _lastErrors2.at(i) = _lastErrors.at(i);
+            _lastErrors.at(i) = error;
+        }
+        for(size_t s = firstSocket; s < lastSocket; s++){
+            _levels.at(s) = std::min(level, (double) getMaxLevel(s));
+            applyLevel(s, (int) round(_levels.at(s)));
+        }
+    }
+
+    if(!_processes.empty()){
+        int throttling = 0;
+        for(size_t s = 0; s < _cpus.size(); s++){
+            throttling = std::max(throttling, _appliedLevels.at(s) - (int) (getMaxLevel(s) - MAMMUT_POWER_CAPPER_THROTTLING_STEPS));
+        }
+        applyThrottling(throttling);
+    }
+}
+
+void PowerCapperSoftware::restore(){
+    // Forced, so that modulation is reset and cores are replugged even
+    // when no level has been applied.
+    for(size_t s = 0; s < _cpus.size(); s++){
+        applyLevel(s, 0, true);
+    }
+    applyThrottling(0);
+    _cpufreq->rollback(_rollbackPoint);
+}
+
+void PowerCapperSoftware::setGains(double kp, double ki, double kd){
+    std::lock_guard<std::mutex> lock(_mutex);
+    _kp = kp;
+    _ki = ki;
+    _kd = kd;
+}
+
+void PowerCapperSoftware::addThrottledProcess(task::ProcessHandler* process){
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_started){
+        throw std::runtime_error("PowerCapperSoftware: Processes must be added before setting a cap.");
+    }
+    _processes.push_back(process);
+}
+
+uint PowerCapperSoftware::getLevel(uint socketId) const{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _appliedLevels.at(socketId);
+}
+
+std::vector<std::pair<PowerCap, PowerCap> > PowerCapperSoftware::get() const{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _caps;
+}
+
+std::pair<PowerCap, PowerCap> PowerCapperSoftware::get(uint socketId) const{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _caps.at(socketId);
+}
+
+PowerCap PowerCapperSoftware::get(uint socketId, uint windowId) const{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return windowId ? _caps.at(socketId).second : _caps.at(socketId).first;
+}
+
+void PowerCapperSoftware::set(PowerCap cap){
+    cap.value /= _cpus.size();
+    for(size_t i = 0; i < _cpus.size(); i++){
+        set(i, cap);
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    _redistribute = true;
+}
+
+void PowerCapperSoftware::set(uint socketId, PowerCap cap){
+    for(size_t i = 0; i < 2; i++){
+        set(i, socketId, cap);
+    }
+}
+
+void PowerCapperSoftware::set(uint windowId, uint socketId, PowerCap cap){
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(windowId){
+        _caps.at(socketId).second = cap;
+    }else{
+        _caps.at(socketId).first = cap;
+    }
+    _redistribute = false;
+    if(!_started && !cap.preparedOnly){
+        _rollbackPoint = _cpufreq->getRollbackPoint();
+        for(size_t i = 0; i < _domains.size(); i++){
+            for(size_t j = 0; j < _domains.at(i).size(); j++){
+                _domains.at(i).at(j)->setGovernor(cpufreq::GOVERNOR_USERSPACE);
+            }
+        }
+        // Levels are applied only when they change: starts from the top.
+        for(size_t i = 0; i < _domains.size(); i++){
+            _appliedLevels.at(i) = -1;
+            applyLevel(i, 0);
         }
+        _thread = new PowerCapperSoftwareThread(this);
+        _thread->start();
+        _started = true;
     }
+}
+
+CounterPlugMeterSampler::CounterPlugMeterSampler(CounterPlugMeter* counter):
+        _counter(counter){
+    ;
+}
+
+// Bounds of the wait after a failed read of a power meter (milliseconds).
+#define COUNTER_PLUG_METER_MIN_BACKOFF 10
+#define COUNTER_PLUG_METER_MAX_BACKOFF 1000
 
-    // Power8
-    if(!_counterPlug){
-        CounterPlugAmesterLinux* cpal = new CounterPlugAmesterLinux();
-        if(cpal->init()){
-            _counterPlug = cpal;
+void CounterPlugMeterSampler::run(){
+    uint interval = _counter->_meter->getSamplingInterval();
+    uint backoff = 0;
+    // Meters paced by the device block in getWatts() until a new sample is
+    // available. After a failed read, we wait twice as long as after the
+    // previous one, to not spin on a broken meter.
+    while(!(backoff ? _counter->_stop.timedWait(backoff) :
+            interval ? _counter->_stop.timedWait(interval) : _counter->_stop.predicate())){
+        if(_counter->sample()){
+            backoff = 0;
+        }else if(backoff){
+            backoff = std::min(2 * backoff, (uint) COUNTER_PLUG_METER_MAX_BACKOFF);
         }else{
-            delete cpal;
-            _counterPlug = NULL;
+            backoff = std::max(interval, (uint) COUNTER_PLUG_METER_MIN_BACKOFF);
+        }
+    }
+}
+
+CounterPlugMeter::CounterPlugMeter(PowerMeter* meter, size_t ringSize):
+        _meter(meter), _sampler(NULL), _samples(ringSize), _cumulative(ringSize),
+        _next(0), _numSamples(0), _offset(0){
+    if(!ringSize){
+        throw std::runtime_error("CounterPlugMeter: The ring must contain at least one sample.");
+    }
+}
+
+CounterPlugMeter::~CounterPlugMeter(){
+    if(_sampler){
+        _stop.notifyAll();
+        _sampler->join();
+        delete _sampler;
+    }
+    delete _meter;
+}
+
+bool CounterPlugMeter::init(){
+    if(!_meter->init() || !sample()){
+        return false;
+    }
+    _sampler = new CounterPlugMeterSampler(this);
+    _sampler->start();
+    return true;
+}
+
+bool CounterPlugMeter::sample(){
+    MeterSample current;
+    if(!_meter->getWatts(current.watts)){
+        return false;
+    }
+    current.timestamp = utils::getMillisecondsTime();
+    std::unique_lock<std::mutex> lock(_mutex);
+    Joules cumulative = 0;
+    if(_numSamples){
+        const MeterSample& last = getSample(_numSamples - 1);
+        cumulative = getCumulative(_numSamples - 1) +
+                     ((last.watts + current.watts) / 2.0) *
+                     ((current.timestamp - last.timestamp) / MAMMUT_MILLISECS_IN_SEC);
+    }
+    _samples.at(_next) = current;
+    _cumulative.at(_next) = cumulative;
+    _next = (_next + 1) % _samples.size();
+    _numSamples = std::min(_numSamples + 1, _samples.size());
+    return true;
+}
+
+const MeterSample& CounterPlugMeter::getSample(size_t i) const{
+    return _samples.at((_next + _samples.size() - _numSamples + i) % _samples.size());
+}
+
+Joules CounterPlugMeter::getCumulative(size_t i) const{
+    return _cumulative.at((_next + _samples.size() - _numSamples + i) % _samples.size());
+}
+
+Joules CounterPlugMeter::getJoules(){
+    std::unique_lock<std::mutex> lock(_mutex);
+    return getCumulative(_numSamples - 1) - _offset;
+}
+
+void CounterPlugMeter::reset(){
+    std::unique_lock<std::mutex> lock(_mutex);
+    _offset = getCumulative(_numSamples - 1);
+}
+
+Joules CounterPlugMeter::getJoules(double timestamp, double& skew) const{
+    std::unique_lock<std::mutex> lock(_mutex);
+    const MeterSample& first = getSample(0);
+    const MeterSample& last = getSample(_numSamples - 1);
+    Joules joules;
+    if(timestamp <= first.timestamp){
+        skew = first.timestamp - timestamp;
+        joules = getCumulative(0) - first.watts * (skew / MAMMUT_MILLISECS_IN_SEC);
+    }else if(timestamp >= last.timestamp){
+        skew = timestamp - last.timestamp;
+        joules = getCumulative(_numSamples - 1) + last.watts * (skew / MAMMUT_MILLISECS_IN_SEC);
+    }else{
+        // Last sample not after the timestamp.
+        size_t low = 0, high = _numSamples - 1;
+        while(high - low > 1){
+            size_t mid = (low + high) / 2;
+            if(getSample(mid).timestamp <= timestamp){
+                low = mid;
+            }else{
+                high = mid;
+            }
+        }
+        const MeterSample& before = getSample(low);
+        const MeterSample& after = getSample(high);
+        double elapsed = timestamp - before.timestamp;
+        double watts = before.watts + (after.watts - before.watts) * elapsed / (after.timestamp - before.timestamp);
+        joules = getCumulative(low) + ((before.watts + watts) / 2.0) * (elapsed / MAMMUT_MILLISECS_IN_SEC);
+        skew = std::min(elapsed, after.timestamp - timestamp);
+    }
+    return joules - _offset;
+}
+
+std::vector<MeterSample> CounterPlugMeter::getSamples() const{
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::vector<MeterSample> samples;
+    for(size_t i = 0; i < _numSamples; i++){
+        samples.push_back(getSample(i));
+    }
+    return samples;
+}
+
+// Number of samples after which the cgroup of a process is read again.
+#define MAMMUT_ENERGY_ACCOUNTING_CGROUP_REFRESH 10
+
+EnergyAccountingThread::EnergyAccountingThread(EnergyAccounting* accounting):
+        _accounting(accounting){
+    ;
+}
+
+void EnergyAccountingThread::run(){
+    while(!_accounting->_stop.timedWait(_accounting->_samplingInterval)){
+        _accounting->sample();
+    }
+}
+
+EnergyAccounting::EnergyAccounting(CounterCpus* counter, uint samplingInterval):
+        _counter(counter), _topology(topology::Topology::getInstance()),
+        _cpus(_topology->getCpus()), _onlineVirtualCores(_cpus.size(), 0),
+        _lastSampleTime(utils::getMillisecondsTime()), _samplingInterval(samplingInterval),
+        _hertz(utils::getClockTicksPerSecond()), _thread(NULL), _numSamples(0), _unattributed(0){
+    if(!_counter){
+        topology::Topology::release(_topology);
+        throw std::runtime_error("EnergyAccounting: Invalid counter.");
+    }
+    std::vector<topology::VirtualCore*> virtualCores = _topology->getVirtualCores();
+    for(size_t i = 0; i < _cpus.size(); i++){
+        std::vector<topology::VirtualCore*> cpuVirtualCores = _cpus.at(i)->getVirtualCores();
+        for(size_t j = 0; j < cpuVirtualCores.size(); j++){
+            topology::VirtualCoreId id = cpuVirtualCores.at(j)->getVirtualCoreId();
+            if(id >= _cpuIndexes.size()){
+                _cpuIndexes.resize(id + 1, 0);
+            }
+            _cpuIndexes.at(id) = i;
+        }
+    }
+    for(size_t i = 0; i < _cpus.size(); i++){
+        _lastJoules.push_back(_counter->getJoulesCpu(_cpus.at(i)));
+    }
+    // First sample only initializes the CPU times.
+    sample();
+    _thread = new EnergyAccountingThread(this);
+    _thread->start();
+}
+
+EnergyAccounting::~EnergyAccounting(){
+    _stop.notifyAll();
+    _thread->join();
+    delete _thread;
+    topology::Topology::release(_topology);
+}
+
+std::string EnergyAccounting::getCgroup(task::TaskId pid){
+    // Read again from time to time, since processes may be moved
+    // (and pids reused).
+    std::map<task::TaskId, std::pair<std::string, uint> >::iterator it = _cgroups.find(pid);
+    if(it != _cgroups.end() &&
+       _numSamples - it->second.second < MAMMUT_ENERGY_ACCOUNTING_CGROUP_REFRESH){
+        return it->second.first;
+    }
+    // Lines are in the form "hierarchy-ID:controllers:path". The
+    // v2 hierarchy has ID 0, and is preferred if present.
+    std::string cgroup = "/";
+    std::vector<std::string> lines = utils::readFile("/proc/" + utils::intToString(pid) + "/cgroup");
+    for(size_t i = 0; i < lines.size(); i++){
+        size_t first = lines.at(i).find(':');
+        size_t second = lines.at(i).find(':', first + 1);
+        if(first == std::string::npos || second == std::string::npos){
+            continue;
+        }
+        if(i == 0 || lines.at(i).compare(0, first, "0") == 0){
+            cgroup = lines.at(i).substr(second + 1);
         }
     }
+    _cgroups[pid] = std::pair<std::string, uint>(cgroup, _numSamples);
+    return cgroup;
+}
+
+void EnergyAccounting::sample(){
+    std::vector<Joules> joules;
+    for(size_t i = 0; i < _cpus.size(); i++){
+        Joules current = _counter->getJoulesCpu(_cpus.at(i));
+        joules.push_back(std::max(0.0, current - _lastJoules.at(i)));
+        _lastJoules.at(i) = current;
+    }
+    double now = utils::getMillisecondsTime();
+    double interval = (now - _lastSampleTime) / MAMMUT_MILLISECS_IN_SEC;
+    _lastSampleTime = now;
+    ++_numSamples;
 
-    // File
-    if(!_counterPlug){
-        CounterPlugFileLinux* cpal = new CounterPlugFileLinux();
-        if(cpal->init()){
-            _counterPlug = cpal;
+    std::vector<TaskUsage> usages;
+    for(auto& it : _lastTimes){
+        it.second.second = false;
+    }
+    std::vector<std::string> pids = utils::getFilesNamesInDir("/proc", false, true);
+    for(size_t i = 0; i < pids.size(); i++){
+        if(!utils::isNumber(pids.at(i))){
+            continue;
+        }
+        task::TaskId pid = utils::stringToInt(pids.at(i));
+        std::string processPath = "/proc/" + pids.at(i) + "/task/";
+        // Processes and threads may terminate while we read them.
+        try{
+            std::string cgroup = getCgroup(pid);
+            std::vector<std::string> tids = utils::getFilesNamesInDir(processPath, false, true);
+            for(size_t j = 0; j < tids.size(); j++){
+                std::string path = processPath + tids.at(j) + "/";
+                task::TaskId tid = utils::stringToInt(tids.at(j));
+                // Fields after the command name (which may contain spaces),
+                // starting from the state.
+                std::string stat = utils::readFirstLineFromFile(path + "stat");
+                std::vector<std::string> fields = utils::split(stat.substr(stat.rfind(')') + 2), ' ');
+                topology::VirtualCoreId virtualCoreId = utils::stringToInt(fields.at(36));
+                double time;
+                if(utils::existsFile(path + "schedstat")){
+                    std::string schedstat = utils::readFirstLineFromFile(path + "schedstat");
+                    time = utils::stringToUlong(utils::split(schedstat, ' ').at(0)) / 1000000000.0;
+                }else{
+                    time = (utils::stringToUlong(fields.at(11)) + utils::stringToUlong(fields.at(12))) / _hertz;
+                }
+                std::map<task::TaskId, std::pair<double, bool> >::iterator it = _lastTimes.find(tid);
+                if(it != _lastTimes.end()){
+                    if(time > it->second.first){
+                        usages.push_back(TaskUsage(pid, cgroup, virtualCoreId, time - it->second.first));
+                    }
+                    it->second = std::pair<double, bool>(time, true);
+                }else{
+                    _lastTimes[tid] = std::pair<double, bool>(time, true);
+                }
+            }
+        }catch(const std::exception& e){
+            ;
+        }
+    }
+    for(auto it = _lastTimes.begin(); it != _lastTimes.end();){
+        if(!it->second.second){
+            it = _lastTimes.erase(it);
         }else{
-            delete cpal;
-            _counterPlug = NULL;
+            ++it;
         }
     }
 
-    // INA231 (XU3)
-    if(!_counterPlug){
-        CounterPlugINALinux* cpal = new CounterPlugINALinux();
-        if(cpal->init()){
-            _counterPlug = cpal;
+    std::unique_lock<std::mutex> lock(_mutex);
+    // Forget terminated processes.
+    for(auto it = _cgroups.begin(); it != _cgroups.end();){
+        if(!utils::existsFile("/proc/" + utils::intToString(it->first))){
+            _processesJoules.erase(it->first);
+            it = _cgroups.erase(it);
         }else{
-            delete cpal;
-            _counterPlug = NULL;
+            _processesJoules.insert(std::pair<task::TaskId, Joules>(it->first, 0));
+            ++it;
+        }
+    }
+    for(size_t i = 0; i < _cpus.size(); i++){
+        std::vector<topology::VirtualCore*> virtualCores = _cpus.at(i)->getVirtualCores();
+        uint online = 0;
+        for(size_t j = 0; j < virtualCores.size(); j++){
+            online += virtualCores.at(j)->isHotPlugged();
+        }
+        _onlineVirtualCores.at(i) = online;
+    }
+    lock.unlock();
+    account(joules, usages, interval);
+}
+
+void EnergyAccounting::account(const std::vector<Joules>& joules, const std::vector<TaskUsage>& usages,
+                               double interval){
+    std::vector<double> times(joules.size(), 0);
+    for(size_t i = 0; i < usages.size(); i++){
+        if(usages.at(i).virtualCoreId < _cpuIndexes.size()){
+            times.at(_cpuIndexes.at(usages.at(i).virtualCoreId)) += usages.at(i).time;
+        }
+    }
+    std::unique_lock<std::mutex> lock(_mutex);
+    // Shares are fractions of the capacity. CPU times may slightly exceed
+    // the capacity, since they are not read at the same instant.
+    std::vector<double> capacities(joules.size(), 0);
+    for(size_t i = 0; i < joules.size(); i++){
+        capacities.at(i) = std::max(interval * _onlineVirtualCores.at(i), times.at(i));
+    }
+    std::vector<Joules> attributed(joules.size(), 0);
+    for(size_t i = 0; i < usages.size(); i++){
+        const TaskUsage& usage = usages.at(i);
+        if(usage.virtualCoreId >= _cpuIndexes.size()){
+            continue;
+        }
+        size_t cpu = _cpuIndexes.at(usage.virtualCoreId);
+        Joules share = joules.at(cpu) * (usage.time / capacities.at(cpu));
+        _processesJoules[usage.pid] += share;
+        _cgroupsJoules[usage.cgroup] += share;
+        attributed.at(cpu) += share;
+    }
+    for(size_t i = 0; i < joules.size(); i++){
+        _unattributed += joules.at(i) - attributed.at(i);
+    }
+}
+
+bool EnergyAccounting::getJoules(task::TaskId pid, Joules& joules) const{
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::map<task::TaskId, Joules>::const_iterator it = _processesJoules.find(pid);
+    if(it == _processesJoules.end()){
+        return false;
+    }
+    joules = it->second;
+    return true;
+}
+
+std::map<std::string, Joules> EnergyAccounting::getCgroupsJoules() const{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _cgroupsJoules;
+}
+
+Joules EnergyAccounting::getUnattributedJoules() const{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _unattributed;
+}
+
+std::vector<std::pair<std::string, PowerMeter* (*)()> > Energy::_powerMeters;
+
+void Energy::registerPowerMeter(const std::string& name, PowerMeter* (*create)()){
+    _powerMeters.push_back(std::pair<std::string, PowerMeter* (*)()>(name, create));
+}
+
+CounterPlug* Energy::createCounterPlug(const std::string& name){
+#if defined (__linux__)
+    if(name == "smartpower2"){
+        return new CounterPlugMeter(new PowerMeterSmartPower2Linux());
+    }else if(name == "smartgauge"){ // SmartPower
+        return new CounterPlugSmartGaugeLinux();
+    }else if(name == "amester"){ // Power8
+        return new CounterPlugAmesterLinux();
+    }else if(name == "file"){
+        return new CounterPlugMeter(new PowerMeterFileLinux());
+    }else if(name == "ina"){ // INA231 (XU3)
+        return new CounterPlugMeter(new PowerMeterINALinux());
+    }else if(name == "psys"){ // RAPL platform domain
+        return new CounterPlugRaplPsysLinux();
+    }
+#endif
+    for(size_t i = 0; i < _powerMeters.size(); i++){
+        if(_powerMeters.at(i).first == name){
+            return new CounterPlugMeter(_powerMeters.at(i).second());
+        }
+    }
+    return NULL;
+}
+
+Energy::Energy(){
+#if defined (__linux__)
+    _counterPlug = NULL;
+    /******** Create plug counter (if present). ********/
+    std::vector<std::string> plugCounters;
+    char* plugCountersEnv = getenv("MAMMUT_PLUG_COUNTERS");
+    if(plugCountersEnv){
+        plugCounters = utils::split(plugCountersEnv, ',');
+    }else{
+        plugCounters.push_back("smartpower2");
+        plugCounters.push_back("smartgauge");
+        plugCounters.push_back("amester");
+        plugCounters.push_back("file");
+        plugCounters.push_back("ina");
+        // Registered meters are external (wall) meters, preferred to the
+        // RAPL platform domain, which is always present on recent Intel Cpus.
+        for(size_t i = 0; i < _powerMeters.size(); i++){
+            plugCounters.push_back(_powerMeters.at(i).first);
+        }
+        plugCounters.push_back("psys");
+    }
+    for(size_t i = 0; i < plugCounters.size() && !_counterPlug; i++){
+        CounterPlug* cp = createCounterPlug(plugCounters.at(i));
+        if(cp && cp->init()){
+            _counterPlug = cp;
+        }else if(cp){
+            delete cp;
         }
     }
 
@@ -177,7 +1161,8 @@ Energy::Energy(){
     }
 #ifdef HAVE_RAPLCAP
     for(size_t i = 0; i < COUNTER_NUM; i++){
-      _powerCappers[i] = new PowerCapperLinux(static_cast<CounterType>(i));
+      _powerCappers[i] = new PowerCapperLinux(static_cast<CounterType>(i),
+                                              i == COUNTER_CPUS ? _counterCpus : NULL);
       if(!_powerCappers[i]->init()){
         delete _powerCappers[i];
         _powerCappers[i] = NULL;
@@ -240,6 +1225,14 @@ Energy* Energy::remote(Communicator* const communicator){
 #endif
 
 Energy::~Energy(){
+    // Power cappers may use the counters (e.g. the budget balancer),
+    // so they must be destroyed first.
+    for(size_t i = 0; i < COUNTER_NUM; i++){
+      if(_powerCappers[i]){
+        delete _powerCappers[i];
+      }
+    }
+
     if(_counterPlug){
         delete _counterPlug;
     }
@@ -251,12 +1244,6 @@ Energy::~Energy(){
     if(_counterCpus){
         delete _counterCpus;
     }
-
-    for(size_t i = 0; i < COUNTER_NUM; i++){
-      if(_powerCappers[i]){
-        delete _powerCappers[i];
-      }
-    }
 }
 
 void Energy::release(Energy* energy){
@@ -341,6 +1328,66 @@ void Energy::rollback(const RollbackPoint& rollbackPoint) const{
   }
 }
 
+static double getMillisecondsTimeRaw(){
+    struct timespec spec;
+    if(clock_gettime(CLOCK_MONOTONIC_RAW, &spec) == -1){
+        throw std::runtime_error(std::string("clock_gettime failed: ") + std::string(strerror(errno)));
+    }
+    return spec.tv_sec * 1000.0 + spec.tv_nsec / 1.0e6;
+}
+
+EnergySnapshot Energy::snapshot() const{
+    EnergySnapshot s;
+    double start, end;
+    // Offset between the clock used by the meters and the raw one,
+    // measured around the raw reading to bound the error.
+    double monotonic = utils::getMillisecondsTime();
+    s.timestamp = getMillisecondsTimeRaw();
+    double offset = (monotonic + utils::getMillisecondsTime()) / 2.0 - s.timestamp;
+
+    if(_counterCpus){
+        CounterSnapshot& cs = s.counters[COUNTER_CPUS];
+        start = getMillisecondsTimeRaw();
+        const std::vector<topology::Cpu*>& cpus = _counterCpus->getCpus();
+        for(size_t i = 0; i < cpus.size(); i++){
+            JoulesCpu jc = _counterCpus->getJoulesComponents(cpus.at(i)->getCpuId());
+            cs.joules += jc.cpu;
+            s.cpus.push_back(jc);
+        }
+        end = getMillisecondsTimeRaw();
+        // Cpus counter is the reference: the snapshot refers to the
+        // middle of its reading.
+        s.timestamp = (start + end) / 2.0;
+        cs.available = true;
+        cs.skew = (end - start) / 2.0;
+    }
+
+    if(_counterMemory){
+        CounterSnapshot& cs = s.counters[COUNTER_MEMORY];
+        start = getMillisecondsTimeRaw();
+        cs.joules = _counterMemory->getJoules();
+        end = getMillisecondsTimeRaw();
+        cs.available = true;
+        cs.skew = (start + end) / 2.0 - s.timestamp;
+    }
+
+    if(_counterPlug){
+        CounterSnapshot& cs = s.counters[COUNTER_PLUG];
+        CounterPlugMeter* meter = dynamic_cast<CounterPlugMeter*>(_counterPlug);
+        if(meter){
+            cs.joules = meter->getJoules(s.timestamp + offset, cs.skew);
+            cs.interpolated = true;
+        }else{
+            start = getMillisecondsTimeRaw();
+            cs.joules = _counterPlug->getJoules();
+            end = getMillisecondsTimeRaw();
+            cs.skew = (start + end) / 2.0 - s.timestamp;
+        }
+        cs.available = true;
+    }
+    return s;
+}
+
 #ifdef MAMMUT_REMOTE
 std::string Energy::getModuleName(){
     CounterReq cr;
@@ -390,12 +1437,18 @@ bool Energy::processMessage(const std::string& messageIdIn, const std::string& m
                             cri.set_res(_counterCpus->hasJoulesGraphic());
                         }else if(cr.subtype() == COUNTER_VALUE_TYPE_DRAM){
                             cri.set_res(_counterCpus->hasJoulesDram());
+                        }else if(cr.subtype() == COUNTER_VALUE_TYPE_CORE){
+                            cri.set_res(_counterCpus->hasJoulesCore());
                         }
                         return utils::setMessageFromData(&cri, messageIdOut, messageOut);
                     }
                 }break;
                 case COUNTER_COMMAND_GET:{
-                    if(cr.type() == COUNTER_TYPE_PB_CPUS){
+                    if(cr.type() == COUNTER_TYPE_PB_CPUS && cr.subtype() == COUNTER_VALUE_TYPE_CORE){
+                        CounterResGetGeneric crgg;
+                        crgg.set_joules(_counterCpus->getJoulesCore(cr.physicalcoreid()));
+                        return utils::setMessageFromData(&crgg, messageIdOut, messageOut);
+                    }else if(cr.type() == COUNTER_TYPE_PB_CPUS){
                         CounterResGetCpu crgc;
                         std::vector<topology::Cpu*> cpus = _counterCpus->getCpus();
                         for(size_t i = 0; i < cpus.size(); i++){
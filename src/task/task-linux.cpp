@@ -1,3 +1,4 @@
+#include <mammut/energy/energy.hpp>
 #include <mammut/task/task-linux.hpp>
 
 #include "unistd.h"
@@ -8,11 +9,17 @@
 #endif
 
 #include <errno.h>
+#include <linux/mempolicy.h>
 #include <signal.h>
 #include <string.h>
 #include <sys/ptrace.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 
+/** Maximum number of NUMA nodes that can be specified in a nodes mask. **/
+#define MAMMUT_MAX_NUMA_NODES 1024
+#define MAMMUT_NUMA_MASK_LONGS (MAMMUT_MAX_NUMA_NODES / (8 * sizeof(unsigned long)))
+
 namespace mammut{
 extern SimulationParameters simulationParameters;
 namespace task{
@@ -201,6 +208,63 @@ bool ExecutionUnitLinux::move(const std::vector<topology::VirtualCore*>& virtual
     return move(virtualCoresIds);
 }
 
+bool ExecutionUnitLinux::move(const topology::NumaNode* numaNode, bool bindMemory) const{
+    std::vector<topology::VirtualCore*> v = numaNode->getVirtualCores();
+    // Memory-only nodes have no virtual cores, only memory is bound.
+    if(v.size() && !move(v)){
+        return false;
+    }
+    if(!bindMemory){
+        return true;
+    }
+
+    topology::NumaNodeId nodeId = numaNode->getNumaNodeId();
+    if(nodeId >= MAMMUT_MAX_NUMA_NODES){
+        throw std::runtime_error("NUMA node identifier too large: " + utils::intToString(nodeId));
+    }
+    unsigned long oldNodes[MAMMUT_NUMA_MASK_LONGS];
+    unsigned long newNodes[MAMMUT_NUMA_MASK_LONGS];
+    memset(oldNodes, 0, sizeof(oldNodes));
+    memset(newNodes, 0, sizeof(newNodes));
+    // The kernel rejects masks with nodes above its maximum node identifier,
+    // so only the possible nodes are set.
+    std::string possiblePath = simulationParameters.sysfsRootPrefix + "/sys/devices/system/node/possible";
+    std::vector<uint> oldNodesIds;
+    if(utils::existsFile(possiblePath)){
+        oldNodesIds = utils::dashedRangesToIntegers(utils::readFirstLineFromFile(possiblePath));
+    }
+    if(!utils::contains(oldNodesIds, nodeId)){
+        oldNodesIds.clear();
+        for(uint i = 0; i <= nodeId; i++){
+            oldNodesIds.push_back(i);
+        }
+    }
+    for(size_t i = 0; i < oldNodesIds.size(); i++){
+        uint id = oldNodesIds.at(i);
+        if(id < MAMMUT_MAX_NUMA_NODES){
+            oldNodes[id / (8 * sizeof(unsigned long))] |= 1UL << (id % (8 * sizeof(unsigned long)));
+        }
+    }
+    newNodes[nodeId / (8 * sizeof(unsigned long))] |= 1UL << (nodeId % (8 * sizeof(unsigned long)));
+
+    if((TaskId) syscall(SYS_gettid) == _id &&
+       syscall(SYS_set_mempolicy, MPOL_BIND, newNodes, MAMMUT_MAX_NUMA_NODES) == -1 &&
+       errno != ENOSYS){
+        throw std::runtime_error("Impossible to set memory policy: " + std::string(strerror(errno)));
+    }
+
+    if(syscall(SYS_migrate_pages, _id, MAMMUT_MAX_NUMA_NODES, oldNodes, newNodes) == -1){
+        if(errno == ESRCH || errno == EPERM){
+            // EPERM: Pages of a process of another user.
+            return false;
+        }else if(errno != ENOSYS){
+            // ENOSYS: Kernel without NUMA support, there is nothing to migrate.
+            throw std::runtime_error("Impossible to migrate pages: " + std::string(strerror(errno)));
+        }
+    }
+    return true;
+}
+
 bool ExecutionUnitLinux::getVirtualCoreIds(std::vector<topology::VirtualCoreId>& vcs) const{
     cpu_set_t set;
     CPU_ZERO(&set);
@@ -252,10 +316,12 @@ bool ThreadHandlerLinux::move(const std::vector<topology::VirtualCoreId>& virtua
 }
 
 ProcessHandlerLinux::ProcessHandlerLinux(TaskId pid,
-                                         ThrottlerThread& throttlerThread):
+                                         ThrottlerThread& throttlerThread,
+                                         const energy::EnergyAccounting* accounting):
         ExecutionUnitLinux(pid, "/proc/" + utils::intToString(pid) + "/"),
         _pid(pid),
-        _throttlerThread(throttlerThread){
+        _throttlerThread(throttlerThread),
+        _accounting(accounting){
 #if defined(WITH_PAPI)
     if(!isActive()){return;}
     _countersAvailable = true;
@@ -478,6 +544,17 @@ bool ProcessHandlerLinux::sendSignal(int signal) const{
     return true;
 }
 
+bool ProcessHandlerLinux::getJoules(double& joules) const{
+    if(!_accounting){
+        throw std::runtime_error("getJoules: No energy accounting set on the tasks manager.");
+    }
+    if(!_accounting->getJoules(_pid, joules)){
+        // Not yet sampled.
+        joules = 0;
+    }
+    return isActive();
+}
+
 #define MAMMUT_THROTTLING_INTERVAL_DEFAULT_MICROSECS 100000
 
 ThrottlerThread::ThrottlerThread():
@@ -578,7 +655,7 @@ void ThrottlerThread::stop(){
     _run.clear();
 }
 
-ProcessesManagerLinux::ProcessesManagerLinux(){
+ProcessesManagerLinux::ProcessesManagerLinux():_accounting(NULL){
     _throttler.start();
 }
 
@@ -592,7 +669,7 @@ std::vector<TaskId> ProcessesManagerLinux::getActiveProcessesIdentifiers() const
 }
 
 ProcessHandler* ProcessesManagerLinux::getProcessHandler(TaskId pid){
-    return new ProcessHandlerLinux(pid, _throttler);
+    return new ProcessHandlerLinux(pid, _throttler, _accounting);
 }
 
 void ProcessesManagerLinux::releaseProcessHandler(ProcessHandler* process) const{
@@ -605,6 +682,10 @@ void ProcessesManagerLinux::setThrottlingInterval(ulong throttlingInterval){
     _throttler.setThrottlingInterval(throttlingInterval);
 }
 
+void ProcessesManagerLinux::setEnergyAccounting(const energy::EnergyAccounting* accounting){
+    _accounting = accounting;
+}
+
 ThreadHandler* ProcessesManagerLinux::getThreadHandler(TaskId pid, TaskId tid) const{
     return new ThreadHandlerLinux(pid, tid);
 }
@@ -2,9 +2,20 @@
 #include <mammut/topology/topology-linux.hpp>
 #include <mammut/utils.hpp>
 
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
 #include <cmath>
+#include <cstring>
 #include <fstream>
+#include <sched.h>
+#include <sstream>
 #include <stdexcept>
+#include <sys/resource.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 //#include <arch/x86/include/asm/processor.h>
 
 using namespace mammut::utils;
@@ -14,7 +25,136 @@ extern SimulationParameters simulationParameters;
 namespace topology{
 
 TopologyLinux::TopologyLinux():Topology(){
-    ;
+    buildNumaNodes();
+}
+
+void TopologyLinux::buildNumaNodes(){
+    std::string nodesPath = simulationParameters.sysfsRootPrefix +
+                            "/sys/devices/system/node/";
+    std::vector<NumaNodeId> nodesIds;
+    if(existsDirectory(nodesPath)){
+        std::vector<std::string> dirs = getFilesNamesInDir(nodesPath, false, true);
+        for(size_t i = 0; i < dirs.size(); i++){
+            if(dirs.at(i).compare(0, 4, "node") == 0 && dirs.at(i).size() > 4 &&
+               isdigit(dirs.at(i).at(4))){
+                nodesIds.push_back(stringToUint(dirs.at(i).substr(4)));
+            }
+        }
+        std::sort(nodesIds.begin(), nodesIds.end());
+    }
+
+    for(size_t i = 0; i < nodesIds.size(); i++){
+        std::string nodePath = nodesPath + "node" + intToString(nodesIds.at(i)) + "/";
+        std::vector<VirtualCore*> virtualCores;
+        std::map<NumaNodeId, uint> distances;
+        if(existsFile(nodePath + "cpulist")){
+            std::vector<uint> ids = dashedRangesToIntegers(readFirstLineFromFile(nodePath + "cpulist"));
+            for(size_t j = 0; j < ids.size(); j++){
+                VirtualCore* vc = getVirtualCore(ids.at(j));
+                if(vc){
+                    virtualCores.push_back(vc);
+                }
+            }
+        }
+        if(existsFile(nodePath + "distance")){
+            // Distances are listed in the same order of the nodes identifiers.
+            std::vector<std::string> d = split(readFirstLineFromFile(nodePath + "distance"), ' ');
+            size_t k = 0;
+            for(size_t j = 0; j < d.size() && k < nodesIds.size(); j++){
+                if(!d.at(j).empty()){
+                    distances[nodesIds.at(k++)] = stringToUint(d.at(j));
+                }
+            }
+        }
+        _numaNodes.push_back(new NumaNodeLinux(nodesIds.at(i), virtualCores, distances));
+    }
+
+    if(_numaNodes.empty()){
+        std::map<NumaNodeId, uint> distances;
+        distances[0] = 10;
+        _numaNodes.push_back(new NumaNodeLinux(0, _virtualCores, distances));
+    }
+}
+
+/**
+ * Converts a cache size (e.g. "32K") to bytes.
+ */
+static uint cacheSizeToBytes(const std::string& size){
+    if(size.empty()){
+        return 0;
+    }
+    uint multiplier = 1;
+    switch(size.at(size.size() - 1)){
+        case 'K':{
+            multiplier = 1024;
+        }break;
+        case 'M':{
+            multiplier = 1024 * 1024;
+        }break;
+        case 'G':{
+            multiplier = 1024 * 1024 * 1024;
+        }break;
+    }
+    return stringToUint(size.substr(0, multiplier == 1 ? size.size() : size.size() - 1)) * multiplier;
+}
+
+void TopologyLinux::buildCaches() const{
+    // Caches shared by multiple virtual cores are found once for each of them.
+    std::map<std::string, Cache*> uniqueCaches;
+    for(size_t i = 0; i < _virtualCores.size(); i++){
+        std::string cachePath = simulationParameters.sysfsRootPrefix +
+                                "/sys/devices/system/cpu/cpu" +
+                                intToString(_virtualCores.at(i)->getVirtualCoreId()) +
+                                "/cache/";
+        if(!existsDirectory(cachePath)){
+            continue;
+        }
+        std::vector<std::string> indexes = getFilesNamesInDir(cachePath, false, true);
+        for(size_t j = 0; j < indexes.size(); j++){
+            std::string indexPath = cachePath + indexes.at(j) + "/";
+            if(indexes.at(j).compare(0, 5, "index") != 0 ||
+               !existsFile(indexPath + "level") ||
+               !existsFile(indexPath + "shared_cpu_list")){
+                continue;
+            }
+            std::string level = readFirstLineFromFile(indexPath + "level");
+            std::string type = readFirstLineFromFile(indexPath + "type");
+            std::string sharedList = readFirstLineFromFile(indexPath + "shared_cpu_list");
+            std::string key = level + type + sharedList;
+            if(uniqueCaches.find(key) != uniqueCaches.end()){
+                continue;
+            }
+
+            CacheType cacheType = CACHE_TYPE_UNIFIED;
+            if(type == "Data"){
+                cacheType = CACHE_TYPE_DATA;
+            }else if(type == "Instruction"){
+                cacheType = CACHE_TYPE_INSTRUCTION;
+            }
+            uint size = 0, lineSize = 0, associativity = 0;
+            if(existsFile(indexPath + "size")){
+                size = cacheSizeToBytes(readFirstLineFromFile(indexPath + "size"));
+            }
+            if(existsFile(indexPath + "coherency_line_size")){
+                lineSize = stringToUint(readFirstLineFromFile(indexPath + "coherency_line_size"));
+            }
+            if(existsFile(indexPath + "ways_of_associativity")){
+                associativity = stringToUint(readFirstLineFromFile(indexPath + "ways_of_associativity"));
+            }
+            std::vector<VirtualCore*> virtualCores;
+            std::vector<uint> ids = dashedRangesToIntegers(sharedList);
+            for(size_t k = 0; k < ids.size(); k++){
+                VirtualCore* vc = getVirtualCore(ids.at(k));
+                if(vc){
+                    virtualCores.push_back(vc);
+                }
+            }
+            Cache* c = new Cache(stringToUint(level), cacheType, size, lineSize,
+                                 associativity, virtualCores);
+            uniqueCaches[key] = c;
+            _caches.push_back(c);
+        }
+    }
 }
 
 void TopologyLinux::maximizeUtilization() const{
@@ -29,6 +169,224 @@ void TopologyLinux::resetUtilization() const{
     }
 }
 
+NumaNodeLinux::NumaNodeLinux(NumaNodeId numaNodeId, std::vector<VirtualCore*> virtualCores,
+                             std::map<NumaNodeId, uint> distances):
+        NumaNode(numaNodeId, virtualCores, distances){
+    _memInfoPath = simulationParameters.sysfsRootPrefix + "/sys/devices/system/node/node" +
+                   intToString(numaNodeId) + "/meminfo";
+    if(!existsFile(_memInfoPath)){
+        // Not a NUMA system, the node has all the memory.
+        _memInfoPath = simulationParameters.sysfsRootPrefix + "/proc/meminfo";
+    }
+}
+
+uint64_t NumaNodeLinux::getMemInfoField(const std::string& fieldName) const{
+    if(!existsFile(_memInfoPath)){
+        return 0;
+    }
+    /**
+     * Lines have the form "Node 0 MemTotal:  32768 kB" in
+     * node meminfo and "MemTotal:  32768 kB" in /proc/meminfo.
+     */
+    std::vector<std::string> lines = readFile(_memInfoPath);
+    for(size_t i = 0; i < lines.size(); i++){
+        std::vector<std::string> fields = split(lines.at(i), ' ');
+        for(size_t j = 0; j < fields.size(); j++){
+            if(fields.at(j) == fieldName + ":"){
+                for(size_t k = j + 1; k < fields.size(); k++){
+                    if(!fields.at(k).empty()){
+                        return stringToUlong(fields.at(k));
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+uint64_t NumaNodeLinux::getMemoryTotal() const{
+    return getMemInfoField("MemTotal");
+}
+
+uint64_t NumaNodeLinux::getMemoryFree() const{
+    return getMemInfoField("MemFree");
+}
+
+/**
+ * Reads /proc/stat once and parses the lines of all the virtual cores.
+ * @param virtualCoresIds The identifiers of the virtual cores found.
+ * @param ticks The ticks spent by each virtual core in each state
+ *        (UTILIZATION_FIELDS_NUM elements for each virtual core).
+ * @param onlyVirtualCoreId If >= 0, only the line of this virtual
+ *        core is parsed.
+ */
+static void readProcStat(std::vector<VirtualCoreId>& virtualCoresIds,
+                         std::vector<uint64_t>& ticks,
+                         int onlyVirtualCoreId = -1){
+    std::ifstream file((simulationParameters.sysfsRootPrefix + "/proc/stat").c_str());
+    if(!file){
+        throw std::runtime_error("Impossible to open /proc/stat.");
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    const std::string content = buffer.str();
+
+    virtualCoresIds.clear();
+    ticks.clear();
+    const char* p = content.c_str();
+    while(*p){
+        // Lines of the virtual cores start with "cpuN " (the aggregate one with "cpu ").
+        if(!strncmp(p, "cpu", 3) && isdigit(p[3])){
+            char* end;
+            VirtualCoreId id = strtoul(p + 3, &end, 10);
+            p = end;
+            if(onlyVirtualCoreId < 0 || id == (VirtualCoreId) onlyVirtualCoreId){
+                virtualCoresIds.push_back(id);
+                for(size_t f = 0; f < UTILIZATION_FIELDS_NUM; f++){
+                    // Missing fields (old kernels) are read as 0.
+                    ticks.push_back(strtoull(p, &end, 10));
+                    p = end;
+                }
+                if(onlyVirtualCoreId >= 0){
+                    return;
+                }
+            }
+        }
+        while(*p && *p != '\n'){
+            ++p;
+        }
+        if(*p){
+            ++p;
+        }
+    }
+}
+
+UtilizationSnapshot TopologyLinux::getUtilizationSnapshot() const{
+    std::vector<VirtualCoreId> virtualCoresIds;
+    std::vector<uint64_t> ticks;
+    readProcStat(virtualCoresIds, ticks);
+    return UtilizationSnapshot(virtualCoresIds, ticks, getClockTicksPerSecond());
+}
+
+/**
+ * Samples TSC, APERF and MPERF on the specified virtual cores
+ * at the beginning and at the end of the window. Virtual cores
+ * whose registers cannot be read are marked as not valid.
+ * Returns false if no virtual core could be read.
+ */
+static bool sampleEffectiveFrequencies(const std::vector<VirtualCore*>& virtualCores, uint window,
+                                       std::vector<EffectiveFrequency>& effectiveFrequencies){
+    MsrBatch batch;
+    for(size_t i = 0; i < virtualCores.size(); i++){
+        VirtualCoreId id = virtualCores.at(i)->getVirtualCoreId();
+        batch.add(id, MSR_TSC);
+        batch.add(id, MSR_APERF);
+        batch.add(id, MSR_MPERF);
+    }
+
+    batch.read();
+    double startTime = getMillisecondsTime();
+    std::vector<uint64_t> start(batch.size());
+    std::vector<bool> valid(batch.size());
+    bool any = false;
+    for(size_t i = 0; i < batch.size(); i++){
+        valid.at(i) = batch.get(i, start.at(i));
+        any = any || valid.at(i);
+    }
+    if(!any){
+        return false;
+    }
+
+    usleep(window * MAMMUT_MICROSECS_IN_MILLISEC);
+
+    batch.read();
+    double elapsed = getMillisecondsTime() - startTime;
+    if(elapsed <= 0){
+        return false;
+    }
+
+    any = false;
+    effectiveFrequencies.resize(virtualCores.size());
+    for(size_t i = 0; i < virtualCores.size(); i++){
+        EffectiveFrequency& ef = effectiveFrequencies.at(i);
+        ef.busy = 0;
+        ef.busyFrequency = 0;
+        ef.averageFrequency = 0;
+        ef.valid = false;
+        uint64_t tsc, aperf, mperf;
+        if(!valid.at(i*3) || !valid.at(i*3 + 1) || !valid.at(i*3 + 2) ||
+           !batch.get(i*3, tsc) || !batch.get(i*3 + 1, aperf) || !batch.get(i*3 + 2, mperf)){
+            continue;
+        }
+        double deltaTsc = tsc - start.at(i*3);
+        double deltaAperf = aperf - start.at(i*3 + 1);
+        double deltaMperf = mperf - start.at(i*3 + 2);
+
+        ef.valid = true;
+        any = true;
+        // Ticks per millisecond are KHz.
+        ef.averageFrequency = deltaAperf / elapsed;
+        if(deltaTsc){
+            // MPERF increments at the TSC rate while in C0.
+            ef.busy = (deltaMperf / deltaTsc) * 100.0;
+        }
+        if(deltaMperf){
+            ef.busyFrequency = (deltaTsc / elapsed) * (deltaAperf / deltaMperf);
+        }
+    }
+    return any;
+}
+
+/**
+ * Samples the TSC and the residency registers on the specified virtual
+ * core at the beginning and at the end of the window. Residency
+ * counters increment at the TSC rate.
+ * Registers which cannot be read (not supported on this model)
+ * are not reported.
+ */
+static bool sampleResidencies(VirtualCoreId virtualCoreId,
+                              const std::vector<std::pair<CState, uint32_t> >& registers,
+                              uint window, CStateResidencies& residencies){
+    MsrBatch batch;
+    batch.add(virtualCoreId, MSR_TSC);
+    for(size_t i = 0; i < registers.size(); i++){
+        batch.add(virtualCoreId, registers.at(i).second);
+    }
+
+    std::vector<uint64_t> start(batch.size());
+    std::vector<bool> valid(batch.size());
+    batch.read();
+    for(size_t i = 0; i < batch.size(); i++){
+        valid.at(i) = batch.get(i, start.at(i));
+    }
+    if(!valid.at(0)){
+        return false;
+    }
+
+    usleep(window * MAMMUT_MICROSECS_IN_MILLISEC);
+
+    batch.read();
+    uint64_t tsc;
+    if(!batch.get(0, tsc) || tsc == start.at(0)){
+        return false;
+    }
+    double deltaTsc = tsc - start.at(0);
+    residencies.clear();
+    for(size_t i = 0; i < registers.size(); i++){
+        uint64_t value;
+        if(valid.at(i + 1) && batch.get(i + 1, value)){
+            double residency = ((value - start.at(i + 1)) / deltaTsc) * 100.0;
+            residencies[registers.at(i).first] = std::min(residency, 100.0);
+        }
+    }
+    return true;
+}
+
+bool TopologyLinux::getEffectiveFrequencies(uint window,
+                                            std::vector<EffectiveFrequency>& effectiveFrequencies) const{
+    return sampleEffectiveFrequencies(_virtualCores, window, effectiveFrequencies);
+}
+
 std::string getTopologyPathFromVirtualCoreId(VirtualCoreId id){
     return simulationParameters.sysfsRootPrefix +
            "/sys/devices/system/cpu/cpu" + intToString(id) + "/topology/";
@@ -56,18 +414,83 @@ std::string CpuLinux::getCpuInfo(const std::string& infoName) const{
     return "";
 }
 
+/**
+ * Checks if CPU information can be read through CPUID instead of
+ * /proc/cpuinfo (i.e. x86 and not simulated).
+ */
+static bool useCpuId(){
+#ifdef __x86_64__
+    return simulationParameters.sysfsRootPrefix.empty();
+#else
+    return false;
+#endif
+}
+
+/**
+ * Family and model as computed by the kernel for /proc/cpuinfo.
+ */
+static uint getCpuIdFamily(){
+    uint32_t signature = CpuIdAsm(1).EAX();
+    uint family = (signature >> 8) & 0xF;
+    if(family == 0xF){
+        family += (signature >> 20) & 0xFF;
+    }
+    return family;
+}
+
+static uint getCpuIdModel(){
+    uint32_t signature = CpuIdAsm(1).EAX();
+    uint model = (signature >> 4) & 0xF;
+    if(getCpuIdFamily() >= 0x6){
+        model += ((signature >> 16) & 0xF) << 4;
+    }
+    return model;
+}
+
+static std::string getCpuIdVendorId(){
+    CpuIdAsm c(0);
+    char vendorId[13];
+    memcpy(vendorId, &c.EBX(), 4);
+    memcpy(vendorId + 4, &c.EDX(), 4);
+    memcpy(vendorId + 8, &c.ECX(), 4);
+    vendorId[12] = '\0';
+    return std::string(vendorId);
+}
+
 std::string CpuLinux::getVendorId() const{
+    if(useCpuId()){
+        return getCpuIdVendorId();
+    }
     return getCpuInfo("vendor_id");
 }
 
 std::string CpuLinux::getFamily() const{
+    if(useCpuId()){
+        return intToString(getCpuIdFamily());
+    }
     return getCpuInfo("cpu family");
 }
 
 std::string CpuLinux::getModel() const{
+    if(useCpuId()){
+        return intToString(getCpuIdModel());
+    }
     return getCpuInfo("model");
 }
 
+bool CpuLinux::getCStateResidencies(uint window, CStateResidencies& residencies) const{
+    std::vector<std::pair<CState, uint32_t> > registers;
+    registers.push_back(std::pair<CState, uint32_t>(CSTATE_C2, MSR_PKG_C2_RESIDENCY));
+    registers.push_back(std::pair<CState, uint32_t>(CSTATE_C3, MSR_PKG_C3_RESIDENCY));
+    registers.push_back(std::pair<CState, uint32_t>(CSTATE_C6, MSR_PKG_C6_RESIDENCY));
+    registers.push_back(std::pair<CState, uint32_t>(CSTATE_C7, MSR_PKG_C7_RESIDENCY));
+    registers.push_back(std::pair<CState, uint32_t>(CSTATE_C8, MSR_PKG_C8_RESIDENCY));
+    registers.push_back(std::pair<CState, uint32_t>(CSTATE_C9, MSR_PKG_C9_RESIDENCY));
+    registers.push_back(std::pair<CState, uint32_t>(CSTATE_C10, MSR_PKG_C10_RESIDENCY));
+    return sampleResidencies(_virtualCores.at(0)->getVirtualCoreId(), registers,
+                             window, residencies);
+}
+
 void CpuLinux::maximizeUtilization() const{
     for(size_t i = 0; i < _virtualCores.size(); i++){
         _virtualCores.at(i)->maximizeUtilization();
@@ -168,30 +591,198 @@ void VirtualCoreIdleLevelLinux::resetCount(){
     _lastAbsCount = getAbsoluteCount();
 }
 
-SpinnerThread::SpinnerThread():_stop(false){
-    srand(time(NULL));
+// Iterations of the compute kernels between two checks of time and stop flag.
+#define MAMMUT_LOAD_COMPUTE_ITERATIONS 10000
+// Size of the buffers of the memory kernels (bytes).
+#define MAMMUT_LOAD_BUFFER_SIZE (32 * 1024 * 1024)
+// Elements of the stream buffer accessed between two checks.
+#define MAMMUT_LOAD_STREAM_ELEMENTS (16 * 1024)
+// Loads of the pointer chasing kernel between two checks.
+#define MAMMUT_LOAD_CHASE_LOADS 1024
+// Elements of the pointer chasing buffer per cache line.
+#define MAMMUT_LOAD_CHASE_STRIDE (64 / sizeof(size_t))
+
+static double loadScalar(double seed){
+    // Independent chains, to keep the floating point units busy.
+    double a = seed, b = seed + 1, c = seed + 2, d = seed + 3;
+    for(size_t i = 0; i < MAMMUT_LOAD_COMPUTE_ITERATIONS; i++){
+        a = a * 0.999999 + 0.000001;
+        b = b * 0.999999 + 0.000001;
+        c = c * 0.999999 + 0.000001;
+        d = d * 0.999999 + 0.000001;
+    }
+    return a + b + c + d;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2,fma")))
+static double loadFmaAvx2(double seed){
+    const __m256d m = _mm256_set1_pd(0.999999);
+    const __m256d s = _mm256_set1_pd(0.000001);
+    // Enough independent accumulators to hide the latency of the FMA units.
+    __m256d r0 = _mm256_set1_pd(seed), r1 = _mm256_set1_pd(seed + 1),
+            r2 = _mm256_set1_pd(seed + 2), r3 = _mm256_set1_pd(seed + 3),
+            r4 = _mm256_set1_pd(seed + 4), r5 = _mm256_set1_pd(seed + 5),
+            r6 = _mm256_set1_pd(seed + 6), r7 = _mm256_set1_pd(seed + 7);
+    for(size_t i = 0; i < MAMMUT_LOAD_COMPUTE_ITERATIONS; i++){
+        r0 = _mm256_fmadd_pd(r0, m, s);
+        r1 = _mm256_fmadd_pd(r1, m, s);
+        r2 = _mm256_fmadd_pd(r2, m, s);
+        r3 = _mm256_fmadd_pd(r3, m, s);
+        r4 = _mm256_fmadd_pd(r4, m, s);
+        r5 = _mm256_fmadd_pd(r5, m, s);
+        r6 = _mm256_fmadd_pd(r6, m, s);
+        r7 = _mm256_fmadd_pd(r7, m, s);
+    }
+    __m256d r = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(r0, r1), _mm256_add_pd(r2, r3)),
+                              _mm256_add_pd(_mm256_add_pd(r4, r5), _mm256_add_pd(r6, r7)));
+    double v[4];
+    _mm256_storeu_pd(v, r);
+    return v[0] + v[1] + v[2] + v[3];
+}
+
+__attribute__((target("avx512f")))
+static double loadFmaAvx512(double seed){
+    const __m512d m = _mm512_set1_pd(0.999999);
+    const __m512d s = _mm512_set1_pd(0.000001);
+    __m512d r0 = _mm512_set1_pd(seed), r1 = _mm512_set1_pd(seed + 1),
+            r2 = _mm512_set1_pd(seed + 2), r3 = _mm512_set1_pd(seed + 3),
+            r4 = _mm512_set1_pd(seed + 4), r5 = _mm512_set1_pd(seed + 5),
+            r6 = _mm512_set1_pd(seed + 6), r7 = _mm512_set1_pd(seed + 7);
+    for(size_t i = 0; i < MAMMUT_LOAD_COMPUTE_ITERATIONS; i++){
+        r0 = _mm512_fmadd_pd(r0, m, s);
+        r1 = _mm512_fmadd_pd(r1, m, s);
+        r2 = _mm512_fmadd_pd(r2, m, s);
+        r3 = _mm512_fmadd_pd(r3, m, s);
+        r4 = _mm512_fmadd_pd(r4, m, s);
+        r5 = _mm512_fmadd_pd(r5, m, s);
+        r6 = _mm512_fmadd_pd(r6, m, s);
+        r7 = _mm512_fmadd_pd(r7, m, s);
+    }
+    __m512d r = _mm512_add_pd(_mm512_add_pd(_mm512_add_pd(r0, r1), _mm512_add_pd(r2, r3)),
+                              _mm512_add_pd(_mm512_add_pd(r4, r5), _mm512_add_pd(r6, r7)));
+    double v[8];
+    _mm512_storeu_pd(v, r);
+    return v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+}
+#endif
+
+LoadThread::LoadThread(VirtualCoreId virtualCoreId, LoadKernel kernel,
+                       double utilization, uint period):
+        _virtualCoreId(virtualCoreId), _stop(false), _kernel(kernel),
+        _utilization(utilization), _period(period), _streamOffset(0),
+        _chaseIndex(0), _sink(0), _pinned(false){
+    ;
+}
+
+bool LoadThread::waitPinned(){
+    _started.wait();
+    return _pinned;
 }
 
-void SpinnerThread::setStop(bool s){
-    _lock.lock();
+void LoadThread::setStop(bool s){
     _stop = s;
-    _lock.unlock();
 }
 
-bool SpinnerThread::isStopped(){
-    bool r;
-    _lock.lock();
-    r = _stop;
-    _lock.unlock();
-    return r;
+void LoadThread::setKernel(LoadKernel kernel){
+    _kernel = kernel;
+}
+
+void LoadThread::setUtilization(double utilization){
+    _utilization = utilization;
+}
+
+void LoadThread::runKernel(LoadKernel kernel){
+    switch(kernel){
+        case LOAD_KERNEL_SCALAR:{
+            _sink = loadScalar(_sink);
+        }break;
+#if defined(__x86_64__)
+        case LOAD_KERNEL_FMA_AVX2:{
+            _sink = loadFmaAvx2(_sink);
+        }break;
+        case LOAD_KERNEL_FMA_AVX512:{
+            _sink = loadFmaAvx512(_sink);
+        }break;
+#endif
+        case LOAD_KERNEL_MEMORY_STREAM:{
+            if(_streamBuffer.empty()){
+                _streamBuffer.resize(MAMMUT_LOAD_BUFFER_SIZE / sizeof(double), 1.0);
+            }
+            // First half is read, second half is written.
+            size_t half = _streamBuffer.size() / 2;
+            double* src = &(_streamBuffer[0]);
+            double* dst = src + half;
+            size_t end = std::min(_streamOffset + MAMMUT_LOAD_STREAM_ELEMENTS, half);
+            for(size_t i = _streamOffset; i < end; i++){
+                dst[i] = src[i] * 0.999999 + _sink;
+            }
+            _streamOffset = (end == half) ? 0 : end;
+            _sink = dst[end - 1] * 0.000001;
+        }break;
+        case LOAD_KERNEL_POINTER_CHASE:{
+            if(_chaseBuffer.empty()){
+                // A random cycle over the cache lines (Sattolo's algorithm).
+                size_t lines = MAMMUT_LOAD_BUFFER_SIZE / 64;
+                std::vector<size_t> order(lines);
+                for(size_t i = 0; i < lines; i++){
+                    order[i] = i;
+                }
+                unsigned int seed = _virtualCoreId;
+                for(size_t i = lines - 1; i > 0; i--){
+                    size_t j = rand_r(&seed) % i;
+                    std::swap(order[i], order[j]);
+                }
+                _chaseBuffer.resize(lines * MAMMUT_LOAD_CHASE_STRIDE);
+                for(size_t i = 0; i < lines; i++){
+                    _chaseBuffer[order[i] * MAMMUT_LOAD_CHASE_STRIDE] =
+                            order[(i + 1) % lines] * MAMMUT_LOAD_CHASE_STRIDE;
+                }
+            }
+            size_t index = _chaseIndex;
+            for(size_t i = 0; i < MAMMUT_LOAD_CHASE_LOADS; i++){
+                index = _chaseBuffer[index];
+            }
+            _chaseIndex = index;
+        }break;
+        default:{
+            throw std::runtime_error("LoadThread: Unsupported kernel.");
+        }
+    }
 }
 
-void SpinnerThread::run(){
-    double r = rand();
-    while(!isStopped()){
-        r = sin(r);
-    };
-    writeFile("/dev/null", intToString(r));
+void LoadThread::run(){
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(_virtualCoreId, &set);
+    // Highest priority, if allowed.
+    _pinned = sched_setaffinity(0, sizeof(cpu_set_t), &set) != -1 &&
+              (setpriority(PRIO_PROCESS, getPidAndTid().second, PRIO_MIN) != -1 ||
+               errno == EACCES || errno == EPERM);
+    _started.notifyAll();
+    if(!_pinned){
+        return;
+    }
+
+    while(!_stop){
+        double period = _period;
+        double utilization = _utilization;
+        double periodStart = getMillisecondsTime();
+        double busyEnd = periodStart + period * utilization / 100.0;
+        while(!_stop && (utilization >= 100 || getMillisecondsTime() < busyEnd)){
+            runKernel((LoadKernel) _kernel.load());
+            if(utilization != _utilization){
+                break;
+            }
+        }
+        if(utilization < 100){
+            // Sleep in slices, to react quickly to stop requests.
+            double remaining;
+            while(!_stop && (remaining = periodStart + period - getMillisecondsTime()) > 0){
+                usleep(std::min(remaining, 10.0) * MAMMUT_MICROSECS_IN_MILLISEC);
+            }
+        }
+    }
 }
 
 VirtualCoreLinux::VirtualCoreLinux(CpuId cpuId, PhysicalCoreId physicalCoreId, VirtualCoreId virtualCoreId):
@@ -199,8 +790,27 @@ VirtualCoreLinux::VirtualCoreLinux(CpuId cpuId, PhysicalCoreId physicalCoreId, V
             _hotplugFile(simulationParameters.sysfsRootPrefix +
                          "/sys/devices/system/cpu/cpu" + intToString(virtualCoreId) +
                          "/online"),
-            _utilizationThread(new SpinnerThread()),
-            _clkModMsr(virtualCoreId, O_RDWR){
+            _lastProcIdleTime(0),
+            _loadGenerator(NULL),
+            _clkModMsr(NULL),
+            _clkModLowBit(0),
+            _clkModStep(0),
+            _coreType(CORE_TYPE_PERFORMANCE),
+            _estimatedCapacity(0){
+    ;
+}
+
+VirtualCoreLinux::~VirtualCoreLinux(){
+    deleteVectorElements<VirtualCoreIdleLevel*>(_idleLevels);
+    if(_loadGenerator){
+        delete _loadGenerator;
+    }
+    if(_clkModMsr){
+        delete _clkModMsr;
+    }
+}
+
+void VirtualCoreLinux::initIdleLevels() const{
     std::vector<std::string> levelsNames;
     if(existsDirectory(simulationParameters.sysfsRootPrefix +
                        "/sys/devices/system/cpu/cpu0/cpuidle")){
@@ -216,8 +826,20 @@ VirtualCoreLinux::VirtualCoreLinux(CpuId cpuId, PhysicalCoreId physicalCoreId, V
             _idleLevels.push_back(new VirtualCoreIdleLevelLinux(*this, levelId));
         }
     }
-    resetIdleTime();
+}
+
+void VirtualCoreLinux::initIdleTime() const{
+    _lastProcIdleTime = getAbsoluteIdleTime();
+}
+
+void VirtualCoreLinux::initLoadGenerator() const{
+    std::vector<VirtualCore*> virtualCores;
+    virtualCores.push_back(const_cast<VirtualCoreLinux*>(this));
+    _loadGenerator = new LoadGenerator(virtualCores);
+}
 
+void VirtualCoreLinux::initClockModulation() const{
+    _clkModMsr = new Msr(getVirtualCoreId(), O_RDWR);
     uint possibleValues;
     CpuIdAsm cia(6);
     if(cia.EAX() & (1 << 5)){
@@ -240,13 +862,88 @@ VirtualCoreLinux::VirtualCoreLinux(CpuId cpuId, PhysicalCoreId physicalCoreId, V
     _clkModValues.push_back(100.0); 
 }
 
-VirtualCoreLinux::~VirtualCoreLinux(){
-    deleteVectorElements<VirtualCoreIdleLevel*>(_idleLevels);
-    resetUtilization();
-    delete _utilizationThread;
+typedef struct{
+    const char* name;
+    uint32_t leaf;
+    // 0: EAX, 1: EBX, 2: ECX, 3: EDX
+    uint reg;
+    uint bit;
+}CpuIdFlag;
+
+/**
+ * Flags (named as in /proc/cpuinfo) which directly correspond
+ * to a CPUID bit.
+ */
+static const CpuIdFlag cpuIdFlags[] = {
+    {"fpu", 0x1, 3, 0}, {"vme", 0x1, 3, 1}, {"de", 0x1, 3, 2}, {"pse", 0x1, 3, 3},
+    {"tsc", 0x1, 3, 4}, {"msr", 0x1, 3, 5}, {"pae", 0x1, 3, 6}, {"mce", 0x1, 3, 7},
+    {"cx8", 0x1, 3, 8}, {"apic", 0x1, 3, 9}, {"sep", 0x1, 3, 11}, {"mtrr", 0x1, 3, 12},
+    {"pge", 0x1, 3, 13}, {"mca", 0x1, 3, 14}, {"cmov", 0x1, 3, 15}, {"pat", 0x1, 3, 16},
+    {"pse36", 0x1, 3, 17}, {"clflush", 0x1, 3, 19}, {"acpi", 0x1, 3, 22}, {"mmx", 0x1, 3, 23},
+    {"fxsr", 0x1, 3, 24}, {"sse", 0x1, 3, 25}, {"sse2", 0x1, 3, 26}, {"ss", 0x1, 3, 27},
+    {"ht", 0x1, 3, 28}, {"tm", 0x1, 3, 29}, {"pbe", 0x1, 3, 31},
+    {"pni", 0x1, 2, 0}, {"pclmulqdq", 0x1, 2, 1}, {"dtes64", 0x1, 2, 2}, {"monitor", 0x1, 2, 3},
+    {"ds_cpl", 0x1, 2, 4}, {"vmx", 0x1, 2, 5}, {"smx", 0x1, 2, 6}, {"est", 0x1, 2, 7},
+    {"tm2", 0x1, 2, 8}, {"ssse3", 0x1, 2, 9}, {"fma", 0x1, 2, 12}, {"cx16", 0x1, 2, 13},
+    {"xtpr", 0x1, 2, 14}, {"pdcm", 0x1, 2, 15}, {"pcid", 0x1, 2, 17}, {"dca", 0x1, 2, 18},
+    {"sse4_1", 0x1, 2, 19}, {"sse4_2", 0x1, 2, 20}, {"x2apic", 0x1, 2, 21}, {"movbe", 0x1, 2, 22},
+    {"popcnt", 0x1, 2, 23}, {"tsc_deadline_timer", 0x1, 2, 24}, {"aes", 0x1, 2, 25},
+    {"xsave", 0x1, 2, 26}, {"avx", 0x1, 2, 28}, {"f16c", 0x1, 2, 29}, {"rdrand", 0x1, 2, 30},
+    {"hypervisor", 0x1, 2, 31},
+    {"dtherm", 0x6, 0, 0}, {"ida", 0x6, 0, 1}, {"arat", 0x6, 0, 2}, {"pln", 0x6, 0, 4},
+    {"pts", 0x6, 0, 6}, {"hwp", 0x6, 0, 7},
+    {"fsgsbase", 0x7, 1, 0}, {"bmi1", 0x7, 1, 3}, {"hle", 0x7, 1, 4}, {"avx2", 0x7, 1, 5},
+    {"smep", 0x7, 1, 7}, {"bmi2", 0x7, 1, 8}, {"erms", 0x7, 1, 9}, {"invpcid", 0x7, 1, 10},
+    {"rtm", 0x7, 1, 11}, {"avx512f", 0x7, 1, 16}, {"avx512dq", 0x7, 1, 17}, {"rdseed", 0x7, 1, 18},
+    {"adx", 0x7, 1, 19}, {"smap", 0x7, 1, 20}, {"clflushopt", 0x7, 1, 23}, {"clwb", 0x7, 1, 24},
+    {"avx512cd", 0x7, 1, 28}, {"sha_ni", 0x7, 1, 29}, {"avx512bw", 0x7, 1, 30},
+    {"avx512vl", 0x7, 1, 31}, {"hybrid_cpu", 0x7, 3, 15},
+    {"lahf_lm", 0x80000001, 2, 0}, {"abm", 0x80000001, 2, 5}, {"sse4a", 0x80000001, 2, 6},
+    {"syscall", 0x80000001, 3, 11}, {"nx", 0x80000001, 3, 20}, {"pdpe1gb", 0x80000001, 3, 26},
+    {"rdtscp", 0x80000001, 3, 27}, {"lm", 0x80000001, 3, 29},
+    {"nonstop_tsc", 0x80000007, 3, 8},
+};
+
+/**
+ * Checks a flag through CPUID.
+ * @param flagName The name of the flag.
+ * @param present Will be true if the flag is present, false otherwise.
+ * @return false if the flag cannot be checked through CPUID.
+ */
+static bool hasFlagCpuId(const std::string& flagName, bool& present){
+    if(flagName == "constant_tsc"){
+        // Same rules used by the kernel.
+        uint family = getCpuIdFamily(), model = getCpuIdModel();
+        std::string vendorId = getCpuIdVendorId();
+        hasFlagCpuId("nonstop_tsc", present);
+        present = present ||
+                  (vendorId == "GenuineIntel" && ((family == 0xF && model >= 0x03) ||
+                                                  (family == 0x6 && model >= 0x0E))) ||
+                  (vendorId == "AuthenticAMD" && family >= 0x10);
+        return true;
+    }
+    for(size_t i = 0; i < sizeof(cpuIdFlags) / sizeof(cpuIdFlags[0]); i++){
+        const CpuIdFlag& f = cpuIdFlags[i];
+        if(flagName == f.name){
+            uint32_t maxLeaf = CpuIdAsm(f.leaf & 0x80000000).EAX();
+            if(f.leaf > maxLeaf){
+                present = false;
+                return true;
+            }
+            CpuIdAsm c(f.leaf);
+            uint32_t regs[4] = {c.EAX(), c.EBX(), c.ECX(), c.EDX()};
+            present = (regs[f.reg] >> f.bit) & 1;
+            return true;
+        }
+    }
+    return false;
 }
 
 bool VirtualCoreLinux::hasFlag(const std::string& flagName) const{
+    bool present;
+    if(useCpuId() && hasFlagCpuId(flagName, present)){
+        return present;
+    }
     if(!existsFile(simulationParameters.sysfsRootPrefix + "/proc/cpuinfo")){
         return false;
     }
@@ -286,50 +983,172 @@ uint64_t VirtualCoreLinux::getAbsoluteTicks() const{
     return 0;
 }
 
-void VirtualCoreLinux::maximizeUtilization() const{
-    if(_utilizationThread->running()){
-        /** Is useless for the moment. Is just a placeholder in case
-         *  different utilization levels will be added in the future.
-         **/
-        resetUtilization();
+bool VirtualCoreLinux::getEffectiveFrequency(uint window, EffectiveFrequency& effectiveFrequency) const{
+    std::vector<VirtualCore*> virtualCores;
+    std::vector<EffectiveFrequency> effectiveFrequencies;
+    virtualCores.push_back(const_cast<VirtualCoreLinux*>(this));
+    if(!sampleEffectiveFrequencies(virtualCores, window, effectiveFrequencies)){
+        return false;
     }
+    effectiveFrequency = effectiveFrequencies.at(0);
+    return true;
+}
 
-    _utilizationThread->setStop(false);
-    _utilizationThread->start();
-    std::pair<task::TaskId, task::TaskId> pidTid = _utilizationThread->getPidAndTid();
-    auto tHandler = task::TasksManager::local();
-    mammut::task::ThreadHandler* h = tHandler->getThreadHandler(pidTid.first, pidTid.second);
+bool VirtualCoreLinux::getCStateResidencies(uint window, CStateResidencies& residencies) const{
+    std::vector<std::pair<CState, uint32_t> > registers;
+    // MPERF only increments in C0.
+    registers.push_back(std::pair<CState, uint32_t>(CSTATE_C0, MSR_MPERF));
+    registers.push_back(std::pair<CState, uint32_t>(CSTATE_C1, MSR_CORE_C1_RESIDENCY));
+    registers.push_back(std::pair<CState, uint32_t>(CSTATE_C3, MSR_CORE_C3_RESIDENCY));
+    registers.push_back(std::pair<CState, uint32_t>(CSTATE_C6, MSR_CORE_C6_RESIDENCY));
+    registers.push_back(std::pair<CState, uint32_t>(CSTATE_C7, MSR_CORE_C7_RESIDENCY));
+    return sampleResidencies(getVirtualCoreId(), registers, window, residencies);
+}
+
+#ifdef __x86_64__
+/**
+ * Executes CPUID leaf 0x1A on a given virtual core.
+ */
+class CoreTypeThread: public utils::Thread{
+private:
+    const VirtualCoreId _virtualCoreId;
+public:
+    bool pinned;
+    uint32_t eax;
+
+    explicit CoreTypeThread(VirtualCoreId virtualCoreId):
+        _virtualCoreId(virtualCoreId), pinned(false), eax(0){;}
+
+    void run(){
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(_virtualCoreId, &set);
+        pinned = sched_setaffinity(0, sizeof(cpu_set_t), &set) != -1;
+        if(pinned){
+            eax = CpuIdAsm(0x1A).EAX();
+        }
+    }
+};
+#endif
 
-    h->move(this);
-    h->setPriority(MAMMUT_PROCESS_PRIORITY_MAX);
-    tHandler->releaseThreadHandler(h);
-    task::TasksManager::release(tHandler);
+/**
+ * Reads the type of a virtual core from CPUID leaf 0x1A. Since CPUID
+ * refers to the core on which it is executed, it is run by a helper
+ * thread pinned on the virtual core, so that the affinity of the
+ * caller is not modified.
+ */
+static bool getCoreTypeCpuId(VirtualCoreId virtualCoreId, CoreType& coreType){
+#ifdef __x86_64__
+    // CPUID.07H:EDX[15] is set on hybrid processors.
+    if(CpuIdAsm(0).EAX() < 0x1A || !(CpuIdAsm(7).EDX() & (1 << 15))){
+        return false;
+    }
+    CoreTypeThread thread(virtualCoreId);
+    thread.start();
+    thread.join();
+    if(!thread.pinned){
+        return false;
+    }
+    switch(thread.eax >> 24){
+        case 0x20:{
+            coreType = CORE_TYPE_EFFICIENCY;
+        }return true;
+        case 0x40:{
+            coreType = CORE_TYPE_PERFORMANCE;
+        }return true;
+    }
+#endif
+    return false;
 }
 
-void VirtualCoreLinux::resetUtilization() const{
-    if(_utilizationThread->running()){
-        _utilizationThread->setStop(true);
-        _utilizationThread->join();
+/**
+ * Returns the maximum frequency of a virtual core (KHz), 0 if not available.
+ */
+static uint getMaxFrequency(const std::string& virtualCorePath){
+    std::string file = virtualCorePath + "/cpufreq/cpuinfo_max_freq";
+    if(existsFile(file)){
+        return stringToUint(readFirstLineFromFile(file));
     }
+    return 0;
 }
 
-double VirtualCoreLinux::getProcStatTime(ProcStatTimeType type) const{
-    std::vector<std::string> lines = readFile(simulationParameters.sysfsRootPrefix +
-                                              "/proc/stat");
-    std::string line;
-    double field = 0;
-    bool found = false;
-    for(size_t i = 0; i < lines.size(); i++){
-        line = lines.at(i);
-        if(line.find("cpu" + intToString(getVirtualCoreId())) != std::string::npos){
-            found = true;
-            field = stringToInt(split(line, ' ')[type]);
+void VirtualCoreLinux::initCoreType() const{
+    std::string atomPmu = simulationParameters.sysfsRootPrefix + "/sys/devices/cpu_atom/cpus";
+    std::string capacityFile = simulationParameters.sysfsRootPrefix +
+                               "/sys/devices/system/cpu/cpu" +
+                               intToString(getVirtualCoreId()) + "/cpu_capacity";
+    _coreType = CORE_TYPE_PERFORMANCE;
+    if(existsFile(atomPmu)){
+        // Intel hybrid, PMUs are split in cpu_core and cpu_atom.
+        if(contains(dashedRangesToIntegers(readFirstLineFromFile(atomPmu)), getVirtualCoreId())){
+            _coreType = CORE_TYPE_EFFICIENCY;
+        }
+    }else if(existsFile(capacityFile)){
+        if(stringToUint(readFirstLineFromFile(capacityFile)) < 1024){
+            _coreType = CORE_TYPE_EFFICIENCY;
+        }
+    }else if(simulationParameters.sysfsRootPrefix.empty()){
+        getCoreTypeCpuId(getVirtualCoreId(), _coreType);
+    }
+}
+
+CoreType VirtualCoreLinux::getCoreType() const{
+    std::call_once(_coreTypeOnce, &VirtualCoreLinux::initCoreType, this);
+    return _coreType;
+}
+
+uint VirtualCoreLinux::getCapacity() const{
+    std::string cpusPath = simulationParameters.sysfsRootPrefix + "/sys/devices/system/cpu/";
+    std::string capacityFile = cpusPath + "cpu" + intToString(getVirtualCoreId()) + "/cpu_capacity";
+    if(existsFile(capacityFile)){
+        return stringToUint(readFirstLineFromFile(capacityFile));
+    }
+
+    std::call_once(_estimatedCapacityOnce, &VirtualCoreLinux::initEstimatedCapacity, this);
+    return _estimatedCapacity;
+}
+
+void VirtualCoreLinux::initEstimatedCapacity() const{
+    std::string cpusPath = simulationParameters.sysfsRootPrefix + "/sys/devices/system/cpu/";
+    // Estimated from the maximum frequency of the fastest virtual core.
+    uint maxFrequency = 0;
+    std::vector<std::string> dirs = getFilesNamesInDir(cpusPath, false, true);
+    for(size_t i = 0; i < dirs.size(); i++){
+        if(dirs.at(i).compare(0, 3, "cpu") == 0 && dirs.at(i).size() > 3 &&
+           isdigit(dirs.at(i).at(3))){
+            maxFrequency = std::max(maxFrequency, getMaxFrequency(cpusPath + dirs.at(i)));
         }
     }
+    uint frequency = getMaxFrequency(cpusPath + "cpu" + intToString(getVirtualCoreId()));
+    if(maxFrequency && frequency){
+        _estimatedCapacity = (uint) (((uint64_t) frequency * 1024) / maxFrequency);
+    }else{
+        _estimatedCapacity = 1024;
+    }
+}
+
+void VirtualCoreLinux::maximizeUtilization() const{
+    std::call_once(_loadGeneratorOnce, &VirtualCoreLinux::initLoadGenerator, this);
+    _loadGenerator->start();
+}
+
+void VirtualCoreLinux::resetUtilization() const{
+    if(_loadGenerator){
+        _loadGenerator->stop();
+    }
+}
 
-    if(!found){
+double VirtualCoreLinux::getProcStatTime(ProcStatTimeType type) const{
+    if(type == PROC_STAT_NAME || type - PROC_STAT_USER >= UTILIZATION_FIELDS_NUM){
+        return -1;
+    }
+    std::vector<VirtualCoreId> virtualCoresIds;
+    std::vector<uint64_t> ticks;
+    readProcStat(virtualCoresIds, ticks, getVirtualCoreId());
+    if(virtualCoresIds.empty()){
         return -1;
     }else{
+        double field = ticks.at(type - PROC_STAT_USER);
         return (field / getClockTicksPerSecond()) * MAMMUT_MICROSECS_IN_SEC;
     }
 }
@@ -349,10 +1168,12 @@ double VirtualCoreLinux::getAbsoluteIdleTime() const{
 }
 
 double VirtualCoreLinux::getIdleTime() const{
+    std::call_once(_idleTimeOnce, &VirtualCoreLinux::initIdleTime, this);
     return getAbsoluteIdleTime() - _lastProcIdleTime;
 }
 
 void VirtualCoreLinux::resetIdleTime(){
+    std::call_once(_idleTimeOnce, &VirtualCoreLinux::initIdleTime, this);
     _lastProcIdleTime = getAbsoluteIdleTime();
 }
 
@@ -382,40 +1203,244 @@ void VirtualCoreLinux::hotUnplug() const{
 }
 
 bool VirtualCoreLinux::hasClockModulation() const{
-    return _clkModMsr.available();
+    std::call_once(_clkModOnce, &VirtualCoreLinux::initClockModulation, this);
+    return _clkModMsr->available();
 }
 
 std::vector<double> VirtualCoreLinux::getClockModulationValues() const{
+    std::call_once(_clkModOnce, &VirtualCoreLinux::initClockModulation, this);
     return _clkModValues;
 }
 
 void VirtualCoreLinux::setClockModulation(double value){
+    std::call_once(_clkModOnce, &VirtualCoreLinux::initClockModulation, this);
     if(!contains(_clkModValues, value)){
         throw std::runtime_error("Wrong modulation value. Please use only value returned by "
                                  "getClockModulationValues() call");
     }else{
         if(value == 100){
-            _clkModMsr.writeBits(MSR_CLOCK_MODULATION, 4, _clkModLowBit, 0);
+            _clkModMsr->writeBits(MSR_CLOCK_MODULATION, 4, _clkModLowBit, 0);
         }else{
-            _clkModMsr.writeBits(MSR_CLOCK_MODULATION, 4, 4, 1);
-            _clkModMsr.writeBits(MSR_CLOCK_MODULATION, 3, _clkModLowBit, floor(value/_clkModStep));
+            _clkModMsr->writeBits(MSR_CLOCK_MODULATION, 4, 4, 1);
+            _clkModMsr->writeBits(MSR_CLOCK_MODULATION, 3, _clkModLowBit, floor(value/_clkModStep));
         }
     }
 }
 
 double VirtualCoreLinux::getClockModulation() const{
+    std::call_once(_clkModOnce, &VirtualCoreLinux::initClockModulation, this);
     uint64_t v = 0;
-    _clkModMsr.readBits(MSR_CLOCK_MODULATION, 4, 4, v);
+    _clkModMsr->readBits(MSR_CLOCK_MODULATION, 4, 4, v);
     if(!v){
         return 100;
     }
-    _clkModMsr.readBits(MSR_CLOCK_MODULATION, 3, _clkModLowBit, v);
+    _clkModMsr->readBits(MSR_CLOCK_MODULATION, 3, _clkModLowBit, v);
     return v*_clkModStep;
 }
 
 std::vector<VirtualCoreIdleLevel*> VirtualCoreLinux::getIdleLevels() const{
+    std::call_once(_idleLevelsOnce, &VirtualCoreLinux::initIdleLevels, this);
     return _idleLevels;
 }
 
+LatencyQoS::LatencyQoS(uint latency):_latency(latency), _fd(-1){
+    _fd = open("/dev/cpu_dma_latency", O_RDWR);
+    if(_fd == -1){
+        throw std::runtime_error("LatencyQoS: Impossible to open /dev/cpu_dma_latency.");
+    }
+    writeLatency();
+}
+
+static std::string getResumeLatencyFile(VirtualCoreId id){
+    return simulationParameters.sysfsRootPrefix +
+           "/sys/devices/system/cpu/cpu" + intToString(id) +
+           "/power/pm_qos_resume_latency_us";
+}
+
+LatencyQoS::LatencyQoS(uint latency, const std::vector<VirtualCore*>& virtualCores):
+        _latency(latency), _fd(-1), _virtualCores(virtualCores){
+    for(size_t i = 0; i < _virtualCores.size(); i++){
+        std::string fileName = getResumeLatencyFile(_virtualCores.at(i)->getVirtualCoreId());
+        if(!existsFile(fileName)){
+            throw std::runtime_error("LatencyQoS: Per-core resume latency not supported.");
+        }
+        _oldLatencies.push_back(readFirstLineFromFile(fileName));
+    }
+    writeLatency();
+}
+
+LatencyQoS::~LatencyQoS(){
+    if(_fd != -1){
+        // Closing the file removes the request.
+        close(_fd);
+    }
+    for(size_t i = 0; i < _virtualCores.size(); i++){
+        // Restore as many virtual cores as possible (e.g. some of them
+        // may have been unplugged in the meantime).
+        try{
+            writeFile(getResumeLatencyFile(_virtualCores.at(i)->getVirtualCoreId()),
+                      _oldLatencies.at(i));
+        }catch(const std::exception& e){
+            ;
+        }
+    }
+}
+
+void LatencyQoS::writeLatency() const{
+    if(_fd != -1){
+        int32_t latency = _latency;
+        if(write(_fd, &latency, sizeof(latency)) != sizeof(latency)){
+            throw std::runtime_error("LatencyQoS: Impossible to write /dev/cpu_dma_latency.");
+        }
+    }
+    for(size_t i = 0; i < _virtualCores.size(); i++){
+        // 0 means 'no constraint', "n/a" means 'no latency allowed'.
+        writeFile(getResumeLatencyFile(_virtualCores.at(i)->getVirtualCoreId()),
+                  _latency ? intToString(_latency) : "n/a");
+    }
+}
+
+uint LatencyQoS::getLatency() const{
+    return _latency;
+}
+
+void LatencyQoS::setLatency(uint latency){
+    _latency = latency;
+    writeLatency();
+}
+
+std::vector<VirtualCore*> LatencyQoS::getVirtualCores() const{
+    return _virtualCores;
+}
+
+bool LatencyQoS::isAllowed(const VirtualCoreIdleLevel* level) const{
+    if(!_virtualCores.empty()){
+        bool found = false;
+        for(size_t i = 0; i < _virtualCores.size(); i++){
+            if(_virtualCores.at(i)->getVirtualCoreId() == level->getVirtualCoreId()){
+                found = true;
+                break;
+            }
+        }
+        if(!found){
+            return true;
+        }
+    }
+    return level->getExitLatency() <= _latency;
+}
+
+std::vector<VirtualCoreIdleLevel*> LatencyQoS::getAllowedIdleLevels(const VirtualCore* virtualCore) const{
+    std::vector<VirtualCoreIdleLevel*> r;
+    std::vector<VirtualCoreIdleLevel*> levels = virtualCore->getIdleLevels();
+    for(size_t i = 0; i < levels.size(); i++){
+        if(isAllowed(levels.at(i))){
+            r.push_back(levels.at(i));
+        }
+    }
+    return r;
+}
+
+LoadGenerator::LoadGenerator(const std::vector<VirtualCore*>& virtualCores,
+                             LoadKernel kernel, double utilization, uint period):
+        _virtualCores(virtualCores), _kernel(kernel),
+        _utilization(utilization), _period(period){
+    if(!isKernelSupported(kernel)){
+        throw std::runtime_error("LoadGenerator: Unsupported kernel.");
+    }
+    if(utilization < 0 || utilization > 100){
+        throw std::runtime_error("LoadGenerator: Utilization must be in the range [0, 100].");
+    }
+}
+
+LoadGenerator::~LoadGenerator(){
+    stop();
+}
+
+void LoadGenerator::start(){
+    if(isRunning()){
+        return;
+    }
+    for(size_t i = 0; i < _virtualCores.size(); i++){
+        LoadThread* t = new LoadThread(_virtualCores.at(i)->getVirtualCoreId(),
+                                       _kernel, _utilization, _period);
+        t->start();
+        _threads.push_back(t);
+    }
+    for(size_t i = 0; i < _threads.size(); i++){
+        if(!_threads.at(i)->waitPinned()){
+            stop();
+            throw std::runtime_error("LoadGenerator: Impossible to pin a thread on virtual core " +
+                                     intToString(_virtualCores.at(i)->getVirtualCoreId()) + ".");
+        }
+    }
+}
+
+void LoadGenerator::stop(){
+    for(size_t i = 0; i < _threads.size(); i++){
+        _threads.at(i)->setStop(true);
+    }
+    for(size_t i = 0; i < _threads.size(); i++){
+        _threads.at(i)->join();
+    }
+    deleteVectorElements<LoadThread*>(_threads);
+}
+
+bool LoadGenerator::isRunning() const{
+    return !_threads.empty();
+}
+
+std::vector<VirtualCore*> LoadGenerator::getVirtualCores() const{
+    return _virtualCores;
+}
+
+double LoadGenerator::getUtilization() const{
+    return _utilization;
+}
+
+void LoadGenerator::setUtilization(double utilization){
+    if(utilization < 0 || utilization > 100){
+        throw std::runtime_error("LoadGenerator: Utilization must be in the range [0, 100].");
+    }
+    _utilization = utilization;
+    for(size_t i = 0; i < _threads.size(); i++){
+        _threads.at(i)->setUtilization(utilization);
+    }
+}
+
+LoadKernel LoadGenerator::getKernel() const{
+    return _kernel;
+}
+
+void LoadGenerator::setKernel(LoadKernel kernel){
+    if(!isKernelSupported(kernel)){
+        throw std::runtime_error("LoadGenerator: Unsupported kernel.");
+    }
+    _kernel = kernel;
+    for(size_t i = 0; i < _threads.size(); i++){
+        _threads.at(i)->setKernel(kernel);
+    }
+}
+
+bool LoadGenerator::isKernelSupported(LoadKernel kernel){
+    switch(kernel){
+        case LOAD_KERNEL_SCALAR:
+        case LOAD_KERNEL_MEMORY_STREAM:
+        case LOAD_KERNEL_POINTER_CHASE:{
+            return true;
+        }
+#if defined(__x86_64__)
+        case LOAD_KERNEL_FMA_AVX2:{
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        }
+        case LOAD_KERNEL_FMA_AVX512:{
+            return __builtin_cpu_supports("avx512f");
+        }
+#endif
+        default:{
+            return false;
+        }
+    }
+}
+
 }
 }
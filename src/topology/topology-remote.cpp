@@ -31,6 +31,15 @@ void TopologyRemote::resetUtilization() const{
     setUtilization(_communicator, SetUtilization_Type_RESET, SetUtilization_UnitType_TOPOLOGY, 0);
 }
 
+bool TopologyRemote::getEffectiveFrequencies(uint window,
+                                             std::vector<EffectiveFrequency>& effectiveFrequencies) const{
+    throw std::runtime_error("Unsupported remote function.");
+}
+
+UtilizationSnapshot TopologyRemote::getUtilizationSnapshot() const{
+    throw std::runtime_error("Unsupported remote function.");
+}
+
 CpuRemote::CpuRemote(Communicator* const communicator, CpuId cpuId, std::vector<PhysicalCore*> physicalCores)
     :Cpu(cpuId, physicalCores), _communicator(communicator){
     ;
@@ -60,6 +69,10 @@ std::string CpuRemote::getModel() const{
     return r.model();
 }
 
+bool CpuRemote::getCStateResidencies(uint window, CStateResidencies& residencies) const{
+    throw std::runtime_error("Unsupported remote function.");
+}
+
 void CpuRemote::maximizeUtilization() const{
     setUtilization(_communicator, SetUtilization_Type_MAXIMIZE, SetUtilization_UnitType_CPU, getCpuId());
 }
@@ -297,6 +310,22 @@ std::vector<VirtualCoreIdleLevel*> VirtualCoreRemote::getIdleLevels() const{
     return _idleLevels;
 }
 
+bool VirtualCoreRemote::getEffectiveFrequency(uint window, EffectiveFrequency& effectiveFrequency) const{
+    throw std::runtime_error("Unsupported remote function.");
+}
+
+bool VirtualCoreRemote::getCStateResidencies(uint window, CStateResidencies& residencies) const{
+    throw std::runtime_error("Unsupported remote function.");
+}
+
+CoreType VirtualCoreRemote::getCoreType() const{
+    throw std::runtime_error("Unsupported remote function.");
+}
+
+uint VirtualCoreRemote::getCapacity() const{
+    throw std::runtime_error("Unsupported remote function.");
+}
+
 bool VirtualCoreRemote::hasClockModulation() const{
     throw std::runtime_error("Unsupported remote function.");
 }
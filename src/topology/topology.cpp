@@ -6,7 +6,9 @@
 #endif
 #include <mammut/utils.hpp>
 
+#include "algorithm"
 #include "map"
+#include "sched.h"
 #include "stddef.h"
 #include "stdexcept"
 #include "string"
@@ -16,14 +18,17 @@ extern SimulationParameters simulationParameters;
 
 namespace topology{
 
-Topology::Topology():_communicator(NULL){
 #if defined(__linux__)
+/**
+ * Reads the coordinates of the online virtual cores from sysfs. The
+ * identifiers of the physical cores are the ones reported by the
+ * kernel (i.e. not unique across CPUs).
+ */
+static std::vector<VirtualCoreCoordinates> getCoordinatesSysfs(){
     std::vector<VirtualCoreCoordinates> coord;
     std::string range;
     std::string path;
     int lowestCoreId, highestCoreId;
-    std::map<std::pair<CpuId, PhysicalCoreId>, PhysicalCoreId> uniquePhysicalCoreIds;
-    PhysicalCoreId nextIdToUse = 0;
 
     const std::string coresListFile = simulationParameters.sysfsRootPrefix +
                                       "/sys/devices/system/cpu/possible";
@@ -48,23 +53,132 @@ Topology::Topology():_communicator(NULL){
             vcc.cpuId = utils::stringToInt(utils::readFirstLineFromFile(path + "physical_package_id"));
             vcc.physicalCoreId = utils::stringToInt(utils::readFirstLineFromFile(path + "core_id"));
             vcc.virtualCoreId = virtualCoreId;
+            coord.push_back(vcc);
+        }
+    }
+    return coord;
+}
+
+#if defined(__x86_64__)
+/**
+ * Reads the coordinates of a set of virtual cores from the x2APIC
+ * identifiers (CPUID leaf 0x1F or 0xB). Since CPUID refers to the
+ * core on which it is executed, this thread is moved on each virtual
+ * core, leaving the affinity of the caller untouched.
+ */
+class CpuIdTopologyThread: public utils::Thread{
+private:
+    const std::vector<uint>& _virtualCoresIds;
+    std::vector<VirtualCoreCoordinates>& _coord;
+    bool _succeeded;
+public:
+    CpuIdTopologyThread(const std::vector<uint>& virtualCoresIds,
+                        std::vector<VirtualCoreCoordinates>& coord):
+        _virtualCoresIds(virtualCoresIds), _coord(coord), _succeeded(false){;}
+
+    bool succeeded() const{
+        return _succeeded;
+    }
+
+    void run(){
+        uint32_t maxLeaf = utils::CpuIdAsm(0).EAX();
+        uint32_t leaf;
+        if(maxLeaf >= 0x1F && utils::CpuIdAsm(0x1F, 0).EBX()){
+            leaf = 0x1F;
+        }else if(maxLeaf >= 0xB && utils::CpuIdAsm(0xB, 0).EBX()){
+            leaf = 0xB;
+        }else{
+            return;
+        }
 
+        for(size_t i = 0; i < _virtualCoresIds.size(); i++){
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(_virtualCoresIds.at(i), &set);
+            if(sched_setaffinity(0, sizeof(cpu_set_t), &set) == -1){
+                return;
+            }
             /**
-             * core_id is not unique. The pair <physical_package_id, core_id> is unique.
-             * Accordingly, we modify physicalCoreId to let it unique.
+             * Each subleaf describes a level (SMT, core, module, tile, die)
+             * and the number of bits of the x2APIC id to shift to get the
+             * identifier of the next level. The shift of the last level
+             * gives the package identifier.
              */
-            std::map<std::pair<CpuId, PhysicalCoreId>, PhysicalCoreId>::iterator it;
-            std::pair<CpuId, PhysicalCoreId> identifiersPair(vcc.cpuId, vcc.physicalCoreId);
-            it = uniquePhysicalCoreIds.find(identifiersPair);
-            if(it == uniquePhysicalCoreIds.end()){
-                uniquePhysicalCoreIds.insert(std::pair<std::pair<CpuId, PhysicalCoreId>, PhysicalCoreId>(identifiersPair, nextIdToUse));
-                vcc.physicalCoreId = nextIdToUse;
-                ++nextIdToUse;
-            }else{
-                vcc.physicalCoreId = it->second;
+            uint32_t smtShift = 0, packageShift = 0, x2ApicId = 0;
+            for(uint subleaf = 0; subleaf < 8; subleaf++){
+                utils::CpuIdAsm c(leaf, subleaf);
+                uint32_t levelType = (c.ECX() >> 8) & 0xFF;
+                if(!levelType){
+                    break;
+                }
+                if(levelType == 1){
+                    smtShift = c.EAX() & 0x1F;
+                }
+                packageShift = c.EAX() & 0x1F;
+                x2ApicId = c.EDX();
             }
+            VirtualCoreCoordinates vcc;
+            vcc.cpuId = x2ApicId >> packageShift;
+            vcc.physicalCoreId = x2ApicId >> smtShift;
+            vcc.virtualCoreId = _virtualCoresIds.at(i);
+            _coord.push_back(vcc);
+        }
+        _succeeded = true;
+    }
+};
+#endif
 
-            coord.push_back(vcc);
+/**
+ * Reads the coordinates of the online virtual cores through CPUID,
+ * without accessing sysfs files (except the list of online virtual cores).
+ * @return false if CPUID topology leaves are not available.
+ */
+static bool getCoordinatesCpuId(std::vector<VirtualCoreCoordinates>& coord){
+#if defined(__x86_64__)
+    const std::string onlineFile = "/sys/devices/system/cpu/online";
+    if(!simulationParameters.sysfsRootPrefix.empty() || !utils::existsFile(onlineFile)){
+        return false;
+    }
+    std::vector<uint> virtualCoresIds = utils::dashedRangesToIntegers(utils::readFirstLineFromFile(onlineFile));
+    CpuIdTopologyThread thread(virtualCoresIds, coord);
+    thread.start();
+    thread.join();
+    if(!thread.succeeded()){
+        coord.clear();
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+#endif
+
+Topology::Topology():_communicator(NULL){
+#if defined(__linux__)
+    std::vector<VirtualCoreCoordinates> coord;
+    std::map<std::pair<CpuId, PhysicalCoreId>, PhysicalCoreId> uniquePhysicalCoreIds;
+    PhysicalCoreId nextIdToUse = 0;
+
+    if(!getCoordinatesCpuId(coord)){
+        coord = getCoordinatesSysfs();
+    }
+
+    for(size_t i = 0; i < coord.size(); i++){
+        VirtualCoreCoordinates& vcc = coord.at(i);
+        /**
+         * core_id is not unique. The pair <physical_package_id, core_id> is unique.
+         * Accordingly, we modify physicalCoreId to let it unique.
+         */
+        std::map<std::pair<CpuId, PhysicalCoreId>, PhysicalCoreId>::iterator it;
+        std::pair<CpuId, PhysicalCoreId> identifiersPair(vcc.cpuId, vcc.physicalCoreId);
+        it = uniquePhysicalCoreIds.find(identifiersPair);
+        if(it == uniquePhysicalCoreIds.end()){
+            uniquePhysicalCoreIds.insert(std::pair<std::pair<CpuId, PhysicalCoreId>, PhysicalCoreId>(identifiersPair, nextIdToUse));
+            vcc.physicalCoreId = nextIdToUse;
+            ++nextIdToUse;
+        }else{
+            vcc.physicalCoreId = it->second;
         }
     }
 
@@ -116,6 +230,8 @@ Topology::~Topology(){
     utils::deleteVectorElements<Cpu*>(_cpus);
     utils::deleteVectorElements<PhysicalCore*>(_physicalCores);
     utils::deleteVectorElements<VirtualCore*>(_virtualCores);
+    utils::deleteVectorElements<NumaNode*>(_numaNodes);
+    utils::deleteVectorElements<Cache*>(_caches);
 }
 
 void Topology::release(Topology* topology){
@@ -281,6 +397,187 @@ VirtualCore* Topology::getVirtualCore() const{
     }
 }
 
+std::vector<NumaNode*> Topology::getNumaNodes() const{
+    return _numaNodes;
+}
+
+NumaNode* Topology::getNumaNode(NumaNodeId numaNodeId) const{
+    for(size_t i = 0; i < _numaNodes.size(); i++){
+        if(_numaNodes.at(i)->getNumaNodeId() == numaNodeId){
+            return _numaNodes.at(i);
+        }
+    }
+    return NULL;
+}
+
+NumaNode* Topology::getNumaNode(const VirtualCore* virtualCore) const{
+    for(size_t i = 0; i < _numaNodes.size(); i++){
+        if(_numaNodes.at(i)->hasVirtualCore(virtualCore)){
+            return _numaNodes.at(i);
+        }
+    }
+    return NULL;
+}
+
+std::vector<std::vector<uint> > Topology::getNumaDistances() const{
+    std::vector<std::vector<uint> > r(_numaNodes.size());
+    for(size_t i = 0; i < _numaNodes.size(); i++){
+        for(size_t j = 0; j < _numaNodes.size(); j++){
+            r.at(i).push_back(_numaNodes.at(i)->getDistance(_numaNodes.at(j)->getNumaNodeId()));
+        }
+    }
+    return r;
+}
+
+const std::vector<Cache*>& Topology::caches() const{
+    std::call_once(_cachesOnce, &Topology::buildCaches, this);
+    return _caches;
+}
+
+std::vector<Cache*> Topology::getCaches() const{
+    return caches();
+}
+
+static bool compareCachesLevel(const Cache* a, const Cache* b){
+    return a->getLevel() < b->getLevel();
+}
+
+std::vector<Cache*> Topology::getCaches(const VirtualCore* virtualCore) const{
+    const std::vector<Cache*>& all = caches();
+    std::vector<Cache*> r;
+    for(size_t i = 0; i < all.size(); i++){
+        if(all.at(i)->hasVirtualCore(virtualCore)){
+            r.push_back(all.at(i));
+        }
+    }
+    std::stable_sort(r.begin(), r.end(), compareCachesLevel);
+    return r;
+}
+
+std::vector<std::vector<VirtualCore*> > Topology::getLlcGroups() const{
+    std::vector<std::vector<VirtualCore*> > r;
+    const std::vector<Cache*>& all = caches();
+    uint llcLevel = 0;
+    for(size_t i = 0; i < all.size(); i++){
+        if(all.at(i)->getType() != CACHE_TYPE_INSTRUCTION &&
+           all.at(i)->getLevel() > llcLevel){
+            llcLevel = all.at(i)->getLevel();
+        }
+    }
+    for(size_t i = 0; i < all.size(); i++){
+        Cache* c = all.at(i);
+        if(c->getLevel() == llcLevel && c->getType() != CACHE_TYPE_INSTRUCTION){
+            r.push_back(c->getVirtualCores());
+        }
+    }
+    if(r.empty()){
+        for(size_t i = 0; i < _cpus.size(); i++){
+            r.push_back(_cpus.at(i)->getVirtualCores());
+        }
+    }
+    return r;
+}
+
+UtilizationSnapshot::UtilizationSnapshot():_ticksPerSecond(1){
+    ;
+}
+
+UtilizationSnapshot::UtilizationSnapshot(const std::vector<VirtualCoreId>& virtualCoresIds,
+                                         const std::vector<uint64_t>& ticks, double ticksPerSecond):
+        _virtualCoresIds(virtualCoresIds), _ticks(ticks), _ticksPerSecond(ticksPerSecond){
+    if(_ticks.size() != _virtualCoresIds.size() * UTILIZATION_FIELDS_NUM){
+        throw std::runtime_error("UtilizationSnapshot: wrong number of fields.");
+    }
+    for(size_t i = 0; i < _virtualCoresIds.size(); i++){
+        VirtualCoreId id = _virtualCoresIds.at(i);
+        if(id >= _positions.size()){
+            _positions.resize(id + 1, -1);
+        }
+        _positions.at(id) = i;
+    }
+}
+
+const uint64_t* UtilizationSnapshot::getRow(VirtualCoreId virtualCoreId) const{
+    if(!hasVirtualCore(virtualCoreId)){
+        return NULL;
+    }
+    return &(_ticks.at(_positions.at(virtualCoreId) * UTILIZATION_FIELDS_NUM));
+}
+
+std::vector<VirtualCoreId> UtilizationSnapshot::getVirtualCoresIds() const{
+    return _virtualCoresIds;
+}
+
+bool UtilizationSnapshot::hasVirtualCore(VirtualCoreId virtualCoreId) const{
+    return virtualCoreId < _positions.size() && _positions.at(virtualCoreId) != -1;
+}
+
+double UtilizationSnapshot::getTime(VirtualCoreId virtualCoreId, UtilizationField field) const{
+    const uint64_t* row = getRow(virtualCoreId);
+    if(!row){
+        return 0;
+    }
+    return (row[field] / _ticksPerSecond) * MAMMUT_MICROSECS_IN_SEC;
+}
+
+UtilizationSnapshot UtilizationSnapshot::getDelta(const UtilizationSnapshot& previous) const{
+    std::vector<VirtualCoreId> ids;
+    std::vector<uint64_t> ticks;
+    ids.reserve(_virtualCoresIds.size());
+    ticks.reserve(_ticks.size());
+    for(size_t i = 0; i < _virtualCoresIds.size(); i++){
+        const uint64_t* previousRow = previous.getRow(_virtualCoresIds.at(i));
+        if(!previousRow){
+            continue;
+        }
+        const uint64_t* row = &(_ticks.at(i * UTILIZATION_FIELDS_NUM));
+        ids.push_back(_virtualCoresIds.at(i));
+        for(size_t f = 0; f < UTILIZATION_FIELDS_NUM; f++){
+            // Counters may go backwards (e.g. iowait) or be reset by hotplug.
+            ticks.push_back(row[f] >= previousRow[f] ? row[f] - previousRow[f] : 0);
+        }
+    }
+    return UtilizationSnapshot(ids, ticks, _ticksPerSecond);
+}
+
+/**
+ * Returns the utilization [0, 100] given a row of ticks.
+ */
+static double getRowUtilization(const uint64_t* row){
+    uint64_t total = 0;
+    for(size_t f = 0; f < UTILIZATION_FIELDS_NUM; f++){
+        total += row[f];
+    }
+    if(!total){
+        return 0;
+    }
+    uint64_t idle = row[UTILIZATION_IDLE] + row[UTILIZATION_IOWAIT];
+    return ((double) (total - idle) / (double) total) * 100.0;
+}
+
+double UtilizationSnapshot::getUtilization(const UtilizationSnapshot& previous,
+                                           VirtualCoreId virtualCoreId) const{
+    const uint64_t* row = getRow(virtualCoreId);
+    const uint64_t* previousRow = previous.getRow(virtualCoreId);
+    if(!row || !previousRow){
+        return 0;
+    }
+    uint64_t delta[UTILIZATION_FIELDS_NUM];
+    for(size_t f = 0; f < UTILIZATION_FIELDS_NUM; f++){
+        delta[f] = row[f] >= previousRow[f] ? row[f] - previousRow[f] : 0;
+    }
+    return getRowUtilization(delta);
+}
+
+std::vector<double> UtilizationSnapshot::getUtilizations(const UtilizationSnapshot& previous) const{
+    std::vector<double> r;
+    r.reserve(_virtualCoresIds.size());
+    for(size_t i = 0; i < _virtualCoresIds.size(); i++){
+        r.push_back(getUtilization(previous, _virtualCoresIds.at(i)));
+    }
+    return r;
+}
+
 RollbackPoint Topology::getRollbackPoint() const{
     RollbackPoint rp;
     for(VirtualCore* v :_virtualCores){
@@ -557,6 +854,77 @@ bool VirtualCore::areTicksConstant() const{
     return hasFlag("constant_tsc");
 }
 
+NumaNode::NumaNode(NumaNodeId numaNodeId, std::vector<VirtualCore*> virtualCores,
+                   std::map<NumaNodeId, uint> distances):
+        _numaNodeId(numaNodeId), _virtualCores(virtualCores), _distances(distances){
+    ;
+}
+
+NumaNodeId NumaNode::getNumaNodeId() const{
+    return _numaNodeId;
+}
+
+std::vector<VirtualCore*> NumaNode::getVirtualCores() const{
+    return _virtualCores;
+}
+
+bool NumaNode::hasVirtualCore(const VirtualCore* virtualCore) const{
+    for(size_t i = 0; i < _virtualCores.size(); i++){
+        if(*_virtualCores.at(i) == *virtualCore){
+            return true;
+        }
+    }
+    return false;
+}
+
+uint NumaNode::getDistance(NumaNodeId numaNodeId) const{
+    std::map<NumaNodeId, uint>::const_iterator it = _distances.find(numaNodeId);
+    if(it == _distances.end()){
+        return 0;
+    }
+    return it->second;
+}
+
+Cache::Cache(uint level, CacheType type, uint size, uint lineSize,
+             uint associativity, std::vector<VirtualCore*> virtualCores):
+        _level(level), _type(type), _size(size), _lineSize(lineSize),
+        _associativity(associativity), _virtualCores(virtualCores){
+    ;
+}
+
+uint Cache::getLevel() const{
+    return _level;
+}
+
+CacheType Cache::getType() const{
+    return _type;
+}
+
+uint Cache::getSize() const{
+    return _size;
+}
+
+uint Cache::getLineSize() const{
+    return _lineSize;
+}
+
+uint Cache::getAssociativity() const{
+    return _associativity;
+}
+
+std::vector<VirtualCore*> Cache::getVirtualCores() const{
+    return _virtualCores;
+}
+
+bool Cache::hasVirtualCore(const VirtualCore* virtualCore) const{
+    for(size_t i = 0; i < _virtualCores.size(); i++){
+        if(*_virtualCores.at(i) == *virtualCore){
+            return true;
+        }
+    }
+    return false;
+}
+
 
 size_t getNumPhysicalCores(const std::vector<VirtualCore*>& virtualCores){
     return getOneVirtualPerPhysical(virtualCores).size();
@@ -583,6 +951,17 @@ std::vector<VirtualCore*> getOneVirtualPerPhysical(const std::vector<VirtualCore
     return r;
 }
 
+std::vector<VirtualCore*> getVirtualCoresOfType(const std::vector<VirtualCore*>& virtualCores,
+                                                CoreType coreType){
+    std::vector<VirtualCore*> r;
+    for(size_t i = 0; i < virtualCores.size(); i++){
+        if(virtualCores.at(i)->getCoreType() == coreType){
+            r.push_back(virtualCores.at(i));
+        }
+    }
+    return r;
+}
+
 #ifdef MAMMUT_REMOTE
 std::string Topology::getModuleName(){
     GetTopology gt;
@@ -17,6 +17,7 @@
 #include "string.h"
 #include "syscall.h"
 #include "unistd.h"
+#include "sys/ioctl.h"
 #include "sys/syscall.h"
 #include "sys/time.h"
 
@@ -344,6 +345,22 @@ void dashedRangeToIntegers(const string& dashedRange, int& rangeStart, int& rang
     rangeStop = stringToInt(dashedRange.substr(dashPos + 1));
 }
 
+vector<uint> dashedRangesToIntegers(const string& dashedRanges){
+    vector<uint> r;
+    vector<string> ranges = split(dashedRanges, ',');
+    for(size_t i = 0; i < ranges.size(); i++){
+        if(ranges.at(i).empty()){
+            continue;
+        }
+        int rangeStart, rangeStop;
+        dashedRangeToIntegers(ranges.at(i), rangeStart, rangeStop);
+        for(int j = rangeStart; j <= rangeStop; j++){
+            r.push_back(j);
+        }
+    }
+    return r;
+}
+
 string intToString(int x){
     stringstream out;
     out << x;
@@ -519,6 +536,101 @@ bool Msr::writeBits(uint32_t which, unsigned int highBit,
     return write(which, oldValue | value);
 }
 
+// msr_safe batch interface (https://github.com/LLNL/msr-safe).
+struct msr_batch_op{
+    uint16_t cpu;
+    uint16_t isrdmsr;
+    int32_t err;
+    uint32_t msr;
+    uint64_t msrdata;
+    uint64_t wmask;
+};
+
+struct msr_batch_array{
+    uint32_t numops;
+    struct msr_batch_op* ops;
+};
+
+#define X86_IOC_MSR_BATCH _IOWR('c', 0xA2, struct msr_batch_array)
+
+MsrBatch::MsrBatch(){
+    _batchFd = -1;
+    if(existsFile("/dev/cpu/msr_batch")){
+        _batchFd = open("/dev/cpu/msr_batch", O_RDWR);
+    }
+}
+
+MsrBatch::~MsrBatch(){
+    if(_batchFd != -1){
+        close(_batchFd);
+    }
+    deleteVectorElements<Msr*>(_msrs);
+}
+
+Msr* MsrBatch::getMsr(uint32_t virtualCoreId){
+    if(_msrs.size() <= virtualCoreId){
+        _msrs.resize(virtualCoreId + 1, NULL);
+    }
+    if(!_msrs.at(virtualCoreId)){
+        _msrs.at(virtualCoreId) = new Msr(virtualCoreId);
+    }
+    return _msrs.at(virtualCoreId);
+}
+
+size_t MsrBatch::add(uint32_t virtualCoreId, uint32_t which){
+    _virtualCores.push_back(virtualCoreId);
+    _registers.push_back(which);
+    _values.push_back(0);
+    _valid.push_back(false);
+    if(_batchFd == -1){
+        getMsr(virtualCoreId);
+    }
+    return _registers.size() - 1;
+}
+
+size_t MsrBatch::size() const{
+    return _registers.size();
+}
+
+bool MsrBatch::read(){
+    bool r = true;
+    if(_registers.empty()){
+        return r;
+    }
+    if(_batchFd != -1){
+        vector<struct msr_batch_op> ops(_registers.size());
+        for(size_t i = 0; i < ops.size(); i++){
+            memset(&ops[i], 0, sizeof(struct msr_batch_op));
+            ops[i].cpu = _virtualCores[i];
+            ops[i].isrdmsr = 1;
+            ops[i].msr = _registers[i];
+        }
+        struct msr_batch_array batch;
+        batch.numops = ops.size();
+        batch.ops = &ops[0];
+        bool done = ioctl(_batchFd, X86_IOC_MSR_BATCH, &batch) != -1;
+        for(size_t i = 0; i < ops.size(); i++){
+            _valid[i] = done && !ops[i].err;
+            _values[i] = ops[i].msrdata;
+            r = r && _valid[i];
+        }
+    }else{
+        for(size_t i = 0; i < _registers.size(); i++){
+            Msr* msr = getMsr(_virtualCores[i]);
+            uint64_t value = 0;
+            _valid[i] = msr->available() && msr->read(_registers[i], value);
+            _values[i] = value;
+            r = r && _valid[i];
+        }
+    }
+    return r;
+}
+
+bool MsrBatch::get(size_t index, uint64_t& value) const{
+    value = _values.at(index);
+    return _valid.at(index);
+}
+
 #ifndef AMESTER_ROOT
 #define AMESTER_ROOT simulationParameters.sysfsRootPrefix + "/tmp/amester"
 #endif
@@ -586,17 +698,17 @@ double getMillisecondsTime(){
 }
 
 
-CpuIdAsm::CpuIdAsm(unsigned i) {
+CpuIdAsm::CpuIdAsm(unsigned i, unsigned subleaf) {
     memset(regs, 0, sizeof(regs));
 #ifdef _WIN32
-    __cpuid((int *)regs, (int)i);
+    __cpuidex((int *)regs, (int)i, (int)subleaf);
 #else
     #ifdef __x86_64__
     memset(regs, 0, sizeof(regs));
     asm volatile
     ("cpuid" : "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
-    : "a" (i), "c" (0));
-    // ECX is set to zero for CPUID function 4
+    : "a" (i), "c" (subleaf));
+    // ECX selects the subleaf (e.g. for CPUID functions 4, 7, 0xB)
     #endif
 #endif
 }
@@ -2,10 +2,13 @@
  *  Different tests on topology module.
  **/
 #include <algorithm>
+#include <fstream>
+#include <iterator>
 #include <limits.h>
 #include <stdlib.h>
 #include <time.h>
 #include <mammut/mammut.hpp>
+#include <mammut/cpufreq/cpufreq-linux.hpp>
 #include "gtest/gtest.h"
 
 using namespace mammut;
@@ -104,3 +107,295 @@ TEST(CpufreqTest, GeneralTest) {
         }
     }
 }
+
+/**
+ * Builds a copy of repara (in ./archs/<name>) where the cpufreq
+ * files are replaced according to the given driver.
+ **/
+static void createPstateArch(const string& name, const string& driver,
+                             const string& extraCommands){
+    string cmd = "rm -rf ./archs/" + name + " && "
+                 "cp -r ./archs/repara ./archs/" + name + " && "
+                 "cd ./archs/" + name + "/sys/devices/system/cpu && "
+                 "rm -f cpufreq/boost && "
+                 "for d in cpu*/cpufreq; do "
+                 "echo " + driver + " > $d/scaling_driver; "
+                 "echo 'performance powersave' > $d/scaling_available_governors; "
+                 "echo powersave > $d/scaling_governor; "
+                 "echo 'default performance balance_performance balance_power power' > "
+                 "$d/energy_performance_available_preferences; "
+                 "echo balance_performance > $d/energy_performance_preference; "
+                 "rm -f $d/scaling_available_frequencies $d/scaling_setspeed; "
+                 "done && " + extraCommands;
+    ASSERT_EQ(system(cmd.c_str()), 0);
+}
+
+static void createIntelPstateArch(){
+    createPstateArch("repara-pstate", "intel_pstate",
+                     "mkdir -p intel_pstate && "
+                     "echo 0 > intel_pstate/no_turbo && "
+                     "echo 50 > intel_pstate/min_perf_pct && "
+                     "echo 100 > intel_pstate/max_perf_pct && "
+                     "for d in cpu*/cpufreq; do echo 1800000 > $d/base_frequency; done");
+}
+
+TEST(CpufreqTest, IntelPstate) {
+    createIntelPstateArch();
+    Mammut m;
+    SimulationParameters p;
+    p.sysfsRootPrefix = "./archs/repara-pstate/";
+    m.setSimulationParameters(p);
+    CpuFreq* frequency = m.getInstanceCpuFreq();
+
+    /** Boosting is controlled through no_turbo. **/
+    EXPECT_TRUE(frequency->isBoostingSupported());
+    EXPECT_TRUE(frequency->isBoostingEnabled());
+    frequency->disableBoosting();
+    EXPECT_TRUE(!frequency->isBoostingEnabled());
+    frequency->enableBoosting();
+    EXPECT_TRUE(frequency->isBoostingEnabled());
+
+    std::vector<Domain*> domains = frequency->getDomains();
+    EXPECT_EQ(domains.size(), (size_t) 2);
+    for(Domain* domain : domains){
+        DomainIntelPstate* pstate = dynamic_cast<DomainIntelPstate*>(domain);
+        ASSERT_TRUE(pstate != NULL);
+        EXPECT_TRUE(domain->hasContinuousFrequencies());
+        EXPECT_FALSE(domain->isGovernorAvailable(GOVERNOR_USERSPACE));
+
+        /** Range sampled with 100MHz steps. **/
+        std::vector<Frequency> frequencies = domain->getAvailableFrequencies();
+        EXPECT_EQ(frequencies.size(), (size_t) 14);
+        EXPECT_EQ(frequencies.front(), (Frequency) 1200000);
+        EXPECT_EQ(frequencies.at(1), (Frequency) 1300000);
+        EXPECT_EQ(frequencies.back(), (Frequency) 2401000);
+        domain->removeTurboFrequencies();
+        EXPECT_EQ(domain->getAvailableFrequencies().back(), (Frequency) 1800000);
+        domain->reinsertTurboFrequencies();
+
+        /** Any frequency in range can be pinned. **/
+        EXPECT_TRUE(domain->setFrequencyUserspace(1750000));
+        EXPECT_EQ(domain->getCurrentFrequencyUserspace(), (Frequency) 1750000);
+        EXPECT_FALSE(domain->setFrequencyUserspace(3000000));
+        EXPECT_TRUE(domain->setGovernorBounds(1234000, 2401000));
+        Frequency lb, ub;
+        EXPECT_TRUE(domain->getCurrentGovernorBounds(lb, ub));
+        EXPECT_EQ(lb, (Frequency) 1234000);
+        EXPECT_EQ(ub, (Frequency) 2401000);
+        EXPECT_EQ(domain->getCurrentFrequencyUserspace(), (Frequency) 0);
+        EXPECT_FALSE(domain->setGovernorBounds(1000000, 2401000));
+
+        uint lbPct, ubPct;
+        EXPECT_TRUE(pstate->getPerfPctBounds(lbPct, ubPct));
+        EXPECT_EQ(lbPct, (uint) 50);
+        EXPECT_EQ(ubPct, (uint) 100);
+        EXPECT_FALSE(pstate->setPerfPctBounds(60, 110));
+        EXPECT_TRUE(pstate->setPerfPctBounds(20, 80));
+        EXPECT_TRUE(pstate->getPerfPctBounds(lbPct, ubPct));
+        EXPECT_EQ(lbPct, (uint) 20);
+        EXPECT_EQ(ubPct, (uint) 80);
+        EXPECT_TRUE(pstate->setPerfPctBounds(50, 100));
+
+        EXPECT_EQ(pstate->getAvailableEnergyPerformancePreferences().size(), (size_t) 5);
+        EXPECT_STREQ(pstate->getEnergyPerformancePreference().c_str(), "balance_performance");
+        EXPECT_TRUE(pstate->setEnergyPerformancePreference("power"));
+        EXPECT_STREQ(pstate->getEnergyPerformancePreference().c_str(), "power");
+        EXPECT_FALSE(pstate->setEnergyPerformancePreference("fast"));
+        // No MSRs in simulation, so raw values and HWP are not available.
+        EXPECT_FALSE(pstate->setEnergyPerformancePreference("128"));
+        EXPECT_FALSE(pstate->isHwpEnabled());
+        HwpRequest request;
+        EXPECT_FALSE(pstate->getHwpRequest(request));
+    }
+    EXPECT_EQ(system("rm -rf ./archs/repara-pstate"), 0);
+}
+
+TEST(CpufreqTest, AmdPstate) {
+    createPstateArch("repara-amd-pstate", "amd-pstate-epp",
+                     "for c in cpu[0-9]*; do "
+                     "mkdir -p $c/acpi_cppc; "
+                     "echo 240 > $c/acpi_cppc/highest_perf; "
+                     "echo 120 > $c/acpi_cppc/nominal_perf; "
+                     "echo 70 > $c/acpi_cppc/lowest_nonlinear_perf; "
+                     "echo 60 > $c/acpi_cppc/lowest_perf; "
+                     "echo 1200 > $c/acpi_cppc/nominal_freq; "
+                     "done");
+    Mammut m;
+    SimulationParameters p;
+    p.sysfsRootPrefix = "./archs/repara-amd-pstate/";
+    m.setSimulationParameters(p);
+    CpuFreq* frequency = m.getInstanceCpuFreq();
+    EXPECT_FALSE(frequency->isBoostingSupported());
+
+    std::vector<Domain*> domains = frequency->getDomains();
+    EXPECT_EQ(domains.size(), (size_t) 2);
+    for(Domain* domain : domains){
+        DomainAmdPstate* pstate = dynamic_cast<DomainAmdPstate*>(domain);
+        ASSERT_TRUE(pstate != NULL);
+        EXPECT_TRUE(domain->hasContinuousFrequencies());
+
+        CppcCapabilities capabilities;
+        EXPECT_TRUE(pstate->getCppcCapabilities(capabilities));
+        EXPECT_EQ(capabilities.highestPerf, (uint32_t) 240);
+        EXPECT_EQ(capabilities.nominalPerf, (uint32_t) 120);
+        EXPECT_EQ(capabilities.lowestNonlinearPerf, (uint32_t) 70);
+        EXPECT_EQ(capabilities.lowestPerf, (uint32_t) 60);
+        EXPECT_EQ(capabilities.nominalFrequency, (Frequency) 1200000);
+        EXPECT_EQ(pstate->perfToFrequency(240), (Frequency) 2400000);
+        EXPECT_EQ(pstate->perfToFrequency(60), (Frequency) 600000);
+
+        /** Frequencies above the nominal one are turbo frequencies. **/
+        domain->removeTurboFrequencies();
+        EXPECT_EQ(domain->getAvailableFrequencies().back(), (Frequency) 1200000);
+        domain->reinsertTurboFrequencies();
+
+        /** No MSRs in simulation, falls back on scaling_cur_freq. **/
+        EXPECT_EQ(domain->getCurrentFrequency(), (Frequency) 2401000);
+        EXPECT_FALSE(pstate->isCppcEnabled());
+        CppcRequest request;
+        EXPECT_FALSE(pstate->getCppcRequest(request));
+
+        EXPECT_TRUE(domain->setFrequencyUserspace(2000000));
+        EXPECT_EQ(domain->getCurrentFrequencyUserspace(), (Frequency) 2000000);
+        EXPECT_TRUE(pstate->setEnergyPerformancePreference("balance_power"));
+        EXPECT_STREQ(pstate->getEnergyPerformancePreference().c_str(), "balance_power");
+        EXPECT_FALSE(pstate->setEnergyPerformancePreference("128"));
+    }
+    EXPECT_EQ(system("rm -rf ./archs/repara-amd-pstate"), 0);
+}
+
+TEST(CpufreqTest, Uncore) {
+    ASSERT_EQ(system("cd ./archs/repara/sys/devices/system/cpu && "
+                     "for d in package_00_die_00 package_01_die_00; do "
+                     "mkdir -p intel_uncore_frequency/$d; "
+                     "echo 1200000 > intel_uncore_frequency/$d/initial_min_freq_khz; "
+                     "echo 2400000 > intel_uncore_frequency/$d/initial_max_freq_khz; "
+                     "echo 1200000 > intel_uncore_frequency/$d/min_freq_khz; "
+                     "echo 2400000 > intel_uncore_frequency/$d/max_freq_khz; "
+                     "echo 1800000 > intel_uncore_frequency/$d/current_freq_khz; "
+                     "done"), 0);
+    Mammut m;
+    SimulationParameters p;
+    p.sysfsRootPrefix = "./archs/repara/";
+    m.setSimulationParameters(p);
+    CpuFreq* frequency = m.getInstanceCpuFreq();
+    std::vector<UncoreDomain*> domains = frequency->getUncoreDomains();
+    ASSERT_EQ(domains.size(), (size_t) 2);
+    RollbackPoint rp = frequency->getRollbackPoint();
+    for(size_t i = 0; i < domains.size(); i++){
+        UncoreDomain* domain = domains.at(i);
+        EXPECT_EQ(domain->getCpuId(), i);
+        EXPECT_EQ(frequency->getUncoreDomain(m.getInstanceTopology()->getCpu(i)), domain);
+        Frequency lb, ub;
+        domain->getHardwareFrequencyBounds(lb, ub);
+        EXPECT_EQ(lb, (Frequency) 1200000);
+        EXPECT_EQ(ub, (Frequency) 2400000);
+        EXPECT_EQ(domain->getCurrentFrequency(), (Frequency) 1800000);
+        EXPECT_FALSE(domain->setFrequencyBounds(1000000, 2000000));
+        EXPECT_FALSE(domain->setFrequencyBounds(2000000, 1500000));
+        EXPECT_TRUE(domain->setFrequencyBounds(1500000, 1500000));
+        EXPECT_TRUE(domain->getFrequencyBounds(lb, ub));
+        EXPECT_EQ(lb, (Frequency) 1500000);
+        EXPECT_EQ(ub, (Frequency) 1500000);
+    }
+    frequency->rollback(rp);
+    for(UncoreDomain* domain : domains){
+        Frequency lb, ub;
+        EXPECT_TRUE(domain->getFrequencyBounds(lb, ub));
+        EXPECT_EQ(lb, (Frequency) 1200000);
+        EXPECT_EQ(ub, (Frequency) 2400000);
+    }
+}
+
+TEST(CpufreqTest, VoltageTablesResume) {
+    Mammut m;
+    SimulationParameters p;
+    p.sysfsRootPrefix = "./archs/repara/";
+    m.setSimulationParameters(p);
+    CpuFreq* frequency = m.getInstanceCpuFreq();
+    std::vector<Domain*> domains = frequency->getDomains();
+
+    // Tables already complete: nothing has to be measured again.
+    std::map<DomainId, VoltageTable> expected;
+    for(size_t i = 0; i < domains.size(); i++){
+        Domain* domain = domains.at(i);
+        std::vector<Frequency> frequencies = domain->getAvailableFrequencies();
+        size_t numCores = topology::getNumPhysicalCores(domain->getVirtualCores());
+        for(size_t n = 0; n <= numCores; n++){
+            for(size_t f = 0; f < frequencies.size(); f++){
+                expected[domain->getId()][VoltageTableKey(n, frequencies.at(f))] = 0.5 + n * 0.01 + f * 0.001;
+            }
+        }
+        dumpVoltageTable(expected[domain->getId()], "voltageTable.txt." + utils::intToString(domain->getId()));
+    }
+
+    VoltageTableParameters parameters;
+    parameters.fileName = "voltageTable.txt";
+    std::map<DomainId, VoltageTable> tables = frequency->getVoltageTables(parameters);
+    ASSERT_EQ(tables.size(), domains.size());
+    for(size_t i = 0; i < domains.size(); i++){
+        DomainId id = domains.at(i)->getId();
+        ASSERT_EQ(tables[id].size(), expected[id].size());
+        for(VoltageTableIterator it = expected[id].begin(); it != expected[id].end(); ++it){
+            EXPECT_NEAR(tables[id][it->first], it->second, 0.000001);
+        }
+    }
+    ASSERT_EQ(system("rm -f voltageTable.txt.*"), 0);
+}
+
+TEST(CpufreqTest, VoltageModel) {
+    VoltageTable table;
+    for(uint n = 0; n <= 4; n++){
+        for(Frequency f = 1000000; f <= 2000000; f += 100000){
+            table[VoltageTableKey(n, f)] = 0.7 + n * 0.01 + (f / 1000000.0) * 0.1;
+        }
+    }
+
+    // Empty lines are skipped.
+    dumpVoltageTable(table, "voltageTable.txt");
+    ASSERT_EQ(system("echo >> voltageTable.txt"), 0);
+    VoltageTable loaded;
+    loadVoltageTable(loaded, "voltageTable.txt");
+    EXPECT_EQ(loaded.size(), table.size());
+
+    VoltageModel model(table);
+    EXPECT_EQ(model.getMaxVirtualCores(), (uint) 4);
+    ASSERT_EQ(model.getNumFrequencies(), (size_t) 11);
+    EXPECT_EQ(model.getFrequency(0), (Frequency) 1000000);
+    EXPECT_EQ(model.getFrequencyIndex(1500000), 5);
+    EXPECT_EQ(model.getFrequencyIndex(1550000), -1);
+    EXPECT_DOUBLE_EQ(model.getVoltage(3, 5), table[VoltageTableKey(3, 1500000)]);
+    model.setPowerCoefficients(5, 20, 5);
+    EXPECT_DOUBLE_EQ(model.getPower(3, 5), 35);
+    model.save("voltageModel.bin");
+
+    VoltageModel mapped("voltageModel.bin");
+    EXPECT_EQ(mapped.getMaxVirtualCores(), (uint) 4);
+    EXPECT_EQ(mapped.getNumFrequencies(), (size_t) 11);
+    EXPECT_DOUBLE_EQ(mapped.getPower(3, 5), 35);
+    EXPECT_DOUBLE_EQ(mapped.getStaticPower(0), 0);
+    VoltageTable fromModel = mapped.getVoltageTable();
+    EXPECT_EQ(fromModel.size(), table.size());
+    for(VoltageTableIterator it = table.begin(); it != table.end(); ++it){
+        EXPECT_DOUBLE_EQ(fromModel[it->first], it->second);
+    }
+
+    // Text files are not valid models.
+    EXPECT_THROW(VoltageModel("voltageTable.txt"), std::runtime_error);
+    EXPECT_THROW(VoltageModel("nonExistingModel.bin"), std::runtime_error);
+
+    // Unsorted frequencies.
+    std::ifstream in("voltageModel.bin", std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    uint32_t* header = (uint32_t*) &data[0];
+    std::swap(header[4], header[5]);
+    std::ofstream("voltageModel.bin", std::ios::binary | std::ios::trunc) << data;
+    EXPECT_THROW(VoltageModel("voltageModel.bin"), std::runtime_error);
+
+    // Header whose size wraps around when computed on 32 bits.
+    uint32_t wrapping[14] = {0x4D564D4D, 1, 0x80000000, 2, 1000000, 2000000};
+    std::ofstream("voltageModel.bin", std::ios::binary | std::ios::trunc).write((char*) wrapping, sizeof(wrapping));
+    EXPECT_THROW(VoltageModel("voltageModel.bin"), std::runtime_error);
+    ASSERT_EQ(system("rm -f voltageTable.txt voltageModel.bin"), 0);
+}
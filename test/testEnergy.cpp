@@ -0,0 +1,468 @@
+/**
+ *  Different tests on energy module.
+ **/
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <mammut/mammut.hpp>
+#include <mammut/energy/energy-linux.hpp>
+#include "gtest/gtest.h"
+
+using namespace mammut;
+using namespace mammut::cpufreq;
+using namespace mammut::energy;
+using namespace std;
+
+static VoltageTable getTestVoltageTable(){
+    VoltageTable table;
+    for(uint n = 0; n <= 8; n++){
+        for(Frequency f = 1000000; f <= 3000000; f += 500000){
+            table[VoltageTableKey(n, f)] = 0.6 + 0.15 * (f / 1000000.0) + 0.005 * n;
+        }
+    }
+    return table;
+}
+
+static double getTestPower(VoltageTable& table, uint n, Frequency f, uint workloadClass){
+    double voltage = table[VoltageTableKey(n, f)];
+    double coefficient = workloadClass ? 4.0 : 2.5;
+    return 30 + n * coefficient * voltage * voltage * (f / 1000000.0);
+}
+
+TEST(EnergyTest, PowerModel) {
+    VoltageTable table = getTestVoltageTable();
+    PowerModel model(table, 2);
+    EXPECT_EQ(model.getFrequencies().size(), (size_t) 5);
+
+    std::vector<PowerSample> samples;
+    for(uint n = 0; n <= 8; n++){
+        for(Frequency f = 1000000; f <= 3000000; f += 500000){
+            for(uint w = 0; w < 2; w++){
+                samples.push_back(PowerSample(PowerConfiguration(n, f, w), getTestPower(table, n, f, w)));
+            }
+        }
+    }
+    model.fit(samples);
+    EXPECT_NEAR(model.getStaticPower(), 30, 0.001);
+    EXPECT_NEAR(model.getDynamicCoefficient(0), 2.5, 0.001);
+    EXPECT_NEAR(model.getDynamicCoefficient(1), 4.0, 0.001);
+    EXPECT_NEAR(model.predict(PowerConfiguration(4, 2000000, 1)), getTestPower(table, 4, 2000000, 1), 0.01);
+    EXPECT_NEAR(model.predict(4, 2, 1), getTestPower(table, 4, 2000000, 1), 0.01);
+    // Interpolated between 2000000 and 2500000.
+    double interpolated = model.predict(PowerConfiguration(4, 2250000, 0));
+    EXPECT_GT(interpolated, getTestPower(table, 4, 2000000, 0));
+    EXPECT_LT(interpolated, getTestPower(table, 4, 2500000, 0));
+    EXPECT_THROW(model.predict(PowerConfiguration(4, 2000000, 2)), std::runtime_error);
+
+    // The workload changes: the online update follows it.
+    for(size_t i = 0; i < 1000; i++){
+        uint n = i % 9;
+        Frequency f = 1000000 + (i % 5) * 500000;
+        double power = getTestPower(table, n, f, 0) + n * 0.5 * pow(table[VoltageTableKey(n, f)], 2) * (f / 1000000.0);
+        model.update(PowerSample(PowerConfiguration(n, f, 0), power));
+    }
+    EXPECT_NEAR(model.getDynamicCoefficient(0), 3.0, 0.01);
+    EXPECT_NEAR(model.getStaticPower(), 30, 0.1);
+
+    VoltageModel voltageModel(table);
+    model.storeCoefficients(voltageModel, 1);
+    EXPECT_NEAR(voltageModel.getPower(1, 2), model.predict(PowerConfiguration(1, 2000000, 1)), 0.001);
+
+    // Voltage with one loaded virtual core missing for 2000000.
+    VoltageTable partial = table;
+    partial.erase(VoltageTableKey(1, 2000000));
+    VoltageModel partialModel(partial);
+    EXPECT_THROW(PowerModel(partialModel).storeCoefficients(partialModel), std::runtime_error);
+}
+
+// Plug counter simulating a machine whose power depends on the
+// frequency of its domains.
+class CounterPlugFrequency: public CounterPlug{
+private:
+    std::vector<Domain*> _domains;
+    Joules _joules;
+    double _lastTime;
+    bool init(){return true;}
+public:
+    explicit CounterPlugFrequency(const std::vector<Domain*>& domains):
+        _domains(domains), _joules(0), _lastTime(utils::getMillisecondsTime()){;}
+    ~CounterPlugFrequency(){;}
+
+    double getPower(){
+        double power = 20;
+        for(size_t i = 0; i < _domains.size(); i++){
+            power += 0.00005 * _domains.at(i)->getCurrentFrequencyUserspace();
+        }
+        return power;
+    }
+
+    Joules getJoules(){
+        double now = utils::getMillisecondsTime();
+        _joules += getPower() * (now - _lastTime) / 1000.0;
+        _lastTime = now;
+        return _joules;
+    }
+
+    void reset(){
+        getJoules();
+        _joules = 0;
+    }
+};
+
+TEST(EnergyTest, PowerCapperSoftware) {
+    Mammut m;
+    SimulationParameters p;
+    p.sysfsRootPrefix = "./archs/repara/";
+    m.setSimulationParameters(p);
+    CpuFreq* frequency = m.getInstanceCpuFreq();
+    std::vector<Domain*> domains = frequency->getDomains();
+    Governor governor = domains.at(0)->getCurrentGovernor();
+    CounterPlugFrequency counter(domains);
+
+    PowerCapperSoftware* capper = new PowerCapperSoftware(&counter, frequency);
+    EXPECT_TRUE(capper->get(0, 0).preparedOnly);
+    PowerCap cap;
+    cap.value = 200;
+    cap.window = 1;
+    cap.preparedOnly = false;
+    capper->set(cap);
+    EXPECT_DOUBLE_EQ(capper->get(1, 1).value, 100);
+    // At most 200 Watts when both domains run at 1.8GHz.
+    usleep(2000000);
+    EXPECT_LE(counter.getPower(), 205);
+    EXPECT_GE(counter.getPower(), 185);
+    EXPECT_GT(capper->getLevel(0), (uint) 0);
+    EXPECT_EQ(capper->getLevel(0), capper->getLevel(1));
+    delete capper;
+    EXPECT_EQ(domains.at(0)->getCurrentGovernor(), governor);
+}
+
+TEST(EnergyTest, PowerBudgetRedistribution) {
+    std::vector<double> budgets(2, 100);
+    std::vector<double> power;
+    power.push_back(99);
+    power.push_back(40);
+    std::vector<bool> limited;
+    limited.push_back(true);
+    limited.push_back(false);
+    // Socket 1 keeps 40 * 1.1 Watts, the rest goes to socket 0.
+    PowerCapperLinux::redistribute(budgets, power, limited);
+    EXPECT_NEAR(budgets.at(1), 44, 0.0001);
+    EXPECT_NEAR(budgets.at(0), 156, 0.0001);
+
+    // Never below the minimum share.
+    power.at(1) = 5;
+    PowerCapperLinux::redistribute(budgets, power, limited);
+    EXPECT_NEAR(budgets.at(1), 25, 0.0001);
+    EXPECT_NEAR(budgets.at(0), 175, 0.0001);
+
+    // Both limited: back towards the even split.
+    limited.at(1) = true;
+    PowerCapperLinux::redistribute(budgets, power, limited);
+    EXPECT_NEAR(budgets.at(0), 137.5, 0.0001);
+    EXPECT_NEAR(budgets.at(1), 62.5, 0.0001);
+
+    // Nobody limited: the total is preserved.
+    limited.assign(2, false);
+    power.at(0) = 50;
+    power.at(1) = 50;
+    PowerCapperLinux::redistribute(budgets, power, limited);
+    EXPECT_NEAR(budgets.at(0) + budgets.at(1), 200, 0.0001);
+}
+
+// Cpus counter simulating Cpus consuming 10 Watts each.
+class CounterCpusConstant: public CounterCpus{
+private:
+    double _start;
+    bool init(){return true;}
+public:
+    explicit CounterCpusConstant(topology::Topology* topology):
+        CounterCpus(topology), _start(utils::getMillisecondsTime()){;}
+    ~CounterCpusConstant(){;}
+
+    Joules getJoulesCpu(topology::CpuId cpuId){
+        return 10 * (utils::getMillisecondsTime() - _start) / 1000.0;
+    }
+    JoulesCpu getJoulesComponents(topology::CpuId cpuId){
+        return JoulesCpu(getJoulesCpu(cpuId), 0, 0, 0);
+    }
+    bool hasJoulesCores(){return false;}
+    Joules getJoulesCores(topology::CpuId cpuId){return 0;}
+    bool hasJoulesGraphic(){return false;}
+    Joules getJoulesGraphic(topology::CpuId cpuId){return 0;}
+    bool hasJoulesDram(){return false;}
+    Joules getJoulesDram(topology::CpuId cpuId){return 0;}
+    bool hasJoulesCore(){return false;}
+    Joules getJoulesCore(topology::PhysicalCoreId physicalCoreId){return 0;}
+    void reset(){_start = utils::getMillisecondsTime();}
+};
+
+TEST(EnergyTest, EnergyAccounting) {
+    Mammut m;
+    SimulationParameters p;
+    p.sysfsRootPrefix = "";
+    m.setSimulationParameters(p);
+    topology::Topology* topology = m.getInstanceTopology();
+    CounterCpusConstant counter(topology);
+    std::vector<topology::Cpu*> cpus = topology->getCpus();
+    std::vector<topology::VirtualCore*> virtualCores = cpus.at(0)->getVirtualCores();
+    topology::VirtualCoreId vc0 = virtualCores.at(0)->getVirtualCoreId();
+    uint online = 0;
+    for(size_t i = 0; i < virtualCores.size(); i++){
+        online += virtualCores.at(i)->isHotPlugged();
+    }
+    EnergyAccounting accounting(&counter, 50);
+
+    // Two processes saturating the first Cpu, nobody on the others. Pids
+    // are above the Linux limit (2^22), so the sampling thread can't see them.
+    const task::TaskId pidA = 4194305, pidB = 4194306, pidC = 4194307;
+    std::vector<Joules> joules(cpus.size(), 10);
+    std::vector<TaskUsage> usages;
+    usages.push_back(TaskUsage(pidA, "/a", vc0, 0.3));
+    usages.push_back(TaskUsage(pidB, "/b", vc0, 0.1));
+    usages.push_back(TaskUsage(pidB, "/b", vc0, 0.1));
+    Joules unattributed = accounting.getUnattributedJoules();
+    accounting.account(joules, usages, 0.5 / online);
+    Joules j;
+    EXPECT_TRUE(accounting.getJoules(pidA, j));
+    EXPECT_NEAR(j, 6, 0.0001);
+    EXPECT_TRUE(accounting.getJoules(pidB, j));
+    EXPECT_NEAR(j, 4, 0.0001);
+    EXPECT_FALSE(accounting.getJoules(pidC, j));
+    std::map<std::string, Joules> cgroups = accounting.getCgroupsJoules();
+    EXPECT_NEAR(cgroups["/b"], 4, 0.0001);
+    EXPECT_GE(accounting.getUnattributedJoules() - unattributed, 10 * (cpus.size() - 1) - 0.0001);
+
+    // Same usages on a half idle Cpu: the idle half is unattributed.
+    unattributed = accounting.getUnattributedJoules();
+    accounting.account(joules, usages, 1.0 / online);
+    EXPECT_TRUE(accounting.getJoules(pidA, j));
+    EXPECT_NEAR(j, 9, 0.0001);
+    EXPECT_TRUE(accounting.getJoules(pidB, j));
+    EXPECT_NEAR(j, 6, 0.0001);
+    EXPECT_GE(accounting.getUnattributedJoules() - unattributed, 5 + 10 * (cpus.size() - 1) - 0.0001);
+
+    // Energy of this (busy) process is accounted through its handler.
+    task::TasksManager* tasks = m.getInstanceTask();
+    tasks->setEnergyAccounting(&accounting);
+    task::ProcessHandler* process = tasks->getProcessHandler(getpid());
+    double start = utils::getMillisecondsTime();
+    volatile double x = 0;
+    while(utils::getMillisecondsTime() - start < 500){
+        x += 1;
+    }
+    EXPECT_TRUE(process->getJoules(j));
+    EXPECT_GT(j, 0);
+    EXPECT_LE(j, 10 * cpus.size() * 0.6);
+    tasks->releaseProcessHandler(process);
+    tasks->setEnergyAccounting(NULL);
+}
+
+static void writeRaplFile(const std::string& path, const std::string& value){
+    utils::executeCommand("mkdir -p " + path.substr(0, path.rfind('/')), true);
+    std::ofstream file(path.c_str());
+    file << value << std::endl;
+}
+
+TEST(EnergyTest, RaplBackend) {
+    Mammut m;
+    SimulationParameters p;
+    p.sysfsRootPrefix = "./archs/repara/";
+    m.setSimulationParameters(p);
+    std::string root = p.sysfsRootPrefix + "/sys/class/powercap/intel-rapl/intel-rapl:";
+    writeRaplFile(root + "0/max_energy_range_uj", "1000000000");
+    for(uint i = 0; i < 2; i++){
+        std::string cpu = utils::intToString(i);
+        writeRaplFile(root + cpu + "/name", "package-" + cpu);
+        writeRaplFile(root + cpu + "/energy_uj", "999000000");
+        writeRaplFile(root + cpu + "/intel-rapl:" + cpu + ":0/name", "dram");
+        writeRaplFile(root + cpu + "/intel-rapl:" + cpu + ":0/energy_uj", "5000000");
+    }
+    writeRaplFile(root + "2/name", "psys");
+    writeRaplFile(root + "2/max_energy_range_uj", "100000000");
+    writeRaplFile(root + "2/energy_uj", "90000000");
+
+    RaplBackend* backend = RaplBackend::acquire(RAPL_SOURCE_SYSFS);
+    ASSERT_TRUE(backend != NULL);
+    EXPECT_EQ(RaplBackend::acquire(), backend);
+    EXPECT_TRUE(backend->hasDomain(RAPL_DOMAIN_DRAM));
+    EXPECT_FALSE(backend->hasDomain(RAPL_DOMAIN_CORES));
+    // The package counter wraps.
+    writeRaplFile(root + "0/energy_uj", "2000000");
+    writeRaplFile(root + "0/intel-rapl:0:0/energy_uj", "8000000");
+    EXPECT_NEAR(backend->getJoules(0, RAPL_DOMAIN_PACKAGE), 3, 0.0001);
+    EXPECT_NEAR(backend->getJoules(0, RAPL_DOMAIN_DRAM), 3, 0.0001);
+    EXPECT_NEAR(backend->getJoulesComponents(1).cpu, 0, 0.0001);
+    EXPECT_TRUE(backend->hasJoulesPlatform());
+    writeRaplFile(root + "2/energy_uj", "500000");
+    EXPECT_NEAR(backend->getJoulesPlatform(), 10.5, 0.0001);
+
+    // Cpus and memory counters share the backend.
+    Energy* energy = m.getInstanceEnergy();
+    Counter* memory = energy->getCounter(COUNTER_MEMORY);
+    CounterCpus* cpus = dynamic_cast<CounterCpus*>(energy->getCounter(COUNTER_CPUS));
+    ASSERT_TRUE(memory != NULL);
+    ASSERT_TRUE(cpus != NULL);
+    Counter* plug = energy->getCounter(COUNTER_PLUG);
+    ASSERT_TRUE(plug != NULL);
+    writeRaplFile(root + "2/energy_uj", "4500000");
+    EXPECT_NEAR(plug->getJoules(), 4, 0.0001);
+    writeRaplFile(root + "1/energy_uj", "1000000");
+    writeRaplFile(root + "1/intel-rapl:1:0/energy_uj", "6000000");
+    EXPECT_NEAR(cpus->getJoulesCpu((topology::CpuId) 1), 2, 0.0001);
+    EXPECT_NEAR(cpus->getJoulesDram((topology::CpuId) 1), 1, 0.0001);
+    EXPECT_NEAR(memory->getJoules(), 1, 0.0001);
+    memory->reset();
+    EXPECT_NEAR(memory->getJoules(), 0, 0.0001);
+    EXPECT_NEAR(cpus->getJoulesDram((topology::CpuId) 1), 1, 0.0001);
+    EXPECT_NEAR(backend->getJoules(1, RAPL_DOMAIN_PACKAGE), 2, 0.0001);
+    RaplBackend::release(backend);
+    RaplBackend::release(backend);
+}
+
+// Meter whose power increases by 1 Watt every 10 milliseconds.
+class PowerMeterRamp: public PowerMeter{
+private:
+    double _start;
+public:
+    PowerMeterRamp():_start(0){;}
+    bool init(){_start = utils::getMillisecondsTime(); return true;}
+    bool getWatts(double& watts){watts = (utils::getMillisecondsTime() - _start) / 10.0; return true;}
+    uint getSamplingInterval(){return 10;}
+};
+
+static PowerMeter* createPowerMeterRamp(){
+    return new PowerMeterRamp();
+}
+
+TEST(EnergyTest, PowerMeter) {
+    Energy::registerPowerMeter("ramp", createPowerMeterRamp);
+    setenv("MAMMUT_PLUG_COUNTERS", "nonexisting,ramp", 1);
+    Mammut m;
+    CounterPlugMeter* counter = dynamic_cast<CounterPlugMeter*>(m.getInstanceEnergy()->getCounter(COUNTER_PLUG));
+    unsetenv("MAMMUT_PLUG_COUNTERS");
+    ASSERT_TRUE(counter != NULL);
+    usleep(1000000);
+    // Integral of t/10 for one second (t in milliseconds), exact with trapezoids.
+    std::vector<MeterSample> samples = counter->getSamples();
+    ASSERT_GT(samples.size(), (size_t) 10);
+    const MeterSample& last = samples.back();
+    double elapsed = last.timestamp - samples.front().timestamp;
+    double expected = (samples.front().watts + last.watts) / 2.0 * elapsed / 1000.0;
+    // A new sample (~1 Joule) may be acquired after getSamples().
+    EXPECT_NEAR(counter->getJoules(), expected, 1.5);
+    for(size_t i = 1; i < samples.size(); i++){
+        EXPECT_GT(samples.at(i).timestamp, samples.at(i - 1).timestamp);
+    }
+    counter->reset();
+    EXPECT_DOUBLE_EQ(counter->getJoules(), 0);
+}
+
+// Meter paced by the device which provides a single sample, then fails.
+class PowerMeterBroken: public PowerMeter{
+public:
+    static std::atomic<uint> reads;
+    bool init(){reads = 0; return true;}
+    bool getWatts(double& watts){watts = 10; return reads++ == 0;}
+    uint getSamplingInterval(){return 0;}
+};
+
+std::atomic<uint> PowerMeterBroken::reads;
+
+static PowerMeter* createPowerMeterBroken(){
+    return new PowerMeterBroken();
+}
+
+TEST(EnergyTest, PowerMeterBroken) {
+    Energy::registerPowerMeter("broken", createPowerMeterBroken);
+    setenv("MAMMUT_PLUG_COUNTERS", "broken", 1);
+    double start;
+    {
+        Mammut m;
+        CounterPlugMeter* counter = dynamic_cast<CounterPlugMeter*>(m.getInstanceEnergy()->getCounter(COUNTER_PLUG));
+        unsetenv("MAMMUT_PLUG_COUNTERS");
+        ASSERT_TRUE(counter != NULL);
+        usleep(500000);
+        // Failed reads are not recorded and are retried less and less often.
+        EXPECT_EQ(counter->getSamples().size(), (size_t) 1);
+        EXPECT_LT(PowerMeterBroken::reads, (uint) 10);
+        EXPECT_DOUBLE_EQ(counter->getJoules(), 0);
+        start = utils::getMillisecondsTime();
+    }
+    // The sampler is stopped without waiting for the backoff to expire.
+    EXPECT_LT(utils::getMillisecondsTime() - start, 500);
+}
+
+// Meter always reading 10 Watts, sampled every 100 milliseconds.
+class PowerMeterConstant: public PowerMeter{
+public:
+    bool init(){return true;}
+    bool getWatts(double& watts){watts = 10; return true;}
+    uint getSamplingInterval(){return 100;}
+};
+
+static PowerMeter* createPowerMeterConstant(){
+    return new PowerMeterConstant();
+}
+
+TEST(EnergyTest, Snapshot) {
+    Energy::registerPowerMeter("constant", createPowerMeterConstant);
+    setenv("MAMMUT_PLUG_COUNTERS", "constant", 1);
+    Mammut m;
+    Energy* energy = m.getInstanceEnergy();
+    unsetenv("MAMMUT_PLUG_COUNTERS");
+    ASSERT_TRUE(energy->getCounter(COUNTER_PLUG) != NULL);
+    usleep(150000);
+    EnergySnapshot first = energy->snapshot();
+    usleep(250000);
+    EnergySnapshot second = energy->snapshot();
+
+    const CounterSnapshot& plug = second.counters[COUNTER_PLUG];
+    EXPECT_TRUE(plug.available);
+    EXPECT_TRUE(plug.interpolated);
+    EXPECT_GE(plug.skew, 0);
+    // At most one sampling interval, plus some scheduling delay.
+    EXPECT_LE(plug.skew, 150);
+    EXPECT_GT(second.timestamp, first.timestamp);
+    // Interpolation does not depend on the phase of the samples.
+    double seconds = (second.timestamp - first.timestamp) / 1000.0;
+    EXPECT_NEAR(plug.joules - first.counters[COUNTER_PLUG].joules, 10 * seconds, 0.01);
+    if(second.counters[COUNTER_CPUS].available){
+        EXPECT_GE(second.counters[COUNTER_CPUS].joules, first.counters[COUNTER_CPUS].joules);
+        EXPECT_EQ(second.cpus.size(), ((CounterCpus*) energy->getCounter(COUNTER_CPUS))->getCpus().size());
+    }else{
+        EXPECT_TRUE(second.cpus.empty());
+    }
+}
+
+TEST(EnergyTest, RaplTracer) {
+    Mammut m;
+    SimulationParameters p;
+    p.sysfsRootPrefix = "";
+    m.setSimulationParameters(p);
+    topology::Cpu* cpu = m.getInstanceTopology()->getCpus().back();
+    topology::VirtualCoreId virtualCoreId = cpu->getVirtualCores().back()->getVirtualCoreId();
+    RaplBackend* backend = RaplBackend::acquire(RAPL_SOURCE_MSR);
+    if(!backend || !cpu->getVirtualCore()->areTicksConstant()){
+        EXPECT_THROW(RaplTracer tracer(virtualCoreId), std::runtime_error);
+        RaplBackend::release(backend);
+        return;
+    }
+    RaplBackend::release(backend);
+
+    RaplTracer tracer(virtualCoreId);
+    tracer.start(50);
+    usleep(100000);
+    EXPECT_TRUE(tracer.stop());
+    std::vector<RaplTraceSample> samples = tracer.getSamples();
+    // Counters are updated about every millisecond.
+    ASSERT_GT(samples.size(), (size_t) 10);
+    EXPECT_DOUBLE_EQ(samples.front().joules, 0);
+    EXPECT_LT(samples.back().timestamp - samples.front().timestamp, 51);
+    for(size_t i = 1; i < samples.size(); i++){
+        EXPECT_GT(samples.at(i).ticks, samples.at(i - 1).ticks);
+        EXPECT_GT(samples.at(i).timestamp, samples.at(i - 1).timestamp);
+        EXPECT_GT(samples.at(i).joules, samples.at(i - 1).joules);
+        EXPECT_GT(samples.at(i).watts, 0);
+    }
+}
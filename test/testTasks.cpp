@@ -9,6 +9,8 @@
 #include <mammut/mammut.hpp>
 #if defined (__linux__)
 #include <mammut/task/task-linux.hpp>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
 #endif
 #include "gtest/gtest.h"
 
@@ -112,6 +114,31 @@ TEST(TaskTest, MiscTest) {
     }
 }
 
+TEST(TaskTest, NumaMove) {
+    Mammut m;
+    SimulationParameters p;
+    p.sysfsRootPrefix = "";
+    m.setSimulationParameters(p);
+    Topology* topology = m.getInstanceTopology();
+    TasksManager* task = m.getInstanceTask();
+    ThreadHandler* th = task->getThreadHandler();
+    NumaNode* node = topology->getNumaNodes().back();
+
+    EXPECT_TRUE(th->move(node, true));
+    std::vector<VirtualCoreId> virtualCoresIds;
+    ASSERT_TRUE(th->getVirtualCoreIds(virtualCoresIds));
+    for(size_t i = 0; i < virtualCoresIds.size(); i++){
+        EXPECT_TRUE(node == topology->getNumaNode(topology->getVirtualCore(virtualCoresIds.at(i))));
+    }
+
+    // Restore the placement and the memory policy of this thread.
+    EXPECT_TRUE(th->move(topology->getVirtualCores()));
+#if defined (__linux__)
+    syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+#endif
+    task->releaseThreadHandler(th);
+}
+
 TEST(TaskTest, ThrottlingTest) {
     Mammut m;
     SimulationParameters p;
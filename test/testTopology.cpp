@@ -132,3 +132,278 @@ TEST(TopologyTest, GeneralTest) {
         EXPECT_GT(sleepingSecs - (totalTime / 1000000.0), 9.99);
     }
 }
+
+TEST(TopologyTest, EffectiveFrequency) {
+    Mammut m;
+    Topology* topology = m.getInstanceTopology();
+    vector<VirtualCore*> virtualCores = topology->getVirtualCores();
+    EffectiveFrequency ef;
+    utils::Msr msr(virtualCores.at(0)->getVirtualCoreId());
+    uint64_t aperf;
+    // Only meaningful where APERF/MPERF are accessible.
+    bool available = msr.available() && msr.read(MSR_APERF, aperf);
+    EXPECT_EQ(virtualCores.at(0)->getEffectiveFrequency(10, ef), available);
+    if(available){
+        EXPECT_TRUE(ef.valid);
+        EXPECT_GE(ef.busy, 0);
+        EXPECT_LE(ef.busy, 100.5);
+        EXPECT_LE(ef.averageFrequency, ef.busyFrequency + 1);
+        vector<EffectiveFrequency> efs;
+        EXPECT_TRUE(topology->getEffectiveFrequencies(10, efs));
+        EXPECT_EQ(efs.size(), virtualCores.size());
+        EXPECT_TRUE(efs.at(0).valid);
+    }else{
+        vector<EffectiveFrequency> efs;
+        EXPECT_FALSE(topology->getEffectiveFrequencies(10, efs));
+    }
+}
+
+TEST(TopologyTest, CStateResidencies) {
+    Mammut m;
+    Topology* topology = m.getInstanceTopology();
+    VirtualCore* vc = topology->getVirtualCore();
+    Cpu* cpu = topology->getCpu(vc->getCpuId());
+    CStateResidencies residencies;
+    utils::Msr msr(vc->getVirtualCoreId());
+    uint64_t tsc;
+    // Only meaningful where the MSRs are accessible.
+    bool available = msr.available() && msr.read(MSR_TSC, tsc);
+    EXPECT_EQ(vc->getCStateResidencies(10, residencies), available);
+    if(available){
+        double total = 0;
+        for(auto it = residencies.begin(); it != residencies.end(); it++){
+            EXPECT_GE(it->second, 0);
+            EXPECT_LE(it->second, 100);
+            total += it->second;
+        }
+        EXPECT_LE(total, 101);
+        EXPECT_TRUE(cpu->getCStateResidencies(10, residencies));
+    }
+}
+
+TEST(TopologyTest, LatencyQoS) {
+    ASSERT_EQ(system("for c in ./archs/repara/sys/devices/system/cpu/cpu[0-9]*; do "
+                     "echo 0 > $c/power/pm_qos_resume_latency_us; done"), 0);
+    Mammut m;
+    SimulationParameters p;
+    p.sysfsRootPrefix = "./archs/repara/";
+    m.setSimulationParameters(p);
+    Topology* topology = m.getInstanceTopology();
+    vector<VirtualCore*> virtualCores;
+    virtualCores.push_back(topology->getVirtualCore(0));
+    virtualCores.push_back(topology->getVirtualCore(1));
+    string file = "./archs/repara/sys/devices/system/cpu/cpu1/power/pm_qos_resume_latency_us";
+    {
+        LatencyQoS qos(20, virtualCores);
+        EXPECT_EQ(qos.getLatency(), (uint) 20);
+        EXPECT_EQ(qos.getVirtualCores().size(), (size_t) 2);
+        EXPECT_STREQ(utils::readFirstLineFromFile(file).c_str(), "20");
+        // Exit latencies: 0, 1, 10, 59, 80
+        vector<VirtualCoreIdleLevel*> allowed = qos.getAllowedIdleLevels(virtualCores.at(1));
+        EXPECT_EQ(allowed.size(), (size_t) 3);
+        for(size_t i = 0; i < allowed.size(); i++){
+            EXPECT_LE(allowed.at(i)->getExitLatency(), (uint) 20);
+        }
+        // Not constrained.
+        EXPECT_EQ(qos.getAllowedIdleLevels(topology->getVirtualCore(2)).size(), (size_t) 5);
+
+        qos.setLatency(0);
+        EXPECT_STREQ(utils::readFirstLineFromFile(file).c_str(), "n/a");
+        EXPECT_EQ(qos.getAllowedIdleLevels(virtualCores.at(0)).size(), (size_t) 1);
+    }
+    // Removed on destruction.
+    EXPECT_STREQ(utils::readFirstLineFromFile(file).c_str(), "0");
+}
+
+TEST(TopologyTest, NumaNodes) {
+    Mammut m;
+    SimulationParameters p;
+    p.sysfsRootPrefix = "./archs/repara/";
+    m.setSimulationParameters(p);
+    // No NUMA information, a single node with all the virtual cores.
+    Topology* topology = m.getInstanceTopology();
+    ASSERT_EQ(topology->getNumaNodes().size(), (size_t) 1);
+    EXPECT_EQ(topology->getNumaNodes().at(0)->getVirtualCores().size(), (size_t) 48);
+    EXPECT_EQ(topology->getNumaNodes().at(0)->getDistance(0), (uint) 10);
+    EXPECT_EQ(topology->getNumaNodes().at(0)->getMemoryTotal(), (uint64_t) 0);
+
+    ASSERT_EQ(system("n=./archs/repara/sys/devices/system/node; "
+                     "mkdir -p $n/node0 $n/node1 && "
+                     "echo 0-11,24-35 > $n/node0/cpulist && "
+                     "echo 12-23,36-47 > $n/node1/cpulist && "
+                     "echo '10 21' > $n/node0/distance && "
+                     "echo '21 10' > $n/node1/distance && "
+                     "printf 'Node 0 MemTotal:       32768 kB\\nNode 0 MemFree:        16384 kB\\n' > $n/node0/meminfo && "
+                     "printf 'Node 1 MemTotal:       65536 kB\\nNode 1 MemFree:        1024 kB\\n' > $n/node1/meminfo"), 0);
+    Topology* numaTopology = Topology::local();
+    vector<NumaNode*> nodes = numaTopology->getNumaNodes();
+    ASSERT_EQ(nodes.size(), (size_t) 2);
+    for(size_t i = 0; i < nodes.size(); i++){
+        EXPECT_EQ(nodes.at(i)->getNumaNodeId(), i);
+        EXPECT_EQ(nodes.at(i)->getVirtualCores().size(), (size_t) 24);
+    }
+    EXPECT_EQ(nodes.at(0)->getMemoryTotal(), (uint64_t) 32768);
+    EXPECT_EQ(nodes.at(0)->getMemoryFree(), (uint64_t) 16384);
+    EXPECT_EQ(nodes.at(1)->getMemoryTotal(), (uint64_t) 65536);
+    EXPECT_EQ(nodes.at(1)->getMemoryFree(), (uint64_t) 1024);
+    EXPECT_EQ(numaTopology->getNumaNode(numaTopology->getVirtualCore(12)), nodes.at(1));
+    EXPECT_EQ(numaTopology->getNumaNode(numaTopology->getVirtualCore(24)), nodes.at(0));
+    EXPECT_EQ(numaTopology->getNumaNode(1), nodes.at(1));
+    EXPECT_TRUE(numaTopology->getNumaNode(2) == NULL);
+    vector<vector<uint> > distances = numaTopology->getNumaDistances();
+    EXPECT_EQ(distances.at(0).at(0), (uint) 10);
+    EXPECT_EQ(distances.at(0).at(1), (uint) 21);
+    EXPECT_EQ(distances.at(1).at(0), (uint) 21);
+    Topology::release(numaTopology);
+    ASSERT_EQ(system("rm -rf ./archs/repara/sys/devices/system/node"), 0);
+}
+
+TEST(TopologyTest, Caches) {
+    Mammut m;
+    SimulationParameters p;
+    p.sysfsRootPrefix = "./archs/repara/";
+    m.setSimulationParameters(p);
+    Topology* topology = m.getInstanceTopology();
+    // L1d, L1i and L2 for each physical core, one L3 for each CPU.
+    EXPECT_EQ(topology->getCaches().size(), (size_t) 24*3 + 2);
+
+    vector<Cache*> caches = topology->getCaches(topology->getVirtualCore(0));
+    ASSERT_EQ(caches.size(), (size_t) 4);
+    EXPECT_EQ(caches.at(0)->getLevel(), (uint) 1);
+    EXPECT_EQ(caches.at(1)->getLevel(), (uint) 1);
+    EXPECT_EQ(caches.at(2)->getLevel(), (uint) 2);
+    EXPECT_EQ(caches.at(2)->getType(), CACHE_TYPE_UNIFIED);
+    EXPECT_EQ(caches.at(2)->getSize(), (uint) 256*1024);
+    EXPECT_EQ(caches.at(2)->getVirtualCores().size(), (size_t) 2);
+    Cache* l3 = caches.at(3);
+    EXPECT_EQ(l3->getLevel(), (uint) 3);
+    EXPECT_EQ(l3->getSize(), (uint) 30720*1024);
+    EXPECT_EQ(l3->getLineSize(), (uint) 64);
+    EXPECT_EQ(l3->getAssociativity(), (uint) 20);
+    EXPECT_EQ(l3->getVirtualCores().size(), (size_t) 24);
+    EXPECT_TRUE(l3->hasVirtualCore(topology->getVirtualCore(35)));
+    EXPECT_FALSE(l3->hasVirtualCore(topology->getVirtualCore(12)));
+
+    vector<vector<VirtualCore*> > groups = topology->getLlcGroups();
+    ASSERT_EQ(groups.size(), (size_t) 2);
+    EXPECT_EQ(groups.at(0).size(), (size_t) 24);
+    EXPECT_EQ(groups.at(1).size(), (size_t) 24);
+}
+
+TEST(TopologyTest, CoreTypes) {
+    Mammut m;
+    SimulationParameters p;
+    // big.LITTLE, capacity 404 on cpu0-3 and 1024 on cpu4-7.
+    p.sysfsRootPrefix = "./archs/c8/";
+    m.setSimulationParameters(p);
+    Topology* topology = m.getInstanceTopology();
+    vector<VirtualCore*> virtualCores = topology->getVirtualCores();
+    ASSERT_EQ(virtualCores.size(), (size_t) 8);
+    for(size_t i = 0; i < virtualCores.size(); i++){
+        VirtualCore* vc = virtualCores.at(i);
+        if(vc->getVirtualCoreId() < 4){
+            EXPECT_EQ(vc->getCoreType(), CORE_TYPE_EFFICIENCY);
+            EXPECT_EQ(vc->getCapacity(), (uint) 404);
+        }else{
+            EXPECT_EQ(vc->getCoreType(), CORE_TYPE_PERFORMANCE);
+            EXPECT_EQ(vc->getCapacity(), (uint) 1024);
+        }
+    }
+    EXPECT_EQ(getVirtualCoresOfType(virtualCores, CORE_TYPE_PERFORMANCE).size(), (size_t) 4);
+    EXPECT_EQ(getVirtualCoresOfType(virtualCores, CORE_TYPE_EFFICIENCY).size(), (size_t) 4);
+
+    // Intel hybrid, split PMUs.
+    ASSERT_EQ(system("d=./archs/repara/sys/devices; mkdir -p $d/cpu_core $d/cpu_atom && "
+                     "echo 0-11,24-35 > $d/cpu_core/cpus && "
+                     "echo 12-23,36-47 > $d/cpu_atom/cpus"), 0);
+    p.sysfsRootPrefix = "./archs/repara/";
+    m.setSimulationParameters(p);
+    Topology* hybrid = Topology::local();
+    EXPECT_EQ(hybrid->getVirtualCore(0)->getCoreType(), CORE_TYPE_PERFORMANCE);
+    EXPECT_EQ(hybrid->getVirtualCore(12)->getCoreType(), CORE_TYPE_EFFICIENCY);
+    EXPECT_EQ(hybrid->getVirtualCore(36)->getCoreType(), CORE_TYPE_EFFICIENCY);
+    EXPECT_EQ(getVirtualCoresOfType(hybrid->getVirtualCores(), CORE_TYPE_EFFICIENCY).size(), (size_t) 24);
+    // Same maximum frequency on all the virtual cores.
+    EXPECT_EQ(hybrid->getVirtualCore(12)->getCapacity(), (uint) 1024);
+    Topology::release(hybrid);
+    ASSERT_EQ(system("rm -rf ./archs/repara/sys/devices/cpu_core ./archs/repara/sys/devices/cpu_atom"), 0);
+}
+
+TEST(TopologyTest, UtilizationSnapshot) {
+    Mammut m;
+    SimulationParameters p;
+    p.sysfsRootPrefix = "./archs/repara/";
+    m.setSimulationParameters(p);
+    Topology* topology = m.getInstanceTopology();
+    double ticksPerSecond = utils::getClockTicksPerSecond();
+
+    UtilizationSnapshot first = topology->getUtilizationSnapshot();
+    EXPECT_EQ(first.getVirtualCoresIds().size(), (size_t) 48);
+    // "cpu1" must not match "cpu10".."cpu19".
+    EXPECT_DOUBLE_EQ(first.getTime(1, UTILIZATION_IDLE), (220674229 / ticksPerSecond) * 1000000.0);
+    EXPECT_DOUBLE_EQ(first.getTime(0, UTILIZATION_USER), (15465863 / ticksPerSecond) * 1000000.0);
+    EXPECT_FALSE(first.hasVirtualCore(48));
+
+    // cpu0: 300 busy ticks and 100 idle ticks. cpu1: only idle.
+    ASSERT_EQ(system("cd ./archs/repara/proc && "
+                     "awk '$1 == \"cpu0\" {$2 += 100; $4 += 200; $5 += 100} "
+                     "$1 == \"cpu1\" {$5 += 50} {print}' stat > stat.new && mv stat.new stat"), 0);
+    UtilizationSnapshot second = topology->getUtilizationSnapshot();
+    EXPECT_DOUBLE_EQ(second.getUtilization(first, 0), 75.0);
+    EXPECT_DOUBLE_EQ(second.getUtilization(first, 1), 0.0);
+    std::vector<double> utilizations = second.getUtilizations(first);
+    ASSERT_EQ(utilizations.size(), (size_t) 48);
+    EXPECT_DOUBLE_EQ(utilizations.at(0), 75.0);
+
+    UtilizationSnapshot delta = second.getDelta(first);
+    EXPECT_DOUBLE_EQ(delta.getTime(0, UTILIZATION_SYSTEM), (200 / ticksPerSecond) * 1000000.0);
+    EXPECT_DOUBLE_EQ(delta.getTime(1, UTILIZATION_IDLE), (50 / ticksPerSecond) * 1000000.0);
+    EXPECT_DOUBLE_EQ(delta.getTime(2, UTILIZATION_IDLE), 0);
+}
+
+TEST(TopologyTest, LoadGenerator) {
+    // Runs on the real machine.
+    Mammut m;
+    SimulationParameters p;
+    p.sysfsRootPrefix = "";
+    m.setSimulationParameters(p);
+    Topology* topology = m.getInstanceTopology();
+    std::vector<VirtualCore*> virtualCores;
+    virtualCores.push_back(topology->getVirtualCores().back());
+    VirtualCoreId id = virtualCores.back()->getVirtualCoreId();
+
+    EXPECT_THROW(LoadGenerator(virtualCores, LOAD_KERNEL_SCALAR, 150), std::runtime_error);
+    LoadGenerator generator(virtualCores, LOAD_KERNEL_SCALAR, 50);
+    EXPECT_FALSE(generator.isRunning());
+    UtilizationSnapshot before = topology->getUtilizationSnapshot();
+    generator.start();
+    EXPECT_TRUE(generator.isRunning());
+    sleep(1);
+    UtilizationSnapshot after = topology->getUtilizationSnapshot();
+    generator.stop();
+    EXPECT_FALSE(generator.isRunning());
+    EXPECT_GT(after.getUtilization(before, id), 25);
+    EXPECT_LT(after.getUtilization(before, id), 90);
+
+    generator.setUtilization(100);
+    before = topology->getUtilizationSnapshot();
+    generator.start();
+    sleep(1);
+    after = topology->getUtilizationSnapshot();
+    generator.stop();
+    EXPECT_GT(after.getUtilization(before, id), 80);
+
+    LoadKernel kernels[] = {LOAD_KERNEL_SCALAR, LOAD_KERNEL_FMA_AVX2, LOAD_KERNEL_FMA_AVX512,
+                            LOAD_KERNEL_MEMORY_STREAM, LOAD_KERNEL_POINTER_CHASE};
+    generator.start();
+    for(size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++){
+        if(LoadGenerator::isKernelSupported(kernels[i])){
+            generator.setKernel(kernels[i]);
+            EXPECT_EQ(generator.getKernel(), kernels[i]);
+            usleep(100000);
+        }else{
+            EXPECT_THROW(generator.setKernel(kernels[i]), std::runtime_error);
+        }
+    }
+    generator.stop();
+}
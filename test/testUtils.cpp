@@ -84,4 +84,13 @@ TEST(UtilitiesTest, Generic) {
     EXPECT_EQ(v.front(), 4);
     v.erase(v.begin(), v.begin() + 1);
     EXPECT_TRUE(z.empty());
+
+    // Ranges
+    std::vector<uint> ranges = dashedRangesToIntegers("0-2,5,7-8");
+    ASSERT_EQ(ranges.size(), (size_t) 6);
+    EXPECT_EQ(ranges.at(0), (uint) 0);
+    EXPECT_EQ(ranges.at(2), (uint) 2);
+    EXPECT_EQ(ranges.at(3), (uint) 5);
+    EXPECT_EQ(ranges.at(5), (uint) 8);
+    EXPECT_TRUE(dashedRangesToIntegers("").empty());
 }